@@ -0,0 +1,381 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * look for any of many byte strings at once, e.g., thousands of
+ * signatures, in one pass over the bytes, with an Aho-Corasick automaton.
+ *
+ * The automaton is a table of the next state for every state and byte:
+ * the failure links are followed once, when it is built, so that a byte
+ * costs a single load. Bytes that are in no pattern all behave the same
+ * and share a column, which keeps the table as small as the alphabet of
+ * the patterns allows. Each state has the first state on its chain of
+ * suffixes at which patterns end, so that the patterns a byte completes
+ * are found without walking the failure links.
+ *
+ * Most bytes of most frames start no pattern and leave the automaton in
+ * its root. While there, the bytes are skipped over 16 at a time with
+ * SSSE3, if the CPU has it: each byte's low and high nibble index two
+ * tables of 16 bytes (PSHUFB), and the byte may start a pattern only if
+ * the two entries have a bit in common. The bit is given by the high
+ * nibble modulo 8, thus a byte is let through that differs from one that
+ * starts a pattern in the top bit of its high nibble only; the automaton
+ * sorts it out.
+ *
+ * A pattern file has a pattern per line, its id being the line number.
+ * Lines beginning with # and empty lines are skipped. \xHH, \n, \r, \t
+ * and \\ stand for the bytes they do in C.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#endif
+
+#include "acmatch.h"
+
+#define MAX_TABLE   (1ULL << 31)    /* bytes of the table of states    */
+
+static int parse_line(const char *line, uint8_t *pat, unsigned int *len);
+static unsigned int skip(const struct acmatch *m, const uint8_t *p,
+        unsigned int i, unsigned int n);
+#if defined(__x86_64__) || defined(__i386__)
+static unsigned int skip_ssse3(const struct acmatch *m, const uint8_t *p,
+        unsigned int i, unsigned int n);
+#endif
+
+/* the patterns of a pattern file */
+int acmatch_load(struct acmatch *m, const char *path)
+{
+    char line[ACMATCH_LINE];
+    uint8_t **pats = NULL, *pat;
+    unsigned int *lens = NULL, len;
+    uint32_t *ids = NULL, n = 0, cap = 0, lineno = 0;
+    int rc = -1;
+    FILE *fp;
+
+    memset(m, 0, sizeof(*m));
+    if ((fp = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno ++;
+        if (strchr(line, '\n') == NULL && !feof(fp)) {
+            fprintf(stderr, "ERROR: %s:%u: line too long\n", path, lineno);
+            goto out;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+
+        if (n == cap) {
+            cap = cap == 0 ? 1024 : 2 * cap;
+            if ((pats = realloc(pats, cap * sizeof(*pats))) == NULL
+                    || (lens = realloc(lens, cap * sizeof(*lens))) == NULL
+                    || (ids = realloc(ids, cap * sizeof(*ids))) == NULL) {
+                fprintf(stderr, "insufficient memory\n");
+                goto out;
+            }
+        }
+        if ((pat = malloc(strlen(line))) == NULL) {
+            fprintf(stderr, "insufficient memory\n");
+            goto out;
+        }
+        if (parse_line(line, pat, &len) != 0) {
+            fprintf(stderr, "ERROR: %s:%u: bad escape\n", path, lineno);
+            free(pat);
+            goto out;
+        }
+        pats[n] = pat;
+        lens[n] = len;
+        ids[n ++] = lineno;
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "ERROR: reading %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+    rc = acmatch_build(m, (const uint8_t *const *)pats, lens, ids, n);
+
+out:
+    while (n > 0)
+        free(pats[-- n]);
+    free(pats);
+    free(lens);
+    free(ids);
+    fclose(fp);
+    return rc;
+}
+
+/* an automaton for the n patterns of lens[i] bytes at pats[i], of ids[i] */
+int acmatch_build(struct acmatch *m, const uint8_t *const *pats,
+        const unsigned int *lens, const uint32_t *ids, uint32_t n)
+{
+    uint32_t *fail = NULL, *order = NULL, *ends = NULL, *pos = NULL;
+    uint32_t i, j, s, t, head, tail, nc;
+    unsigned long long bound = 1;
+    int c, rc = -1;
+
+    memset(m, 0, sizeof(*m));
+    if (n == 0) {
+        fprintf(stderr, "ERROR: no patterns\n");
+        return -1;
+    }
+    for (i = 0; i < n; i ++) {
+        if (lens[i] == 0) {
+            fprintf(stderr, "ERROR: pattern %u is empty\n", ids[i]);
+            return -1;
+        }
+        bound += lens[i];
+        for (j = 0; j < lens[i]; j ++)
+            if (m->cls[pats[i][j]] == 0)
+                m->cls[pats[i][j]] = ++ m->nclasses;
+    }
+    nc = ++ m->nclasses;
+    if (bound * nc * sizeof(*m->delta) > MAX_TABLE) {
+        fprintf(stderr, "ERROR: patterns too many or too long\n");
+        return -1;
+    }
+
+    m->npatterns = n;
+    m->delta = calloc(bound * nc, sizeof(*m->delta));
+    m->outs = calloc(bound + 1, sizeof(*m->outs));
+    ends = malloc(n * sizeof(*ends));
+    if (m->delta == NULL || m->outs == NULL || ends == NULL)
+        goto nomem;
+
+    /* the trie, 0 for no child as the root is no one's child */
+    m->nstates = 1;
+    for (i = 0; i < n; i ++) {
+        for (s = 0, j = 0; j < lens[i]; j ++, s = t) {
+            if ((t = m->delta[s * nc + m->cls[pats[i][j]]]) == 0) {
+                t = m->nstates ++;
+                m->delta[s * nc + m->cls[pats[i][j]]] = t;
+            }
+        }
+        ends[i] = s;
+        m->outs[s + 1] ++;
+    }
+
+    fail = calloc(m->nstates, sizeof(*fail));
+    order = malloc(m->nstates * sizeof(*order));
+    m->match = calloc(m->nstates, sizeof(*m->match));
+    m->dict = calloc(m->nstates, sizeof(*m->dict));
+    m->ids = malloc(n * sizeof(*m->ids));
+    pos = malloc((m->nstates + 1) * sizeof(*pos));
+    if (fail == NULL || order == NULL || m->match == NULL || m->dict == NULL
+            || m->ids == NULL || pos == NULL)
+        goto nomem;
+
+    /*
+     * breadth first, a state's failure is done before the state: fill in
+     * the missing transitions with those of the failure, done already
+     */
+    head = tail = 0;
+    for (c = 0; c < (int)nc; c ++)
+        if ((t = m->delta[c]) != 0)
+            order[tail ++] = t;
+    while (head < tail) {
+        s = order[head ++];
+        m->dict[s] = m->match[fail[s]];
+        m->match[s] = m->outs[s + 1] > 0 ? s : m->dict[s];
+        for (c = 0; c < (int)nc; c ++) {
+            if ((t = m->delta[s * nc + c]) != 0) {
+                fail[t] = m->delta[fail[s] * nc + c];
+                order[tail ++] = t;
+            } else {
+                m->delta[s * nc + c] = m->delta[fail[s] * nc + c];
+            }
+        }
+    }
+
+    /* the ids by the state they end at */
+    for (s = 0; s < m->nstates; s ++)
+        m->outs[s + 1] += m->outs[s];
+    memcpy(pos, m->outs, (m->nstates + 1) * sizeof(*pos));
+    for (i = 0; i < n; i ++)
+        m->ids[pos[ends[i]] ++] = ids[i];
+
+    for (c = 0; c < 256; c ++) {
+        if (m->delta[m->cls[c]] == 0)
+            continue;
+        m->first[c] = 1;
+        m->lo[c & 0x0f] |= 1 << ((c >> 4) & 7);
+        m->hi[c >> 4] = 1 << ((c >> 4) & 7);
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    m->simd = __builtin_cpu_supports("ssse3");
+#endif
+    rc = 0;
+    goto out;
+
+nomem:
+    fprintf(stderr, "insufficient memory\n");
+    acmatch_free(m);
+out:
+    free(fail);
+    free(order);
+    free(ends);
+    free(pos);
+    return rc;
+}
+
+/*
+ * the ids of the patterns in the len bytes at data, each once, maxids at
+ * most. Returns how many.
+ */
+unsigned int acmatch_scan(struct acmatch *m, const uint8_t *data,
+        unsigned int len, uint32_t *ids, unsigned int maxids)
+{
+    struct timespec t0, t1;
+    unsigned int i = 0, nids = 0, j, k;
+    uint32_t s = 0, t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (i < len) {
+        if (s == 0 && (i = skip(m, data, i, len)) >= len)
+            break;
+        s = m->delta[s * m->nclasses + m->cls[data[i ++]]];
+        for (t = m->match[s]; t != 0; t = m->dict[t]) {
+            for (j = m->outs[t]; j < m->outs[t + 1]; j ++) {
+                for (k = 0; k < nids && ids[k] != m->ids[j]; k ++)
+                    ;
+                if (k == nids && nids < maxids)
+                    ids[nids ++] = m->ids[j];
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    m->stats.frames ++;
+    m->stats.bytes += len;
+    m->stats.matched += nids > 0;
+    m->stats.ns += (t1.tv_sec - t0.tv_sec) * 1000000000LL
+        + (t1.tv_nsec - t0.tv_nsec);
+    return nids;
+}
+
+void acmatch_free(struct acmatch *m)
+{
+    free(m->delta);
+    free(m->match);
+    free(m->dict);
+    free(m->outs);
+    free(m->ids);
+    m->delta = m->match = m->dict = m->outs = m->ids = NULL;
+}
+
+/* the size of the automaton and how fast it went */
+void acmatch_report(const struct acmatch *m, FILE *fp)
+{
+    const struct acmatch_stats *s = &m->stats;
+
+    fprintf(fp, "patterns: %u in %u states x %u byte classes, %.1f MB, "
+            "%s prefilter\n", m->npatterns, m->nstates, m->nclasses,
+            (double)m->nstates * m->nclasses * sizeof(*m->delta) / (1 << 20),
+            m->simd ? "ssse3" : "scalar");
+    fprintf(fp, "patterns: %llu frames %llu bytes scanned in %.3f s, "
+            "%.2f Gbit/s, %llu frames matched\n", s->frames, s->bytes,
+            s->ns / 1e9, s->ns == 0 ? 0 : s->bytes * 8.0 / s->ns,
+            s->matched);
+}
+
+/* the bytes of a line of a pattern file, with the escapes */
+static int parse_line(const char *line, uint8_t *pat, unsigned int *len)
+{
+    const char *p = line;
+    unsigned int n = 0, v;
+
+    while (*p != '\0') {
+        if (*p != '\\') {
+            pat[n ++] = *p ++;
+            continue;
+        }
+        switch (p[1]) {
+            case 'x':
+                if (!isxdigit((unsigned char)p[2])
+                        || !isxdigit((unsigned char)p[3])
+                        || sscanf(p + 2, "%2x", &v) != 1)
+                    return -1;
+                pat[n ++] = v;
+                p += 4;
+                continue;
+            case 'n':
+                pat[n ++] = '\n';
+                break;
+            case 'r':
+                pat[n ++] = '\r';
+                break;
+            case 't':
+                pat[n ++] = '\t';
+                break;
+            case '\\':
+                pat[n ++] = '\\';
+                break;
+            default:
+                return -1;
+        }
+        p += 2;
+    }
+    *len = n;
+    return 0;
+}
+
+/* the first byte from i on that may start a pattern, or n */
+static unsigned int skip(const struct acmatch *m, const uint8_t *p,
+        unsigned int i, unsigned int n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (m->simd)
+        i = skip_ssse3(m, p, i, n);
+#endif
+    while (i < n && !m->first[p[i]])
+        i ++;
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 16 bytes at a time, up to the last 16 or a byte that may start one */
+__attribute__((target("ssse3")))
+static unsigned int skip_ssse3(const struct acmatch *m, const uint8_t *p,
+        unsigned int i, unsigned int n)
+{
+    const __m128i lo = _mm_loadu_si128((const __m128i *)m->lo);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)m->hi);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i v, l, h;
+    unsigned int bits;
+
+    for (; i + 16 <= n; i += 16) {
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+        h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h),
+                    _mm_setzero_si128())) & 0xffff;
+        if (bits != 0)
+            return i + __builtin_ctz(bits);
+    }
+    return i;
+}
+#endif
@@ -0,0 +1,66 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ACMATCH_HD
+#define ACMATCH_HD
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ACMATCH_LINE        4096    /* longest line of a pattern file  */
+#define ACMATCH_MAX_IDS     16      /* patterns reported per frame     */
+
+/* counters, updated by the owner of the matcher only */
+struct acmatch_stats {
+    unsigned long long frames;
+    unsigned long long bytes;
+    unsigned long long matched; /* frames with a pattern in them       */
+    unsigned long long ns;      /* spent scanning                      */
+};
+
+/*
+ * an Aho-Corasick automaton as a table of next states by state and byte
+ * class, the root being state 0.
+ */
+struct acmatch {
+    uint32_t *delta;            /* nstates x nclasses                  */
+    uint32_t *match;            /* first state with patterns on the    */
+                                /* suffix chain, the state itself      */
+                                /* included, 0 if none                 */
+    uint32_t *dict;             /* the same, the state left out        */
+    uint32_t *outs;             /* ids[outs[s]] to ids[outs[s + 1]]    */
+    uint32_t *ids;              /* end at state s                      */
+    uint32_t nstates;
+    uint32_t npatterns;
+    unsigned int nclasses;      /* bytes in no pattern are class 0     */
+    uint16_t cls[256];
+    uint8_t first[256];         /* the bytes that leave the root       */
+    uint8_t lo[16];             /* prefilter by the low and high       */
+    uint8_t hi[16];             /* nibbles of the bytes in first       */
+    int simd;                   /* the prefilter runs in SSSE3         */
+    struct acmatch_stats stats;
+};
+
+int acmatch_load(struct acmatch *m, const char *path);
+int acmatch_build(struct acmatch *m, const uint8_t *const *pats,
+        const unsigned int *lens, const uint32_t *ids, uint32_t n);
+unsigned int acmatch_scan(struct acmatch *m, const uint8_t *data,
+        unsigned int len, uint32_t *ids, unsigned int maxids);
+void acmatch_free(struct acmatch *m);
+void acmatch_report(const struct acmatch *m, FILE *fp);
+
+#endif
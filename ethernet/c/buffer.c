@@ -17,18 +17,24 @@
 
 /* Description */
 /* 
- * dump the buffer in a human-readable form to stdout
+ * dump the buffer in a human-readable form to stdout: the offset, 16 bytes
+ * in hex and the same bytes as text, unprintable ones as '.', a line.
+ *
+ * The lines are rendered into a buffer and written with one call rather
+ * than with a printf per line and a sprintf per byte. A byte costs two
+ * lookups in a table of hex digits, or, with SSSE3 if the CPU has it, a
+ * whole line of 16 bytes is turned into hex with two PSHUFB and spread
+ * across the columns with three more, and its text made with a compare.
  */
 
+#include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#endif
 #include "buffer.h"
 
-#define PRINTF printf
-
-void dumpbuf(char *buf, int nrecv)
-{
 #define LINE_WIDTH        74
 #define INDEX_LEN        4
 #define INDEX_GAP_LEN    2
@@ -40,38 +46,165 @@ void dumpbuf(char *buf, int nrecv)
                 (HEX_COLUMN_START + HEX_COLUMN_WIDTH + COLUMN_GAP_LEN)
 #define PRINT_COLUMN_WIDTH    (HEX_COLUMN_WIDTH/3)
 #define    CHAR_PER_LINE    (PRINT_COLUMN_WIDTH)
-            
-    int i = 0, hexpos = 0, printpos = 0;
-    char idxbuf[INDEX_LEN+1], 
-         hexbuf[HEX_COLUMN_WIDTH+1], 
-         printbuf[PRINT_COLUMN_WIDTH+1];
-
-    sprintf(idxbuf, "%0*d", INDEX_LEN, i);
-    while (nrecv > 0 && i < nrecv) {
-        if (i % CHAR_PER_LINE == 0) {
-            printbuf[printpos] = '\0';
-            hexpos = 0;
-            printpos = 0;
-            if (i > 0)
-                PRINTF("%s%*c%-*s%*c%s\n", idxbuf, INDEX_GAP_LEN, ' ', 
-                        HEX_COLUMN_WIDTH, hexbuf, COLUMN_GAP_LEN,
-                        ' ', printbuf);
-            sprintf(idxbuf, "%0*x", INDEX_LEN, i);
-        }
-        hexpos += sprintf(hexbuf+hexpos, "%02x ", (unsigned char)buf[i]); 
-        if (isprint(buf[i]))
-            printbuf[printpos ++] = buf[i];
-        else
-            printbuf[printpos ++] = '.';
-        i ++;
+
+#define DUMP_STACK      4096    /* bytes rendered on the stack          */
+
+static const char hexdigits[16] = "0123456789abcdef";
+
+static char *dump_index(char *out, size_t idx);
+static char *dump_line(char *out, const unsigned char *p, unsigned int n);
+#if defined(__x86_64__) || defined(__i386__)
+static size_t dump_ssse3(char *out, const unsigned char *p, size_t n,
+        size_t offset);
+#endif
+
+/*
+ * the whole buffer rendered at once and written with one fwrite(3), on
+ * the stack for a frame of up to DUMP_STACK bytes. Should a larger one
+ * find no memory, it is rendered DUMP_STACK bytes at a time.
+ */
+void dumpbuf(char *buf, int nrecv)
+{
+    char stack[HEXDUMP_SIZE(DUMP_STACK)], *text = stack;
+    size_t off, n, chunk = DUMP_STACK;
+
+    if (nrecv <= 0)
+        return;
+    if ((size_t)nrecv > DUMP_STACK
+            && (text = malloc(HEXDUMP_SIZE(nrecv))) != NULL)
+        chunk = nrecv;
+    else
+        text = stack;
+
+    for (off = 0; off < (size_t)nrecv; off += n) {
+        n = (size_t)nrecv - off < chunk ? (size_t)nrecv - off : chunk;
+        fwrite(text, 1, hexdump(text, buf + off, n, off), stdout);
+    }
+    if (text != stack)
+        free(text);
+}
+
+/*
+ * the lines dumpbuf() prints for the n bytes of buf into out, which must
+ * have room for HEXDUMP_SIZE(n) bytes. The offsets begin at offset, which
+ * must be a multiple of 16 if the lines are to follow on from others.
+ * Returns the bytes written, no NUL is appended.
+ */
+size_t hexdump(char *out, const void *buf, size_t n, size_t offset)
+{
+    const unsigned char *p = buf;
+    char *o = out;
+    size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3")) {
+        i = n / CHAR_PER_LINE * CHAR_PER_LINE;
+        o += dump_ssse3(o, p, i, offset);
+    }
+#endif
+    for (; i < n; i += CHAR_PER_LINE) {
+        o = dump_index(o, offset + i);
+        o = dump_line(o, p + i, n - i < CHAR_PER_LINE ? n - i
+                : CHAR_PER_LINE);
     }
+    return o - out;
+}
+
+/* as printf("%04x  "), with more digits if need be */
+static char *dump_index(char *out, size_t idx)
+{
+    int digits = INDEX_LEN, i;
+
+    while (digits < (int)(2 * sizeof(idx)) && idx >> (4 * digits) != 0)
+        digits ++;
+    for (i = digits - 1; i >= 0; i --)
+        *out ++ = hexdigits[(idx >> (4 * i)) & 0x0f];
+    memset(out, ' ', INDEX_GAP_LEN);
+    return out + INDEX_GAP_LEN;
+}
+
+/* the columns of up to CHAR_PER_LINE bytes after the index */
+static char *dump_line(char *out, const unsigned char *p, unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i ++) {
+        out[0] = hexdigits[p[i] >> 4];
+        out[1] = hexdigits[p[i] & 0x0f];
+        out[2] = ' ';
+        out += 3;
+    }
+    memset(out, ' ', HEX_COLUMN_WIDTH - 3 * n + COLUMN_GAP_LEN);
+    out += HEX_COLUMN_WIDTH - 3 * n + COLUMN_GAP_LEN;
+    /* isprint() in the C locale */
+    for (i = 0; i < n; i ++)
+        *out ++ = p[i] >= 0x20 && p[i] < 0x7f ? p[i] : '.';
+    *out ++ = '\n';
+    return out;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * whole lines of 16 bytes, n being a multiple of 16. The hex digits of
+ * the bytes are interleaved high, low, and then shuffled into 3 columns a
+ * byte, the lanes that get no digit (index 0x80) being the spaces.
+ */
+__attribute__((target("ssse3")))
+static size_t dump_ssse3(char *out, const unsigned char *p, size_t n,
+        size_t offset)
+{
+    const __m128i digits = _mm_loadu_si128((const __m128i *)hexdigits);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i m0 = _mm_setr_epi8(0, 1, -128, 2, 3, -128, 4, 5, -128,
+            6, 7, -128, 8, 9, -128, 10);
+    const __m128i m1a = _mm_setr_epi8(11, -128, 12, 13, -128, 14, 15,
+            -128, -128, -128, -128, -128, -128, -128, -128, -128);
+    const __m128i m1b = _mm_setr_epi8(-128, -128, -128, -128, -128, -128,
+            -128, -128, 0, 1, -128, 2, 3, -128, 4, 5);
+    const __m128i m2 = _mm_setr_epi8(-128, 6, 7, -128, 8, 9, -128, 10, 11,
+            -128, 12, 13, -128, 14, 15, -128);
+    __m128i v, hi, lo, a, b, c, text;
+    char *o = out;
+    size_t i;
+
+    for (i = 0; i < n; i += 16) {
+        o = dump_index(o, offset + i);
+        v = _mm_loadu_si128((const __m128i *)(p + i));
+        hi = _mm_shuffle_epi8(digits,
+                _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+        a = _mm_unpacklo_epi8(hi, lo);
+        b = _mm_unpackhi_epi8(hi, lo);
+
+        c = _mm_shuffle_epi8(a, m0);
+        c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi8(c,
+                        _mm_setzero_si128()), space));
+        _mm_storeu_si128((__m128i *)o, c);
+        c = _mm_or_si128(_mm_shuffle_epi8(a, m1a), _mm_shuffle_epi8(b, m1b));
+        c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi8(c,
+                        _mm_setzero_si128()), space));
+        _mm_storeu_si128((__m128i *)(o + 16), c);
+        c = _mm_shuffle_epi8(b, m2);
+        c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi8(c,
+                        _mm_setzero_si128()), space));
+        _mm_storeu_si128((__m128i *)(o + 32), c);
+        o += HEX_COLUMN_WIDTH;
+        memset(o, ' ', COLUMN_GAP_LEN);
+        o += COLUMN_GAP_LEN;
 
-    if (nrecv > 0) {
-        printbuf[printpos] = '\0';
-        PRINTF("%s%*c%-*s%*c%s\n", idxbuf, INDEX_GAP_LEN, ' ', 
-                HEX_COLUMN_WIDTH, hexbuf, COLUMN_GAP_LEN, ' ', printbuf);
+        /* 0x20 to 0x7e, signed: the bytes from 0x80 on are negative */
+        c = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+        text = _mm_or_si128(_mm_and_si128(c, v), _mm_andnot_si128(c, dot));
+        _mm_storeu_si128((__m128i *)o, text);
+        o += 16;
+        *o ++ = '\n';
     }
+    return o - out;
 }
+#endif
 
 
 char *safe_strncpy(char *dst, const char *src, size_t size)
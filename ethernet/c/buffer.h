@@ -18,7 +18,13 @@
 #ifndef BUFFER_HD
 #define BUFFER_HD
 
+#include <stddef.h>
+
+#define HEXDUMP_LINE_MAX    88  /* 16 bytes, an index of 16 digits    */
+#define HEXDUMP_SIZE(n)     (((size_t)(n) + 15) / 16 * HEXDUMP_LINE_MAX)
+
 void dumpbuf(char *buf, int nrecv);
+size_t hexdump(char *out, const void *buf, size_t n, size_t offset);
 char *safe_strncpy(char *dst, const char *src, size_t size);
 
 #endif
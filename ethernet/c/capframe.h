@@ -0,0 +1,79 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPFRAME_HD
+#define CAPFRAME_HD
+
+#include <string.h>
+#include <time.h>
+#include <linux/virtio_net.h>
+
+#define CAPFRAME_HEADROOM   4   /* bytes before data to put a tag back    */
+#define CAPFRAME_VLAN_ROOM  8   /* bytes of VLAN tags beyond the MTU      */
+
+/*
+ * a captured frame as handed from a receive path (recvfrom, the mmap'ed
+ * ring, ...) to whoever consumes it. data points into the receive buffer
+ * and is only valid during the call of the handler.
+ *
+ * The kernel takes the outer VLAN tag off most frames before a packet
+ * socket sees them. Such a frame has vlan set and, from the receive rings
+ * and buffers, CAPFRAME_HEADROOM bytes of room before data to put the tag
+ * back in, see capture.c.
+ *
+ * With PACKET_VNET_HDR, a frame may be an aggregate of segmentation
+ * offload, larger than the MTU, that the virtio-net header describes,
+ * see gso.c.
+ */
+struct capframe {
+    unsigned char *data;       /* first byte of the Ethernet header       */
+    unsigned int caplen;       /* number of bytes available at data       */
+    unsigned int len;          /* length of the frame on the wire         */
+    struct timespec ts;        /* time the frame was received             */
+    int ifindex;               /* interface the frame was received at     */
+    unsigned char pkttype;     /* PACKET_HOST, PACKET_OUTGOING, ...       */
+    unsigned char halen;       /* length of addr                          */
+    unsigned char addr[8];     /* physical address of the sender          */
+    unsigned char vlan;        /* the kernel took a VLAN tag off, below   */
+    unsigned short vlan_tpid;  /* the tag, in host order                  */
+    unsigned short vlan_tci;
+    unsigned char gso_type;    /* the virtio-net header, PACKET_VNET_HDR  */
+    unsigned char csum_flags;  /* VIRTIO_NET_HDR_F_*                      */
+    unsigned short gso_size;   /* payload per segment, 0 if not aggregate */
+    unsigned short hdr_len;
+    unsigned short csum_start;
+    unsigned short csum_offset;
+};
+
+typedef void (*capframe_handler_t)(struct capframe *frame, void *arg);
+
+/* take the virtio-net header in front of a frame, native byte order */
+static inline void capframe_vnet(struct capframe *frame,
+        const unsigned char *p)
+{
+    struct virtio_net_hdr h;
+
+    memcpy(&h, p, sizeof(h));
+    frame->csum_flags = h.flags;
+    frame->gso_type = h.gso_type;
+    frame->hdr_len = h.hdr_len;
+    frame->gso_size = h.gso_size;
+    frame->csum_start = h.csum_start;
+    frame->csum_offset = h.csum_offset;
+}
+
+#endif
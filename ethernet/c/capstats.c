@@ -0,0 +1,433 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * live statistics of a capture: frames and bytes per second, the frames
+ * the kernel dropped because we did not keep up (PACKET_STATISTICS), how
+ * often the ring was full, and the distribution of the gaps between
+ * frames and of the frame sizes, and the frames and bytes of each VLAN,
+ * the busiest only in the periodic reports. With a capture file, how far
+ * behind the writer is and how long its writes wait.
+ *
+ * Everything is gathered by the main thread. The workers only bump their
+ * own counters with relaxed stores and the kernel counts the drops anyway,
+ * thus reporting, however often, does not slow down the capture.
+ *
+ * Reports go to stderr or, if a path is given, to the clients of a Unix
+ * domain stream socket there, e.g.,
+ *
+ *     socat - UNIX-CONNECT:/tmp/ethercap.sock
+ *
+ * A client gets a report as soon as it connects and then every report
+ * until it disconnects. A client that does not keep up is disconnected
+ * rather than stalling us.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "capstats.h"
+
+/* the counts of a VLAN, to be sorted */
+struct vlancount {
+    unsigned int id;
+    unsigned long long frames;
+    unsigned long long bytes;
+};
+
+static void report_ifs(struct capstats *st, FILE *fp);
+static void report_queues(struct capstats *st, FILE *fp);
+static void report_output(struct capstats *st, FILE *fp);
+static void report_vlans(const struct capcounters *c, double secs,
+        unsigned int limit, FILE *fp);
+static int by_frames(const void *a, const void *b);
+static void write_report(struct capstats *st, FILE *fp, int periodic);
+static void send_report(struct capstats *st, int client, const char *buf,
+        size_t len);
+static double elapsed(const struct timespec *from, const struct timespec *to);
+
+int capstats_open(struct capstats *st, const struct capconf *conf,
+        struct capworker *workers, struct spsc *queues,
+        const struct pcapfile *pcap, const struct dedup *dedup,
+        int nworkers, const char *path)
+{
+    struct sockaddr_un addr;        /* man 7 unix */
+
+    memset(st, 0, sizeof(*st));
+    st->conf = conf;
+    st->workers = workers;
+    st->nworkers = nworkers;
+    st->queues = queues;
+    st->pcap = pcap;
+    st->dedup = dedup;
+    st->path = path;
+    st->listenfd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &st->start);
+    st->last_time = st->start;
+
+    if (path == NULL)
+        return 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: stats socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    st->listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (st->listenfd < 0) {
+        perror("socket(AF_UNIX, SOCK_STREAM, 0) failed");
+        return -1;
+    }
+    /* a socket left behind by an earlier run */
+    unlink(path);
+    if (bind(st->listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("bind(listenfd, &addr, sizeof(addr))");
+        return -1;
+    }
+    if (listen(st->listenfd, CAPSTATS_MAX_CLIENTS) != 0) {
+        perror("listen(listenfd, ...)");
+        return -1;
+    }
+    return 0;
+}
+
+/* take the pending connections and send each a report */
+void capstats_accept(struct capstats *st)
+{
+    char *buf;
+    size_t len;
+    FILE *fp;
+    int fd;
+
+    while ((fd = accept4(st->listenfd, NULL, NULL,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (st->nclients == CAPSTATS_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        if ((fp = open_memstream(&buf, &len)) == NULL) {
+            close(fd);
+            continue;
+        }
+        write_report(st, fp, 0);
+        fclose(fp);
+        st->clients[st->nclients ++] = fd;
+        send_report(st, fd, buf, len);
+        free(buf);
+    }
+}
+
+/*
+ * report the rates since the previous periodic report and the totals.
+ * Only periodic reports start a new interval, on demand reports (SIGUSR1)
+ * leave the period alone.
+ */
+void capstats_report(struct capstats *st, int periodic)
+{
+    char *buf;
+    size_t len;
+    FILE *fp;
+    int i;
+
+    if (st->path == NULL) {
+        write_report(st, stderr, periodic);
+        return;
+    }
+
+    if ((fp = open_memstream(&buf, &len)) == NULL)
+        return;
+    write_report(st, fp, periodic);
+    fclose(fp);
+    /* send_report() may drop a client, going backward skips none */
+    for (i = st->nclients - 1; i >= 0; i --)
+        send_report(st, st->clients[i], buf, len);
+    free(buf);
+}
+
+/* the summary at exit, the workers must have exited */
+void capstats_final(struct capstats *st, FILE *fp)
+{
+    struct capkstats ktotal;
+    struct rxbatch_stats batches;
+    struct capworker *w;
+    int i;
+
+    memset(&batches, 0, sizeof(batches));
+    capstats_read(st, &st->now, &ktotal);
+    for (i = 0; i < st->nworkers; i ++) {
+        w = &st->workers[i];
+        if (st->nworkers > 1) {
+            fprintf(fp, "worker %d (cpu %d): %llu frames %llu bytes\n",
+                    i, w->cpu, w->counters.frames, w->counters.bytes);
+        }
+        rxbatch_stats_add(&batches, &w->rx.stats);
+    }
+    fprintf(fp, "captured %llu frames %llu bytes\n",
+            st->now.frames, st->now.bytes);
+    fprintf(fp, "kernel: %llu received %llu dropped %llu ring full\n",
+            ktotal.packets, ktotal.drops, ktotal.freezes);
+    if (st->now.aggregates > 0) {
+        fprintf(fp, "gso: %llu aggregates cut into %llu segments\n",
+                st->now.aggregates, st->now.segments);
+    }
+    if (st->conf->nifs > 1)
+        report_ifs(st, fp);
+    report_output(st, fp);
+    report_vlans(&st->now, 0, CAPTURE_VLANS, fp);
+    if (st->nworkers > 0)
+        rxbatch_stats_print(&batches, st->workers[0].rx.nslots, fp);
+    hist_print(&st->now.gaps, "gap between frames, ns", fp);
+    hist_print(&st->now.sizes, "frame size, bytes", fp);
+}
+
+void capstats_close(struct capstats *st)
+{
+    int i;
+
+    for (i = 0; i < st->nclients; i ++)
+        close(st->clients[i]);
+    st->nclients = 0;
+    if (st->path != NULL && st->listenfd >= 0) {
+        close(st->listenfd);
+        unlink(st->path);
+        st->listenfd = -1;
+    }
+}
+
+/* merge the counters of the workers, which may be running */
+void capstats_read(struct capstats *st, struct capcounters *total,
+        struct capkstats *ktotal)
+{
+    struct capworker *w;
+    int i, j;
+
+    memset(total, 0, sizeof(*total));
+    memset(ktotal, 0, sizeof(*ktotal));
+    for (i = 0; i < st->nworkers; i ++) {
+        w = &st->workers[i];
+        capworker_kstats(w);
+        total->frames += stat_read(&w->counters.frames);
+        total->bytes += stat_read(&w->counters.bytes);
+        total->aggregates += stat_read(&w->counters.aggregates);
+        total->segments += stat_read(&w->counters.segments);
+        hist_merge(&total->gaps, &w->counters.gaps);
+        hist_merge(&total->sizes, &w->counters.sizes);
+        for (j = 0; j < CAPTURE_VLANS; j ++) {
+            total->vlan_frames[j] += stat_read(&w->counters.vlan_frames[j]);
+            total->vlan_bytes[j] += stat_read(&w->counters.vlan_bytes[j]);
+        }
+        for (j = 0; j < w->nsocks; j ++) {
+            ktotal->packets += w->socks[j].kstats.packets;
+            ktotal->drops += w->socks[j].kstats.drops;
+            ktotal->freezes += w->socks[j].kstats.freezes;
+        }
+    }
+}
+
+/* the totals of each interface, over the sockets of all the workers */
+static void report_ifs(struct capstats *st, FILE *fp)
+{
+    unsigned long long frames, bytes;
+    struct capkstats k;
+    struct capsock *s;
+    int i, j;
+
+    for (i = 0; i < st->conf->nifs; i ++) {
+        frames = bytes = 0;
+        memset(&k, 0, sizeof(k));
+        for (j = 0; j < st->nworkers; j ++) {
+            s = &st->workers[j].socks[i];
+            frames += stat_read(&s->frames);
+            bytes += stat_read(&s->bytes);
+            k.packets += s->kstats.packets;
+            k.drops += s->kstats.drops;
+            k.freezes += s->kstats.freezes;
+        }
+        fprintf(fp, "  %s: %llu frames %llu bytes, kernel %llu received "
+                "%llu dropped %llu ring full\n", st->conf->ifs[i].name,
+                frames, bytes, k.packets, k.drops, k.freezes);
+    }
+}
+
+/*
+ * how full the queues to the output thread have been, and the frames
+ * dropped because the output did not keep up
+ */
+static void report_queues(struct capstats *st, FILE *fp)
+{
+    unsigned long long overflows = 0, highwater = 0, hw;
+    int i;
+
+    if (st->queues == NULL)
+        return;
+
+    for (i = 0; i < st->nworkers; i ++) {
+        overflows += stat_read(&st->queues[i].overflows);
+        hw = stat_read(&st->queues[i].highwater);
+        if (hw > highwater)
+            highwater = hw;
+    }
+    fprintf(fp, "  output queues: %llu dropped, high water %llu of %u "
+            "frames\n", overflows, highwater, st->queues[0].nslots);
+}
+
+/*
+ * the queues to the output thread, the duplicates dropped there and the
+ * writer of the capture file
+ */
+static void report_output(struct capstats *st, FILE *fp)
+{
+    report_queues(st, fp);
+    if (st->dedup != NULL)
+        dedup_report(st->dedup, fp);
+    if (st->pcap != NULL)
+        pcapfile_report(st->pcap, fp);
+}
+
+static void write_report(struct capstats *st, FILE *fp, int periodic)
+{
+    struct capcounters *now = &st->now, *diff = &st->diff;
+    struct capkstats know;
+    struct timespec t;
+    double secs;
+    int i;
+
+    capstats_read(st, now, &know);
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    secs = elapsed(&st->last_time, &t);
+    if (secs <= 0)
+        secs = 1e-9;
+
+    diff->frames = now->frames - st->last.frames;
+    diff->bytes = now->bytes - st->last.bytes;
+    diff->aggregates = now->aggregates - st->last.aggregates;
+    diff->segments = now->segments - st->last.segments;
+    hist_diff(&diff->gaps, &now->gaps, &st->last.gaps);
+    hist_diff(&diff->sizes, &now->sizes, &st->last.sizes);
+    for (i = 0; i < CAPTURE_VLANS; i ++) {
+        diff->vlan_frames[i] = now->vlan_frames[i] - st->last.vlan_frames[i];
+        diff->vlan_bytes[i] = now->vlan_bytes[i] - st->last.vlan_bytes[i];
+    }
+
+    fprintf(fp, "[%.1fs] last %.1fs: %.0f frames/s %.0f bytes/s, "
+            "%llu dropped %llu ring full\n", elapsed(&st->start, &t), secs,
+            diff->frames / secs, diff->bytes / secs,
+            know.drops - st->klast.drops, know.freezes - st->klast.freezes);
+    report_ifs(st, fp);
+    if (diff->aggregates > 0) {
+        fprintf(fp, "  gso: %.0f aggregates/s cut into %.0f segments/s\n",
+                diff->aggregates / secs, diff->segments / secs);
+    }
+    report_output(st, fp);
+    report_vlans(diff, secs, CAPSTATS_VLANS, fp);
+    hist_summary(&diff->gaps, "  gap ns", fp);
+    hist_summary(&diff->sizes, "  size", fp);
+
+    if (periodic) {
+        st->last = *now;
+        st->klast = know;
+        st->last_time = t;
+    }
+}
+
+/*
+ * the frames and bytes of the limit busiest VLANs, per second if secs is
+ * not 0, and of the untagged frames
+ */
+static void report_vlans(const struct capcounters *c, double secs,
+        unsigned int limit, FILE *fp)
+{
+    struct vlancount *v;
+    unsigned long long tagged = 0;
+    const char *unit = secs > 0 ? "/s" : "";
+    double per = secs > 0 ? secs : 1;
+    unsigned int id, n = 0, i;
+
+    for (id = 0; id < CAPTURE_VLANS; id ++) {
+        if (c->vlan_frames[id] > 0) {
+            tagged += c->vlan_frames[id];
+            n ++;
+        }
+    }
+    if (n == 0 || (v = malloc(n * sizeof(*v))) == NULL)
+        return;
+
+    for (id = 0, i = 0; id < CAPTURE_VLANS; id ++) {
+        if (c->vlan_frames[id] > 0) {
+            v[i].id = id;
+            v[i].frames = c->vlan_frames[id];
+            v[i ++].bytes = c->vlan_bytes[id];
+        }
+    }
+    qsort(v, n, sizeof(*v), by_frames);
+
+    fprintf(fp, "  untagged: %.0f frames%s\n", (c->frames - tagged) / per,
+            unit);
+    for (i = 0; i < n && i < limit; i ++) {
+        fprintf(fp, "  vlan %u: %.0f frames%s %.0f bytes%s\n", v[i].id,
+                v[i].frames / per, unit, v[i].bytes / per, unit);
+    }
+    if (n > limit)
+        fprintf(fp, "  %u more VLANs\n", n - limit);
+    free(v);
+}
+
+/* busiest first, then by ID */
+static int by_frames(const void *a, const void *b)
+{
+    const struct vlancount *x = a, *y = b;
+
+    if (x->frames != y->frames)
+        return x->frames < y->frames ? 1 : -1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static void send_report(struct capstats *st, int client, const char *buf,
+        size_t len)
+{
+    int i;
+
+    if (send(client, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)len)
+        return;
+
+    /* gone, or too slow to take a report */
+    close(client);
+    for (i = 0; i < st->nclients; i ++) {
+        if (st->clients[i] == client) {
+            st->clients[i] = st->clients[-- st->nclients];
+            break;
+        }
+    }
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec)
+        + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
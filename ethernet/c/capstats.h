@@ -0,0 +1,63 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPSTATS_HD
+#define CAPSTATS_HD
+
+#include <stdio.h>
+#include <time.h>
+
+#include "capture.h"
+#include "dedup.h"
+#include "pcapfile.h"
+#include "spsc.h"
+
+#define CAPSTATS_MAX_CLIENTS    16
+#define CAPSTATS_VLANS          8   /* busiest VLANs in a periodic report */
+
+/* statistics of the capture workers, gathered by the main thread */
+struct capstats {
+    const struct capconf *conf;
+    struct capworker *workers;
+    int nworkers;
+    struct spsc *queues;        /* to the output thread, or NULL       */
+    const struct pcapfile *pcap;/* being written, or NULL              */
+    const struct dedup *dedup;  /* duplicates dropped, or NULL         */
+    struct timespec start;
+    struct timespec last_time;  /* of the previous periodic report     */
+    struct capcounters last;    /* counters at the previous report     */
+    struct capkstats klast;
+    struct capcounters now;     /* scratch, too big for the stack      */
+    struct capcounters diff;
+    const char *path;           /* stats socket, or NULL for stderr    */
+    int listenfd;
+    int clients[CAPSTATS_MAX_CLIENTS];
+    int nclients;
+};
+
+int capstats_open(struct capstats *st, const struct capconf *conf,
+        struct capworker *workers, struct spsc *queues,
+        const struct pcapfile *pcap, const struct dedup *dedup,
+        int nworkers, const char *path);
+void capstats_accept(struct capstats *st);
+void capstats_read(struct capstats *st, struct capcounters *total,
+        struct capkstats *ktotal);
+void capstats_report(struct capstats *st, int periodic);
+void capstats_final(struct capstats *st, FILE *fp);
+void capstats_close(struct capstats *st);
+
+#endif
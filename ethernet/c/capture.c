@@ -0,0 +1,836 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * capture workers. A worker is a thread with a raw packet socket of its
+ * own for each interface, bound to the interface, that receives frames
+ * either in batches by recvmmsg(2) or from a TPACKET_V3 ring and hands
+ * them to the frame handler. A worker with more than one socket waits for
+ * them together by epoll(7).
+ *
+ * With more than one worker, the sockets of each interface join a
+ * PACKET_FANOUT group and the kernel spreads the frames across them (see
+ * packet(7)), e.g., by flow hash or by the CPU that received the frame.
+ * Each worker is pinned to a CPU of its own so that the workers scale with
+ * the receive queues of the NIC.
+ *
+ * With a snaplen, the filter truncates the frames in the kernel, before
+ * they are copied to the socket buffer or the ring.
+ *
+ * Every frame carries the time the kernel, or the NIC if asked for and
+ * able to, received it in nanoseconds. The workers keep histograms of the
+ * gaps between the frames and of their sizes to show jitter and bursts,
+ * and count the frames and bytes of each VLAN, and, for the dashboard, of
+ * each MAC address and EtherType.
+ *
+ * With PACKET_VNET_HDR, frames come with the virtio-net header, that tells
+ * the aggregates of GRO, TSO or GSO, which are up to 64 KiB and need
+ * buffers of CAPTURE_GSO_BUFSIZE bytes. The aggregates may be cut back
+ * into the segments that were on the wire, see gso.c, before they are
+ * counted and handed on.
+ *
+ * The kernel takes the outer VLAN tag off the frames it receives and
+ * tells us the tag apart (PACKET_AUXDATA, or the ring's frame header).
+ * The tag is put back where it was, in the room the receive paths leave
+ * in front of every frame, so that the handler, the filter of a replay
+ * and the capture file see the frame as it was on the wire. An inner tag
+ * of QinQ is left in the frame by the kernel.
+ *
+ * Instead of capturing, a single worker may replay the frames of a capture
+ * file, see pcapread.c, through the same handler, counters and filter (run
+ * by filter_run() here as there is no kernel to run it). The frames are
+ * paced as they were recorded, or handed over as fast as the handler takes
+ * them so that the cost per frame of the whole path can be measured on the
+ * same input time after time.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "capture.h"
+
+static void *capworker_run(void *arg);
+static int capworker_wait(struct capworker *w);
+static void capworker_replay(struct capworker *w);
+static int replay_wait(struct capworker *w, const struct timespec *t);
+static void capsock_frame(struct capframe *frame, void *arg);
+static void capsock_deliver(struct capframe *frame, void *arg);
+static void vlan_insert(struct capframe *frame, unsigned int bufsize);
+static void vlan_count(struct capcounters *c, const struct capframe *frame);
+static void mix_count(struct capmix *m, const struct capframe *frame);
+static void slot_count(struct capslot *slots, unsigned int nslots,
+        struct capslot *other, uint64_t key, unsigned int len);
+static int capture_stopped(struct capconf *conf);
+static int capsock_open(struct capsock *s, struct capworker *w, int ifn);
+static int capsock_timestamps(struct capsock *s);
+static int capsock_kstats(struct capsock *s);
+
+static const struct {
+    const char *name;
+    int mode;
+} fanout_modes[] = {
+    /* keep the frames of a flow on one socket */
+    {"hash", PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG},
+    /* the socket of the CPU that received the frame */
+    {"cpu",  PACKET_FANOUT_CPU},
+    /* round-robin, frame by frame, PACKET_FANOUT_LB as the kernel calls it */
+    {"rr",   PACKET_FANOUT_LB},
+    {"lb",   PACKET_FANOUT_LB},
+    /* by flow hash, but move on to the next socket when one falls behind */
+    {"hash-rollover", PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG
+                | PACKET_FANOUT_FLAG_ROLLOVER},
+    /* the socket matching the receive queue of the NIC */
+    {"qm",   PACKET_FANOUT_QM},
+    {NULL,   -1}
+};
+
+/* map the name of a fanout mode to PACKET_FANOUT_*, -1 if unknown */
+int capture_fanout_mode(const char *name)
+{
+    int i;
+
+    for (i = 0; fanout_modes[i].name != NULL; i ++) {
+        if (!strcmp(fanout_modes[i].name, name))
+            return fanout_modes[i].mode;
+    }
+    return -1;
+}
+
+int capworker_open(struct capworker *w, int id, int cpu,
+        struct capconf *conf)
+{
+    struct epoll_event ev;
+    struct timeval tv;
+    int i;
+
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->cpu = cpu;
+    w->conf = conf;
+    w->arg = conf->arg;
+    w->epfd = -1;
+    for (i = 0; i < CAPTURE_MAX_IFS; i ++)
+        w->socks[i].sockfd = -1;
+    if (conf->mix && (w->mix = calloc(1, sizeof(*w->mix))) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        return -1;
+    }
+
+    if (conf->replay != NULL) {
+        /* the frames are read from the file in place, no socket */
+        for (i = 0; i < conf->nifs; i ++) {
+            w->socks[i].w = w;
+            w->socks[i].ifn = i;
+        }
+        w->nsocks = conf->nifs;
+        return 0;
+    }
+
+    if (!conf->ring) {
+        /* allocate buffers, shared by the sockets of the worker */
+        if (rxbatch_init(&w->rx, conf->batch, conf->bufsize,
+                    conf->vnet) != 0)
+            return -1;
+    }
+    if (conf->segment && (w->segbuf = malloc(conf->bufsize)) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < conf->nifs; i ++) {
+        w->nsocks = i + 1;
+        if (capsock_open(&w->socks[i], w, i) != 0)
+            return -1;
+    }
+
+    if (w->nsocks == 1) {
+        /*
+         * a single socket is waited for directly. Without the ring, wake
+         * up now and then to see whether we are asked to stop.
+         */
+        if (conf->ring)
+            return 0;
+        tv.tv_sec = 0;
+        tv.tv_usec = CAPTURE_POLL_TIMEOUT * 1000;
+        if (setsockopt(w->socks[0].sockfd, SOL_SOCKET,
+                SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+            perror("setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, ...)");
+            return -1;
+        }
+        return 0;
+    }
+
+    /* more than one, wait for whichever has frames. see epoll(7) */
+    if ((w->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1(EPOLL_CLOEXEC) failed");
+        return -1;
+    }
+    for (i = 0; i < w->nsocks; i ++) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &w->socks[i];
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD,
+                    w->socks[i].sockfd, &ev) != 0) {
+            perror("epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, ...)");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int capworker_start(struct capworker *w)
+{
+    int rc;
+
+    if ((rc = pthread_create(&w->tid, NULL, capworker_run, w)) != 0) {
+        fprintf(stderr, "ERROR: pthread_create(...): %s\n", strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+void capworker_join(struct capworker *w)
+{
+    pthread_join(w->tid, NULL);
+}
+
+void capworker_close(struct capworker *w)
+{
+    int i;
+
+    for (i = 0; i < w->nsocks; i ++) {
+        pktring_teardown(&w->socks[i].ring);
+        if (w->socks[i].sockfd >= 0) {
+            close(w->socks[i].sockfd);
+            w->socks[i].sockfd = -1;
+        }
+    }
+    if (w->epfd >= 0) {
+        close(w->epfd);
+        w->epfd = -1;
+    }
+    rxbatch_free(&w->rx);
+    free(w->segbuf);
+    w->segbuf = NULL;
+    free(w->mix);
+    w->mix = NULL;
+}
+
+/* see capsock_kstats() */
+int capworker_kstats(struct capworker *w)
+{
+    int i, rc = 0;
+
+    for (i = 0; i < w->nsocks; i ++) {
+        if (w->socks[i].sockfd >= 0 && capsock_kstats(&w->socks[i]) != 0)
+            rc = -1;
+    }
+    return rc;
+}
+
+/* the name of the interface, NULL if we do not capture on it */
+const char *capture_ifname(const struct capconf *conf, int ifindex)
+{
+    int i;
+
+    for (i = 0; i < conf->nifs; i ++) {
+        if (conf->ifs[i].ifindex == ifindex)
+            return conf->ifs[i].name;
+    }
+    return NULL;
+}
+
+/*
+ * add what the kernel has counted on the socket since we last asked to
+ * s->kstats: reading PACKET_STATISTICS resets them. The counters are kept
+ * by the kernel, thus this costs the worker nothing.
+ */
+static int capsock_kstats(struct capsock *s)
+{
+    struct tpacket_stats st;
+    struct tpacket_stats_v3 st3;
+    socklen_t len;
+
+    if (s->w->conf->ring) {
+        len = sizeof(st3);
+        if (getsockopt(s->sockfd, SOL_PACKET,
+                PACKET_STATISTICS, &st3, &len) != 0) {
+            perror("getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, ...)");
+            return -1;
+        }
+        s->kstats.packets += st3.tp_packets;
+        s->kstats.drops += st3.tp_drops;
+        s->kstats.freezes += st3.tp_freeze_q_cnt;
+        return 0;
+    }
+
+    len = sizeof(st);
+    if (getsockopt(s->sockfd, SOL_PACKET,
+            PACKET_STATISTICS, &st, &len) != 0) {
+        perror("getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, ...)");
+        return -1;
+    }
+    s->kstats.packets += st.tp_packets;
+    s->kstats.drops += st.tp_drops;
+    return 0;
+}
+
+/* the n-th CPU (modulo their number) that we are allowed to run on */
+int capture_cpu(int n)
+{
+    cpu_set_t cpus;
+    int cpu, count;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0
+            || (count = CPU_COUNT(&cpus)) == 0)
+        return -1;
+
+    n %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu ++) {
+        if (CPU_ISSET(cpu, &cpus) && n-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+/*
+ * ask the NIC to timestamp every frame it receives. Many drivers can't,
+ * in which case the kernel's time of receipt is used.
+ */
+int capture_hwtstamp(int sockfd, const char *ifname)
+{
+    struct ifreq ifr;
+    struct hwtstamp_config hwconfig;
+
+    memset(&hwconfig, 0, sizeof(hwconfig));
+    hwconfig.tx_type = HWTSTAMP_TX_OFF;
+    hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    ifr.ifr_data = (void *)&hwconfig;
+    if (ioctl(sockfd, SIOCSHWTSTAMP, &ifr) != 0) {
+        perror("ioctl(sockfd, SIOCSHWTSTAMP, ...)");
+        return -1;
+    }
+    return 0;
+}
+
+void capture_stop(struct capconf *conf)
+{
+    __atomic_store_n(&conf->stop, 1, __ATOMIC_RELAXED);
+}
+
+static int capture_stopped(struct capconf *conf)
+{
+    return __atomic_load_n(&conf->stop, __ATOMIC_RELAXED);
+}
+
+static void *capworker_run(void *arg)
+{
+    struct capworker *w = arg;
+    struct capconf *conf = w->conf;
+    cpu_set_t cpus;
+
+    if (w->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(w->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(),
+                    sizeof(cpus), &cpus) != 0) {
+            fprintf(stderr, "WARN: could not pin worker %d to cpu %d\n",
+                    w->id, w->cpu);
+        }
+    }
+
+    if (conf->replay != NULL) {
+        capworker_replay(w);
+        return NULL;
+    }
+
+    if (w->nsocks > 1) {
+        while (!capture_stopped(conf)) {
+            if (capworker_wait(w) < 0)
+                break;
+        }
+        return NULL;
+    }
+
+    if (conf->ring) {
+        while (!capture_stopped(conf)) {
+            if (pktring_poll(&w->socks[0].ring, CAPTURE_POLL_TIMEOUT,
+                        capsock_frame, &w->socks[0]) < 0) {
+                perror("poll(sockfd ...) failed");
+                break;
+            }
+        }
+        return NULL;
+    }
+
+    while (!capture_stopped(conf)) {
+        if (rxbatch_recv(&w->rx, w->socks[0].sockfd,
+                    capsock_frame, &w->socks[0]) < 0) {
+            perror("recvmmsg(sockfd ...) failed");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* wait for any of the sockets and receive from those that have frames */
+static int capworker_wait(struct capworker *w)
+{
+    struct epoll_event evs[CAPTURE_MAX_IFS];
+    struct capsock *s;
+    int i, n;
+
+    n = epoll_wait(w->epfd, evs, CAPTURE_MAX_IFS, CAPTURE_POLL_TIMEOUT);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        perror("epoll_wait(epfd, ...) failed");
+        return -1;
+    }
+
+    for (i = 0; i < n; i ++) {
+        s = evs[i].data.ptr;
+        if (w->conf->ring) {
+            if (pktring_poll(&s->ring, 0, capsock_frame, s) < 0) {
+                perror("poll(sockfd ...) failed");
+                return -1;
+            }
+        } else if (rxbatch_recv(&w->rx, s->sockfd, capsock_frame, s) < 0) {
+            perror("recvmmsg(sockfd ...) failed");
+            return -1;
+        }
+    }
+    return n;
+}
+
+/*
+ * hand the frames of the file to the handler, each at the time it was
+ * recorded relative to the first one unless replaying as fast as possible,
+ * then tell the main thread by conf->donefd
+ */
+static void capworker_replay(struct capworker *w)
+{
+    struct capconf *conf = w->conf;
+    struct capframe frame;
+    struct timespec start, end, first, t;
+    unsigned int ret;
+    uint64_t one = 1;
+    int n;
+
+    memset(&first, 0, sizeof(first));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!capture_stopped(conf)) {
+        if (pcapread_next(conf->replay, &frame) <= 0)
+            break;
+        if (!conf->replay_fast) {
+            if (w->replayed == 0)
+                first = frame.ts;
+            t.tv_sec = start.tv_sec + (frame.ts.tv_sec - first.tv_sec);
+            t.tv_nsec = start.tv_nsec + (frame.ts.tv_nsec - first.tv_nsec);
+            if (replay_wait(w, &t) != 0)
+                break;
+        }
+        w->replayed ++;
+
+        /* frames of interfaces we did not set up a socket for */
+        n = frame.ifindex - 1;
+        if (n < 0 || n >= w->nsocks)
+            continue;
+        frame.ifindex = conf->ifs[n].ifindex;
+
+        if (conf->filter != NULL) {
+            if ((ret = filter_run(conf->filter, &frame)) == 0)
+                continue;
+            if (ret < frame.caplen)
+                frame.caplen = ret;
+        }
+
+        /* the file does not record the sender, take it from the header */
+        if (frame.caplen >= ETHER_HDR_LEN) {
+            frame.halen = ETHER_ADDR_LEN;
+            memcpy(frame.addr, frame.data + ETHER_ADDR_LEN, ETHER_ADDR_LEN);
+        }
+        capsock_frame(&frame, &w->socks[n]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    w->replay_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL
+        + end.tv_nsec - start.tv_nsec;
+
+    if (conf->donefd >= 0 && write(conf->donefd, &one, sizeof(one)) < 0)
+        perror("write(donefd, ...) failed");
+}
+
+/*
+ * sleep until t on the monotonic clock, but no longer than
+ * CAPTURE_POLL_TIMEOUT at a time to see whether we are asked to stop
+ */
+static int replay_wait(struct capworker *w, const struct timespec *t)
+{
+    struct timespec now, until;
+
+    while (!capture_stopped(w->conf)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        until.tv_sec = t->tv_sec + t->tv_nsec / 1000000000;
+        until.tv_nsec = t->tv_nsec % 1000000000;
+        if (until.tv_nsec < 0) {
+            until.tv_sec --;
+            until.tv_nsec += 1000000000;
+        }
+        if (until.tv_sec < now.tv_sec || (until.tv_sec == now.tv_sec
+                    && until.tv_nsec <= now.tv_nsec))
+            return 0;
+        if (until.tv_sec - now.tv_sec > 1
+                || (until.tv_sec - now.tv_sec) * 1000000000LL + until.tv_nsec
+                    - now.tv_nsec > CAPTURE_POLL_TIMEOUT * 1000000LL) {
+            until = now;
+            until.tv_nsec += CAPTURE_POLL_TIMEOUT * 1000000L;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec ++;
+                until.tv_nsec -= 1000000000;
+            }
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+    }
+    return -1;
+}
+
+/*
+ * have the kernel timestamp the frames in nanoseconds. The ring always
+ * carries a timestamp, PACKET_TIMESTAMP only picks the source. Otherwise
+ * it comes as a control message, see rxbatch.c.
+ */
+static int capsock_timestamps(struct capsock *s)
+{
+    int on = 1, flags;
+
+    if (s->w->conf->ring) {
+        if (!s->w->conf->hwtstamp)
+            return 0;
+        flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+        if (setsockopt(s->sockfd, SOL_PACKET,
+                PACKET_TIMESTAMP, &flags, sizeof(flags)) != 0) {
+            perror("setsockopt(sockfd, SOL_PACKET, PACKET_TIMESTAMP, ...)");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (s->w->conf->hwtstamp) {
+        /* hardware if the NIC has stamped the frame, software if not */
+        flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE
+            | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (setsockopt(s->sockfd, SOL_SOCKET,
+                SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+            perror("setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, ...)");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (setsockopt(s->sockfd, SOL_SOCKET,
+            SO_TIMESTAMPNS, &on, sizeof(on)) != 0) {
+        perror("setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, ...)");
+        return -1;
+    }
+    return 0;
+}
+
+/* a frame as received: the VLAN tag put back, an aggregate cut */
+static void capsock_frame(struct capframe *frame, void *arg)
+{
+    struct capsock *s = arg;
+    struct capworker *w = s->w;
+    int n;
+
+    if (frame->vlan)
+        vlan_insert(frame, w->conf->bufsize);
+
+    if (frame->gso_size != 0 && w->segbuf != NULL
+            && (n = gso_segment(frame, w->segbuf, capsock_deliver, s)) > 0) {
+        stat_add(&w->counters.aggregates, 1);
+        stat_add(&w->counters.segments, n);
+        return;
+    }
+    if (w->segbuf != NULL)
+        gso_checksum(frame);
+    capsock_deliver(frame, s);
+}
+
+/* count the frame and hand it to the handler */
+static void capsock_deliver(struct capframe *frame, void *arg)
+{
+    struct capsock *s = arg;
+    struct capworker *w = s->w;
+    long long gap;
+
+    stat_add(&s->frames, 1);
+    stat_add(&s->bytes, frame->len);
+
+    /* frames may come out of order across a batch, count those as 0 */
+    if (w->last.tv_sec != 0 || w->last.tv_nsec != 0) {
+        gap = (frame->ts.tv_sec - w->last.tv_sec) * 1000000000LL
+            + (frame->ts.tv_nsec - w->last.tv_nsec);
+        hist_add(&w->counters.gaps, gap > 0 ? gap : 0);
+    }
+    if (frame->ts.tv_sec > w->last.tv_sec || (frame->ts.tv_sec ==
+                w->last.tv_sec && frame->ts.tv_nsec > w->last.tv_nsec))
+        w->last = frame->ts;
+    hist_add(&w->counters.sizes, frame->len);
+
+    stat_add(&w->counters.frames, 1);
+    stat_add(&w->counters.bytes, frame->len);
+    vlan_count(&w->counters, frame);
+    if (w->mix != NULL)
+        mix_count(w->mix, frame);
+    w->conf->handler(frame, w->arg);
+}
+
+/*
+ * put the tag the kernel took off back after the MAC addresses, moving
+ * them into the headroom. A frame cut to bufsize by the snaplen stays so.
+ */
+static void vlan_insert(struct capframe *frame, unsigned int bufsize)
+{
+    unsigned char *d;
+
+    if (frame->caplen < 2 * ETH_ALEN)
+        return;
+    d = frame->data - CAPFRAME_HEADROOM;
+    memmove(d, frame->data, 2 * ETH_ALEN);
+    d[12] = frame->vlan_tpid >> 8;
+    d[13] = frame->vlan_tpid & 0xff;
+    d[14] = frame->vlan_tci >> 8;
+    d[15] = frame->vlan_tci & 0xff;
+    frame->data = d;
+    frame->caplen += CAPFRAME_HEADROOM;
+    if (frame->caplen > bufsize)
+        frame->caplen = bufsize;
+    frame->len += CAPFRAME_HEADROOM;
+    frame->vlan = 0;
+}
+
+/* by the ID of the outer tag, untagged frames are not counted */
+static void vlan_count(struct capcounters *c, const struct capframe *frame)
+{
+    const unsigned char *d = frame->data;
+    unsigned int type, id;
+
+    if (frame->caplen < ETH_HLEN + 2)
+        return;
+    type = d[12] << 8 | d[13];
+    if (type != ETH_P_8021Q && type != ETH_P_8021AD)
+        return;
+    id = (d[14] << 8 | d[15]) & (CAPTURE_VLANS - 1);
+    stat_add(&c->vlan_frames[id], 1);
+    stat_add(&c->vlan_bytes[id], frame->len);
+}
+
+/* by MAC address and by EtherType, that of the frame within any tags */
+static void mix_count(struct capmix *m, const struct capframe *frame)
+{
+    const unsigned char *d = frame->data;
+    unsigned int off = 2 * ETH_ALEN, type;
+
+    if (frame->caplen < ETH_HLEN)
+        return;
+    slot_count(m->dmacs, CAPTURE_MACS, &m->dmac_other,
+            1ULL << 48 | (uint64_t)d[0] << 40 | (uint64_t)d[1] << 32
+            | (uint64_t)d[2] << 24 | d[3] << 16 | d[4] << 8 | d[5],
+            frame->len);
+    d += ETH_ALEN;
+    slot_count(m->smacs, CAPTURE_MACS, &m->smac_other,
+            1ULL << 48 | (uint64_t)d[0] << 40 | (uint64_t)d[1] << 32
+            | (uint64_t)d[2] << 24 | d[3] << 16 | d[4] << 8 | d[5],
+            frame->len);
+
+    d = frame->data;
+    type = d[off] << 8 | d[off + 1];
+    while ((type == ETH_P_8021Q || type == ETH_P_8021AD)
+            && off + 6 <= frame->caplen) {
+        off += 4;
+        type = d[off] << 8 | d[off + 1];
+    }
+    /* a length, of an 802.3 frame */
+    if (type < ETH_P_802_3_MIN)
+        type = 0;
+    slot_count(m->types, CAPTURE_ETHERTYPES, &m->type_other, type + 1,
+            frame->len);
+}
+
+/* the frame in the slot of key, taking a free one if key has none */
+static void slot_count(struct capslot *slots, unsigned int nslots,
+        struct capslot *other, uint64_t key, unsigned int len)
+{
+    struct capslot *s = other;
+    unsigned int h, i;
+
+    h = (key * 0x9e3779b97f4a7c15ULL) >> 40;
+    for (i = 0; i < CAPTURE_PROBES; i ++) {
+        s = &slots[(h + i) & (nslots - 1)];
+        if (s->key == 0)
+            __atomic_store_n(&s->key, key, __ATOMIC_RELAXED);
+        if (s->key == key)
+            break;
+        s = other;
+    }
+    stat_add(&s->frames, 1);
+    stat_add(&s->bytes, len);
+}
+
+/* a socket bound to conf->ifs[ifn] */
+static int capsock_open(struct capsock *s, struct capworker *w, int ifn)
+{
+    struct capconf *conf = w->conf;
+    const struct capif *ifp = &conf->ifs[ifn];
+    struct sockaddr_ll bindethaddr; /* man 7 packet    */
+    struct packet_mreq mr;          /* man 7 packet    */
+    int fanout, on, rcvbuf;
+
+    s->w = w;
+    s->ifn = ifn;
+
+    /* open a raw packet socket to capture all types of ethernet frames */
+    s->sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (s->sockfd < 0) {
+        perror("socket(AF_PACKET, SOCK_RAW, ETH_P_ALL) failed");
+        return -1;
+    }
+
+    /* drop unwanted frames in the kernel, from the very beginning */
+    if (conf->filter != NULL && filter_attach(s->sockfd, conf->filter) != 0)
+        return -1;
+
+    /* put the interface into promiscuous mode. man 7 packet */
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = ifp->ifindex;
+    mr.mr_type =  PACKET_MR_PROMISC;
+    if (setsockopt(s->sockfd, SOL_PACKET,
+            PACKET_ADD_MEMBERSHIP, (char *)&mr, sizeof(mr)) != 0) {
+        perror("setsockopt(sockfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, ...)");
+        return -1;
+    }
+
+    /* bind the socket to the interface. see bind(2) and packet(7) */
+    memset(&bindethaddr, 0, sizeof(bindethaddr));
+    bindethaddr.sll_family = AF_PACKET;
+    bindethaddr.sll_protocol = htons(ETH_P_ALL);
+    bindethaddr.sll_ifindex = ifp->ifindex;
+    if (bind(s->sockfd,
+        (struct sockaddr*)&bindethaddr, sizeof(bindethaddr)) != 0) {
+        perror("bind(sockfd, &bindethaddr, sizeof(bindethaddr))");
+        return -1;
+    }
+
+    if (capsock_timestamps(s) != 0)
+        return -1;
+
+    /*
+     * the filter may truncate the frames and the kernel takes the VLAN
+     * tags off, the ring tells us how long they were and the tag but
+     * recvmmsg(2) does not. Have the kernel tell us in a control message.
+     */
+    on = 1;
+    if (!conf->ring && setsockopt(s->sockfd, SOL_PACKET,
+                PACKET_AUXDATA, &on, sizeof(on)) != 0) {
+        perror("setsockopt(sockfd, SOL_PACKET, PACKET_AUXDATA, ...)");
+        return -1;
+    }
+
+    /* before the ring is set up, which it changes the layout of */
+    on = 1;
+    if (conf->vnet && setsockopt(s->sockfd, SOL_PACKET,
+                PACKET_VNET_HDR, &on, sizeof(on)) != 0) {
+        perror("setsockopt(sockfd, SOL_PACKET, PACKET_VNET_HDR, ...)");
+        return -1;
+    }
+
+    /*
+     * the default socket buffer holds a few aggregates only. Past
+     * net.core.rmem_max if we may (CAP_NET_ADMIN), up to it if not.
+     */
+    rcvbuf = CAPTURE_GSO_RCVBUF;
+    if (conf->vnet && !conf->ring && setsockopt(s->sockfd, SOL_SOCKET,
+                SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) != 0
+            && setsockopt(s->sockfd, SOL_SOCKET,
+                SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0) {
+        perror("setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, ...)");
+        return -1;
+    }
+
+    if (conf->ring) {
+        /*
+         * the frames live in the ring and we do not need a buffer of our
+         * own. A frame never spans two blocks, thus a block must hold at
+         * least one frame of bufsize bytes plus the headers the kernel
+         * puts in front of it, or large frames are truncated.
+         */
+        if (w->id == 0 && ifn == 0 && conf->block_size < conf->bufsize + 256) {
+            fprintf(stderr, "WARN: ring block size %u is too small for "
+                    "frames of %u bytes, frames will be truncated\n",
+                    conf->block_size, conf->bufsize);
+        }
+        if (pktring_setup(&s->ring, s->sockfd, conf->block_size,
+                    conf->block_nr, conf->block_timeout, conf->vnet) != 0) {
+            return -1;
+        }
+    } else if (conf->nifs > 1) {
+        /* waited for by epoll(7), recvmmsg(2) must not block */
+        on = 1;
+        if (ioctl(s->sockfd, FIONBIO, &on) != 0) {
+            perror("ioctl(sockfd, FIONBIO, ...)");
+            return -1;
+        }
+    }
+
+    /*
+     * join the fanout group, the socket must be bound already. A group is
+     * bound to one interface, thus every interface has a group of its own.
+     */
+    if (conf->fanout_mode >= 0) {
+        fanout = ((conf->fanout_id + ifn) & 0xffff)
+            | (conf->fanout_mode << 16);
+        if (setsockopt(s->sockfd, SOL_PACKET,
+                PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+            perror("setsockopt(sockfd, SOL_PACKET, PACKET_FANOUT, ...)");
+            return -1;
+        }
+    }
+
+    return 0;
+}
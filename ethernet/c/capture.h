@@ -0,0 +1,163 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CAPTURE_HD
+#define CAPTURE_HD
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "capframe.h"
+#include "filter.h"
+#include "gso.h"
+#include "hist.h"
+#include "pcapread.h"
+#include "pktring.h"
+#include "rxbatch.h"
+
+#define CAPTURE_MAX_WORKERS     64
+#define CAPTURE_MAX_IFS         32
+#define CAPTURE_POLL_TIMEOUT    100  /* ms, how soon a worker sees stop */
+#define CAPTURE_HEADERS_SNAPLEN 128  /* ethernet, 2 VLAN, IPv6, TCP w/ opts */
+#define CAPTURE_VLANS           4096 /* VLAN IDs                         */
+#define CAPTURE_MACS            4096 /* MAC addresses counted, a power of 2 */
+#define CAPTURE_ETHERTYPES      256  /* EtherTypes counted, a power of 2  */
+#define CAPTURE_PROBES          16   /* slots tried for a key             */
+#define CAPTURE_GSO_BUFSIZE     (14 + CAPFRAME_VLAN_ROOM + GSO_MAX_SIZE)
+#define CAPTURE_GSO_RCVBUF      (16 << 20)  /* socket buffer for those  */
+
+/* an interface to capture on */
+struct capif {
+    const char *name;
+    int ifindex;
+};
+
+/* settings shared by all capture workers */
+struct capconf {
+    struct capif ifs[CAPTURE_MAX_IFS];
+    int nifs;
+    unsigned int bufsize;       /* most bytes of a frame we capture     */
+    int ring;                   /* receive from PACKET_RX_RING          */
+    unsigned int block_size;
+    unsigned int block_nr;
+    unsigned int block_timeout;
+    unsigned int batch;         /* frames per recvmmsg(2) w/o the ring  */
+    int hwtstamp;               /* timestamps from the NIC if it can    */
+    int vnet;                   /* PACKET_VNET_HDR, bufsize for GSO     */
+    int segment;                /* cut GSO aggregates into segments     */
+    int fanout_mode;            /* PACKET_FANOUT_*, or -1 for no fanout */
+    int fanout_id;              /* fanout group of the first interface  */
+    const struct filter *filter;/* attached to every socket, or NULL    */
+    struct pcapread *replay;    /* replay a file instead of capturing   */
+    int replay_fast;            /* as fast as possible, not as recorded */
+    int donefd;                 /* eventfd written when replay is done  */
+    int mix;                    /* count the frames by MAC and type     */
+    capframe_handler_t handler; /* called for every frame captured      */
+    void *arg;
+    int stop;                   /* set by capture_stop()                */
+};
+
+/* updated by the owning worker only, read with stat_read() */
+struct capcounters {
+    unsigned long long frames;
+    unsigned long long bytes;
+    struct hist gaps;           /* ns between consecutive frames        */
+    struct hist sizes;          /* frame length in bytes                */
+    unsigned long long aggregates;  /* GSO frames cut into segments     */
+    unsigned long long segments;
+    unsigned long long vlan_frames[CAPTURE_VLANS];  /* by outer VLAN ID */
+    unsigned long long vlan_bytes[CAPTURE_VLANS];
+};
+
+/* frames and bytes of a key, 0 while the slot is free */
+struct capslot {
+    uint64_t key;
+    unsigned long long frames;
+    unsigned long long bytes;
+};
+
+/*
+ * the frames by source and destination MAC address and by EtherType,
+ * after any VLAN tags, for the dashboard. The owning worker takes a slot
+ * for a key for good, thus another thread sees the key of a slot not yet
+ * or for good, and reads the counts with stat_read(). A key that finds
+ * no slot in CAPTURE_PROBES is counted in the table's other slot.
+ */
+struct capmix {
+    struct capslot smacs[CAPTURE_MACS];
+    struct capslot dmacs[CAPTURE_MACS];
+    struct capslot types[CAPTURE_ETHERTYPES];
+    struct capslot smac_other;
+    struct capslot dmac_other;
+    struct capslot type_other;
+};
+
+/*
+ * PACKET_STATISTICS of a socket, summed up since it was opened. Read by
+ * the main thread only, the workers never touch them.
+ */
+struct capkstats {
+    unsigned long long packets; /* passed the filter, including drops   */
+    unsigned long long drops;   /* no room in the socket buffer or ring */
+    unsigned long long freezes; /* times the ring was full              */
+};
+
+struct capworker;
+
+/* a socket of a worker, bound to one of the interfaces */
+struct capsock {
+    struct capworker *w;
+    int ifn;                    /* captures on conf->ifs[ifn]           */
+    int sockfd;
+    struct pktring ring;
+    unsigned long long frames;  /* per interface, read with stat_read() */
+    unsigned long long bytes;
+    struct capkstats kstats;
+};
+
+/* a capture thread and the sockets it receives from, one per interface */
+struct capworker {
+    int id;
+    int cpu;                    /* cpu the thread is pinned to, or -1   */
+    struct capsock socks[CAPTURE_MAX_IFS];
+    int nsocks;
+    int epfd;                   /* waits for the sockets if more than 1 */
+    struct rxbatch rx;          /* receive buffers if not using the ring */
+    unsigned char *segbuf;      /* a segment being cut, with segment    */
+    pthread_t tid;
+    struct capconf *conf;
+    void *arg;                  /* to the handler, conf->arg by default */
+    struct capcounters counters;
+    struct capmix *mix;         /* if conf->mix, or NULL                */
+    struct timespec last;       /* when the previous frame arrived      */
+    unsigned long long replayed;/* frames read from the replayed file   */
+    unsigned long long replay_ns;   /* how long reading them took       */
+};
+
+int capture_fanout_mode(const char *name);
+int capture_cpu(int n);
+int capture_hwtstamp(int sockfd, const char *ifname);
+const char *capture_ifname(const struct capconf *conf, int ifindex);
+int capworker_open(struct capworker *w, int id, int cpu,
+        struct capconf *conf);
+int capworker_start(struct capworker *w);
+void capworker_join(struct capworker *w);
+void capworker_close(struct capworker *w);
+int capworker_kstats(struct capworker *w);
+void capture_stop(struct capconf *conf);
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/* 
+ * decompress a capture file that ethercap wrote with -z, e.g., for
+ * tcpdump or Wireshark.
+ *
+ * usage: 
+ *
+ *      capzcat [-l] file > file.pcap
+ *
+ * The file is a series of blocks, see lzblk.c, each beginning with a
+ * record. -l lists the blocks instead: where each is in the file, how
+ * large it is before and after compression and, for pcap files, the time
+ * of its first frame, which is how a reader finds where to begin.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lzblk.h"
+
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_FILE_HDR_LEN       24
+#define MAX_BLOCK               (1 << 24)   /* pcapfile.c writes 1 MiB */
+
+static void usage(char *prog);
+static void list_block(size_t off, const unsigned char *blk, size_t rawlen,
+        size_t len, int *pcap);
+
+int main(int argc, char *argv[])
+{
+    struct stat st;
+    unsigned char *map, *buf;
+    size_t off, used;
+    long n;
+    int fd, c, list = 0, pcap = -1, rc = 0;
+
+    while ((c = getopt(argc, argv, "l")) != -1) {
+        switch (c) {
+            case 'l':
+                list = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    if (st.st_size == 0)
+        exit(0);
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap(file) failed");
+        exit(1);
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if ((buf = malloc(MAX_BLOCK)) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        exit(1);
+    }
+
+    for (off = 0; off < (size_t)st.st_size; off += used) {
+        n = lzblk_unframe(map + off, st.st_size - off, buf, MAX_BLOCK, &used);
+        if (n < 0) {
+            fprintf(stderr, "ERROR: broken block at %zu\n", off);
+            rc = 1;
+            break;
+        }
+        if (list) {
+            list_block(off, buf, n, used, &pcap);
+        } else if (fwrite(buf, 1, n, stdout) != (size_t)n) {
+            perror("fwrite(stdout)");
+            rc = 1;
+            break;
+        }
+    }
+
+    free(buf);
+    munmap(map, st.st_size);
+    if (fflush(stdout) != 0)
+        rc = 1;
+    return rc;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "\nWrong usage. \n\n"
+            "%s [-l] file\n\n"
+            "  -l     list the blocks of file\n\n", prog);
+}
+
+/*
+ * a line of -l. *pcap tells whether the blocks hold a pcap file, -1 until
+ * the first block is seen
+ */
+static void list_block(size_t off, const unsigned char *blk, size_t rawlen,
+        size_t len, int *pcap)
+{
+    uint32_t magic, sec, nsec;
+    size_t rec = 0;
+
+    if (*pcap < 0) {
+        memcpy(&magic, blk, 4);
+        *pcap = rawlen >= 4 && magic == PCAP_MAGIC_NSEC;
+        rec = PCAP_FILE_HDR_LEN;
+    }
+
+    printf("%12zu %10zu %10zu", off, rawlen, len);
+    if (*pcap && rec + 8 <= rawlen) {
+        memcpy(&sec, blk + rec, 4);
+        memcpy(&nsec, blk + rec + 4, 4);
+        printf(" %u.%09u", sec, nsec);
+    }
+    printf("\n");
+}
@@ -0,0 +1,518 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * a live dashboard of the capture, like top(1): frames and bytes per
+ * second, the drops of the kernel, of the queues to the output thread and
+ * of the writer of the capture file, the busiest EtherTypes and source
+ * and destination MAC addresses, and a histogram of the frame sizes. The
+ * rates are those since the last redraw, every DASH_REFRESH_MS.
+ *
+ * The workers only bump the counters of struct capmix, see capture.c, as
+ * they do those of capstats.c; the main thread merges those of all the
+ * workers and draws them with ncurses, thus the screen, however slow the
+ * terminal, never slows down the capture.
+ *
+ * The screen is drawn on /dev/tty, not on stdout, which may be a capture
+ * file being written.
+ */
+
+#include <sys/ioctl.h>
+#include <curses.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dash.h"
+
+#define DASH_MAX_ENTRIES    65536   /* of a merged table                */
+#define DASH_HEADER         4       /* rows above the EtherTypes        */
+#define DASH_LINE           37      /* columns of a key's line          */
+
+/* the rows of the size histogram */
+static const struct {
+    unsigned long long lo, hi;
+    const char *name;
+} sizes[DASH_SIZES] = {
+    {0,    64,    "0-63"},
+    {64,   128,   "64-127"},
+    {128,  256,   "128-255"},
+    {256,  512,   "256-511"},
+    {512,  1024,  "512-1023"},
+    {1024, 1536,  "1024-1535"},
+    {1536, ~0ULL, "1536-"},
+};
+
+static const struct {
+    unsigned int type;
+    const char *name;
+} ethertypes[] = {
+    {0x0800, "IPv4"},
+    {0x86dd, "IPv6"},
+    {0x0806, "ARP"},
+    {0x8035, "RARP"},
+    {0x88cc, "LLDP"},
+    {0x8847, "MPLS"},
+    {0x8848, "MPLS multicast"},
+    {0x88f7, "PTP"},
+    {0x888e, "EAPOL"},
+    {0x8863, "PPPoE discovery"},
+    {0x8864, "PPPoE session"},
+    {0x8809, "slow protocols"},
+    {0x88e5, "MACsec"},
+    {0x8906, "FCoE"},
+    {0x22f0, "AVTP"},
+};
+
+static int table_init(struct dash_table *t, unsigned int nslots,
+        int nworkers);
+static void table_merge(struct dash_table *t, const struct capslot *slots,
+        unsigned int nslots, const struct capslot *other);
+static struct dash_entry *table_find(struct dash_table *t, uint64_t key);
+static void table_begin(struct dash_table *t);
+static void table_end(struct dash_table *t);
+static void table_free(struct dash_table *t);
+static int by_rate(const void *a, const void *b);
+static void draw_header(struct dash *d, double secs);
+static void draw_table(struct dash_table *t, int row, int col, int width,
+        int rows, const char *title, int types, double secs);
+static void draw_sizes(struct dash *d, int row, int col, int width,
+        double secs);
+static void key_name(uint64_t key, int types, char *buf, size_t len);
+static void put(int row, int col, int width, const char *fmt, ...);
+static void check_size(struct dash *d);
+static double elapsed(const struct timespec *from, const struct timespec *to);
+
+/*
+ * take over the terminal and draw the first screen. The workers must have
+ * been opened with conf->mix but not started
+ */
+int dash_open(struct dash *d, struct capstats *st)
+{
+    memset(d, 0, sizeof(*d));
+    d->st = st;
+    if ((d->tty = fopen("/dev/tty", "r+")) == NULL) {
+        fprintf(stderr, "ERROR: the dashboard needs a terminal: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    d->now = calloc(1, sizeof(*d->now));
+    d->last = calloc(1, sizeof(*d->last));
+    if (d->now == NULL || d->last == NULL
+            || table_init(&d->smacs, CAPTURE_MACS, st->nworkers) != 0
+            || table_init(&d->dmacs, CAPTURE_MACS, st->nworkers) != 0
+            || table_init(&d->types, CAPTURE_ETHERTYPES,
+                st->nworkers) != 0) {
+        fprintf(stderr, "insufficient memory\n");
+        dash_close(d);
+        return -1;
+    }
+
+    if ((d->screen = newterm(NULL, d->tty, d->tty)) == NULL) {
+        fprintf(stderr, "ERROR: can't draw on terminal %s\n",
+                getenv("TERM") != NULL ? getenv("TERM") : "(no TERM)");
+        dash_close(d);
+        return -1;
+    }
+    cbreak();
+    noecho();
+    nodelay(stdscr, TRUE);
+    keypad(stdscr, TRUE);
+    curs_set(0);
+
+    clock_gettime(CLOCK_MONOTONIC, &d->last_time);
+    dash_draw(d);
+    return 0;
+}
+
+/* to be polled for the keys pressed */
+int dash_fd(const struct dash *d)
+{
+    return d->tty != NULL ? fileno(d->tty) : -1;
+}
+
+/* the keys pressed: 1 if q, to quit */
+int dash_key(struct dash *d)
+{
+    int c;
+
+    while ((c = getch()) != ERR) {
+        if (c == 'q' || c == 'Q')
+            return 1;
+        if (c == KEY_RESIZE)
+            dash_draw(d);
+    }
+    return 0;
+}
+
+/* the counters since the last redraw */
+void dash_draw(struct dash *d)
+{
+    struct capstats *st = d->st;
+    struct capcounters *swap;
+    struct capworker *w;
+    struct timespec t;
+    double secs;
+    int i, half, rows;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    secs = elapsed(&d->last_time, &t);
+    if (secs <= 0)
+        secs = 1e-9;
+
+    capstats_read(st, d->now, &d->know);
+    d->overflows = 0;
+    for (i = 0; st->queues != NULL && i < st->nworkers; i ++)
+        d->overflows += stat_read(&st->queues[i].overflows);
+    d->dropped = st->pcap != NULL ? stat_read(&st->pcap->dropped) : 0;
+
+    table_begin(&d->smacs);
+    table_begin(&d->dmacs);
+    table_begin(&d->types);
+    for (i = 0; i < st->nworkers; i ++) {
+        w = &st->workers[i];
+        if (w->mix == NULL)
+            continue;
+        table_merge(&d->smacs, w->mix->smacs, CAPTURE_MACS,
+                &w->mix->smac_other);
+        table_merge(&d->dmacs, w->mix->dmacs, CAPTURE_MACS,
+                &w->mix->dmac_other);
+        table_merge(&d->types, w->mix->types, CAPTURE_ETHERTYPES,
+                &w->mix->type_other);
+    }
+    table_end(&d->smacs);
+    table_end(&d->dmacs);
+    table_end(&d->types);
+
+    check_size(d);
+    half = COLS / 2;
+    erase();
+    draw_header(d, secs);
+    draw_table(&d->types, DASH_HEADER, 0, half, DASH_SIZES, "ETHERTYPE",
+            1, secs);
+    draw_sizes(d, DASH_HEADER, half, COLS - half, secs);
+    rows = LINES - DASH_HEADER - DASH_SIZES - 3;
+    draw_table(&d->smacs, DASH_HEADER + DASH_SIZES + 2, 0, half, rows,
+            "SOURCE MAC", 0, secs);
+    draw_table(&d->dmacs, DASH_HEADER + DASH_SIZES + 2, half, COLS - half,
+            rows, "DESTINATION MAC", 0, secs);
+    refresh();
+
+    swap = d->last;
+    d->last = d->now;
+    d->now = swap;
+    d->klast = d->know;
+    d->last_overflows = d->overflows;
+    d->last_dropped = d->dropped;
+    d->last_time = t;
+}
+
+/* give the terminal back, before anything more is printed */
+void dash_close(struct dash *d)
+{
+    if (d->screen != NULL) {
+        endwin();
+        delscreen(d->screen);
+        d->screen = NULL;
+    }
+    if (d->tty != NULL) {
+        fclose(d->tty);
+        d->tty = NULL;
+    }
+    free(d->now);
+    free(d->last);
+    d->now = d->last = NULL;
+    table_free(&d->smacs);
+    table_free(&d->dmacs);
+    table_free(&d->types);
+}
+
+/* room for the keys of nslots slots in each of the workers */
+static int table_init(struct dash_table *t, unsigned int nslots,
+        int nworkers)
+{
+    unsigned long long n = 2ULL * nslots * (nworkers > 0 ? nworkers : 1);
+
+    t->size = 1;
+    while (t->size < n && t->size < DASH_MAX_ENTRIES)
+        t->size <<= 1;
+    t->entries = calloc(t->size, sizeof(*t->entries));
+    t->sorted = calloc(t->size, sizeof(*t->sorted));
+    if (t->entries == NULL || t->sorted == NULL)
+        return -1;
+    return 0;
+}
+
+/* the counts of the slots of a worker added to their entries */
+static void table_merge(struct dash_table *t, const struct capslot *slots,
+        unsigned int nslots, const struct capslot *other)
+{
+    struct dash_entry *e;
+    uint64_t key;
+    unsigned int i;
+
+    for (i = 0; i < nslots; i ++) {
+        key = __atomic_load_n(&slots[i].key, __ATOMIC_RELAXED);
+        if (key == 0)
+            continue;
+        e = table_find(t, key);
+        e->frames += stat_read(&slots[i].frames);
+        e->bytes += stat_read(&slots[i].bytes);
+    }
+    t->other.frames += stat_read(&other->frames);
+    t->other.bytes += stat_read(&other->bytes);
+}
+
+/* the entry of key, a free one if it has none, other if none is free */
+static struct dash_entry *table_find(struct dash_table *t, uint64_t key)
+{
+    struct dash_entry *e;
+    unsigned int h, i;
+
+    h = (key * 0x9e3779b97f4a7c15ULL) >> 40;
+    for (i = 0; i < t->size; i ++) {
+        e = &t->entries[(h + i) & (t->size - 1)];
+        if (e->key == 0)
+            e->key = key;
+        if (e->key == key)
+            return e;
+    }
+    return &t->other;
+}
+
+/* keep the counts of the last redraw in the deltas while counting anew */
+static void table_begin(struct dash_table *t)
+{
+    unsigned int i;
+
+    for (i = 0; i < t->size; i ++) {
+        t->entries[i].dframes = t->entries[i].frames;
+        t->entries[i].dbytes = t->entries[i].bytes;
+        t->entries[i].frames = t->entries[i].bytes = 0;
+    }
+    t->other.dframes = t->other.frames;
+    t->other.dbytes = t->other.bytes;
+    t->other.frames = t->other.bytes = 0;
+}
+
+/* the deltas, and the keys sorted by them */
+static void table_end(struct dash_table *t)
+{
+    struct dash_entry *e;
+    unsigned int i;
+
+    t->nsorted = 0;
+    for (i = 0; i < t->size; i ++) {
+        e = &t->entries[i];
+        if (e->key == 0)
+            continue;
+        e->dframes = e->frames - e->dframes;
+        e->dbytes = e->bytes - e->dbytes;
+        t->sorted[t->nsorted ++] = e;
+    }
+    t->other.dframes = t->other.frames - t->other.dframes;
+    t->other.dbytes = t->other.bytes - t->other.dbytes;
+    qsort(t->sorted, t->nsorted, sizeof(*t->sorted), by_rate);
+}
+
+static void table_free(struct dash_table *t)
+{
+    free(t->entries);
+    free(t->sorted);
+    t->entries = NULL;
+    t->sorted = NULL;
+}
+
+/* the busiest since the last redraw first, then those of most frames */
+static int by_rate(const void *a, const void *b)
+{
+    const struct dash_entry *x = *(const struct dash_entry **)a;
+    const struct dash_entry *y = *(const struct dash_entry **)b;
+
+    if (x->dframes != y->dframes)
+        return x->dframes < y->dframes ? 1 : -1;
+    if (x->frames != y->frames)
+        return x->frames < y->frames ? 1 : -1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+/* the interfaces, the rates, the totals and the drops */
+static void draw_header(struct dash *d, double secs)
+{
+    const struct capconf *conf = d->st->conf;
+    struct capcounters *now = d->now, *last = d->last;
+    char ifs[256];
+    size_t n = 0;
+    long up;
+    int i;
+
+    ifs[0] = '\0';
+    for (i = 0; i < conf->nifs && n < sizeof(ifs) - 1; i ++) {
+        n += snprintf(ifs + n, sizeof(ifs) - n, "%s%s", i > 0 ? " " : "",
+                conf->ifs[i].name);
+    }
+    up = (long)elapsed(&d->st->start, &d->last_time) + (long)secs;
+
+    attron(A_BOLD);
+    put(0, 0, COLS, "ethercap %s", ifs);
+    attroff(A_BOLD);
+    put(0, COLS > 30 ? COLS - 30 : 0, 30, "up %02ld:%02ld:%02ld  q to quit",
+            up / 3600, up / 60 % 60, up % 60);
+    put(1, 0, COLS, "%.0f frames/s  %.2f Mbit/s  %.0f bytes/frame    "
+            "total %llu frames %llu bytes",
+            (now->frames - last->frames) / secs,
+            (now->bytes - last->bytes) * 8 / secs / 1e6,
+            now->frames > last->frames ? (double)(now->bytes - last->bytes)
+            / (now->frames - last->frames) : 0.0, now->frames, now->bytes);
+    put(2, 0, COLS, "drops/s: kernel %.0f  ring full %.0f  queues %.0f  "
+            "writer %.0f    total %llu %llu %llu %llu",
+            (d->know.drops - d->klast.drops) / secs,
+            (d->know.freezes - d->klast.freezes) / secs,
+            (d->overflows - d->last_overflows) / secs,
+            (d->dropped - d->last_dropped) / secs,
+            d->know.drops, d->know.freezes, d->overflows, d->dropped);
+}
+
+/* the busiest keys of a table, as many as fit in rows below the title */
+static void draw_table(struct dash_table *t, int row, int col, int width,
+        int rows, const char *title, int types, double secs)
+{
+    struct dash_entry *e;
+    char name[32];
+    unsigned int i;
+    int shown;
+
+    if (rows < 1)
+        return;
+    attron(A_REVERSE);
+    put(row ++, col, width - 1, "%-17s %9s %9s%*s", title, "frames/s",
+            "Mbit/s", width, "");
+    attroff(A_REVERSE);
+
+    /* the last row for the keys not counted apart, if any */
+    shown = t->other.frames > 0 ? rows - 1 : rows;
+    for (i = 0; i < t->nsorted && (int)i < shown; i ++) {
+        e = t->sorted[i];
+        key_name(e->key, types, name, sizeof(name));
+        put(row ++, col, width - 1, "%-17s %9.0f %9.2f", name,
+                e->dframes / secs, e->dbytes * 8 / secs / 1e6);
+    }
+    if (t->other.frames > 0 && rows > 0) {
+        put(row, col, width - 1, "%-17s %9.0f %9.2f", "(other)",
+                t->other.dframes / secs, t->other.dbytes * 8 / secs / 1e6);
+    }
+}
+
+/* the frames of each size since the last redraw, as bars */
+static void draw_sizes(struct dash *d, int row, int col, int width,
+        double secs)
+{
+    struct hist diff;
+    unsigned long long n[DASH_SIZES], max = 0;
+    char bar[256];
+    int i, len, barlen = width - 21;
+
+    if (barlen > (int)sizeof(bar) - 1)
+        barlen = sizeof(bar) - 1;
+    hist_diff(&diff, &d->now->sizes, &d->last->sizes);
+    for (i = 0; i < DASH_SIZES; i ++) {
+        n[i] = hist_range(&diff, sizes[i].lo, sizes[i].hi);
+        if (n[i] > max)
+            max = n[i];
+    }
+
+    attron(A_REVERSE);
+    put(row ++, col, width, "%-9s %9s%*s", "SIZE", "frames/s", width, "");
+    attroff(A_REVERSE);
+    for (i = 0; i < DASH_SIZES; i ++) {
+        len = barlen > 0 && max > 0 ? (int)(n[i] * barlen / max) : 0;
+        if (len == 0 && n[i] > 0 && barlen > 0)
+            len = 1;
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        put(row ++, col, width, "%-9s %9.0f %s", sizes[i].name,
+                n[i] / secs, bar);
+    }
+}
+
+/* the address of a MAC key, the name of an EtherType key */
+static void key_name(uint64_t key, int types, char *buf, size_t len)
+{
+    unsigned int type, i;
+
+    if (!types) {
+        snprintf(buf, len, "%02x:%02x:%02x:%02x:%02x:%02x",
+                (unsigned int)(key >> 40) & 0xff,
+                (unsigned int)(key >> 32) & 0xff,
+                (unsigned int)(key >> 24) & 0xff,
+                (unsigned int)(key >> 16) & 0xff,
+                (unsigned int)(key >> 8) & 0xff, (unsigned int)key & 0xff);
+        return;
+    }
+
+    type = key - 1;
+    if (type == 0) {
+        snprintf(buf, len, "802.3/LLC");
+        return;
+    }
+    for (i = 0; i < sizeof(ethertypes) / sizeof(ethertypes[0]); i ++) {
+        if (ethertypes[i].type == type) {
+            snprintf(buf, len, "%s", ethertypes[i].name);
+            return;
+        }
+    }
+    snprintf(buf, len, "0x%04x", type);
+}
+
+/* at most width columns at row, col */
+static void put(int row, int col, int width, const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+
+    if (row >= LINES || col >= COLS || width <= 0)
+        return;
+    if (width > COLS - col)
+        width = COLS - col;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    mvaddnstr(row, col, buf, width);
+}
+
+/* follow the size of the terminal if it has changed */
+static void check_size(struct dash *d)
+{
+    struct winsize ws;
+
+    if (ioctl(fileno(d->tty), TIOCGWINSZ, &ws) != 0 || ws.ws_row == 0)
+        return;
+    if (ws.ws_row != d->rows || ws.ws_col != d->cols) {
+        d->rows = ws.ws_row;
+        d->cols = ws.ws_col;
+        resizeterm(ws.ws_row, ws.ws_col);
+    }
+}
+
+static double elapsed(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec)
+        + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
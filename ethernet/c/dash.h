@@ -0,0 +1,77 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DASH_HD
+#define DASH_HD
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "capstats.h"
+
+#define DASH_REFRESH_MS     1000    /* between redraws                  */
+#define DASH_SIZES          7       /* rows of the size histogram       */
+
+/* the counts of a key over all the workers, at this and the last redraw */
+struct dash_entry {
+    uint64_t key;               /* as in struct capslot, 0 if free     */
+    unsigned long long frames;
+    unsigned long long bytes;
+    unsigned long long dframes; /* since the last redraw               */
+    unsigned long long dbytes;
+};
+
+/* the slots of a table of all the workers merged */
+struct dash_table {
+    struct dash_entry *entries;
+    unsigned int size;          /* a power of 2                        */
+    struct dash_entry other;    /* keys that found no entry            */
+    struct dash_entry **sorted; /* busiest first                       */
+    unsigned int nsorted;
+};
+
+struct screen;
+
+/* a screen of live counters on the terminal, redrawn by the main thread */
+struct dash {
+    struct capstats *st;
+    FILE *tty;
+    struct screen *screen;
+    unsigned short rows;        /* of the terminal at the last redraw  */
+    unsigned short cols;
+    struct timespec last_time;  /* of the last redraw                  */
+    struct capcounters *now;    /* too big for the stack               */
+    struct capcounters *last;
+    struct capkstats know;
+    struct capkstats klast;
+    unsigned long long overflows;       /* of the output queues         */
+    unsigned long long last_overflows;
+    unsigned long long dropped;         /* by the writer of the file    */
+    unsigned long long last_dropped;
+    struct dash_table smacs;
+    struct dash_table dmacs;
+    struct dash_table types;
+};
+
+int dash_open(struct dash *d, struct capstats *st);
+int dash_fd(const struct dash *d);
+int dash_key(struct dash *d);
+void dash_draw(struct dash *d);
+void dash_close(struct dash *d);
+
+#endif
@@ -0,0 +1,143 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * measure what decoding the headers of a frame costs, see decode.c.
+ *
+ * usage:
+ *
+ *      decbench [-n rounds] file
+ *
+ * The frames of a pcap or pcapng file, as ethercap -r replays them, are
+ * loaded once and decoded rounds times over (default 100), so that the
+ * time is that of the decoder and not of the disk. Prints the time per
+ * frame and how many frames have each layer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decode.h"
+#include "pcapread.h"
+
+#define DEFAULT_ROUNDS      100
+
+static void usage(char *prog);
+static long long elapsed_ns(const struct timespec *a,
+        const struct timespec *b);
+
+static const char *layer_names[] = {
+    "eth", "vlan", "arp", "ipv4", "ipv6", "tcp", "udp", "icmp",
+    "fragment", "truncated"
+};
+
+int main(int argc, char *argv[])
+{
+    struct pcapread rd;
+    struct capframe frame, *frames = NULL, *more;
+    struct decoded d;
+    struct timespec start, end;
+    unsigned long long layers[10] = {0}, sum = 0;
+    size_t n = 0, cap = 0, i;
+    long rounds = DEFAULT_ROUNDS, r;
+    long long ns;
+    int c, rc, b;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+            case 'n':
+                rounds = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || rounds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (pcapread_open(&rd, argv[optind]) != 0)
+        return 1;
+    while ((rc = pcapread_next(&rd, &frame)) == 1) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 4096;
+            if ((more = realloc(frames, cap * sizeof(*frames))) == NULL) {
+                fprintf(stderr, "insufficient memory\n");
+                rc = -1;
+                break;
+            }
+            frames = more;
+        }
+        frames[n ++] = frame;
+    }
+    if (rc < 0 || n == 0) {
+        if (rc == 0)
+            fprintf(stderr, "ERROR: %s has no frames\n", argv[optind]);
+        free(frames);
+        pcapread_close(&rd);
+        return 1;
+    }
+
+    for (i = 0; i < n; i ++) {
+        if (decode_frame(&d, frames[i].data, frames[i].caplen) != 0)
+            continue;
+        for (b = 0; b < 10; b ++)
+            layers[b] += (d.layers >> b) & 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r ++) {
+        for (i = 0; i < n; i ++) {
+            decode_frame(&d, frames[i].data, frames[i].caplen);
+            /* use the result, or the compiler may not decode at all */
+            sum += d.layers + d.sport + d.paylen;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = elapsed_ns(&start, &end);
+
+    printf("%zu frames x %ld rounds in %lld.%09lld s: %.1f ns per frame "
+            "(%llx)\n", n, rounds, ns / 1000000000LL, ns % 1000000000LL,
+            (double)ns / ((double)n * rounds), sum & 0xff);
+    for (b = 0; b < 10; b ++) {
+        if (layers[b] > 0)
+            printf("  %-10s %10llu %5.1f%%\n", layer_names[b], layers[b],
+                    100.0 * layers[b] / n);
+    }
+
+    free(frames);
+    pcapread_close(&rd);
+    return 0;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-n rounds] file\n", prog);
+}
+
+static long long elapsed_ns(const struct timespec *a,
+        const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000000LL
+        + (b->tv_nsec - a->tv_nsec);
+}
@@ -0,0 +1,293 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * decode the headers of a frame in one pass, from the Ethernet header
+ * down to TCP, UDP or ICMP, without copying anything: the result is a
+ * set of pointers into the frame and the few fields every stage wants,
+ * e.g., the EtherType after the VLAN tags, the IP protocol after the
+ * IPv6 extension headers and the ports.
+ *
+ * Understood are Ethernet II, 802.1Q and 802.1ad (QinQ) tags, ARP, IPv4
+ * with options, IPv6 with the hop-by-hop, routing, fragment and
+ * destination options headers, TCP, UDP and ICMP(v6), and the ports of
+ * SCTP. The frames are those of the wire and may be anything: every
+ * length is checked against what was captured, and decoding stops at the
+ * first header that does not fit, with DECODE_TRUNCATED set and what was
+ * decoded so far kept. Fragments other than the first have no transport
+ * header to decode.
+ *
+ * Used by the flow table, the top talkers and the text output of
+ * ethercap. See decbench.c for what it costs per frame.
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "decode.h"
+
+#define ETH_HLEN            14
+#define ARP_HLEN            8
+
+static int decode_l3(struct decoded *d, const uint8_t *p, unsigned int n);
+static int decode_ipv4(struct decoded *d, const uint8_t *p, unsigned int n);
+static int decode_ipv6(struct decoded *d, const uint8_t *p, unsigned int n);
+static int decode_l4(struct decoded *d, const uint8_t *p, unsigned int n);
+
+/*
+ * decode the caplen bytes at data. Returns 0, or -1 if there is not even
+ * an Ethernet header. A header that is cut short is not an error: its
+ * layer is left out and DECODE_TRUNCATED set.
+ */
+int decode_frame(struct decoded *d, const uint8_t *data, unsigned int caplen)
+{
+    unsigned int off = ETH_HLEN;
+
+    memset(d, 0, sizeof(*d));
+    if (caplen < ETH_HLEN)
+        return -1;
+
+    d->layers = DECODE_ETH;
+    d->dmac = data;
+    d->smac = data + 6;
+    d->ethertype = decode_be16(data + 12);
+    while (d->ethertype == ETHERTYPE_VLAN_
+            || d->ethertype == ETHERTYPE_QINQ_) {
+        if (off + 4 > caplen) {
+            d->layers |= DECODE_TRUNCATED;
+            break;
+        }
+        if (d->nvlans < DECODE_MAX_VLANS)
+            d->vlans[d->nvlans ++] = decode_be16(data + off);
+        d->ethertype = decode_be16(data + off + 2);
+        d->layers |= DECODE_VLAN;
+        off += 4;
+    }
+
+    d->payload = data + off;
+    d->paylen = caplen - off;
+    if (decode_l3(d, data + off, caplen - off) != 0)
+        d->layers |= DECODE_TRUNCATED;
+    return 0;
+}
+
+/* one line: tags, addresses, protocol and ports */
+void decode_print(const struct decoded *d, FILE *fp)
+{
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    int af = d->addrlen == 16 ? AF_INET6 : AF_INET;
+    int i;
+
+    for (i = 0; i < d->nvlans; i ++)
+        fprintf(fp, "vlan %u ", d->vlans[i] & 0x0fff);
+    if (d->src != NULL) {
+        inet_ntop(af, d->src, src, sizeof(src));
+        inet_ntop(af, d->dst, dst, sizeof(dst));
+    }
+
+    if (d->layers & DECODE_ARP) {
+        fprintf(fp, "arp %s %s > %s", d->arpop == 1 ? "request"
+                : d->arpop == 2 ? "reply" : "op", src, dst);
+    } else if (d->layers & (DECODE_IPV4 | DECODE_IPV6)) {
+        fprintf(fp, "%s ", d->layers & DECODE_IPV4 ? "ip" : "ip6");
+        if (d->sport != 0 || d->dport != 0)
+            fprintf(fp, "%s.%u > %s.%u", src, d->sport, dst, d->dport);
+        else
+            fprintf(fp, "%s > %s", src, dst);
+
+        if (d->layers & DECODE_TCP) {
+            fprintf(fp, " tcp flags 0x%02x", d->tcpflags);
+        } else if (d->layers & DECODE_UDP) {
+            fprintf(fp, " udp");
+        } else if (d->layers & DECODE_ICMP) {
+            fprintf(fp, " icmp %u/%u", d->icmptype, d->icmpcode);
+        } else if (d->proto == IPPROTO_TCP_) {
+            fprintf(fp, " tcp");
+        } else if (d->proto == IPPROTO_UDP_) {
+            fprintf(fp, " udp");
+        } else {
+            fprintf(fp, " proto %u", d->proto);
+        }
+        if (d->layers & DECODE_FRAGMENT)
+            fprintf(fp, " fragment");
+        fprintf(fp, " ttl %u", d->ttl);
+    } else {
+        fprintf(fp, "ethertype 0x%04x", d->ethertype);
+    }
+
+    fprintf(fp, " payload %u%s\n", d->paylen,
+            d->layers & DECODE_TRUNCATED ? " truncated" : "");
+}
+
+static int decode_l3(struct decoded *d, const uint8_t *p, unsigned int n)
+{
+    switch (d->ethertype) {
+        case ETHERTYPE_IPV4_:
+            return decode_ipv4(d, p, n);
+        case ETHERTYPE_IPV6_:
+            return decode_ipv6(d, p, n);
+        case ETHERTYPE_ARP_:
+            /* Ethernet and IPv4 only, the others have no use here */
+            if (n < ARP_HLEN + 20)
+                return -1;
+            if (decode_be16(p) != 1 || decode_be16(p + 2) != ETHERTYPE_IPV4_
+                    || p[4] != 6 || p[5] != 4)
+                return 0;
+            d->layers |= DECODE_ARP;
+            d->l3 = p;
+            d->l3len = ARP_HLEN + 20;
+            d->arpop = decode_be16(p + 6);
+            d->src = p + ARP_HLEN + 6;
+            d->dst = p + ARP_HLEN + 16;
+            d->addrlen = 4;
+            d->payload = p + d->l3len;
+            d->paylen = n - d->l3len;
+            return 0;
+    }
+    return 0;
+}
+
+static int decode_ipv4(struct decoded *d, const uint8_t *p, unsigned int n)
+{
+    unsigned int hl, total;
+
+    if (n < 20)
+        return -1;
+    if ((p[0] >> 4) != 4 || (hl = (p[0] & 0x0f) * 4) < 20)
+        return 0;
+    if (hl > n)
+        return -1;
+
+    d->layers |= DECODE_IPV4;
+    d->l3 = p;
+    d->l3len = hl;
+    d->ttl = p[8];
+    d->proto = p[9];
+    d->src = p + 12;
+    d->dst = p + 16;
+    d->addrlen = 4;
+
+    /* the payload ends where the datagram does, not at the padding */
+    total = decode_be16(p + 2);
+    if (total >= hl && total < n)
+        n = total;
+    d->payload = p + hl;
+    d->paylen = n - hl;
+
+    /* the transport header is in the first fragment only */
+    if ((decode_be16(p + 6) & 0x1fff) != 0) {
+        d->layers |= DECODE_FRAGMENT;
+        return 0;
+    }
+    return decode_l4(d, p + hl, n - hl);
+}
+
+static int decode_ipv6(struct decoded *d, const uint8_t *p, unsigned int n)
+{
+    unsigned int off = 40, len, plen;
+    uint8_t nh;
+
+    if (n < 40)
+        return -1;
+    if ((p[0] >> 4) != 6)
+        return 0;
+
+    d->layers |= DECODE_IPV6;
+    d->l3 = p;
+    d->ttl = p[7];
+    d->src = p + 8;
+    d->dst = p + 24;
+    d->addrlen = 16;
+    plen = decode_be16(p + 4);
+    if (plen != 0 && 40 + plen < n)
+        n = 40 + plen;
+
+    nh = p[6];
+    while (nh == IPPROTO_HOPOPTS_ || nh == IPPROTO_ROUTING_
+            || nh == IPPROTO_DSTOPTS_ || nh == IPPROTO_FRAGMENT_) {
+        if (off + 8 > n)
+            break;
+        len = nh == IPPROTO_FRAGMENT_ ? 8 : (p[off + 1] + 1) * 8u;
+        if (nh == IPPROTO_FRAGMENT_ && (decode_be16(p + off + 2) & 0xfff8))
+            d->layers |= DECODE_FRAGMENT;
+        nh = p[off];
+        off += len;
+        /* what follows a fragment header of a later fragment is data */
+        if (off > n || (d->layers & DECODE_FRAGMENT))
+            break;
+    }
+
+    d->proto = nh;
+    d->l3len = off < n ? off : n;
+    d->payload = p + d->l3len;
+    d->paylen = n - d->l3len;
+    if (off > n)
+        return -1;
+    if (d->layers & DECODE_FRAGMENT)
+        return 0;
+    return decode_l4(d, p + off, n - off);
+}
+
+static int decode_l4(struct decoded *d, const uint8_t *p, unsigned int n)
+{
+    unsigned int hl;
+
+    switch (d->proto) {
+        case IPPROTO_TCP_:
+        case IPPROTO_UDP_:
+        case IPPROTO_SCTP_:
+            /* the ports come first, and are kept if the rest is cut */
+            if (n < 4)
+                return -1;
+            d->sport = decode_be16(p);
+            d->dport = decode_be16(p + 2);
+            if (d->proto == IPPROTO_SCTP_)
+                return n < 12 ? -1 : 0;     /* the chunks are payload */
+            if (d->proto == IPPROTO_UDP_) {
+                if ((hl = 8) > n)
+                    return -1;
+                d->layers |= DECODE_UDP;
+                break;
+            }
+            if (n < 20 || (hl = (p[12] >> 4) * 4) > n)
+                return -1;
+            if (hl < 20)
+                return 0;
+            d->layers |= DECODE_TCP;
+            d->tcpflags = p[13];
+            break;
+        case IPPROTO_ICMP_:
+        case IPPROTO_ICMPV6_:
+            /* type, code and checksum, the rest depends on the type */
+            if (n < 4)
+                return -1;
+            hl = 4;
+            d->layers |= DECODE_ICMP;
+            d->icmptype = p[0];
+            d->icmpcode = p[1];
+            break;
+        default:
+            return 0;
+    }
+
+    d->l4 = p;
+    d->l4len = hl;
+    d->payload = p + hl;
+    d->paylen = n - hl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECODE_HD
+#define DECODE_HD
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capframe.h"
+
+#define DECODE_MAX_VLANS    2       /* 802.1Q, or 802.1ad and 802.1Q   */
+
+/* the layers a frame was decoded to */
+#define DECODE_ETH          0x0001
+#define DECODE_VLAN         0x0002
+#define DECODE_ARP          0x0004
+#define DECODE_IPV4         0x0008
+#define DECODE_IPV6         0x0010
+#define DECODE_TCP          0x0020
+#define DECODE_UDP          0x0040
+#define DECODE_ICMP         0x0080  /* ICMP or ICMPv6                  */
+#define DECODE_FRAGMENT     0x0100  /* IP fragment other than the first */
+#define DECODE_TRUNCATED    0x0200  /* a header was cut short          */
+
+#define ETHERTYPE_IPV4_     0x0800
+#define ETHERTYPE_ARP_      0x0806
+#define ETHERTYPE_VLAN_     0x8100
+#define ETHERTYPE_IPV6_     0x86dd
+#define ETHERTYPE_QINQ_     0x88a8
+
+#define IPPROTO_HOPOPTS_    0
+#define IPPROTO_ICMP_       1
+#define IPPROTO_TCP_        6
+#define IPPROTO_UDP_        17
+#define IPPROTO_ROUTING_    43
+#define IPPROTO_FRAGMENT_   44
+#define IPPROTO_ICMPV6_     58
+#define IPPROTO_DSTOPTS_    60
+#define IPPROTO_SCTP_       132
+
+/*
+ * views of the headers of a frame. The pointers point into the frame
+ * itself, nothing is copied, and are valid as long as the frame is.
+ * Headers are at any alignment: read multibyte fields with decode_be16()
+ * and decode_be32(). The numbers are in host order.
+ */
+struct decoded {
+    unsigned int layers;        /* DECODE_*                            */
+    const uint8_t *dmac;
+    const uint8_t *smac;
+    uint16_t ethertype;         /* after the VLAN tags                 */
+    uint8_t nvlans;
+    uint16_t vlans[DECODE_MAX_VLANS];   /* TCI, the outer first        */
+    const uint8_t *l3;          /* ARP, IPv4 or IPv6 header            */
+    unsigned int l3len;         /* IP headers and extension headers    */
+    const uint8_t *src;         /* IP or ARP sender protocol address   */
+    const uint8_t *dst;
+    uint8_t addrlen;            /* 4 or 16                             */
+    uint8_t proto;              /* IP protocol, after the extensions   */
+    uint8_t ttl;                /* or hop limit                        */
+    uint16_t arpop;
+    const uint8_t *l4;          /* TCP, UDP or ICMP header             */
+    unsigned int l4len;
+    uint16_t sport;             /* TCP, UDP or SCTP, even if cut short */
+    uint16_t dport;
+    uint8_t tcpflags;
+    uint8_t icmptype;
+    uint8_t icmpcode;
+    const uint8_t *payload;     /* after the last header decoded       */
+    unsigned int paylen;        /* bytes captured of the payload       */
+};
+
+static inline uint16_t decode_be16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t decode_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | p[3];
+}
+
+int decode_frame(struct decoded *d, const uint8_t *data,
+        unsigned int caplen);
+void decode_print(const struct decoded *d, FILE *fp);
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * drop the frames seen twice, as a SPAN port, or a tap on both sides of
+ * a router, sends them: once as they come in and once as they go out.
+ *
+ * An IP frame is known by a 64-bit hash of its IP packet and its length,
+ * but for the fields a hop changes: the IPv4 TTL and header checksum, the
+ * IPv6 hop limit and the TCP, UDP or ICMP checksum, which are hashed as 0.
+ * The Ethernet header, any VLAN tags and any padding are left out, as a
+ * router gives the packet new MAC addresses and may give it another VLAN.
+ * Other frames are hashed whole. A frame whose hash has been seen within
+ * the window before or after it is a duplicate. The window is to be no
+ * longer than it takes the same frame to be sent again, e.g., by TCP
+ * retransmission.
+ *
+ * The frames seen are kept by hash in buckets of DEDUP_WAYS, the size of
+ * a cache line, and a new frame takes the place of the oldest in its
+ * bucket. A duplicate is thus found in a single cache line, and the set
+ * takes no more memory however fast the frames come, at the cost of
+ * missing the duplicates of frames forgotten within the window. Those
+ * are counted: if many are, the buckets are too few for the rate of
+ * frames. Time is that of the frames, so replaying a file drops the same
+ * frames every time.
+ *
+ * A set belongs to one thread.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "decode.h"
+#include "dedup.h"
+#include "hist.h"
+
+static uint64_t hash_frame(const struct capframe *frame);
+static uint64_t hash_bytes(const uint8_t *p, unsigned int n, uint64_t h);
+static void zero(uint8_t *p, unsigned int off, unsigned int n,
+        unsigned int len);
+
+/* a set of nbuckets, rounded up to a power of 2, of DEDUP_WAYS frames */
+int dedup_init(struct dedup *d, uint32_t nbuckets, unsigned int window_us)
+{
+    memset(d, 0, sizeof(*d));
+    if (nbuckets == 0 || nbuckets > (1u << 24)) {
+        fprintf(stderr, "ERROR: dedup buckets must be 1 to %u\n", 1u << 24);
+        return -1;
+    }
+    if (window_us == 0) {
+        fprintf(stderr, "ERROR: dedup window must be at least 1 us\n");
+        return -1;
+    }
+
+    for (d->nbuckets = 1; d->nbuckets < nbuckets; d->nbuckets <<= 1)
+        ;
+    /* a bucket on a cache line of its own */
+    d->entries = aligned_alloc(DEDUP_WAYS * sizeof(*d->entries),
+            (size_t)d->nbuckets * DEDUP_WAYS * sizeof(*d->entries));
+    if (d->entries == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        return -1;
+    }
+    memset(d->entries, 0,
+            (size_t)d->nbuckets * DEDUP_WAYS * sizeof(*d->entries));
+    d->window = window_us * 1000LL;
+    return 0;
+}
+
+/*
+ * 1 if the frame is a duplicate of one seen within the window, else 0,
+ * remembering the frame
+ */
+int dedup_check(struct dedup *d, const struct capframe *frame)
+{
+    struct dedup_entry *b, *oldest;
+    uint64_t hash = hash_frame(frame);
+    int64_t ns = frame->ts.tv_sec * 1000000000LL + frame->ts.tv_nsec, dt;
+    int i;
+
+    stat_add(&d->stats.frames, 1);
+    b = &d->entries[(hash & (d->nbuckets - 1)) * DEDUP_WAYS];
+    oldest = &b[0];
+    for (i = 0; i < DEDUP_WAYS; i ++) {
+        if (b[i].hash == hash && b[i].ns != 0) {
+            /* frames may come out of order across the workers */
+            dt = ns - b[i].ns;
+            if (dt <= d->window && dt >= -d->window) {
+                stat_add(&d->stats.duplicates, 1);
+                stat_add(&d->stats.bytes, frame->len);
+                return 1;
+            }
+            /* seen before the window, take its place */
+            oldest = &b[i];
+            break;
+        }
+        if (b[i].ns < oldest->ns)
+            oldest = &b[i];
+    }
+
+    if (oldest->ns != 0 && ns - oldest->ns <= d->window
+            && oldest->hash != hash)
+        stat_add(&d->stats.evicted, 1);
+    oldest->hash = hash;
+    oldest->ns = ns;
+    return 0;
+}
+
+void dedup_free(struct dedup *d)
+{
+    free(d->entries);
+    d->entries = NULL;
+}
+
+void dedup_report(const struct dedup *d, FILE *fp)
+{
+    unsigned long long frames = stat_read(&d->stats.frames);
+    unsigned long long dups = stat_read(&d->stats.duplicates);
+
+    fprintf(fp, "  dedup: %llu of %llu frames (%.1f%%) %llu bytes dropped "
+            "as duplicates within %lld us, %llu forgotten early in %u "
+            "buckets\n", dups, frames, frames == 0 ? 0 : 100.0 * dups / frames,
+            stat_read(&d->stats.bytes), (long long)d->window / 1000,
+            stat_read(&d->stats.evicted), d->nbuckets);
+}
+
+/*
+ * the IP packet, or the whole frame if it has none. The headers, up to
+ * DEDUP_HEADERS bytes, are copied to have the fields a hop changes
+ * zeroed, the rest is hashed in place
+ */
+static uint64_t hash_frame(const struct capframe *frame)
+{
+    uint8_t hdrs[DEDUP_HEADERS];
+    const uint8_t *p = frame->data;
+    struct decoded d;
+    unsigned int caplen = frame->caplen, len = frame->len, n, l4;
+    uint64_t h;
+
+    if (decode_frame(&d, frame->data, frame->caplen) != 0
+            || !(d.layers & (DECODE_IPV4 | DECODE_IPV6))) {
+        n = caplen < DEDUP_HEADERS ? caplen : DEDUP_HEADERS;
+        memcpy(hdrs, p, n);
+    } else {
+        p = d.l3;
+        caplen -= p - frame->data;
+        /* as long as the IP header says, without the padding */
+        len = d.layers & DECODE_IPV4 ? (p[2] << 8 | p[3])
+            : (p[4] << 8 | p[5]) + 40;
+        /* not that of a GSO aggregate, nor a bogus one */
+        if (len < d.l3len)
+            len = frame->len - (p - frame->data);
+        if (caplen > len)
+            caplen = len;
+        n = caplen < DEDUP_HEADERS ? caplen : DEDUP_HEADERS;
+        memcpy(hdrs, p, n);
+        if (d.layers & DECODE_IPV4) {
+            zero(hdrs, 8, 1, n);
+            zero(hdrs, 10, 2, n);
+        } else {
+            zero(hdrs, 7, 1, n);
+        }
+        l4 = d.l4 != NULL ? d.l4 - p : 0;
+        if (d.layers & DECODE_TCP)
+            zero(hdrs, l4 + 16, 2, n);
+        else if (d.layers & DECODE_UDP)
+            zero(hdrs, l4 + 6, 2, n);
+        else if (d.layers & DECODE_ICMP)
+            zero(hdrs, l4 + 2, 2, n);
+    }
+
+    h = hash_bytes(hdrs, n, len);
+    h = hash_bytes(p + n, caplen - n, h);
+    /* 0 is an empty entry */
+    return h != 0 ? h : 1;
+}
+
+/* mix 8 bytes at a time, see the finalizer of MurmurHash3 */
+static uint64_t hash_bytes(const uint8_t *p, unsigned int n, uint64_t h)
+{
+    uint64_t w;
+    unsigned int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    if (i < n) {
+        w = 0;
+        memcpy(&w, p + i, n - i);
+        h = (h ^ w ^ (uint64_t)(n - i) << 59) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* the n bytes at off, those of them that are within the len copied */
+static void zero(uint8_t *p, unsigned int off, unsigned int n,
+        unsigned int len)
+{
+    for (; n > 0 && off < len; n --, off ++)
+        p[off] = 0;
+}
@@ -0,0 +1,60 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEDUP_HD
+#define DEDUP_HD
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capframe.h"
+
+#define DEDUP_BUCKETS       16384   /* of DEDUP_WAYS frames each       */
+#define DEDUP_WAYS          4       /* 64 bytes, a cache line          */
+#define DEDUP_HEADERS       128     /* bytes with fields to ignore     */
+
+/* a frame seen, by the hash of its bytes, 0 if none */
+struct dedup_entry {
+    uint64_t hash;
+    int64_t ns;                 /* when it was seen                    */
+};
+
+/* counters, updated by the owner of the set only, read with stat_read() */
+struct dedupstats {
+    unsigned long long frames;
+    unsigned long long duplicates;
+    unsigned long long bytes;   /* of the duplicates                   */
+    unsigned long long evicted; /* frames forgotten within the window  */
+};
+
+/*
+ * the frames seen within the last window nanoseconds, in buckets of
+ * DEDUP_WAYS by their hash
+ */
+struct dedup {
+    struct dedup_entry *entries;
+    uint32_t nbuckets;          /* a power of 2                        */
+    int64_t window;
+    struct dedupstats stats;
+};
+
+int dedup_init(struct dedup *d, uint32_t nbuckets, unsigned int window_us);
+int dedup_check(struct dedup *d, const struct capframe *frame);
+void dedup_free(struct dedup *d);
+void dedup_report(const struct dedup *d, FILE *fp);
+
+#endif
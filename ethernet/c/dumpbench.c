@@ -0,0 +1,244 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * measure what dumping a frame as text costs, see dumpbuf() in buffer.c,
+ * against the sprintf per byte and printf per line it used to take.
+ *
+ * usage:
+ *
+ *      dumpbench [-n rounds] file
+ *
+ * The frames of a pcap or pcapng file are loaded once and dumped rounds
+ * times over (default 20) by both to /dev/null, so that the time is that
+ * of the formatting and not of the terminal. First, both dump the frames,
+ * and buffers of every length up to 4 lines of every byte value, into
+ * memory and the text must be the same to the byte.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "pcapread.h"
+
+#define DEFAULT_ROUNDS      20
+#define CHECK_LEN           64      /* lengths of every byte value checked */
+
+static void old_dumpbuf(FILE *fp, char *buf, int nrecv);
+static int check(const unsigned char *buf, size_t len, char *text);
+static void usage(char *prog);
+static long long elapsed_ns(const struct timespec *a,
+        const struct timespec *b);
+
+int main(int argc, char *argv[])
+{
+    struct pcapread rd;
+    struct capframe frame, *frames = NULL, *more;
+    struct timespec start, end;
+    unsigned char bytes[256 + CHECK_LEN];
+    unsigned long long total = 0;
+    size_t n = 0, cap = 0, maxlen = CHECK_LEN, i, j;
+    long rounds = DEFAULT_ROUNDS, r;
+    long long ns_old, ns_new;
+    char *text = NULL;
+    FILE *null = NULL;
+    int c, rc, bad = 0;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+            case 'n':
+                rounds = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || rounds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (pcapread_open(&rd, argv[optind]) != 0)
+        return 1;
+    while ((rc = pcapread_next(&rd, &frame)) == 1) {
+        if (n == cap) {
+            cap = cap ? 2 * cap : 4096;
+            if ((more = realloc(frames, cap * sizeof(*frames))) == NULL) {
+                fprintf(stderr, "insufficient memory\n");
+                rc = -1;
+                break;
+            }
+            frames = more;
+        }
+        frames[n ++] = frame;
+        total += frame.caplen;
+        if (frame.caplen > maxlen)
+            maxlen = frame.caplen;
+    }
+    if (rc < 0 || n == 0) {
+        if (rc == 0)
+            fprintf(stderr, "ERROR: %s has no frames\n", argv[optind]);
+        goto out;
+    }
+    if ((text = malloc(HEXDUMP_SIZE(maxlen))) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        goto out;
+    }
+    if ((null = fopen("/dev/null", "w")) == NULL) {
+        perror("fopen(/dev/null)");
+        goto out;
+    }
+
+    /* the same text for every byte value at every place in a line */
+    for (i = 0; i < sizeof(bytes); i ++)
+        bytes[i] = i;
+    for (i = 0; i < 256; i ++) {
+        for (j = 0; j <= CHECK_LEN; j ++)
+            bad += check(bytes + i, j, text);
+    }
+    for (i = 0; i < n; i ++)
+        bad += check(frames[i].data, frames[i].caplen, text);
+    if (bad > 0) {
+        fprintf(stderr, "ERROR: %d dumps differ\n", bad);
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r ++) {
+        for (i = 0; i < n; i ++)
+            old_dumpbuf(null, (char *)frames[i].data, frames[i].caplen);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns_old = elapsed_ns(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < rounds; r ++) {
+        for (i = 0; i < n; i ++) {
+            fwrite(text, 1, hexdump(text, frames[i].data, frames[i].caplen,
+                        0), null);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns_new = elapsed_ns(&start, &end);
+
+    printf("%zu frames of %.1f bytes x %ld rounds, the same text\n", n,
+            (double)total / n, rounds);
+    printf("  sprintf: %lld.%09lld s, %.1f ns per frame, %.2f ns per byte\n",
+            ns_old / 1000000000LL, ns_old % 1000000000LL,
+            (double)ns_old / ((double)n * rounds),
+            (double)ns_old / ((double)total * rounds));
+    printf("  hexdump: %lld.%09lld s, %.1f ns per frame, %.2f ns per byte\n",
+            ns_new / 1000000000LL, ns_new % 1000000000LL,
+            (double)ns_new / ((double)n * rounds),
+            (double)ns_new / ((double)total * rounds));
+    printf("  %.1f times as fast\n", (double)ns_old / ns_new);
+
+out:
+    if (null != NULL)
+        fclose(null);
+    free(text);
+    free(frames);
+    pcapread_close(&rd);
+    return bad > 0 || rc < 0 || n == 0 || null == NULL;
+}
+
+/* 1 if the text of hexdump() is not that of old_dumpbuf() */
+static int check(const unsigned char *buf, size_t len, char *text)
+{
+    char *old = NULL;
+    size_t oldlen = 0, newlen;
+    FILE *fp;
+    int rc;
+
+    if ((fp = open_memstream(&old, &oldlen)) == NULL) {
+        perror("open_memstream(...)");
+        return 1;
+    }
+    old_dumpbuf(fp, (char *)buf, len);
+    fclose(fp);
+    newlen = hexdump(text, buf, len, 0);
+    rc = newlen != oldlen || memcmp(text, old, oldlen) != 0;
+    free(old);
+    return rc;
+}
+
+/* dumpbuf() as it was */
+static void old_dumpbuf(FILE *fp, char *buf, int nrecv)
+{
+#define LINE_WIDTH        74
+#define INDEX_LEN        4
+#define INDEX_GAP_LEN    2
+#define COLUMN_GAP_LEN    4
+#define HEX_COLUMN_START    (INDEX_LEN + INDEX_GAP_LEN)
+#define HEX_COLUMN_WIDTH    \
+                ((LINE_WIDTH - HEX_COLUMN_START - COLUMN_GAP_LEN)/4*3)
+#define PRINT_COLUMN_START    \
+                (HEX_COLUMN_START + HEX_COLUMN_WIDTH + COLUMN_GAP_LEN)
+#define PRINT_COLUMN_WIDTH    (HEX_COLUMN_WIDTH/3)
+#define    CHAR_PER_LINE    (PRINT_COLUMN_WIDTH)
+            
+    int i = 0, hexpos = 0, printpos = 0;
+    char idxbuf[2*sizeof(int)+1],   /* INDEX_LEN digits, more if need be */
+         hexbuf[HEX_COLUMN_WIDTH+1], 
+         printbuf[PRINT_COLUMN_WIDTH+1];
+
+    sprintf(idxbuf, "%0*d", INDEX_LEN, i);
+    while (nrecv > 0 && i < nrecv) {
+        if (i % CHAR_PER_LINE == 0) {
+            printbuf[printpos] = '\0';
+            hexpos = 0;
+            printpos = 0;
+            if (i > 0)
+                fprintf(fp, "%s%*c%-*s%*c%s\n", idxbuf, INDEX_GAP_LEN, ' ', 
+                        HEX_COLUMN_WIDTH, hexbuf, COLUMN_GAP_LEN,
+                        ' ', printbuf);
+            sprintf(idxbuf, "%0*x", INDEX_LEN, i);
+        }
+        hexpos += sprintf(hexbuf+hexpos, "%02x ", (unsigned char)buf[i]); 
+        if (isprint(buf[i]))
+            printbuf[printpos ++] = buf[i];
+        else
+            printbuf[printpos ++] = '.';
+        i ++;
+    }
+
+    if (nrecv > 0) {
+        printbuf[printpos] = '\0';
+        fprintf(fp, "%s%*c%-*s%*c%s\n", idxbuf, INDEX_GAP_LEN, ' ', 
+                HEX_COLUMN_WIDTH, hexbuf, COLUMN_GAP_LEN, ' ', printbuf);
+    }
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-n rounds] file\n", prog);
+}
+
+static long long elapsed_ns(const struct timespec *a,
+        const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000000LL
+        + (b->tv_nsec - a->tv_nsec);
+}
@@ -17,11 +17,206 @@
 
 /* Description */
 /* 
- * capture ethernet frames on a given network interface. 
+ * capture ethernet frames on the given network interfaces. 
  *
  * usage: 
  *
- *     ethercap ifname
+ *     ethercap [options] ifname [ifname ...]
+ *     ethercap [options] all
+ *     ethercap [options] -r file
+ *
+ * "all" captures on every interface that is up, as listed by rtnetlink(7).
+ * Each worker has a socket per interface and waits for them by epoll(7),
+ * and every frame is tagged with the interface it came in on.
+ *
+ * -r replays the frames of a pcap or pcapng file, compressed or not,
+ * instead, through the same filter, counters, queues and output as
+ * captured frames, and exits at the end of the file. No privilege is
+ * needed to replay.
+ *
+ * options:
+ *
+ *     -B, --batch N            receive up to N frames per recvmmsg(2) call
+ *                              (default 32), see rxbatch.c
+ *     -R, --ring               receive frames from a TPACKET_V3 memory-mapped
+ *                              ring instead of calling recvmmsg(2)
+ *     -b, --block-size KiB     size of a ring block (default 1024)
+ *     -n, --blocks N           number of ring blocks (default 64)
+ *     -t, --block-timeout ms   hand a partially filled block to us after
+ *                              this many milliseconds (default 64)
+ *     -F, --workers N          capture with N threads, each with a socket
+ *                              of its own and pinned to a CPU of its own.
+ *                              The sockets join one PACKET_FANOUT group.
+ *     -m, --fanout mode        how the kernel spreads frames across the
+ *                              workers: hash (default), cpu, rr (or lb,
+ *                              as the kernel calls it), hash-rollover, by
+ *                              flow but moving on from a socket that falls
+ *                              behind, or qm
+ *     -w, --write file         write the frames to file ("-" for stdout)
+ *                              instead of dumping them as text
+ *     -o, --format fmt         format of the file: pcap (default) or pcapng,
+ *                              both with nanosecond timestamps
+ *     -C, --file-size MB       move on to a new file once the file has MB
+ *                              megabytes. The files are named file.0,
+ *                              file.1, ...
+ *     -G, --file-time secs     move on to a new file once the file covers
+ *                              secs seconds of frames
+ *     -W, --file-count N       keep only the last N files of -C or -G,
+ *                              removing the oldest when a new one is begun
+ *     -z, --compress           compress the file as it is written, in blocks
+ *                              that can be read on their own, see lzblk.c
+ *                              and capzcat.c. The reports show the ratio
+ *                              and how fast it goes. -C counts the bytes
+ *                              before compression.
+ *     -x, --hexdump            dump the frames as text to stdout even when
+ *                              writing them to a file
+ *     -f, --filter expr        capture only the frames that match expr, see
+ *                              filter.c for the expression language, e.g.,
+ *                              "vlan 10 and tcp port 80". The kernel drops
+ *                              the other frames before copying them to us.
+ *                              A replay runs the filter on the frames with
+ *                              their outer tag taken out as the kernel
+ *                              does, so that a capture of tagged frames
+ *                              matches as it did live, e.g.,
+ *
+ *                              ethercap -A -r vlan.pcap \
+ *                                  -f "vlan 10 and tcp port 80"
+ *
+ *                              keeps the frames of VLAN 10 to port 80.
+ *     -d, --dump-filter        print the compiled filter and exit
+ *     -s, --snaplen N          capture at most N bytes of every frame. The
+ *                              kernel truncates the frames by the return
+ *                              value of the filter, so that only N bytes are
+ *                              copied, more frames fit in the socket buffer
+ *                              or the ring, and the capture file records the
+ *                              original length of every frame.
+ *     -S, --headers-only       the same as -s 128: enough for the Ethernet,
+ *                              VLAN, IP and TCP headers
+ *     -L, --flows              aggregate the frames into flows and print a
+ *                              line per flow record instead of the frames,
+ *                              see flow.c. A record is printed when the
+ *                              flow has been idle, has been going on for
+ *                              a while, or at exit.
+ *     -i, --flow-idle secs     idle timeout of a flow (default 15)
+ *     -a, --flow-active secs   a flow going on for longer is reported on
+ *                              every secs seconds (default 60)
+ *     -T, --flow-table N       keep at most N flows at a time (default
+ *                              65536). When full, the flow idle the longest
+ *                              is reported to make room.
+ *     -K, --top N              print the top N talkers by source and
+ *                              destination MAC and IP address, by frames,
+ *                              at exit and every -I seconds, instead of the
+ *                              frames. Each report covers the frames since
+ *                              the last one. The talkers are counted in a
+ *                              fixed number of counters however many
+ *                              addresses there are, see topk.c.
+ *     -k, --top-counters N     counters per address kind (default 1024).
+ *                              An address seen in more than 1 in N frames
+ *                              is sure to be counted.
+ *     -E, --streams dir        put the TCP segments back together into the
+ *                              streams each end sent and write them into a
+ *                              file each in dir, see tcpreasm.c and
+ *                              streams.c, and print a line per connection
+ *                              when it is closed instead of the frames.
+ *                              Bytes never seen are left as holes.
+ *     -M, --stream-memory MB   hold at most MB megabytes of segments that
+ *                              came out of order (default 64)
+ *     -P, --patterns file      keep only the frames whose payload has any of
+ *                              the byte strings of file in it, see
+ *                              acmatch.c for the format. A frame kept has
+ *                              a line with the ids of up to 16 patterns,
+ *                              the lines of the file they are on, in its
+ *                              text dump, or on a line of its own when it
+ *                              is written to a file. At exit, how fast the
+ *                              payloads were scanned is reported, e.g., of
+ *                              a file replayed with -A.
+ *     -D, --dedup usecs        drop the frames that are the same as one
+ *                              seen within usecs microseconds, but for the
+ *                              MAC addresses, the VLAN tags, the TTL and
+ *                              the checksums of IP frames, as a SPAN port
+ *                              sends a frame twice, see dedup.c. The
+ *                              reports show how many frames were dropped,
+ *                              and -r with -A what checking them costs.
+ *     -y, --recorder file      keep the last frames in memory instead of
+ *                              writing them out, and dump them into a file
+ *                              of their own, file.0, file.1, ..., on a
+ *                              trigger: SIGUSR2, a frame matching -c or
+ *                              more frames in a second than -q. The file
+ *                              is written as by -o and -z. See flightrec.c.
+ *     -Y, --recorder-size MB   keep at most MB megabytes of frames (default
+ *                              256), allocated at the start
+ *     -e, --recorder-time secs keep at most the last secs seconds of frames
+ *                              (default as many as fit)
+ *     -j, --hugepages          put the frames kept on hugepages
+ *     -c, --trigger expr       dump the frames kept when one matches expr,
+ *                              in the language of -f. The frames have their
+ *                              VLAN tag back by then and are matched as the
+ *                              kernel would, with the outer tag taken out.
+ *     -q, --trigger-rate N     dump the frames kept when more than N come
+ *                              in a second. After a dump, neither -c nor -q
+ *                              triggers another until the frames of -e, or
+ *                              of 10 seconds, have come in.
+ *     -O, --publish name       publish the frames to the processes on the
+ *                              host that attach to the ring of POSIX
+ *                              shared memory of name, e.g., by shmcat.c,
+ *                              instead of dumping them as text. Each reads
+ *                              at its own pace, and only one socket is
+ *                              copied to, see shmring.c.
+ *     -N, --publish-size MB    frames in the ring (default 64)
+ *     -X, --dashboard          draw a live dashboard on the terminal instead
+ *                              of dumping the frames as text: the frames
+ *                              and bytes per second, the drops, the
+ *                              busiest EtherTypes and MAC addresses and
+ *                              the frame sizes, redrawn every second, see
+ *                              dash.c. q quits. Needs -U with -I.
+ *     -I, --interval secs      every secs seconds, report the frames and bytes
+ *                              per second, the frames the kernel dropped and
+ *                              the distribution of the gaps between frames
+ *                              and of the frame sizes, see capstats.c. Send
+ *                              the process SIGUSR1 for a report at any time.
+ *     -U, --stats-socket path  send the reports to the clients of a Unix
+ *                              domain socket at path instead of to stderr
+ *     -Q, --queue N            hand the frames to the output thread through
+ *                              queues of N frames (default 4096), one per
+ *                              worker. When the output falls behind, frames
+ *                              are dropped from the queues and counted
+ *                              rather than the capture being stalled. 0 to
+ *                              write the frames out in the capture threads.
+ *     -H, --hw-timestamp       timestamp the frames in the NIC if it can,
+ *                              instead of when the kernel receives them
+ *     -V, --vnet-hdr           take the frames with their virtio-net header
+ *                              (PACKET_VNET_HDR) into buffers of 64 KiB, so
+ *                              that the aggregates of GRO and TSO, larger
+ *                              than the MTU, are not truncated. The text
+ *                              dump shows the header: the GSO type and
+ *                              size and the checksum flags.
+ *     -g, --segment            the same as -V, and cut the TCP and UDP
+ *                              aggregates into the frames that were, or
+ *                              will be, on the wire, see gso.c
+ *     -r, --read file          replay the frames of a capture file, paced
+ *                              by their timestamps, instead of capturing
+ *     -A, --fast               replay as fast as possible and report the
+ *                              time taken per frame, e.g., to measure the
+ *                              cost of a filter or of the output
+ *
+ * The files are written by a thread of their own from large buffers, thus
+ * a slow disk never stalls the capture: frames are dropped and counted if
+ * the disk falls too far behind. The reports show how many buffers are
+ * waiting to be written and how long they wait.
+ *
+ * SIGUSR2 dumps the frames kept by -y at any time.
+ *
+ * With -O and no other output, ethercap is a capture daemon for the
+ * readers of the ring, e.g.,
+ *
+ *     ethercap -O eth0 eth0 &
+ *     shmcat eth0 | tcpdump -r -
+ *
+ * Frames dumped as text have a line of their decoded headers, see
+ * decode.c, before their bytes.
+ *
+ * Frames are timestamped in nanoseconds. On exit, the histograms of the
+ * gaps between frames and of the frame sizes are printed in full.
  *
  * The program uses raw socket and requires (1) effective UID 0 (root)
  * privilege or (2) CAP_NET_RAW capability. 
@@ -46,35 +241,181 @@
 
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <netpacket/packet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
-#include "sighandler.h"
+#include "acmatch.h"
 #include "buffer.h"
+#include "capframe.h"
+#include "capstats.h"
+#include "capture.h"
+#include "decode.h"
+#include "dash.h"
+#include "dedup.h"
+#include "flightrec.h"
+#include "flow.h"
+#include "gso.h"
+#include "iflist.h"
+#include "pcapfile.h"
+#include "pcapread.h"
+#include "shmring.h"
+#include "spsc.h"
+#include "streams.h"
+#include "tcpreasm.h"
+#include "topk.h"
+
+#define OUTPUT_BURST    64      /* frames from a queue before the next   */
+#define OUTPUT_IDLE_NS  100000  /* sleep when all the queues are empty   */
+#define OUTPUT_TEXT_HDR 4096    /* text of a frame before its bytes      */
+
+struct cmd_line_args {
+    char **ifnames;
+    int nifs;
+    unsigned int batch;         /* frames per recvmmsg(2)             */
+    int ring;                   /* receive from PACKET_RX_RING        */
+    unsigned int block_size;    /* ring block size in bytes           */
+    unsigned int block_nr;      /* number of ring blocks              */
+    unsigned int block_timeout; /* ring block timeout in milliseconds */
+    int nworkers;               /* number of capture threads          */
+    int fanout_mode;            /* PACKET_FANOUT_* if nworkers > 1    */
+    char *wfile;                /* capture file to write              */
+    int format;                 /* PCAPFILE_*                         */
+    struct pcapfile_opts fopts; /* when to switch files               */
+    int hexdump;                /* dump frames as text                */
+    char *filter;               /* filter expression                  */
+    int dump_filter;            /* print the compiled filter and exit */
+    unsigned int snaplen;       /* bytes to capture, 0 for all        */
+    unsigned int interval;      /* seconds between reports, 0 for none */
+    char *stats_path;           /* stats socket                       */
+    unsigned int queue;         /* frames per output queue, 0 for none */
+    int hwtstamp;               /* timestamps from the NIC            */
+    int vnet;                   /* PACKET_VNET_HDR                    */
+    int segment;                /* cut GSO aggregates into segments   */
+    char *rfile;                /* capture file to replay             */
+    int fast;                   /* replay as fast as possible         */
+    int flows;                  /* aggregate the frames into flows    */
+    unsigned int flow_idle;     /* flow timeouts in seconds           */
+    unsigned int flow_active;
+    unsigned int flow_table;    /* most flows at a time               */
+    unsigned int top;           /* talkers to report, 0 for none      */
+    unsigned int top_counters;  /* sketch counters per address kind   */
+    unsigned int dedup;         /* dedup window in us, 0 for none     */
+    char *streams;              /* directory of the TCP streams       */
+    unsigned int stream_memory; /* MB held out of order               */
+    char *patterns;             /* pattern file                       */
+    char *recorder;             /* where the flight recorder dumps    */
+    unsigned int recorder_size; /* MB of frames kept                  */
+    unsigned int recorder_secs; /* seconds of frames kept, 0 for all  */
+    int hugepages;              /* the frames kept on hugepages       */
+    char *trigger;              /* filter expression of a dump        */
+    unsigned long long trigger_rate; /* frames per second of a dump   */
+    char *publish;              /* shared memory to publish to        */
+    unsigned int publish_size;  /* MB of the ring                     */
+    int dashboard;              /* draw the live dashboard            */
+};
+
+/* where the captured frames go */
+struct output {
+    const struct capconf *conf; /* names of the interfaces            */
+    int hexdump;                /* dump frames as text to stdout      */
+    struct pcapfile *pcap;      /* capture file, or NULL              */
+    struct dedup *dedup;        /* frames seen lately, or NULL        */
+    struct flowtab *flows;      /* flow table, or NULL                */
+    struct talkers *talkers;    /* top talkers, or NULL               */
+    unsigned int top;           /* talkers to report                  */
+    int talkers_due;            /* set when a report is due           */
+    struct tcpreasm *reasm;     /* TCP connections, or NULL           */
+    struct streams *streams;    /* where their streams go             */
+    struct acmatch *matcher;    /* frames to keep, or NULL            */
+    int matchlines;             /* print a line per frame kept        */
+    struct flightrec *recorder; /* the last frames, or NULL           */
+    const char *recfile;        /* where they are dumped              */
+    int recformat;              /* PCAPFILE_*                         */
+    struct pcapfile_opts recopts;
+    struct filter *trigger;     /* frames that dump them, or NULL     */
+    int dump_due;               /* set on SIGUSR2                     */
+    struct shmring *ring;       /* frames published, or NULL          */
+};
 
-static void cleanup(int s);
+static void cleanup(void);
+static void close_pcap(void);
 static void usage(char *prog);
+static int parse_cmd_line(int argc, char *argv[], struct cmd_line_args *args);
 static int get_if_index(const int sockfd, const char *ifname);
+static int find_interfaces(const struct cmd_line_args *args);
+static int replay_interfaces(const struct cmd_line_args *args);
+static int wait_for_exit(unsigned int interval, struct dash *dash);
+static int ms_until(const struct timespec *t);
+static int output_start(unsigned int nslots, unsigned int slotsize);
+static void output_stop(void);
+static void *output_run(void *arg);
+static void queue_frame(struct capframe *frame, void *arg);
+static void replay_frame(struct capframe *frame, void *arg);
+static void handle_frame(struct capframe *frame, void *arg);
+static void dump_frame(struct capframe *frame, const char *ifname,
+        const uint32_t *ids, unsigned int nids);
+static void print_match(struct capframe *frame, const char *ifname,
+        const uint32_t *ids, unsigned int nids);
+static void print_ids(const uint32_t *ids, unsigned int nids);
+static void print_flow(const struct flow *f, int reason, void *arg);
+static void stream_data(struct tcpconn *c, int dir, const uint8_t *data,
+        unsigned int len, void *arg);
+static void stream_close(struct tcpconn *c, int reason, void *arg);
+static void report_talkers(struct output *out);
+static void dump_recorder(struct output *out, int trigger);
 static void dump_physical_address(unsigned char halen, unsigned char *addr); 
 
 static int sockfd = -1;
-static char *buf = NULL; /* how big should the buffer be? */
+static struct capworker workers[CAPTURE_MAX_WORKERS];
+static int nworkers = 0;
+static struct pcapfile pcap;
+static struct filter filter;
+static struct output out;
+static struct dedup dedup;
+static struct flowtab flows;
+static struct talkers talkers;
+static struct tcpreasm reasm;
+static struct streams streams;
+static struct acmatch matcher;
+static struct flightrec recorder;
+static struct filter trigger;
+static struct pcapfile recdump;
+static struct shmring ring;
+static struct iflink links[CAPTURE_MAX_IFS];
+static int nlinks = 0;
+static struct pcapread replay;
+static int donefd = -1;
+static struct capstats stats;
+static struct dash dash;
+static int sigfd = -1;
+static struct spsc queues[CAPTURE_MAX_WORKERS];
+static pthread_t output_tid;
+static int output_running = 0;
+static int output_stopping = 0;
 
 int main(int argc, char *argv[])
 {
-    struct sockaddr_ll srcethaddr;  /* man 7 packet    */
-    struct sockaddr_ll bindethaddr; /* man 7 packet    */
-    struct packet_mreq mr;          /* man 7 packet    */
-    struct ifreq ifr;               /* man 7 netdevice */
-    int nbytes;
-    socklen_t addrlen;
+    struct cmd_line_args args;
+    struct capconf conf;
+    char err[FILTER_ERRLEN];
+    struct timespec ns;
+    sigset_t sigs;
+    int i, rc;
 
     /* how big should the buffer be?
      *
@@ -98,122 +439,752 @@ int main(int argc, char *argv[])
      * the buffer size should be set no less than 
      * 6 + 6 + 2 + MTU = ETHER_HDR_LEN + MTU.
      *
-     * Question: how does IEEE 802.1Q affect the required buffer size?
+     * IEEE 802.1Q adds a tag of 4 bytes after the MAC addresses, which
+     * the MTU does not count, and 802.1ad (QinQ) a second one. The kernel
+     * takes the outer tag off before we see the frame and we put it back
+     * (see capture.c), thus the buffer must hold ETHER_HDR_LEN + 8 + MTU
+     * bytes, CAPFRAME_VLAN_ROOM being the 8.
      * */
 
-    int bufsize;      /* how big should the buffer be? */
-    int ifindex;      /* interface index               */
-
-    setupsignal(SIGINT, cleanup);    /* capture CTRL-C */
+    unsigned int bufsize;  /* how big should the buffer be? */
 
-    if (argc < 2) {
+    if (!parse_cmd_line(argc, argv, &args)) {
         usage(argv[0]);
         exit(1);
     }
 
-    /* open a raw packet socket to capture all types of ethernet frames */
-    sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-    if (sockfd < 0) {
-        perror("socket(AF_PACKET, SOCK_RAW, ETH_P_ALL) failed");
+    /* the filter truncates the frames, even one that takes all frames */
+    if (args.filter != NULL || args.dump_filter || args.snaplen > 0) {
+        if (filter_compile(&filter, args.filter, args.snaplen > 0 ?
+                    args.snaplen : FILTER_SNAPLEN_MAX, err) != 0) {
+            fprintf(stderr, "%s\n", err);
+            exit(1);
+        }
+        if (args.dump_filter) {
+            filter_dump(&filter, stdout);
+            exit(0);
+        }
+    }
+    if (args.trigger != NULL && filter_compile(&trigger, args.trigger,
+                FILTER_SNAPLEN_MAX, err) != 0) {
+        fprintf(stderr, "%s\n", err);
         exit(1);
     }
 
-    /* obtain interface index from interface name */
-    if ((ifindex = get_if_index(sockfd, argv[1])) == -1) {
-        fprintf(stderr, 
-                "failed to obtain interface index for interface %s\n", 
-                argv[1]);
-        exit(1);
+    if (args.rfile != NULL) {
+        /* the interfaces are those of the file */
+        if (replay_interfaces(&args) != 0) {
+            cleanup();
+            exit(1);
+        }
+    } else {
+        /*
+         * open a raw packet socket to look up the interfaces. It receives
+         * no frames (protocol 0), the workers open sockets of their own.
+         */
+        sockfd = socket(AF_PACKET, SOCK_RAW, 0);
+        if (sockfd < 0) {
+            perror("socket(AF_PACKET, SOCK_RAW, 0) failed");
+            exit(1);
+        }
+
+        if (find_interfaces(&args) != 0) {
+            cleanup();
+            exit(1);
+        }
     }
 
-    /* put the interface into promiscuous mode. man 7 packet */
-    memset(&mr, 0, sizeof(mr));
-    mr.mr_ifindex = ifindex;
-    mr.mr_type =  PACKET_MR_PROMISC;
-    if (setsockopt(sockfd, SOL_PACKET, 
-            PACKET_ADD_MEMBERSHIP, (char *)&mr, sizeof(mr)) != 0) {
-        perror("setsockopt(sockfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, ...)");
+    /* the buffers must fit the frames of the interface of the largest MTU */
+    memset(&conf, 0, sizeof(conf));
+    bufsize = 0;
+    for (i = 0; i < nlinks; i ++) {
+        if (links[i].mtu + ETHER_HDR_LEN + CAPFRAME_VLAN_ROOM > bufsize)
+            bufsize = links[i].mtu + ETHER_HDR_LEN + CAPFRAME_VLAN_ROOM;
+        conf.ifs[i].name = links[i].name;
+        conf.ifs[i].ifindex = links[i].ifindex;
+    }
+    conf.nifs = nlinks;
+    /* or the aggregates of segmentation offload */
+    if (args.vnet && bufsize < CAPTURE_GSO_BUFSIZE)
+        bufsize = CAPTURE_GSO_BUFSIZE;
+    if (args.snaplen > 0 && args.snaplen < bufsize)
+        bufsize = args.snaplen;
+
+    conf.bufsize = bufsize;
+    conf.batch = args.batch;
+    conf.ring = args.ring;
+    conf.block_size = args.block_size;
+    conf.block_nr = args.block_nr;
+    conf.block_timeout = args.block_timeout;
+    conf.hwtstamp = args.hwtstamp;
+    conf.vnet = args.vnet;
+    conf.segment = args.segment;
+    conf.fanout_mode = args.nworkers > 1 ? args.fanout_mode : -1;
+    conf.fanout_id = getpid();
+    conf.filter = args.filter != NULL || args.snaplen > 0 ? &filter : NULL;
+    conf.handler = args.queue == 0 ? handle_frame
+        : args.rfile != NULL ? replay_frame : queue_frame;
+    conf.arg = &out;
+    conf.donefd = -1;
+    conf.mix = args.dashboard;
+    if (args.rfile != NULL) {
+        conf.replay = &replay;
+        conf.replay_fast = args.fast;
+        if ((donefd = eventfd(0, EFD_CLOEXEC)) < 0) {
+            perror("eventfd(0, ...)");
+            cleanup();
+            exit(1);
+        }
+        conf.donefd = donefd;
+    }
+
+    /* the lookup socket will do for turning on hardware timestamps */
+    for (i = 0; args.hwtstamp && sockfd >= 0 && i < nlinks; i ++) {
+        if (capture_hwtstamp(sockfd, links[i].name) != 0) {
+            fprintf(stderr, "WARN: %s can't timestamp frames, "
+                    "using the kernel's timestamps\n", links[i].name);
+        }
+    }
+
+    /*
+     * the threads, the workers and those writing the capture file, inherit
+     * our signal mask. Block the signals that end the capture or ask for a
+     * report or a dump before any is started so that they are delivered
+     * to us, by the signalfd(2), only.
+     */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    if ((sigfd = signalfd(-1, &sigs, SFD_CLOEXEC)) < 0) {
+        perror("signalfd(-1, &sigs, ...)");
+        cleanup();
         exit(1);
     }
-    
 
-    /* bind the socket to the interface. see bind(2) and packet(7) */
-    memset(&bindethaddr, 0, sizeof(bindethaddr));
-    bindethaddr.sll_family = AF_PACKET;
-    bindethaddr.sll_protocol = htons(ETH_P_ALL);
-    bindethaddr.sll_ifindex = ifindex;
-    if (bind(sockfd, 
-        (struct sockaddr*)&bindethaddr, sizeof(bindethaddr)) != 0) {
-        perror("bind(sockfd, &bindethaddr, sizeof(bindethaddr))");
+    out.conf = &conf;
+    out.hexdump = args.hexdump
+        || (args.wfile == NULL && !args.flows && args.top == 0
+                && args.streams == NULL && args.recorder == NULL
+                && args.publish == NULL && !args.dashboard);
+    /*
+     * the text of a frame in one write(2) when it is flushed, not a
+     * write each time the default buffer of a pipe or a file fills
+     */
+    if (out.hexdump && !isatty(STDOUT_FILENO))
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_TEXT_HDR + HEXDUMP_SIZE(bufsize));
+    if (args.dedup > 0) {
+        if (dedup_init(&dedup, DEDUP_BUCKETS, args.dedup) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.dedup = &dedup;
+    }
+    if (args.flows) {
+        if (flow_init(&flows, args.flow_table, args.flow_idle,
+                    args.flow_active, print_flow, &out) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.flows = &flows;
+    }
+    if (args.top > 0) {
+        if (talkers_init(&talkers, args.top_counters) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.talkers = &talkers;
+        out.top = args.top;
+    }
+    if (args.streams != NULL) {
+        if (streams_init(&streams, args.streams) != 0
+                || tcpreasm_init(&reasm, TCPREASM_CONNS, TCPREASM_IDLE,
+                    (unsigned long long)args.stream_memory << 20,
+                    stream_data, stream_close, &out) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.reasm = &reasm;
+        out.streams = &streams;
+    }
+    if (args.patterns != NULL) {
+        if (acmatch_load(&matcher, args.patterns) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.matcher = &matcher;
+        /* no lines among the frames written to stdout */
+        out.matchlines = !out.hexdump && !args.flows && args.top == 0
+            && args.streams == NULL && !args.dashboard
+            && (args.wfile == NULL || strcmp(args.wfile, "-") != 0);
+    }
+    if (args.recorder != NULL) {
+        if (flightrec_init(&recorder, (size_t)args.recorder_size << 20,
+                    args.recorder_secs, args.trigger_rate,
+                    args.hugepages) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.recorder = &recorder;
+        out.recfile = args.recorder;
+        out.recformat = args.format;
+        /* a dump is written in full, however long it takes */
+        out.recopts.wait = 1;
+        out.recopts.compress = args.fopts.compress;
+        out.trigger = args.trigger != NULL ? &trigger : NULL;
+    }
+    if (args.publish != NULL) {
+        if (shmring_create(&ring, args.publish,
+                    (size_t)args.publish_size << 20, bufsize) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.ring = &ring;
+        for (i = 0; i < nlinks; i ++) {
+            if (shmring_add_if(&ring, links[i].ifindex,
+                        links[i].name) != 0) {
+                cleanup();
+                exit(1);
+            }
+        }
+    }
+    if (args.wfile != NULL) {
+        /* a replay can wait for the disk, a capture can't */
+        args.fopts.wait = args.rfile != NULL;
+        if (pcapfile_open(&pcap, args.wfile, args.format, bufsize,
+                    &args.fopts) != 0) {
+            cleanup();
+            exit(1);
+        }
+        out.pcap = &pcap;
+        for (i = 0; i < nlinks; i ++) {
+            if (pcapfile_add_if(&pcap, links[i].ifindex,
+                        links[i].name) != 0) {
+                cleanup();
+                exit(1);
+            }
+        }
+    }
+
+    for (i = 0; i < args.nworkers; i ++) {
+        if (capworker_open(&workers[i], i, 
+                    args.nworkers > 1 ? capture_cpu(i) : -1, &conf) != 0) {
+            nworkers = i + 1;
+            cleanup();
+            exit(1);
+        }
+    }
+    nworkers = args.nworkers;
+
+    if (args.queue > 0 && output_start(args.queue, bufsize) != 0) {
+        cleanup();
         exit(1);
     }
 
-    /* obtain MTU. see netdevice(7) */
-    ifr.ifr_addr.sa_family = AF_PACKET;
-    safe_strncpy(ifr.ifr_name, argv[1], IFNAMSIZ);
-    if (ioctl(sockfd, SIOCGIFMTU, &ifr) != 0) {
-        perror("ioctl(sockfd, SIOCGIFMTU, &ifr)");
-        exit (1);
+    if (capstats_open(&stats, &conf, workers, args.queue > 0 ? queues : NULL,
+                out.pcap, out.dedup, nworkers, args.stats_path) != 0) {
+        cleanup();
+        exit(1);
     }
 
-    /* allocate buffer */
-    bufsize = ifr.ifr_mtu + ETHER_HDR_LEN;
-    if ((buf = malloc(bufsize)) == NULL) {
-        fprintf(stderr, "insufficient memory\n");
+    if (args.dashboard && dash_open(&dash, &stats) != 0) {
+        cleanup();
         exit(1);
     }
 
     /* begin capturing */
-    memset(&srcethaddr, 0, sizeof(srcethaddr));
-    while (1) {
-
-        addrlen = sizeof(srcethaddr);
-        nbytes = recvfrom(sockfd, buf, bufsize, 
-                0, (struct sockaddr*)&srcethaddr, &addrlen);
-
-        if (nbytes < 0) {
-            perror("recv(sockfd ...) failed");
-            exit (1);
-        }
-    
-        /* dump captured frame */
-        printf("Captured at interface: %s frame from ", argv[1]);
-        dump_physical_address(srcethaddr.sll_halen, srcethaddr.sll_addr);
-        printf("\n");
-        dumpbuf(buf, nbytes);
-        /**
-         * flush the buffer so that we don't have to rely on stdbuf, as in
-         *     sudo stdbuf -o 0 ./ethercap eth0 | tee frame_captured.txt
-         */
-        fflush(stdout);
+    for (i = 0; i < nworkers; i ++) {
+        if (capworker_start(&workers[i]) != 0) {
+            capture_stop(&conf);
+            nworkers = i;
+            cleanup();
+            exit(1);
+        }
     }
 
-    /* remove the interface's promiscuous mode */
-    setsockopt(sockfd, SOL_PACKET, 
-            PACKET_DROP_MEMBERSHIP, (char *)&mr, sizeof(mr));
+    if ((rc = wait_for_exit(args.interval,
+                    args.dashboard ? &dash : NULL)) < 0) {
+        capture_stop(&conf);
+        cleanup();
+        exit(1);
+    }
+    /* the terminal back for the reports */
+    dash_close(&dash);
+    fflush(stderr);
+    fflush(stdout);
+    if (rc == 0)
+        fprintf(stderr, "\nUser pressed CTRL-C. Exiting ...\n");
 
-    free(buf);
-    close(sockfd);
+    capture_stop(&conf);
+    for (i = 0; i < nworkers; i ++) 
+        capworker_join(&workers[i]);
+    output_stop();
+    /* written out in full before the writer is reported on */
+    close_pcap();
+    if (out.flows != NULL)
+        flow_flush(out.flows);
+    if (out.reasm != NULL)
+        tcpreasm_flush(out.reasm);
+    if (out.talkers != NULL)
+        report_talkers(&out);
+    fflush(stdout);
+    if (args.rfile != NULL && workers[0].replayed > 0) {
+        ns.tv_sec = workers[0].replay_ns / 1000000000ULL;
+        ns.tv_nsec = workers[0].replay_ns % 1000000000ULL;
+        fprintf(stderr, "\nreplayed %llu frames in %lld.%09ld s, "
+                "%.1f ns per frame\n", workers[0].replayed,
+                (long long)ns.tv_sec, ns.tv_nsec,
+                (double)workers[0].replay_ns / workers[0].replayed);
+    }
+    capstats_final(&stats, stderr);
+    if (out.flows != NULL)
+        flow_report(out.flows, stderr);
+    if (out.reasm != NULL) {
+        tcpreasm_report(out.reasm, stderr);
+        streams_report(out.streams, stderr);
+    }
+    if (out.matcher != NULL)
+        acmatch_report(out.matcher, stderr);
+    if (out.recorder != NULL)
+        flightrec_report(out.recorder, stderr);
+    if (out.ring != NULL)
+        shmring_report(out.ring, stderr);
+    cleanup();
 
     return 0;
 }
 
 
-static void cleanup(int s __attribute__((unused))) 
+static void cleanup(void) 
 {
-    fflush(stderr);
-    fflush(stdout);
-    fprintf(stderr, "\nUser pressed CTRL-C. Exiting ...\n");
+    int i;
+
+    for (i = 0; i < nworkers; i ++)
+        capworker_close(&workers[i]);
+    output_stop();
+    for (i = 0; i < nworkers; i ++)
+        spsc_free(&queues[i]);
+    close_pcap();
+    dedup_free(&dedup);
+    flow_free(&flows);
+    talkers_free(&talkers);
+    tcpreasm_free(&reasm);
+    streams_free(&streams);
+    acmatch_free(&matcher);
+    flightrec_free(&recorder);
+    shmring_close(&ring);
+    dash_close(&dash);
+    capstats_close(&stats);
+    pcapread_close(&replay);
+    if (donefd >= 0) close(donefd);
+    if (sigfd >= 0) close(sigfd);
     if (sockfd >= 0) close(sockfd);
-    if (buf != NULL) free(buf);
-    exit(0);
+}
+
+static void close_pcap(void)
+{
+    if (out.pcap == NULL)
+        return;
+    if (pcapfile_close(out.pcap) != 0) {
+        fprintf(stderr, "ERROR: writing capture file: %s\n",
+                strerror(pcapfile_error(out.pcap)));
+    }
+    out.pcap = NULL;
 }
 
 static void usage(char *prog) 
 {
     fprintf(stderr, "\nWrong usage. "
             "You must provie a valid network interface, e.g., \n\n"
-            "%s eth0\n\n", prog);
+            "%s eth0\n"
+            "%s -r file.pcap\n\n"
+            "options:\n"
+            "  -B, --batch N            frames per recvmmsg(2) (default %d)\n"
+            "  -R, --ring               capture from a memory-mapped ring\n"
+            "  -b, --block-size KiB     size of a ring block (default %d)\n"
+            "  -n, --blocks N           number of ring blocks (default %d)\n"
+            "  -t, --block-timeout ms   ring block timeout (default %d)\n"
+            "  -F, --workers N          capture with N pinned threads\n"
+            "  -m, --fanout mode        hash, cpu, rr/lb, hash-rollover, qm\n"
+            "  -w, --write file         write frames to a capture file\n"
+            "  -o, --format fmt         pcap (default) or pcapng\n"
+            "  -C, --file-size MB       new file every MB megabytes\n"
+            "  -G, --file-time secs     new file every secs seconds\n"
+            "  -W, --file-count N       keep the last N files only\n"
+            "  -z, --compress           compress the capture file\n"
+            "  -x, --hexdump            dump frames as text with -w\n"
+            "  -f, --filter expr        capture frames matching expr only\n"
+            "  -d, --dump-filter        print the compiled filter\n"
+            "  -s, --snaplen N          capture N bytes of every frame\n"
+            "  -S, --headers-only       capture the headers only\n"
+            "  -L, --flows              print flow records, not frames\n"
+            "  -i, --flow-idle secs     flow idle timeout (default %d)\n"
+            "  -a, --flow-active secs   flow active timeout (default %d)\n"
+            "  -T, --flow-table N       flows at a time (default %d)\n"
+            "  -K, --top N              print the top N talkers\n"
+            "  -k, --top-counters N     talker counters (default %d)\n"
+            "  -E, --streams dir        write TCP streams into dir\n"
+            "  -M, --stream-memory MB   held out of order (default %d)\n"
+            "  -P, --patterns file      keep frames with these in them\n"
+            "  -D, --dedup usecs        drop duplicates within usecs\n"
+            "  -y, --recorder file      keep frames, dump on a trigger\n"
+            "  -Y, --recorder-size MB   frames kept (default %d)\n"
+            "  -e, --recorder-time secs seconds of frames kept\n"
+            "  -j, --hugepages          keep the frames on hugepages\n"
+            "  -c, --trigger expr       dump on a frame matching expr\n"
+            "  -q, --trigger-rate N     dump on more than N frames/s\n"
+            "  -O, --publish name       publish frames to shared memory\n"
+            "  -N, --publish-size MB    frames in the ring (default %d)\n"
+            "  -X, --dashboard          draw a live traffic dashboard\n"
+            "  -I, --interval secs      report statistics every secs\n"
+            "  -U, --stats-socket path  report to a Unix domain socket\n"
+            "  -Q, --queue N            frames queued for output (%d)\n"
+            "  -H, --hw-timestamp       timestamp frames in the NIC\n"
+            "  -V, --vnet-hdr           capture GRO/TSO aggregates whole\n"
+            "  -g, --segment            cut aggregates into segments\n"
+            "  -r, --read file          replay a pcap or pcapng file\n"
+            "  -A, --fast               replay as fast as possible\n\n",
+            prog, prog, RXBATCH_DEFAULT, PKTRING_BLOCK_SIZE >> 10,
+            PKTRING_BLOCK_NR, PKTRING_BLOCK_TIMEOUT, FLOW_IDLE_TIMEOUT,
+            FLOW_ACTIVE_TIMEOUT, FLOW_TABLE_SIZE, TOPK_COUNTERS,
+            TCPREASM_MEMORY, FLIGHTREC_MEMORY, SHMRING_MEMORY, SPSC_SLOTS);
+}
+
+static int parse_cmd_line(int argc, char *argv[], struct cmd_line_args *args)
+{
+    static const struct option longopts[] = {
+        {"batch",         required_argument, NULL, 'B'},
+        {"ring",          no_argument,       NULL, 'R'},
+        {"block-size",    required_argument, NULL, 'b'},
+        {"blocks",        required_argument, NULL, 'n'},
+        {"block-timeout", required_argument, NULL, 't'},
+        {"workers",       required_argument, NULL, 'F'},
+        {"fanout",        required_argument, NULL, 'm'},
+        {"write",         required_argument, NULL, 'w'},
+        {"format",        required_argument, NULL, 'o'},
+        {"file-size",     required_argument, NULL, 'C'},
+        {"file-time",     required_argument, NULL, 'G'},
+        {"file-count",    required_argument, NULL, 'W'},
+        {"compress",      no_argument,       NULL, 'z'},
+        {"hexdump",       no_argument,       NULL, 'x'},
+        {"filter",        required_argument, NULL, 'f'},
+        {"dump-filter",   no_argument,       NULL, 'd'},
+        {"snaplen",       required_argument, NULL, 's'},
+        {"headers-only",  no_argument,       NULL, 'S'},
+        {"flows",         no_argument,       NULL, 'L'},
+        {"flow-idle",     required_argument, NULL, 'i'},
+        {"flow-active",   required_argument, NULL, 'a'},
+        {"flow-table",    required_argument, NULL, 'T'},
+        {"top",           required_argument, NULL, 'K'},
+        {"top-counters",  required_argument, NULL, 'k'},
+        {"streams",       required_argument, NULL, 'E'},
+        {"stream-memory", required_argument, NULL, 'M'},
+        {"patterns",      required_argument, NULL, 'P'},
+        {"dedup",         required_argument, NULL, 'D'},
+        {"recorder",      required_argument, NULL, 'y'},
+        {"recorder-size", required_argument, NULL, 'Y'},
+        {"recorder-time", required_argument, NULL, 'e'},
+        {"hugepages",     no_argument,       NULL, 'j'},
+        {"trigger",       required_argument, NULL, 'c'},
+        {"trigger-rate",  required_argument, NULL, 'q'},
+        {"publish",       required_argument, NULL, 'O'},
+        {"publish-size",  required_argument, NULL, 'N'},
+        {"dashboard",     no_argument,       NULL, 'X'},
+        {"interval",      required_argument, NULL, 'I'},
+        {"hw-timestamp",  no_argument,       NULL, 'H'},
+        {"vnet-hdr",      no_argument,       NULL, 'V'},
+        {"segment",       no_argument,       NULL, 'g'},
+        {"stats-socket",  required_argument, NULL, 'U'},
+        {"queue",         required_argument, NULL, 'Q'},
+        {"read",          required_argument, NULL, 'r'},
+        {"fast",          no_argument,       NULL, 'A'},
+        {NULL,            0,                 NULL, 0}
+    };
+    int c;
+
+    memset(args, '\0', sizeof(*args));
+    args->batch = RXBATCH_DEFAULT;
+    args->block_size = PKTRING_BLOCK_SIZE;
+    args->block_nr = PKTRING_BLOCK_NR;
+    args->block_timeout = PKTRING_BLOCK_TIMEOUT;
+    args->nworkers = 1;
+    args->fanout_mode = capture_fanout_mode("hash");
+    args->format = PCAPFILE_PCAP;
+    args->queue = SPSC_SLOTS;
+    args->flow_idle = FLOW_IDLE_TIMEOUT;
+    args->flow_active = FLOW_ACTIVE_TIMEOUT;
+    args->flow_table = FLOW_TABLE_SIZE;
+    args->top_counters = TOPK_COUNTERS;
+    args->stream_memory = TCPREASM_MEMORY;
+    args->recorder_size = FLIGHTREC_MEMORY;
+    args->publish_size = SHMRING_MEMORY;
+
+    while ((c = getopt_long(argc, argv,
+                    "B:Rb:n:t:F:m:"         /* capture */
+                    "w:o:C:G:W:z"           /* capture file */
+                    "xf:ds:S"               /* text, filter */
+                    "Li:a:T:K:k:"           /* flows, talkers */
+                    "E:M:P:D:"              /* streams, patterns, dedup */
+                    "y:Y:e:jc:q:"           /* flight recorder */
+                    "O:N:"                  /* publish */
+                    "XI:U:"                 /* dashboard, statistics */
+                    "Q:HVg"                 /* output queue, offloads */
+                    "r:A",                  /* replay */
+                    longopts, NULL)) != -1) {
+        switch (c) {
+            case 'B':
+                args->batch = strtoul(optarg, NULL, 0);
+                break;
+            case 'R':
+                args->ring = 1;
+                break;
+            case 'b':
+                args->block_size = strtoul(optarg, NULL, 0) << 10;
+                break;
+            case 'n':
+                args->block_nr = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                args->block_timeout = strtoul(optarg, NULL, 0);
+                break;
+            case 'F':
+                args->nworkers = atoi(optarg);
+                if (args->nworkers < 1 
+                        || args->nworkers > CAPTURE_MAX_WORKERS) {
+                    fprintf(stderr, "number of workers must be 1 to %d\n",
+                            CAPTURE_MAX_WORKERS);
+                    return 0;
+                }
+                break;
+            case 'm':
+                if ((args->fanout_mode = capture_fanout_mode(optarg)) < 0) {
+                    fprintf(stderr, "unknown fanout mode %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'w':
+                args->wfile = optarg;
+                break;
+            case 'o':
+                if ((args->format = pcapfile_format(optarg)) < 0) {
+                    fprintf(stderr, "unknown file format %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'C':
+                args->fopts.max_bytes = strtoull(optarg, NULL, 0) << 20;
+                break;
+            case 'G':
+                args->fopts.max_secs = strtoul(optarg, NULL, 0);
+                break;
+            case 'W':
+                args->fopts.max_files = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                args->fopts.compress = 1;
+                break;
+            case 'x':
+                args->hexdump = 1;
+                break;
+            case 'f':
+                args->filter = optarg;
+                break;
+            case 'd':
+                args->dump_filter = 1;
+                break;
+            case 's':
+                args->snaplen = strtoul(optarg, NULL, 0);
+                if (args->snaplen < ETHER_HDR_LEN 
+                        || args->snaplen > FILTER_SNAPLEN_MAX) {
+                    fprintf(stderr, "snaplen must be %d to %d\n",
+                            ETHER_HDR_LEN, FILTER_SNAPLEN_MAX);
+                    return 0;
+                }
+                break;
+            case 'S':
+                args->snaplen = CAPTURE_HEADERS_SNAPLEN;
+                break;
+            case 'L':
+                args->flows = 1;
+                break;
+            case 'i':
+                args->flow_idle = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                args->flow_active = strtoul(optarg, NULL, 0);
+                break;
+            case 'T':
+                args->flow_table = strtoul(optarg, NULL, 0);
+                break;
+            case 'K':
+                args->top = strtoul(optarg, NULL, 0);
+                break;
+            case 'k':
+                args->top_counters = strtoul(optarg, NULL, 0);
+                break;
+            case 'E':
+                args->streams = optarg;
+                break;
+            case 'M':
+                args->stream_memory = strtoul(optarg, NULL, 0);
+                break;
+            case 'P':
+                args->patterns = optarg;
+                break;
+            case 'D':
+                args->dedup = strtoul(optarg, NULL, 0);
+                if (args->dedup == 0) {
+                    fprintf(stderr, "dedup window must be at least 1 us\n");
+                    return 0;
+                }
+                break;
+            case 'y':
+                args->recorder = optarg;
+                break;
+            case 'Y':
+                args->recorder_size = strtoul(optarg, NULL, 0);
+                if (args->recorder_size == 0) {
+                    fprintf(stderr, "flight recorder must have at least "
+                            "1 MB\n");
+                    return 0;
+                }
+                break;
+            case 'e':
+                args->recorder_secs = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                args->hugepages = 1;
+                break;
+            case 'c':
+                args->trigger = optarg;
+                break;
+            case 'q':
+                args->trigger_rate = strtoull(optarg, NULL, 0);
+                break;
+            case 'O':
+                args->publish = optarg;
+                break;
+            case 'N':
+                args->publish_size = strtoul(optarg, NULL, 0);
+                if (args->publish_size == 0) {
+                    fprintf(stderr, "ring must have at least 1 MB\n");
+                    return 0;
+                }
+                break;
+            case 'X':
+                args->dashboard = 1;
+                break;
+            case 'I':
+                args->interval = strtoul(optarg, NULL, 0);
+                break;
+            case 'H':
+                args->hwtstamp = 1;
+                break;
+            case 'V':
+                args->vnet = 1;
+                break;
+            case 'g':
+                args->vnet = 1;
+                args->segment = 1;
+                break;
+            case 'U':
+                args->stats_path = optarg;
+                break;
+            case 'Q':
+                args->queue = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                args->rfile = optarg;
+                break;
+            case 'A':
+                args->fast = 1;
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    if (args->fopts.max_files > 0 && args->fopts.max_bytes == 0
+            && args->fopts.max_secs == 0) {
+        fprintf(stderr, "-W needs -C or -G\n");
+        return 0;
+    }
+
+    if (args->flow_idle == 0 || args->flow_active == 0) {
+        fprintf(stderr, "flow timeouts must be at least a second\n");
+        return 0;
+    }
+
+    if (args->recorder == NULL && (args->trigger != NULL
+                || args->trigger_rate > 0 || args->recorder_secs > 0
+                || args->hugepages)) {
+        fprintf(stderr, "-e, -j, -c and -q need -y\n");
+        return 0;
+    }
+
+    /*
+     * a flow table, the talkers, the TCP connections, the counters of the
+     * pattern matcher, the dedup set, the flight recorder and the ring
+     * are used by one thread only
+     */
+    if ((args->flows || args->top > 0 || args->streams != NULL
+                || args->patterns != NULL || args->dedup > 0
+                || args->recorder != NULL || args->publish != NULL)
+            && args->queue == 0 && args->nworkers > 1) {
+        fprintf(stderr, "-L, -K, -E, -P, -D, -y or -O with more than one "
+                "worker needs -Q\n");
+        return 0;
+    }
+
+    if ((args->hexdump || args->flows || args->top > 0
+                || args->streams != NULL)
+            && args->wfile != NULL && !strcmp(args->wfile, "-")) {
+        fprintf(stderr, "cannot dump frames as text when writing to stdout\n");
+        return 0;
+    }
+
+    /* nothing but the dashboard on the terminal */
+    if (args->dashboard) {
+        if (args->hexdump || args->flows || args->top > 0
+                || args->streams != NULL) {
+            fprintf(stderr, "cannot dump frames as text with -X\n");
+            return 0;
+        }
+        if (args->interval > 0 && args->stats_path == NULL) {
+            fprintf(stderr, "-I with -X needs -U\n");
+            return 0;
+        }
+    }
+
+    if (args->rfile != NULL) {
+        if (optind < argc) {
+            fprintf(stderr, "no interface can be given with -r\n");
+            return 0;
+        }
+        if (args->nworkers > 1) {
+            fprintf(stderr, "WARN: replaying with a single worker\n");
+            args->nworkers = 1;
+        }
+        if (args->vnet) {
+            fprintf(stderr, "WARN: a file has no virtio-net headers\n");
+            args->vnet = args->segment = 0;
+        }
+        return 1;
+    }
+
+    if (optind >= argc && !args->dump_filter) 
+        return 0;
+    args->ifnames = &argv[optind];
+    args->nifs = argc - optind;
+    if (args->nifs > CAPTURE_MAX_IFS) {
+        fprintf(stderr, "can capture on at most %d interfaces\n",
+                CAPTURE_MAX_IFS);
+        return 0;
+    }
+
+    return 1;
 }
 
 static int get_if_index(const int sockfd, const char *ifname)
@@ -228,6 +1199,481 @@ static int get_if_index(const int sockfd, const char *ifname)
     return ifr.ifr_ifindex;
 }
 
+/*
+ * look up the index and the MTU of the interfaces to capture on, or list
+ * the interfaces that are up for "all"
+ */
+static int find_interfaces(const struct cmd_line_args *args)
+{
+    struct ifreq ifr;               /* man 7 netdevice */
+    struct iflink all[CAPTURE_MAX_IFS];
+    int i, j, n;
+
+    if (args->nifs == 1 && !strcmp(args->ifnames[0], "all")) {
+        if ((n = iflist_get(all, CAPTURE_MAX_IFS)) < 0)
+            return -1;
+        for (i = 0; i < n; i ++) {
+            if (all[i].flags & IFF_UP)
+                links[nlinks ++] = all[i];
+        }
+        if (nlinks == 0) {
+            fprintf(stderr, "no interface is up\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < args->nifs; i ++) {
+        for (j = 0; j < nlinks; j ++) {
+            if (!strcmp(links[j].name, args->ifnames[i])) {
+                fprintf(stderr, "interface %s is given twice\n",
+                        args->ifnames[i]);
+                return -1;
+            }
+        }
+
+        /* obtain interface index from interface name */
+        safe_strncpy(links[nlinks].name, args->ifnames[i], IFNAMSIZ);
+        links[nlinks].ifindex = get_if_index(sockfd, args->ifnames[i]);
+        if (links[nlinks].ifindex == -1) {
+            fprintf(stderr, 
+                    "failed to obtain interface index for interface %s\n", 
+                    args->ifnames[i]);
+            return -1;
+        }
+
+        /* obtain MTU. see netdevice(7) */
+        ifr.ifr_addr.sa_family = AF_PACKET;
+        safe_strncpy(ifr.ifr_name, args->ifnames[i], IFNAMSIZ);
+        if (ioctl(sockfd, SIOCGIFMTU, &ifr) != 0) {
+            perror("ioctl(sockfd, SIOCGIFMTU, &ifr)");
+            return -1;
+        }
+        links[nlinks ++].mtu = ifr.ifr_mtu;
+    }
+    return 0;
+}
+
+/*
+ * open the file to replay and take its interfaces for ours, numbered from
+ * 1 in the order the file describes them
+ */
+static int replay_interfaces(const struct cmd_line_args *args)
+{
+    unsigned int snaplen;
+    int i;
+
+    if (pcapread_open(&replay, args->rfile) != 0)
+        return -1;
+    if (replay.nifs > CAPTURE_MAX_IFS) {
+        fprintf(stderr, "WARN: replaying the frames of the first %d "
+                "interfaces only\n", CAPTURE_MAX_IFS);
+    }
+
+    for (i = 0; i < replay.nifs && i < CAPTURE_MAX_IFS; i ++) {
+        if (replay.ifs[i].linktype != PCAPREAD_LINKTYPE_ETHERNET) {
+            fprintf(stderr, "ERROR: %s: interface %d is not Ethernet "
+                    "(link type %u)\n", args->rfile, i,
+                    replay.ifs[i].linktype);
+            return -1;
+        }
+        safe_strncpy(links[i].name, replay.ifs[i].name, IFNAMSIZ);
+        links[i].ifindex = i + 1;
+        /*
+         * the file says how long its frames may be, if it says, tags
+         * included: the MTU leaves out the room for them that the buffer
+         * size adds back, so that a rewritten file keeps its snaplen
+         */
+        snaplen = replay.ifs[i].snaplen;
+        if (snaplen <= ETHER_HDR_LEN || snaplen > FILTER_SNAPLEN_MAX)
+            snaplen = FILTER_SNAPLEN_MAX;
+        links[i].mtu = snaplen > ETHER_HDR_LEN + CAPFRAME_VLAN_ROOM ?
+            snaplen - ETHER_HDR_LEN - CAPFRAME_VLAN_ROOM : 0;
+    }
+    nlinks = i;
+    return 0;
+}
+
+/*
+ * report every interval seconds (never if 0), on SIGUSR1 and to the
+ * clients of the stats socket, redraw the dashboard if any every
+ * DASH_REFRESH_MS, and have the flight recorder dumped on SIGUSR2, until
+ * SIGINT or SIGTERM, 0, or until a replay is done or q is pressed on the
+ * dashboard, 1
+ */
+static int wait_for_exit(unsigned int interval, struct dash *dash)
+{
+    struct pollfd fds[4];
+    struct signalfd_siginfo si;
+    struct timespec next, redraw;
+    int n, timeout;
+
+    fds[0].fd = sigfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stats.listenfd;     /* ignored by poll(2) if -1 */
+    fds[1].events = POLLIN;
+    fds[2].fd = donefd;
+    fds[2].events = POLLIN;
+    fds[3].fd = dash != NULL ? dash_fd(dash) : -1;
+    fds[3].events = POLLIN;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    redraw = next;
+    next.tv_sec += interval;
+    redraw.tv_nsec += DASH_REFRESH_MS * 1000000LL;
+    redraw.tv_sec += redraw.tv_nsec / 1000000000;
+    redraw.tv_nsec %= 1000000000;
+    while (1) {
+        timeout = interval > 0 ? ms_until(&next) : -1;
+        if (dash != NULL && (timeout < 0 || ms_until(&redraw) < timeout))
+            timeout = ms_until(&redraw);
+        n = poll(fds, 4, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll(fds, ...)");
+            return -1;
+        }
+
+        if (dash != NULL && ms_until(&redraw) == 0) {
+            dash_draw(dash);
+            redraw.tv_nsec += DASH_REFRESH_MS * 1000000LL;
+            redraw.tv_sec += redraw.tv_nsec / 1000000000;
+            redraw.tv_nsec %= 1000000000;
+        }
+        if (interval > 0 && ms_until(&next) == 0) {
+            capstats_report(&stats, 1);
+            /* by the thread that counts the talkers */
+            if (out.talkers != NULL)
+                __atomic_store_n(&out.talkers_due, 1, __ATOMIC_RELAXED);
+            next.tv_sec += interval;
+        }
+        if (n == 0)
+            continue;
+        if (fds[2].revents & POLLIN)
+            return 1;
+        if ((fds[3].revents & POLLIN) && dash_key(dash))
+            return 1;
+        if (fds[1].revents & POLLIN)
+            capstats_accept(&stats);
+        if (fds[0].revents & POLLIN) {
+            if (read(sigfd, &si, sizeof(si)) != sizeof(si))
+                continue;
+            if (si.ssi_signo == SIGUSR2) {
+                /* by the thread that keeps the frames */
+                if (out.recorder != NULL)
+                    __atomic_store_n(&out.dump_due, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            if (si.ssi_signo != SIGUSR1)
+                return 0;
+            /* not over the dashboard */
+            if (dash != NULL && stats.path == NULL)
+                dash_draw(dash);
+            else
+                capstats_report(&stats, 0);
+        }
+    }
+}
+
+/* milliseconds from now until t on the monotonic clock, 0 if past */
+static int ms_until(const struct timespec *t)
+{
+    struct timespec now;
+    long long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (t->tv_sec - now.tv_sec) * 1000LL
+        + (t->tv_nsec - now.tv_nsec + 999999) / 1000000;
+    return ms > 0 ? (int)ms : 0;
+}
+
+/*
+ * give each worker a queue to the output thread and start the thread.
+ * The queues are preallocated, with fewer slots if the frames are large.
+ */
+static int output_start(unsigned int nslots, unsigned int slotsize)
+{
+    int i, rc;
+
+    while (nslots > SPSC_MIN_SLOTS
+            && (unsigned long long)nslots * slotsize > SPSC_MAX_BYTES)
+        nslots >>= 1;
+
+    for (i = 0; i < nworkers; i ++) {
+        if (spsc_init(&queues[i], nslots, slotsize) != 0)
+            return -1;
+        workers[i].arg = &queues[i];
+    }
+
+    if ((rc = pthread_create(&output_tid, NULL, output_run, NULL)) != 0) {
+        fprintf(stderr, "ERROR: pthread_create(...): %s\n", strerror(rc));
+        return -1;
+    }
+    output_running = 1;
+    return 0;
+}
+
+/* let the output thread write out what is queued, and wait for it */
+static void output_stop(void)
+{
+    if (!output_running)
+        return;
+    __atomic_store_n(&output_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(output_tid, NULL);
+    output_running = 0;
+}
+
+/*
+ * take the frames from the queues in turn, a burst at a time so that a
+ * busy worker does not starve the others, and write them out
+ */
+static void *output_run(void *arg)
+{
+    struct timespec idle = {0, OUTPUT_IDLE_NS}, now;
+    struct capframe *frame;
+    int i, n, stopping, busy;
+
+    (void)arg;
+    while (1) {
+        /* read before the queues are drained, so that none is missed */
+        stopping = __atomic_load_n(&output_stopping, __ATOMIC_ACQUIRE);
+        busy = 0;
+        for (i = 0; i < nworkers; i ++) {
+            for (n = 0; n < OUTPUT_BURST
+                    && (frame = spsc_front(&queues[i])) != NULL; n ++) {
+                handle_frame(frame, &out);
+                spsc_pop(&queues[i]);
+                busy = 1;
+            }
+        }
+        if (busy)
+            continue;
+        if (stopping)
+            break;
+        /*
+         * flows and connections time out even when no frames come in,
+         * not in a replay
+         */
+        if ((out.flows != NULL || out.reasm != NULL)
+                && out.conf->replay == NULL) {
+            clock_gettime(CLOCK_REALTIME, &now);
+            if (out.flows != NULL)
+                flow_expire(out.flows, &now);
+            if (out.reasm != NULL)
+                tcpreasm_expire(out.reasm, &now);
+        }
+        if (out.talkers != NULL
+                && __atomic_exchange_n(&out.talkers_due, 0, __ATOMIC_RELAXED))
+            report_talkers(&out);
+        if (out.recorder != NULL
+                && __atomic_exchange_n(&out.dump_due, 0, __ATOMIC_RELAXED))
+            dump_recorder(&out, FLIGHTREC_TRIGGER_SIGNAL);
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+/* in the capture thread: queue the frame, or drop it if the queue is full */
+static void queue_frame(struct capframe *frame, void *arg)
+{
+    spsc_push(arg, frame);
+}
+
+/*
+ * a file can wait for the output, unlike the wire: hold the replay back
+ * rather than drop frames so that every run gives the same output
+ */
+static void replay_frame(struct capframe *frame, void *arg)
+{
+    while (!spsc_room(arg))
+        sched_yield();
+    spsc_push(arg, frame);
+}
+
+static void handle_frame(struct capframe *frame, void *arg)
+{
+    struct output *out = arg;
+    uint32_t ids[ACMATCH_MAX_IDS];
+    unsigned int nids = 0;
+    struct decoded d;
+    int trigger;
+
+    if (out->dedup != NULL && dedup_check(out->dedup, frame))
+        return;
+    if (out->matcher != NULL) {
+        if (decode_frame(&d, frame->data, frame->caplen) != 0) {
+            d.payload = frame->data;
+            d.paylen = frame->caplen;
+        }
+        nids = acmatch_scan(out->matcher, d.payload, d.paylen, ids,
+                ACMATCH_MAX_IDS);
+        if (nids == 0)
+            return;
+        if (out->matchlines)
+            print_match(frame, capture_ifname(out->conf, frame->ifindex),
+                    ids, nids);
+    }
+    if (out->recorder != NULL) {
+        trigger = flightrec_add(out->recorder, frame)
+            ? FLIGHTREC_TRIGGER_RATE : -1;
+        if (__atomic_exchange_n(&out->dump_due, 0, __ATOMIC_RELAXED))
+            trigger = FLIGHTREC_TRIGGER_SIGNAL;
+        else if (out->trigger != NULL && flightrec_armed(out->recorder)
+                && filter_run(out->trigger, frame) != 0)
+            trigger = FLIGHTREC_TRIGGER_FILTER;
+        if (trigger >= 0)
+            dump_recorder(out, trigger);
+    }
+    if (out->pcap != NULL)
+        pcapfile_write(out->pcap, frame);
+    if (out->ring != NULL)
+        shmring_publish(out->ring, frame);
+    if (out->flows != NULL)
+        flow_add(out->flows, frame);
+    if (out->reasm != NULL)
+        tcpreasm_add(out->reasm, frame);
+    if (out->talkers != NULL) {
+        talkers_add(out->talkers, frame);
+        if (__atomic_load_n(&out->talkers_due, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&out->talkers_due, 0, __ATOMIC_RELAXED);
+            report_talkers(out);
+        }
+    }
+    if (out->hexdump)
+        dump_frame(frame, capture_ifname(out->conf, frame->ifindex), ids,
+                nids);
+}
+
+/* a flow record, as a line of text to stdout */
+static void print_flow(const struct flow *f, int reason, void *arg)
+{
+    struct output *out = arg;
+
+    flow_print(f, reason, capture_ifname(out->conf, f->key.ifindex), stdout);
+}
+
+/* a piece of a TCP stream, into its file */
+static void stream_data(struct tcpconn *c, int dir, const uint8_t *data,
+        unsigned int len, void *arg)
+{
+    struct output *out = arg;
+
+    streams_write(out->streams, c, dir, data, len);
+}
+
+/* a TCP connection is closed, as a line of text to stdout */
+static void stream_close(struct tcpconn *c, int reason, void *arg)
+{
+    struct output *out = arg;
+
+    tcpreasm_print(c, reason, capture_ifname(out->conf, c->key.ifindex),
+            stdout);
+    streams_close(out->streams, c);
+}
+
+/* the top talkers since the last report, to stdout */
+static void report_talkers(struct output *out)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    flockfile(stdout);
+    printf("\ntop talkers at %lld.%09ld\n", (long long)now.tv_sec,
+            now.tv_nsec);
+    talkers_print(out->talkers, out->top, stdout);
+    fflush(stdout);
+    funlockfile(stdout);
+    talkers_reset(out->talkers);
+}
+
+/*
+ * the frames kept by the flight recorder, into a file of their own. The
+ * output waits for it, the capture doesn't: frames coming in meanwhile
+ * may be dropped from the queues.
+ */
+static void dump_recorder(struct output *out, int trigger)
+{
+    struct flightrec *fr = out->recorder;
+    char path[PCAPFILE_PATHLEN];
+    int64_t first = fr->oldest, last = fr->newest;
+    int i, n;
+
+    if (fr->nframes == 0) {
+        fprintf(stderr, "flight recorder: no frames to dump on %s\n",
+                flightrec_trigger(trigger));
+        return;
+    }
+    snprintf(path, sizeof(path), "%s.%llu", out->recfile, fr->stats.dumps);
+    if (pcapfile_open(&recdump, path, out->recformat, out->conf->bufsize,
+                &out->recopts) != 0)
+        return;
+    for (i = 0; i < out->conf->nifs; i ++)
+        pcapfile_add_if(&recdump, out->conf->ifs[i].ifindex,
+                out->conf->ifs[i].name);
+
+    n = flightrec_dump(fr, &recdump, trigger);
+    if (pcapfile_close(&recdump) != 0) {
+        fprintf(stderr, "ERROR: writing %s: %s\n", path,
+                strerror(pcapfile_error(&recdump)));
+        return;
+    }
+    fprintf(stderr, "flight recorder: %d frames of %lld.%03lld s dumped "
+            "to %s on %s\n", n, (long long)((last - first) / 1000000000),
+            (long long)((last - first) % 1000000000 / 1000000), path,
+            flightrec_trigger(trigger));
+}
+
+static void dump_frame(struct capframe *frame, const char *ifname,
+        const uint32_t *ids, unsigned int nids)
+{
+    struct decoded d;
+
+    /* workers share stdout, keep the lines of a frame together */
+    flockfile(stdout);
+
+    /* dump captured frame */
+    printf("Captured at interface: %s frame from ", ifname);
+    dump_physical_address(frame->halen, frame->addr);
+    printf(" at %lld.%09ld\n", (long long)frame->ts.tv_sec, frame->ts.tv_nsec);
+    gso_print(frame, stdout);
+    if (decode_frame(&d, frame->data, frame->caplen) == 0)
+        decode_print(&d, stdout);
+    if (nids > 0) {
+        printf("match:");
+        print_ids(ids, nids);
+    }
+    dumpbuf((char *)frame->data, frame->caplen);
+    /**
+     * flush the buffer so that we don't have to rely on stdbuf, as in
+     *     sudo stdbuf -o 0 ./ethercap eth0 | tee frame_captured.txt
+     */
+    fflush(stdout);
+
+    funlockfile(stdout);
+}
+
+/* a frame kept by the patterns in it, as a line of text to stdout */
+static void print_match(struct capframe *frame, const char *ifname,
+        const uint32_t *ids, unsigned int nids)
+{
+    flockfile(stdout);
+    printf("%lld.%09ld %s %u bytes match:", (long long)frame->ts.tv_sec,
+            frame->ts.tv_nsec, ifname, frame->len);
+    print_ids(ids, nids);
+    funlockfile(stdout);
+}
+
+/* the ids of the patterns found, to the end of the line */
+static void print_ids(const uint32_t *ids, unsigned int nids)
+{
+    unsigned int i;
+
+    for (i = 0; i < nids; i ++)
+        printf(" %u", ids[i]);
+    printf("\n");
+}
+
 static void dump_physical_address(unsigned char halen, unsigned char *addr) 
 {
     int i;
@@ -236,4 +1682,3 @@ static void dump_physical_address(unsigned char halen, unsigned char *addr)
     }
     printf("%02x", addr[halen - 1]);
 }
-
@@ -21,10 +21,17 @@
  *
  * usage: 
  *
- *      etherrecv -s src -i intf
+ *      etherrecv -s src -i intf [-f expr] [-b batch]
  *
  * where src is source address in the standard hex-digits-and-colons
- * notation, and intf is the interface name
+ * notation, and intf is the interface name. Only IEEE 802.3 frames, i.e.,
+ * those whose type/length field is a length, get past the kernel; expr,
+ * a filter expression as described in filter.c, narrows them further, e.g.,
+ *
+ *      etherrecv -s 11:22:33:44:55:77 -i eth0 -f "ether dst 11:22:33:44:55:66"
+ *
+ * Frames are received up to batch (default 32) at a time with recvmmsg(2),
+ * see rxbatch.c.
  *
  * The program uses raw socket and requires (1) effective UID 0 (root)
  * privilege or (2) CAP_NET_RAW capability. 
@@ -62,6 +69,8 @@
 #include <signal.h>
 
 #include "buffer.h"
+#include "filter.h"
+#include "rxbatch.h"
 #include "sighandler.h"
 
 /* protocol number is a todo */
@@ -72,6 +81,8 @@
 struct cmd_line_args {
     char *src;
     char *inf;
+    char *filter;
+    unsigned int batch;
 };
 
 struct ether_frame {
@@ -86,17 +97,16 @@ static int build_sockaddr_ll(int sockfd,
         struct cmd_line_args *args, struct sockaddr_ll *addr);
 static int get_if_index(int sockfd, char *inf);
 static void print_payload(struct ether_frame *frame);
+static int attach_filter(int sockfd, struct cmd_line_args *args);
+static void handle_frame(struct capframe *frame, void *arg);
 
 static int sockfd = -1; 
+static struct rxbatch rx;
 
 int main(int argc, char *argv[]) 
 {
     struct cmd_line_args args;
     struct sockaddr_ll sll_addr;
-    struct ether_frame frame;
-    socklen_t addr_len; 
-    ssize_t num_recv;
-    int ether_type;
 
     /* handle CTRL-C */
     setupsignal(SIGINT, cleanup);
@@ -116,57 +126,72 @@ int main(int argc, char *argv[])
         exit(1);
     }
     
+    /* 
+     * have the kernel drop the frames we are not interested in instead of
+     * copying every frame to us and throwing it away below
+     */
+    if (!attach_filter(sockfd, &args)) {
+        close(sockfd);
+        exit(1);
+    }
+
     /* build sockaddr_ll structure */
     build_sockaddr_ll(sockfd, &args, &sll_addr);
 
+    /* allocate the buffers for a batch of frames */
+    if (rxbatch_init(&rx, args.batch, sizeof(struct ether_frame), 0) != 0) {
+        close(sockfd);
+        exit(1);
+    }
+
     /* receive frames */
     fprintf(stderr, "Waiting for a frame to arrive ...\n");
     while(1) {
-        addr_len = sizeof(sll_addr);
-        num_recv = recvfrom(sockfd, 
-                            &frame, 
-                            sizeof(frame), 
-                            0, 
-                            (struct sockaddr *)&sll_addr, 
-                            &addr_len);
-
-        if (num_recv == -1) {
+        if (rxbatch_recv(&rx, sockfd, handle_frame, args.inf) < 0) {
             fprintf(stderr,
-                    "Error: recvfrom(...) return error: %s\n",
+                    "Error: recvmmsg(...) return error: %s\n",
                     strerror(errno));
-            continue;
-        }
-        
-        ether_type = ntohs(frame.hdr.ether_type);
-
-        /* 
-         * Below is a simple method to determine if the frame is from program
-         * ethersend. 
-         *
-         * This may not match sender (ethersend). To avoid receiving irrelevant
-         * message, we'd better to define a protocol number, fill the
-         * ether_type field type at the sender, and add a header to the payload
-         * packet. The header can have a field of length. 
-         *
-         * See comment in program ethersend 
-         * */
-
-        if (ether_type <= ETHERMTU) {
-            print_payload(&frame);
-            fprintf(stderr, 
-                    "INFO: received %zu bytes from %s\n", num_recv, args.inf);
-            dumpbuf((char *)&frame, num_recv);
-            fprintf(stderr, "Waiting for a frame to arrive ...\n");
         }
     }
 
+    rxbatch_free(&rx);
     close(sockfd);
     return 0;
 }
 
+static void handle_frame(struct capframe *cf, void *arg)
+{
+    struct ether_frame *frame = (struct ether_frame *)cf->data;
+    char *inf = arg;
+    int ether_type;
+
+    ether_type = ntohs(frame->hdr.ether_type);
+
+    /* 
+     * Below is a simple method to determine if the frame is from program
+     * ethersend. 
+     *
+     * This may not match sender (ethersend). To avoid receiving irrelevant
+     * message, we'd better to define a protocol number, fill the
+     * ether_type field type at the sender, and add a header to the payload
+     * packet. The header can have a field of length. 
+     *
+     * See comment in program ethersend 
+     * */
+
+    if (ether_type <= ETHERMTU) {
+        print_payload(frame);
+        fprintf(stderr, 
+                "INFO: received %u bytes from %s\n", cf->caplen, inf);
+        dumpbuf((char *)frame, cf->caplen);
+        fprintf(stderr, "Waiting for a frame to arrive ...\n");
+    }
+}
+
 static int parse_cmd_line(int argc, char *argv[], struct cmd_line_args *args)
 {
     memset(args, '\0', sizeof(*args));
+    args->batch = RXBATCH_DEFAULT;
 
     argc --;     
     argv ++;
@@ -181,6 +206,16 @@ static int parse_cmd_line(int argc, char *argv[], struct cmd_line_args *args)
                 return 0;
             }
             args->inf = *(argv + 1);
+        } else if (!strcmp(*argv, "-f")) {
+            if (argc < 2) {
+                return 0;
+            }
+            args->filter = *(argv + 1);
+        } else if (!strcmp(*argv, "-b")) {
+            if (argc < 2) {
+                return 0;
+            }
+            args->batch = atoi(*(argv + 1));
         }
 
         argc -= 2;
@@ -195,7 +230,8 @@ static int parse_cmd_line(int argc, char *argv[], struct cmd_line_args *args)
 
 static void usage() 
 {
-    fprintf(stderr, "Usage: etherrecv -s src -i intf\n");
+    fprintf(stderr, 
+            "Usage: etherrecv -s src -i intf [-f expr] [-b batch]\n");
 }
 
 static void cleanup(int s __attribute__((unused)))
@@ -203,6 +239,7 @@ static void cleanup(int s __attribute__((unused)))
     fflush(stderr);
     fflush(stdout);
     fprintf(stderr, "\nUser pressed CTRL-C. Exiting ...\n");
+    rxbatch_stats_print(&rx.stats, rx.nslots, stderr);
     if (sockfd >= 0) close(sockfd);
     exit(0);
 }
@@ -216,6 +253,27 @@ static void print_payload(struct ether_frame *frame)
     putchar('\n');
 }
 
+/*
+ * compile and attach the kernel filter: the ether_type <= ETHERMTU test
+ * below, and the user's expression if given
+ */
+static int attach_filter(int sockfd, struct cmd_line_args *args)
+{
+    static struct filter filter;
+    char expr[1024], err[FILTER_ERRLEN];
+
+    if (args->filter != NULL)
+        snprintf(expr, sizeof(expr), "llc and (%s)", args->filter);
+    else
+        snprintf(expr, sizeof(expr), "llc");
+
+    if (filter_compile(&filter, expr, sizeof(struct ether_frame), err) != 0) {
+        fprintf(stderr, "ERROR: %s\n", err);
+        return 0;
+    }
+    return filter_attach(sockfd, &filter) == 0;
+}
+
 static int build_sockaddr_ll(int sockfd, 
     struct cmd_line_args *args, struct sockaddr_ll *addr)
 {
@@ -0,0 +1,919 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * compile a small filter expression into a classic BPF program that the
+ * kernel runs on every frame before it is queued to the socket (see
+ * Documentation/networking/filter.rst in the Linux source tree). Frames the
+ * program rejects are dropped in the kernel and never copied to us.
+ *
+ * The expression language is a small subset of that of pcap-filter(7):
+ *
+ *     expr := term { (or | ||) term }
+ *     term := factor { (and | &&) factor }
+ *     factor := (not | !) factor | ( expr ) | primitive
+ *
+ *     primitive :=
+ *         ether type T          EtherType T, a number or ip, ip6, arp, ...
+ *         ether src|dst|host M  source/destination/either MAC address M
+ *         llc                   an IEEE 802.3 frame, EtherType <= 1500
+ *         vlan [ID]             an IEEE 802.1Q/802.1ad frame [of VLAN ID]
+ *         ip | ip6 | arp        the EtherType of IPv4, IPv6 or ARP
+ *         ip proto P            IPv4 with protocol P, a number or a name
+ *         ip6 proto P           IPv6 with next header P
+ *         proto P               either of the two above
+ *         tcp | udp | sctp      IPv4 or IPv6 with that protocol
+ *         icmp | icmp6          ICMP over IPv4, ICMPv6 over IPv6
+ *         [tcp|udp|sctp] [src|dst] port N
+ *                               a TCP, UDP or SCTP source/destination/either
+ *                               port N, IPv4 or IPv6
+ *
+ * The Linux kernel strips the VLAN tag of most frames before AF_PACKET
+ * sockets see them and reports it as ancillary data. Therefore vlan looks
+ * at the ancillary data first and at the frame itself second, and the
+ * IP, port and protocol primitives assume the frame as delivered, i.e.,
+ * with the tag removed. As in pcap-filter(7), port and protocol tests do
+ * not follow IPv6 extension headers.
+ *
+ * The code is generated while the expression is parsed, with a true and a
+ * false label handed down to each subexpression. All jumps go forward, the
+ * labels are resolved to jump offsets after the whole expression has been
+ * parsed. The program ends in "ret #snaplen" for accepted frames, which
+ * also truncates them to snaplen bytes, and "ret #0" for rejected frames.
+ *
+ * filter_run() interprets a program, this or any other, for frames that
+ * do not come through a socket, e.g., those replayed from a file. It takes
+ * the outer tag out of a copy of the header and reports it as ancillary
+ * data, as the kernel does, so that a frame matches the same whether it
+ * is captured or replayed.
+ */
+
+#include <sys/socket.h>
+#include <netinet/ether.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "filter.h"
+
+#define MAX_LABELS      1024
+#define L_NEXT          (-1)    /* the instruction that follows */
+
+#define ETHERTYPE_OFF   12
+#define IP_OFF          14      /* IPv4/IPv6 header, tag stripped */
+#define IPV4_PROTO_OFF  (IP_OFF + 9)
+#define IPV4_FRAG_OFF   (IP_OFF + 6)
+#define IPV6_NXT_OFF    (IP_OFF + 6)
+#define IPV6_L4_OFF     (IP_OFF + 40)
+#define VLAN_TAG_LEN    4
+#define UNTAG_COPY      128     /* header bytes copied without the tag */
+
+#define DIR_ANY         0
+#define DIR_SRC         1
+#define DIR_DST         2
+
+struct compiler {
+    const char *pos;            /* where the next token begins        */
+    char tok[64];               /* the current token, "" at the end   */
+    struct filter *flt;
+    int jt[BPF_MAXINSNS];       /* labels of the jump targets         */
+    int jf[BPF_MAXINSNS];
+    int label_pos[MAX_LABELS];  /* instruction a label is placed at   */
+    int label_alias[MAX_LABELS];/* or the label it stands for         */
+    int nlabels;
+    int accept, reject;
+    char *err;
+};
+
+/* a frame as a socket filter sees it, the outer VLAN tag taken out */
+struct untagged {
+    const unsigned char *head;  /* the first hlen bytes               */
+    const unsigned char *rest;  /* the bytes from hlen on             */
+    unsigned int hlen;
+    unsigned int caplen, len;
+    int tagged;                 /* a tag was taken out, tpid and tci  */
+    unsigned int tpid, tci;
+    unsigned char copy[UNTAG_COPY];
+};
+
+struct named_number {
+    const char *name;
+    unsigned int value;
+};
+
+static const struct named_number ethertypes[] = {
+    {"ip",   0x0800},
+    {"arp",  0x0806},
+    {"vlan", 0x8100},
+    {"ip6",  0x86dd},
+    {"qinq", 0x88a8},
+    {"lldp", 0x88cc},
+    {NULL,   0}
+};
+
+static const struct named_number protocols[] = {
+    {"icmp",  1},
+    {"tcp",   6},
+    {"udp",   17},
+    {"icmp6", 58},
+    {"sctp",  132},
+    {NULL,    0}
+};
+
+static void next(struct compiler *c);
+static int accept_tok(struct compiler *c, const char *s, const char *alt);
+static int fail(struct compiler *c, const char *what);
+static int number(struct compiler *c, unsigned int max, unsigned int *n);
+static int named_number(struct compiler *c, const char *what,
+        unsigned int max, unsigned int *n, const struct named_number *p);
+static int new_label(struct compiler *c);
+static void place(struct compiler *c, int label);
+static void alias(struct compiler *c, int label, int target);
+static int resolve(struct compiler *c, int label);
+static int emit(struct compiler *c, unsigned short code, unsigned int k);
+static int emit_jmp(struct compiler *c, unsigned short code, unsigned int k,
+        int t, int f);
+static int parse_or(struct compiler *c, int t, int f);
+static int parse_and(struct compiler *c, int t, int f);
+static int parse_factor(struct compiler *c, int t, int f);
+static int parse_primitive(struct compiler *c, int t, int f);
+static int gen_ethertype(struct compiler *c, unsigned int type, int t, int f);
+static int gen_ether_addr(struct compiler *c, int dir,
+        const unsigned char *mac, int t, int f);
+static int gen_vlan(struct compiler *c, int has_id, unsigned int id,
+        int t, int f);
+static int gen_proto(struct compiler *c, int family, unsigned int proto,
+        int t, int f);
+static int gen_l4_proto(struct compiler *c, unsigned int proto,
+        int t, int f);
+static int gen_port_cmp(struct compiler *c, unsigned short mode,
+        unsigned int off, int dir, unsigned int port, int t, int f);
+static int gen_port(struct compiler *c, unsigned int proto, int dir,
+        unsigned int port, int t, int f);
+static void untag(struct untagged *u, const struct capframe *frame);
+static unsigned int ancillary(const struct untagged *u,
+        const struct capframe *frame, unsigned int n);
+static int alu(unsigned short code, unsigned int *a, unsigned int operand);
+static int jump(const struct sock_filter *in, unsigned int a, unsigned int x);
+
+/*
+ * compile expr (NULL or empty accepts every frame) into flt. Returns 0, or
+ * -1 with a message in err, which holds FILTER_ERRLEN bytes.
+ */
+int filter_compile(struct filter *flt, const char *expr,
+        unsigned int snaplen, char *err)
+{
+    static struct compiler cc;  /* too big for the stack, not reentrant */
+    struct compiler *c = &cc;
+    int i, t, f;
+
+    memset(c, 0, sizeof(*c));
+    c->flt = flt;
+    c->err = err;
+    c->pos = expr != NULL ? expr : "";
+    flt->len = 0;
+    err[0] = '\0';
+
+    c->accept = new_label(c);
+    c->reject = new_label(c);
+
+    next(c);
+    if (c->tok[0] != '\0') {
+        if (parse_or(c, c->accept, c->reject) != 0)
+            return -1;
+        if (c->tok[0] != '\0')
+            return fail(c, "unexpected");
+    }
+
+    place(c, c->accept);
+    if (emit(c, BPF_RET | BPF_K, snaplen) < 0)
+        return -1;
+    place(c, c->reject);
+    if (emit(c, BPF_RET | BPF_K, 0) < 0)
+        return -1;
+
+    /* turn the labels into jump offsets */
+    for (i = 0; i < flt->len; i ++) {
+        if (BPF_CLASS(flt->insns[i].code) != BPF_JMP)
+            continue;
+        t = resolve(c, c->jt[i]);
+        f = resolve(c, c->jf[i]);
+        t = t == L_NEXT ? 0 : t - (i + 1);
+        f = f == L_NEXT ? 0 : f - (i + 1);
+        if (BPF_OP(flt->insns[i].code) == BPF_JA) {
+            flt->insns[i].k = t;
+        } else if (t < 0 || t > 255 || f < 0 || f > 255) {
+            snprintf(err, FILTER_ERRLEN, "filter expression is too complex");
+            return -1;
+        } else {
+            flt->insns[i].jt = t;
+            flt->insns[i].jf = f;
+        }
+    }
+
+    return 0;
+}
+
+int filter_attach(int sockfd, const struct filter *flt)
+{
+    struct sock_fprog prog;
+    char c;
+
+    prog.len = flt->len;
+    prog.filter = (struct sock_filter *)flt->insns;
+    if (setsockopt(sockfd, SOL_SOCKET,
+                SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0) {
+        perror("setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, ...)");
+        return -1;
+    }
+
+    /* throw away what has been queued before the filter was in place */
+    while (recv(sockfd, &c, 1, MSG_DONTWAIT) >= 0)
+        ;
+
+    return 0;
+}
+
+/* print the program as C initializers, like tcpdump -dd */
+void filter_dump(const struct filter *flt, FILE *fp)
+{
+    int i;
+
+    for (i = 0; i < flt->len; i ++) {
+        fprintf(fp, "{ 0x%02x, %u, %u, 0x%08x },\n", flt->insns[i].code,
+                flt->insns[i].jt, flt->insns[i].jf, flt->insns[i].k);
+    }
+}
+
+/* byte k of the frame without its outer tag */
+static inline unsigned int byte_at(const struct untagged *u, unsigned int k)
+{
+    return k < u->hlen ? u->head[k] : u->rest[k];
+}
+
+/* bytes to keep of the tagged frame for n of the untagged one */
+static inline unsigned int kept(const struct untagged *u, unsigned int n)
+{
+    if (n == 0 || !u->tagged || n > UINT_MAX - VLAN_TAG_LEN)
+        return n;
+    return n + VLAN_TAG_LEN;
+}
+
+/*
+ * run the program on a frame in userspace, as the kernel would, e.g., on
+ * frames read from a capture file. Returns the number of bytes to keep, 0
+ * to drop the frame. The frame has its VLAN tags in place, the outer one
+ * is taken out and served by the ancillary VLAN loads as the kernel does.
+ */
+unsigned int filter_run(const struct filter *flt, const struct capframe *frame)
+{
+    struct untagged u;
+    unsigned int len, a = 0, x = 0, mem[BPF_MEMWORDS], k;
+    const struct sock_filter *in;
+    int pc;
+
+    untag(&u, frame);
+    len = u.caplen;
+    memset(mem, 0, sizeof(mem));
+    for (pc = 0; pc < flt->len; pc ++) {
+        in = &flt->insns[pc];
+        k = in->k;
+        switch (in->code) {
+            case BPF_LD | BPF_W | BPF_ABS:
+            case BPF_LD | BPF_H | BPF_ABS:
+            case BPF_LD | BPF_B | BPF_ABS:
+            case BPF_LD | BPF_W | BPF_IND:
+            case BPF_LD | BPF_H | BPF_IND:
+            case BPF_LD | BPF_B | BPF_IND:
+                if (BPF_MODE(in->code) == BPF_IND)
+                    k += x;
+                else if (k >= (unsigned int)SKF_AD_OFF) {
+                    a = ancillary(&u, frame, k - SKF_AD_OFF);
+                    break;
+                }
+                /* out of the frame: drop it, as the kernel does */
+                switch (BPF_SIZE(in->code)) {
+                    case BPF_W:
+                        if (k > len || len - k < 4)
+                            return 0;
+                        a = (uint32_t)byte_at(&u, k) << 24
+                            | byte_at(&u, k + 1) << 16
+                            | byte_at(&u, k + 2) << 8 | byte_at(&u, k + 3);
+                        break;
+                    case BPF_H:
+                        if (k > len || len - k < 2)
+                            return 0;
+                        a = byte_at(&u, k) << 8 | byte_at(&u, k + 1);
+                        break;
+                    default:
+                        if (k >= len)
+                            return 0;
+                        a = byte_at(&u, k);
+                        break;
+                }
+                break;
+            case BPF_LD | BPF_W | BPF_LEN:
+                a = u.len;
+                break;
+            case BPF_LDX | BPF_W | BPF_LEN:
+                x = u.len;
+                break;
+            case BPF_LD | BPF_IMM:
+                a = k;
+                break;
+            case BPF_LDX | BPF_IMM:
+                x = k;
+                break;
+            case BPF_LDX | BPF_B | BPF_MSH:
+                if (k >= len)
+                    return 0;
+                x = (byte_at(&u, k) & 0xf) << 2;
+                break;
+            case BPF_LD | BPF_MEM:
+                a = mem[k % BPF_MEMWORDS];
+                break;
+            case BPF_LDX | BPF_MEM:
+                x = mem[k % BPF_MEMWORDS];
+                break;
+            case BPF_ST:
+                mem[k % BPF_MEMWORDS] = a;
+                break;
+            case BPF_STX:
+                mem[k % BPF_MEMWORDS] = x;
+                break;
+            case BPF_RET | BPF_K:
+                return kept(&u, k);
+            case BPF_RET | BPF_A:
+                return kept(&u, a);
+            case BPF_MISC | BPF_TAX:
+                x = a;
+                break;
+            case BPF_MISC | BPF_TXA:
+                a = x;
+                break;
+            default:
+                if (BPF_CLASS(in->code) == BPF_ALU) {
+                    if (alu(in->code, &a, BPF_SRC(in->code) == BPF_X ?
+                                x : k) != 0)
+                        return 0;
+                } else if (BPF_CLASS(in->code) == BPF_JMP) {
+                    pc += jump(in, a, x);
+                } else {
+                    return 0;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+static void next(struct compiler *c)
+{
+    size_t n = 0;
+
+    while (isspace((unsigned char)*c->pos))
+        c->pos ++;
+
+    if (*c->pos == '(' || *c->pos == ')'
+            || (*c->pos == '!' && c->pos[1] != '=')) {
+        c->tok[n ++] = *c->pos ++;
+    } else if ((c->pos[0] == '&' && c->pos[1] == '&')
+            || (c->pos[0] == '|' && c->pos[1] == '|')) {
+        c->tok[n ++] = *c->pos ++;
+        c->tok[n ++] = *c->pos ++;
+    } else {
+        while (*c->pos != '\0' && !isspace((unsigned char)*c->pos)
+                && *c->pos != '(' && *c->pos != ')' && *c->pos != '!') {
+            if (n < sizeof(c->tok) - 1)
+                c->tok[n ++] = *c->pos;
+            c->pos ++;
+        }
+    }
+    c->tok[n] = '\0';
+}
+
+/* consume the current token if it is s (or alt) */
+static int accept_tok(struct compiler *c, const char *s, const char *alt)
+{
+    if (!strcmp(c->tok, s) || (alt != NULL && !strcmp(c->tok, alt))) {
+        next(c);
+        return 1;
+    }
+    return 0;
+}
+
+static int fail(struct compiler *c, const char *what)
+{
+    if (c->tok[0] != '\0') {
+        snprintf(c->err, FILTER_ERRLEN,
+                "filter: %s '%s'", what, c->tok);
+    } else {
+        snprintf(c->err, FILTER_ERRLEN,
+                "filter: %s end of expression", what);
+    }
+    return -1;
+}
+
+static int number(struct compiler *c, unsigned int max, unsigned int *n)
+{
+    unsigned long v;
+    char *end;
+
+    if (!isdigit((unsigned char)c->tok[0]))
+        return fail(c, "expected a number but got");
+    errno = 0;
+    v = strtoul(c->tok, &end, 0);
+    if (*end != '\0' || errno != 0 || v > max)
+        return fail(c, "invalid number");
+    *n = v;
+    next(c);
+    return 0;
+}
+
+/* a number or one of names */
+static int named_number(struct compiler *c, const char *what,
+        unsigned int max, unsigned int *n, const struct named_number *p)
+{
+    if (isdigit((unsigned char)c->tok[0]))
+        return number(c, max, n);
+    for (; p->name != NULL; p ++) {
+        if (!strcmp(p->name, c->tok)) {
+            *n = p->value;
+            next(c);
+            return 0;
+        }
+    }
+    return fail(c, what);
+}
+
+static int new_label(struct compiler *c)
+{
+    if (c->nlabels == MAX_LABELS)
+        return L_NEXT;
+    c->label_pos[c->nlabels] = -1;
+    c->label_alias[c->nlabels] = -1;
+    return c->nlabels ++;
+}
+
+static void place(struct compiler *c, int label)
+{
+    if (label >= 0)
+        c->label_pos[label] = c->flt->len;
+}
+
+static void alias(struct compiler *c, int label, int target)
+{
+    if (label >= 0)
+        c->label_alias[label] = target;
+}
+
+static int resolve(struct compiler *c, int label)
+{
+    while (label >= 0 && c->label_alias[label] >= 0)
+        label = c->label_alias[label];
+    return label >= 0 ? c->label_pos[label] : L_NEXT;
+}
+
+static int emit(struct compiler *c, unsigned short code, unsigned int k)
+{
+    return emit_jmp(c, code, k, L_NEXT, L_NEXT);
+}
+
+static int emit_jmp(struct compiler *c, unsigned short code, unsigned int k,
+        int t, int f)
+{
+    struct filter *flt = c->flt;
+
+    if (flt->len == BPF_MAXINSNS || c->nlabels == MAX_LABELS) {
+        snprintf(c->err, FILTER_ERRLEN, "filter expression is too long");
+        return -1;
+    }
+    flt->insns[flt->len].code = code;
+    flt->insns[flt->len].jt = 0;
+    flt->insns[flt->len].jf = 0;
+    flt->insns[flt->len].k = k;
+    c->jt[flt->len] = t;
+    c->jf[flt->len] = f;
+    return flt->len ++;
+}
+
+static int parse_or(struct compiler *c, int t, int f)
+{
+    int l;
+
+    while (1) {
+        l = new_label(c);
+        if (parse_and(c, t, l) != 0)
+            return -1;
+        if (!accept_tok(c, "or", "||")) {
+            alias(c, l, f);
+            return 0;
+        }
+        place(c, l);
+    }
+}
+
+static int parse_and(struct compiler *c, int t, int f)
+{
+    int l;
+
+    while (1) {
+        l = new_label(c);
+        if (parse_factor(c, l, f) != 0)
+            return -1;
+        if (!accept_tok(c, "and", "&&")) {
+            alias(c, l, t);
+            return 0;
+        }
+        place(c, l);
+    }
+}
+
+static int parse_factor(struct compiler *c, int t, int f)
+{
+    if (accept_tok(c, "not", "!"))
+        return parse_factor(c, f, t);
+
+    if (accept_tok(c, "(", NULL)) {
+        if (parse_or(c, t, f) != 0)
+            return -1;
+        if (!accept_tok(c, ")", NULL))
+            return fail(c, "expected ')' but got");
+        return 0;
+    }
+
+    return parse_primitive(c, t, f);
+}
+
+static int parse_primitive(struct compiler *c, int t, int f)
+{
+    struct ether_addr mac;
+    unsigned int n, proto = 0;
+    int dir = DIR_ANY, l;
+
+    if (accept_tok(c, "ether", NULL)) {
+        if (accept_tok(c, "type", NULL)) {
+            if (named_number(c, "unknown EtherType",
+                        0xffff, &n, ethertypes) != 0)
+                return -1;
+            return gen_ethertype(c, n, t, f);
+        }
+        if (accept_tok(c, "src", NULL))
+            dir = DIR_SRC;
+        else if (accept_tok(c, "dst", NULL))
+            dir = DIR_DST;
+        else if (!accept_tok(c, "host", NULL))
+            return fail(c, "expected type, src, dst or host but got");
+        if (ether_aton_r(c->tok, &mac) == NULL)
+            return fail(c, "invalid MAC address");
+        next(c);
+        if (dir != DIR_ANY)
+            return gen_ether_addr(c, dir, mac.ether_addr_octet, t, f);
+        l = new_label(c);
+        if (gen_ether_addr(c, DIR_SRC, mac.ether_addr_octet, t, l) != 0)
+            return -1;
+        place(c, l);
+        return gen_ether_addr(c, DIR_DST, mac.ether_addr_octet, t, f);
+    }
+
+    if (accept_tok(c, "llc", NULL)) {
+        if (emit(c, BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF) < 0)
+            return -1;
+        return emit_jmp(c, BPF_JMP | BPF_JGT | BPF_K, 1500, f, t) < 0 ? -1 : 0;
+    }
+
+    if (accept_tok(c, "vlan", NULL)) {
+        if (!isdigit((unsigned char)c->tok[0]))
+            return gen_vlan(c, 0, 0, t, f);
+        if (number(c, 4095, &n) != 0)
+            return -1;
+        return gen_vlan(c, 1, n, t, f);
+    }
+
+    if (accept_tok(c, "arp", NULL))
+        return gen_ethertype(c, 0x0806, t, f);
+
+    if (accept_tok(c, "ip", NULL)) {
+        if (!accept_tok(c, "proto", NULL))
+            return gen_ethertype(c, 0x0800, t, f);
+        if (named_number(c, "unknown protocol", 255, &n, protocols) != 0)
+            return -1;
+        return gen_proto(c, 4, n, t, f);
+    }
+
+    if (accept_tok(c, "ip6", NULL)) {
+        if (!accept_tok(c, "proto", NULL))
+            return gen_ethertype(c, 0x86dd, t, f);
+        if (named_number(c, "unknown protocol", 255, &n, protocols) != 0)
+            return -1;
+        return gen_proto(c, 6, n, t, f);
+    }
+
+    if (accept_tok(c, "proto", NULL)) {
+        if (named_number(c, "unknown protocol", 255, &n, protocols) != 0)
+            return -1;
+        return gen_proto(c, 0, n, t, f);
+    }
+
+    if (accept_tok(c, "icmp", NULL))
+        return gen_proto(c, 4, 1, t, f);
+    if (accept_tok(c, "icmp6", NULL))
+        return gen_proto(c, 6, 58, t, f);
+
+    /* [tcp|udp|sctp] [src|dst] port N, or just tcp, udp or sctp */
+    if (accept_tok(c, "tcp", NULL))
+        proto = 6;
+    else if (accept_tok(c, "udp", NULL))
+        proto = 17;
+    else if (accept_tok(c, "sctp", NULL))
+        proto = 132;
+
+    if (accept_tok(c, "src", NULL))
+        dir = DIR_SRC;
+    else if (accept_tok(c, "dst", NULL))
+        dir = DIR_DST;
+
+    if (!accept_tok(c, "port", NULL)) {
+        if (proto != 0 && dir == DIR_ANY)
+            return gen_proto(c, 0, proto, t, f);
+        return fail(c, "unknown primitive");
+    }
+    if (number(c, 65535, &n) != 0)
+        return -1;
+    return gen_port(c, proto, dir, n, t, f);
+}
+
+static int gen_ethertype(struct compiler *c, unsigned int type, int t, int f)
+{
+    if (emit(c, BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF) < 0)
+        return -1;
+    return emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, type, t, f) < 0 ? -1 : 0;
+}
+
+static int gen_ether_addr(struct compiler *c, int dir,
+        const unsigned char *mac, int t, int f)
+{
+    unsigned int off = dir == DIR_SRC ? 6 : 0;
+    uint32_t lo = (uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16
+        | (uint32_t)mac[4] << 8 | mac[5];
+    uint32_t hi = (uint32_t)mac[0] << 8 | mac[1];
+
+    if (emit(c, BPF_LD | BPF_W | BPF_ABS, off + 2) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, lo, L_NEXT, f) < 0
+            || emit(c, BPF_LD | BPF_H | BPF_ABS, off) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, hi, t, f) < 0)
+        return -1;
+    return 0;
+}
+
+static int gen_vlan(struct compiler *c, int has_id, unsigned int id,
+        int t, int f)
+{
+    int inframe = new_label(c), tagged = new_label(c);
+
+    /* the tag the kernel has taken off the frame */
+    if (emit(c, BPF_LD | BPF_W | BPF_ABS,
+                SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 0, inframe, L_NEXT) < 0)
+        return -1;
+    if (has_id) {
+        if (emit(c, BPF_LD | BPF_W | BPF_ABS,
+                    SKF_AD_OFF + SKF_AD_VLAN_TAG) < 0
+                || emit(c, BPF_ALU | BPF_AND | BPF_K, 0x0fff) < 0
+                || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, id, t, f) < 0)
+            return -1;
+    } else if (emit_jmp(c, BPF_JMP | BPF_JA, 0, t, L_NEXT) < 0) {
+        return -1;
+    }
+
+    /* or a tag still in the frame */
+    place(c, inframe);
+    if (emit(c, BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K,
+                0x8100, has_id ? tagged : t, L_NEXT) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K,
+                0x88a8, has_id ? tagged : t, f) < 0)
+        return -1;
+    if (has_id) {
+        place(c, tagged);
+        if (emit(c, BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF + 2) < 0
+                || emit(c, BPF_ALU | BPF_AND | BPF_K, 0x0fff) < 0
+                || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, id, t, f) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* family 4, 6 or 0 for either */
+static int gen_proto(struct compiler *c, int family, unsigned int proto,
+        int t, int f)
+{
+    int v6 = family == 0 ? new_label(c) : f;
+
+    if (emit(c, BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF) < 0)
+        return -1;
+
+    if (family != 6) {
+        if (emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 0x0800, L_NEXT, v6) < 0
+                || emit(c, BPF_LD | BPF_B | BPF_ABS, IPV4_PROTO_OFF) < 0
+                || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, proto, t, f) < 0)
+            return -1;
+    }
+
+    /* A still holds the EtherType when we get here */
+    if (family != 4) {
+        place(c, v6);
+        if (emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 0x86dd, L_NEXT, f) < 0
+                || emit(c, BPF_LD | BPF_B | BPF_ABS, IPV6_NXT_OFF) < 0
+                || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, proto, t, f) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* test the protocol in A: proto, or any of TCP, UDP and SCTP if 0 */
+static int gen_l4_proto(struct compiler *c, unsigned int proto, int t, int f)
+{
+    if (proto != 0)
+        return emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, proto, t, f) < 0
+            ? -1 : 0;
+    if (emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 6, t, L_NEXT) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 17, t, L_NEXT) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 132, t, f) < 0)
+        return -1;
+    return 0;
+}
+
+/* compare the source and/or the destination port at [X + off] with port */
+static int gen_port_cmp(struct compiler *c, unsigned short mode,
+        unsigned int off, int dir, unsigned int port, int t, int f)
+{
+    if (dir != DIR_DST) {
+        if (emit(c, BPF_LD | BPF_H | mode, off) < 0
+                || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, port,
+                    t, dir == DIR_SRC ? f : L_NEXT) < 0)
+            return -1;
+    }
+    if (dir != DIR_SRC) {
+        if (emit(c, BPF_LD | BPF_H | mode, off + 2) < 0
+                || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, port, t, f) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int gen_port(struct compiler *c, unsigned int proto, int dir,
+        unsigned int port, int t, int f)
+{
+    int v6 = new_label(c), l4 = new_label(c), l4v6 = new_label(c);
+
+    if (emit(c, BPF_LD | BPF_H | BPF_ABS, ETHERTYPE_OFF) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 0x0800, L_NEXT, v6) < 0
+            || emit(c, BPF_LD | BPF_B | BPF_ABS, IPV4_PROTO_OFF) < 0
+            || gen_l4_proto(c, proto, l4, f) != 0)
+        return -1;
+
+    /* IPv4: only the first fragment has the ports, X = header length */
+    place(c, l4);
+    if (emit(c, BPF_LD | BPF_H | BPF_ABS, IPV4_FRAG_OFF) < 0
+            || emit_jmp(c, BPF_JMP | BPF_JSET | BPF_K, 0x1fff, f, L_NEXT) < 0
+            || emit(c, BPF_LDX | BPF_B | BPF_MSH, IP_OFF) < 0
+            || gen_port_cmp(c, BPF_IND, IP_OFF, dir, port, t, f) != 0)
+        return -1;
+
+    /* IPv6: A still holds the EtherType when we get here */
+    place(c, v6);
+    if (emit_jmp(c, BPF_JMP | BPF_JEQ | BPF_K, 0x86dd, L_NEXT, f) < 0
+            || emit(c, BPF_LD | BPF_B | BPF_ABS, IPV6_NXT_OFF) < 0
+            || gen_l4_proto(c, proto, l4v6, f) != 0)
+        return -1;
+    place(c, l4v6);
+    return gen_port_cmp(c, BPF_ABS, IPV6_L4_OFF, dir, port, t, f);
+}
+
+/*
+ * take the outer 802.1Q/802.1ad tag out of a copy of the header, as the
+ * kernel does before a socket filter sees the frame. The bytes beyond the
+ * copy are read from the frame, 4 bytes further on.
+ */
+static void untag(struct untagged *u, const struct capframe *frame)
+{
+    const unsigned char *d = frame->data;
+    unsigned int type, n;
+
+    u->head = u->rest = d;
+    u->hlen = u->caplen = frame->caplen;
+    u->len = frame->len;
+    u->tagged = 0;
+    u->tpid = u->tci = 0;
+    if (frame->caplen < ETHERTYPE_OFF + VLAN_TAG_LEN)
+        return;
+    type = d[ETHERTYPE_OFF] << 8 | d[ETHERTYPE_OFF + 1];
+    if (type != 0x8100 && type != 0x88a8)
+        return;
+
+    u->tagged = 1;
+    u->tpid = type;
+    u->tci = d[ETHERTYPE_OFF + 2] << 8 | d[ETHERTYPE_OFF + 3];
+    u->caplen -= VLAN_TAG_LEN;
+    u->len -= u->len >= VLAN_TAG_LEN ? VLAN_TAG_LEN : u->len;
+    n = u->caplen < UNTAG_COPY ? u->caplen : UNTAG_COPY;
+    memcpy(u->copy, d, ETHERTYPE_OFF);
+    memcpy(u->copy + ETHERTYPE_OFF, d + ETHERTYPE_OFF + VLAN_TAG_LEN,
+            n - ETHERTYPE_OFF);
+    u->head = u->copy;
+    u->hlen = n;
+    u->rest = d + VLAN_TAG_LEN;
+}
+
+/* the ancillary data the kernel would have for the frame, see filter.h */
+static unsigned int ancillary(const struct untagged *u,
+        const struct capframe *frame, unsigned int n)
+{
+    switch (n) {
+        case SKF_AD_PROTOCOL:
+            if (u->caplen < ETHERTYPE_OFF + 2)
+                return 0;
+            return byte_at(u, ETHERTYPE_OFF) << 8
+                | byte_at(u, ETHERTYPE_OFF + 1);
+        case SKF_AD_PKTTYPE:
+            return frame->pkttype;
+        case SKF_AD_IFINDEX:
+            return frame->ifindex;
+        case SKF_AD_VLAN_TAG:
+            return u->tci;
+        case SKF_AD_VLAN_TAG_PRESENT:
+            return u->tagged;
+#ifdef SKF_AD_VLAN_TPID
+        case SKF_AD_VLAN_TPID:
+            return u->tpid;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/* a = a op operand, -1 on division by zero */
+static int alu(unsigned short code, unsigned int *a, unsigned int operand)
+{
+    switch (BPF_OP(code)) {
+        case BPF_ADD: *a += operand; break;
+        case BPF_SUB: *a -= operand; break;
+        case BPF_MUL: *a *= operand; break;
+        case BPF_DIV:
+            if (operand == 0)
+                return -1;
+            *a /= operand;
+            break;
+        case BPF_MOD:
+            if (operand == 0)
+                return -1;
+            *a %= operand;
+            break;
+        case BPF_AND: *a &= operand; break;
+        case BPF_OR:  *a |= operand; break;
+        case BPF_XOR: *a ^= operand; break;
+        case BPF_LSH: *a = operand < 32 ? *a << operand : 0; break;
+        case BPF_RSH: *a = operand < 32 ? *a >> operand : 0; break;
+        case BPF_NEG: *a = -*a; break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+/* how many instructions to skip */
+static int jump(const struct sock_filter *in, unsigned int a, unsigned int x)
+{
+    unsigned int operand = BPF_SRC(in->code) == BPF_X ? x : in->k;
+    int taken;
+
+    switch (BPF_OP(in->code)) {
+        case BPF_JA:   return in->k;
+        case BPF_JEQ:  taken = a == operand; break;
+        case BPF_JGT:  taken = a > operand; break;
+        case BPF_JGE:  taken = a >= operand; break;
+        case BPF_JSET: taken = (a & operand) != 0; break;
+        default:       taken = 0; break;
+    }
+    return taken ? in->jt : in->jf;
+}
@@ -0,0 +1,41 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FILTER_HD
+#define FILTER_HD
+
+#include <stdio.h>
+#include <linux/filter.h>
+
+#include "capframe.h"
+
+#define FILTER_ERRLEN       128
+#define FILTER_SNAPLEN_MAX  262144  /* accept frames as a whole */
+
+/* a classic BPF program compiled from a filter expression */
+struct filter {
+    struct sock_filter insns[BPF_MAXINSNS];
+    unsigned short len;
+};
+
+int filter_compile(struct filter *flt, const char *expr,
+        unsigned int snaplen, char *err);
+int filter_attach(int sockfd, const struct filter *flt);
+void filter_dump(const struct filter *flt, FILE *fp);
+unsigned int filter_run(const struct filter *flt, const struct capframe *frame);
+
+#endif
@@ -0,0 +1,296 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * a flight recorder: the last frames are kept in memory, in an arena
+ * allocated and faulted in once at the start, and written to a capture
+ * file only when something worth looking at has happened. Writing every
+ * frame to disk costs too much, but the frames of the seconds before an
+ * incident are the ones wanted.
+ *
+ * The arena is a ring of records, a header and the bytes of a frame each.
+ * A new frame lets go of the oldest ones until it fits, and, if a window
+ * is given, of those older than the window by the time of the new frame,
+ * thus the arena holds the last window seconds or size bytes of frames,
+ * whichever are fewer. Optionally, the arena is on hugepages, fewer TLB
+ * misses for the copies into it; if none are reserved (see
+ * /proc/sys/vm/nr_hugepages), transparent hugepages are asked for.
+ *
+ * A dump writes the frames in the arena, oldest first, into a capture
+ * file and empties the arena, so that no frame is in two dumps. The
+ * caller decides when: on a signal, on a frame that matches a filter, or
+ * when the frames of a second are more than the rate the recorder counts
+ * them against. After a dump, the frames can't trigger another until the
+ * arena has had a window, or FLIGHTREC_HOLDOFF seconds, to fill again; a
+ * signal always can. The times are those of the frames, thus a replayed
+ * file is recorded as it was captured.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "filter.h"
+#include "flightrec.h"
+
+#define NS_PER_SEC      1000000000LL
+
+/* bytes a record of caplen bytes takes in the arena */
+#define RECSIZE(caplen) \
+    ((sizeof(struct flightrec_rec) + (size_t)(caplen) + 7) & ~(size_t)7)
+
+static const char *trigger_names[FLIGHTREC_TRIGGERS] = {
+    "signal", "filter", "rate"
+};
+
+static void release(struct flightrec *fr);
+static void skip_pad(struct flightrec *fr);
+static struct flightrec_rec *record_at(const struct flightrec *fr,
+        uint64_t pos);
+
+/*
+ * an arena of size bytes, rounded up to hugepages if huge, keeping the
+ * frames of the last secs seconds (all that fit if 0) and triggering a
+ * dump on more than rate frames in a second (never if 0)
+ */
+int flightrec_init(struct flightrec *fr, size_t size, unsigned int secs,
+        unsigned long long rate, int huge)
+{
+    void *p = MAP_FAILED;
+
+    memset(fr, 0, sizeof(*fr));
+    size &= ~(size_t)7;
+    if (size < RECSIZE(FILTER_SNAPLEN_MAX)) {
+        fprintf(stderr, "ERROR: flight recorder of %zu bytes is too small\n",
+                size);
+        return -1;
+    }
+
+    if (huge) {
+        size = (size + FLIGHTREC_HUGEPAGE - 1)
+            & ~(size_t)(FLIGHTREC_HUGEPAGE - 1);
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE
+                | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED)
+            fprintf(stderr, "WARN: no hugepages for the flight recorder: "
+                    "%s\n", strerror(errno));
+        else
+            fr->huge = 1;
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "insufficient memory\n");
+            return -1;
+        }
+        if (huge)
+            madvise(p, size, MADV_HUGEPAGE);
+        /* fault the pages in now rather than while capturing */
+        memset(p, 0, size);
+    }
+
+    fr->arena = p;
+    fr->size = size;
+    fr->window = secs * NS_PER_SEC;
+    fr->holdoff = secs > 0 ? fr->window : FLIGHTREC_HOLDOFF * NS_PER_SEC;
+    fr->rate = rate;
+    fr->second = -1;
+    return 0;
+}
+
+/*
+ * keep the frame, letting go of the oldest ones to make room. Returns 1
+ * if the frame makes more than the rate in its second and the frames can
+ * trigger a dump, 0 otherwise.
+ */
+int flightrec_add(struct flightrec *fr, const struct capframe *frame)
+{
+    struct flightrec_rec *r;
+    size_t need = RECSIZE(frame->caplen), off, pad;
+    int64_t ns = frame->ts.tv_sec * NS_PER_SEC + frame->ts.tv_nsec;
+    int fire = 0;
+
+    if (fr->rate > 0) {
+        if (frame->ts.tv_sec != fr->second) {
+            fr->second = frame->ts.tv_sec;
+            fr->count = 0;
+        }
+        if (++ fr->count == fr->rate + 1 && ns >= fr->armed)
+            fire = 1;
+    }
+
+    /* a record does not wrap, the bytes to the end are skipped instead */
+    while (1) {
+        off = fr->head % fr->size;
+        pad = need > fr->size - off ? fr->size - off : 0;
+        if (fr->head + pad + need - fr->tail <= fr->size)
+            break;
+        if (fr->nframes == 0) {
+            fr->head = fr->tail = 0;
+            continue;
+        }
+        release(fr);
+    }
+    if (pad > 0) {
+        if (pad >= sizeof(*r))
+            record_at(fr, fr->head)->caplen = FLIGHTREC_PAD;
+        fr->head += pad;
+    }
+
+    r = record_at(fr, fr->head);
+    r->sec = frame->ts.tv_sec;
+    r->nsec = frame->ts.tv_nsec;
+    r->caplen = frame->caplen;
+    r->len = frame->len;
+    r->ifindex = frame->ifindex;
+    memcpy(r + 1, frame->data, frame->caplen);
+    fr->head += need;
+
+    if (fr->nframes == 0)
+        fr->oldest = ns;
+    fr->newest = ns;
+    fr->nframes ++;
+    fr->nbytes += frame->caplen;
+    fr->stats.frames ++;
+    fr->stats.bytes += frame->caplen;
+
+    /* the newest frame stays, however old the others */
+    if (fr->window > 0) {
+        while (fr->nframes > 1 && fr->oldest < ns - fr->window)
+            release(fr);
+    }
+    return fire;
+}
+
+/* whether a frame can trigger a dump, or it is too soon after the last */
+int flightrec_armed(const struct flightrec *fr)
+{
+    return fr->newest >= fr->armed;
+}
+
+/*
+ * write the frames, oldest first, into pf, opened by the caller, and empty
+ * the arena. Returns the number of frames written.
+ */
+int flightrec_dump(struct flightrec *fr, struct pcapfile *pf, int trigger)
+{
+    struct flightrec_rec *r;
+    struct capframe frame;
+    uint64_t pos;
+    int n = 0;
+
+    for (pos = fr->tail; pos != fr->head; pos += RECSIZE(r->caplen)) {
+        if (fr->size - pos % fr->size < sizeof(*r)
+                || record_at(fr, pos)->caplen == FLIGHTREC_PAD) {
+            pos += fr->size - pos % fr->size;
+            if (pos == fr->head)
+                break;
+        }
+        r = record_at(fr, pos);
+        memset(&frame, 0, sizeof(frame));
+        frame.data = (unsigned char *)(r + 1);
+        frame.caplen = r->caplen;
+        frame.len = r->len;
+        frame.ts.tv_sec = r->sec;
+        frame.ts.tv_nsec = r->nsec;
+        frame.ifindex = r->ifindex;
+        pcapfile_write(pf, &frame);
+        n ++;
+    }
+
+    fr->head = fr->tail = 0;
+    fr->nframes = 0;
+    fr->nbytes = 0;
+    fr->armed = fr->newest + fr->holdoff;
+    fr->stats.dumps ++;
+    fr->stats.dumped += n;
+    if (trigger >= 0 && trigger < FLIGHTREC_TRIGGERS)
+        fr->stats.triggers[trigger] ++;
+    return n;
+}
+
+const char *flightrec_trigger(int trigger)
+{
+    if (trigger < 0 || trigger >= FLIGHTREC_TRIGGERS)
+        return "unknown";
+    return trigger_names[trigger];
+}
+
+void flightrec_free(struct flightrec *fr)
+{
+    if (fr->arena != NULL)
+        munmap(fr->arena, fr->size);
+    fr->arena = NULL;
+}
+
+/* what the arena holds, and the dumps so far */
+void flightrec_report(const struct flightrec *fr, FILE *fp)
+{
+    int64_t span = fr->nframes > 0 ? fr->newest - fr->oldest : 0;
+    int i;
+
+    if (fr->arena == NULL)
+        return;
+    fprintf(fp, "\nflight recorder: %llu frames, %llu bytes of %zu MB%s, "
+            "%lld.%03lld s\n", fr->nframes, fr->nbytes, fr->size >> 20,
+            fr->huge ? " on hugepages" : "", (long long)(span / NS_PER_SEC),
+            (long long)(span % NS_PER_SEC / 1000000));
+    fprintf(fp, "recorded: %llu frames, %llu bytes, dumps: %llu of %llu "
+            "frames, by", fr->stats.frames, fr->stats.bytes,
+            fr->stats.dumps, fr->stats.dumped);
+    for (i = 0; i < FLIGHTREC_TRIGGERS; i ++)
+        fprintf(fp, " %s %llu", trigger_names[i], fr->stats.triggers[i]);
+    fprintf(fp, "\n");
+}
+
+/* let go of the oldest frame */
+static void release(struct flightrec *fr)
+{
+    struct flightrec_rec *r = record_at(fr, fr->tail);
+
+    fr->tail += RECSIZE(r->caplen);
+    fr->nframes --;
+    fr->nbytes -= r->caplen;
+    skip_pad(fr);
+    if (fr->nframes > 0) {
+        r = record_at(fr, fr->tail);
+        fr->oldest = r->sec * NS_PER_SEC + r->nsec;
+    }
+}
+
+/* from the bytes skipped at the end of the arena to the record after */
+static void skip_pad(struct flightrec *fr)
+{
+    size_t rem = fr->size - fr->tail % fr->size;
+
+    if (fr->tail == fr->head)
+        return;
+    if (rem < sizeof(struct flightrec_rec)
+            || record_at(fr, fr->tail)->caplen == FLIGHTREC_PAD)
+        fr->tail += rem;
+}
+
+static struct flightrec_rec *record_at(const struct flightrec *fr,
+        uint64_t pos)
+{
+    return (struct flightrec_rec *)(fr->arena + pos % fr->size);
+}
@@ -0,0 +1,98 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLIGHTREC_HD
+#define FLIGHTREC_HD
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capframe.h"
+#include "pcapfile.h"
+
+#define FLIGHTREC_MEMORY        256     /* MB of frames by default     */
+#define FLIGHTREC_HOLDOFF       10      /* seconds between dumps by    */
+                                        /* the frames, with no window  */
+#define FLIGHTREC_HUGEPAGE      (2 << 20)
+
+/* what set off a dump */
+#define FLIGHTREC_TRIGGER_SIGNAL    0
+#define FLIGHTREC_TRIGGER_FILTER    1
+#define FLIGHTREC_TRIGGER_RATE      2
+#define FLIGHTREC_TRIGGERS          3
+
+/*
+ * a frame in the arena, followed by its bytes and padded to a multiple of
+ * 8 bytes. A record never wraps: one of caplen FLIGHTREC_PAD, or the end
+ * of the arena being too close for a header, means the next record is
+ * at the start.
+ */
+struct flightrec_rec {
+    int64_t sec;
+    uint32_t nsec;
+    uint32_t caplen;
+    uint32_t len;
+    int32_t ifindex;
+};
+
+#define FLIGHTREC_PAD           0xffffffffu
+
+/* counters, updated by the owner of the recorder only */
+struct flightrecstats {
+    unsigned long long frames;      /* put in the arena                */
+    unsigned long long bytes;
+    unsigned long long dumps;
+    unsigned long long dumped;      /* frames written by the dumps     */
+    unsigned long long triggers[FLIGHTREC_TRIGGERS]; /* acted upon     */
+};
+
+/*
+ * the last frames, as many as fit in size bytes or, if window is not 0,
+ * as came in the last window nanoseconds, whichever are fewer. head and
+ * tail count the bytes written and let go since the start, thus the
+ * records are at tail % size to head % size.
+ */
+struct flightrec {
+    unsigned char *arena;
+    size_t size;
+    int huge;                   /* on hugepages                        */
+    uint64_t head;
+    uint64_t tail;
+    unsigned long long nframes; /* in the arena                        */
+    unsigned long long nbytes;  /* of the frames in the arena          */
+    int64_t window;
+    int64_t holdoff;            /* ns after a dump the frames can't    */
+    int64_t armed;              /* trigger another before, and when    */
+    unsigned long long rate;    /* frames per second to trigger a dump */
+    int64_t second;             /* being counted, and its frames       */
+    unsigned long long count;
+    int64_t oldest;             /* ns of the frames in the arena       */
+    int64_t newest;
+    struct flightrecstats stats;
+};
+
+int flightrec_init(struct flightrec *fr, size_t size, unsigned int secs,
+        unsigned long long rate, int huge);
+int flightrec_add(struct flightrec *fr, const struct capframe *frame);
+int flightrec_armed(const struct flightrec *fr);
+int flightrec_dump(struct flightrec *fr, struct pcapfile *pf, int trigger);
+const char *flightrec_trigger(int trigger);
+void flightrec_free(struct flightrec *fr);
+void flightrec_report(const struct flightrec *fr, FILE *fp);
+
+#endif
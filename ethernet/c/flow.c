@@ -0,0 +1,407 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * aggregate frames into flows, as NetFlow or IPFIX exporters do: frames
+ * with the same MAC addresses, EtherType, IP addresses, protocol and ports
+ * on the same interface count towards one record, with the number of
+ * frames and bytes and the time of the first and the last frame.
+ *
+ * A record is exported, i.e., handed to a callback, once no frame of the
+ * flow has been seen for the idle timeout, once it has covered the active
+ * timeout, so that long flows are reported on as they go, or when the
+ * table is full and room is needed for a new flow. Time is that of the
+ * frames, thus replaying a file gives the same records every time.
+ *
+ * The flows live in a fixed array and are found by an open addressing
+ * hash table of their indices, linearly probed and kept at most half
+ * full, so that a lookup is a hash and a probe or two. Deleting shifts
+ * the entries after the hole back instead of leaving tombstones. Two
+ * lists through the flows, one in the order of their last frame and one
+ * in the order they began, find the flows that time out without a scan.
+ *
+ * A table belongs to one thread.
+ */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "decode.h"
+#include "flow.h"
+#include "hist.h"
+
+static uint32_t hash_key(const struct flowkey *key);
+static uint32_t lookup(struct flowtab *t, const struct flowkey *key,
+        uint32_t hash, uint32_t *slot);
+static void remove_flow(struct flowtab *t, uint32_t i, int reason);
+static void lru_unlink(struct flowtab *t, uint32_t i);
+static void lru_append(struct flowtab *t, uint32_t i);
+static void age_unlink(struct flowtab *t, uint32_t i);
+static void age_append(struct flowtab *t, uint32_t i);
+static int later(const struct timespec *a, const struct timespec *b);
+static void print_mac(const uint8_t *mac, FILE *fp);
+
+static const char *reasons[] = {"idle", "active", "evicted", "end"};
+
+/* a table of nflows flows at most, exporting the records to export */
+int flow_init(struct flowtab *t, uint32_t nflows, unsigned int idle,
+        unsigned int active, flow_export_t export, void *arg)
+{
+    uint32_t i;
+
+    memset(t, 0, sizeof(*t));
+    if (nflows == 0 || nflows > (1u << 30)) {
+        fprintf(stderr, "ERROR: flow table size must be 1 to %u\n", 1u << 30);
+        return -1;
+    }
+
+    t->nflows = nflows;
+    for (t->nslots = 2; t->nslots < 2 * nflows; t->nslots <<= 1)
+        ;
+    t->flows = calloc((size_t)nflows + 1, sizeof(*t->flows));
+    t->slots = calloc(t->nslots, sizeof(*t->slots));
+    if (t->flows == NULL || t->slots == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        flow_free(t);
+        return -1;
+    }
+
+    for (i = 1; i < nflows; i ++)
+        t->flows[i].lru_next = i + 1;
+    t->freelist = 1;
+    t->idle = idle;
+    t->active = active;
+    t->export = export;
+    t->arg = arg;
+    return 0;
+}
+
+/*
+ * the key of a frame. Returns 0, or -1 if the frame is too short to have
+ * an Ethernet header. Headers cut short by the snaplen leave the fields
+ * beyond them 0.
+ */
+int flow_key(struct flowkey *key, const struct capframe *frame)
+{
+    struct decoded d;
+
+    memset(key, 0, sizeof(*key));
+    key->ifindex = frame->ifindex;
+    if (decode_frame(&d, frame->data, frame->caplen) != 0)
+        return -1;
+
+    memcpy(key->dmac, d.dmac, 6);
+    memcpy(key->smac, d.smac, 6);
+    key->ethertype = d.ethertype;
+    if (!(d.layers & (DECODE_IPV4 | DECODE_IPV6)))
+        return 0;
+
+    key->ipver = d.layers & DECODE_IPV4 ? 4 : 6;
+    key->proto = d.proto;
+    memcpy(key->src, d.src, d.addrlen);
+    memcpy(key->dst, d.dst, d.addrlen);
+    if (d.layers & DECODE_ICMP)
+        key->sport = d.icmptype << 8 | d.icmpcode;
+    else
+        key->sport = d.sport;
+    key->dport = d.dport;
+    return 0;
+}
+
+/* count the frame towards its flow, exporting what has timed out first */
+void flow_add(struct flowtab *t, const struct capframe *frame)
+{
+    struct flowkey key;
+    struct flow *f;
+    uint32_t hash, i, slot;
+
+    stat_add(&t->stats.frames, 1);
+    if (flow_key(&key, frame) != 0)
+        return;
+    flow_expire(t, &frame->ts);
+
+    hash = hash_key(&key);
+    if ((i = lookup(t, &key, hash, &slot)) == 0) {
+        if (t->freelist == 0) {
+            /* make room, the slot may move */
+            remove_flow(t, t->lru_head, FLOW_END_EVICTED);
+            lookup(t, &key, hash, &slot);
+        }
+        i = t->freelist;
+        f = &t->flows[i];
+        t->freelist = f->lru_next;
+        memset(f, 0, sizeof(*f));
+        f->key = key;
+        f->hash = hash;
+        f->slot = slot;
+        f->first = frame->ts;
+        t->slots[slot] = i;
+        age_append(t, i);
+        stat_add(&t->stats.created, 1);
+        stat_add(&t->stats.active, 1);
+    } else {
+        lru_unlink(t, i);
+    }
+
+    f = &t->flows[i];
+    f->packets ++;
+    f->bytes += frame->len;
+    if (later(&frame->ts, &f->last))
+        f->last = frame->ts;
+    lru_append(t, i);
+}
+
+/*
+ * export the flows that have seen no frame for the idle timeout, and
+ * those that began the active timeout ago
+ */
+void flow_expire(struct flowtab *t, const struct timespec *now)
+{
+    struct timespec limit;
+
+    limit = *now;
+    limit.tv_sec -= t->idle;
+    while (t->lru_head != 0
+            && !later(&t->flows[t->lru_head].last, &limit))
+        remove_flow(t, t->lru_head, FLOW_END_IDLE);
+
+    limit = *now;
+    limit.tv_sec -= t->active;
+    while (t->age_head != 0
+            && !later(&t->flows[t->age_head].first, &limit))
+        remove_flow(t, t->age_head, FLOW_END_ACTIVE);
+}
+
+/* export every flow, e.g., at exit */
+void flow_flush(struct flowtab *t)
+{
+    while (t->age_head != 0)
+        remove_flow(t, t->age_head, FLOW_END_FLUSH);
+}
+
+void flow_free(struct flowtab *t)
+{
+    free(t->flows);
+    free(t->slots);
+    t->flows = NULL;
+    t->slots = NULL;
+}
+
+/* a record as a line of text */
+void flow_print(const struct flow *f, int reason, const char *ifname,
+        FILE *fp)
+{
+    const struct flowkey *k = &f->key;
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    int af = k->ipver == 6 ? AF_INET6 : AF_INET;
+
+    fprintf(fp, "%lld.%09ld %lld.%09ld %s ", (long long)f->first.tv_sec,
+            f->first.tv_nsec, (long long)f->last.tv_sec, f->last.tv_nsec,
+            ifname != NULL ? ifname : "?");
+    print_mac(k->smac, fp);
+    fprintf(fp, " > ");
+    print_mac(k->dmac, fp);
+    fprintf(fp, " 0x%04x", k->ethertype);
+
+    if (k->ipver != 0) {
+        inet_ntop(af, k->src, src, sizeof(src));
+        inet_ntop(af, k->dst, dst, sizeof(dst));
+        switch (k->proto) {
+            case IPPROTO_TCP_:
+                fprintf(fp, " tcp");
+                break;
+            case IPPROTO_UDP_:
+                fprintf(fp, " udp");
+                break;
+            case IPPROTO_SCTP_:
+                fprintf(fp, " sctp");
+                break;
+            case IPPROTO_ICMP_:
+            case IPPROTO_ICMPV6_:
+                fprintf(fp, " icmp %u/%u", k->sport >> 8, k->sport & 0xff);
+                break;
+            default:
+                fprintf(fp, " proto %u", k->proto);
+        }
+        if (k->dport != 0 || k->proto == IPPROTO_TCP_
+                || k->proto == IPPROTO_UDP_ || k->proto == IPPROTO_SCTP_)
+            fprintf(fp, " %s.%u > %s.%u", src, k->sport, dst, k->dport);
+        else
+            fprintf(fp, " %s > %s", src, dst);
+    }
+
+    fprintf(fp, " %llu frames %llu bytes %s\n", f->packets, f->bytes,
+            reasons[reason]);
+}
+
+void flow_report(const struct flowtab *t, FILE *fp)
+{
+    const struct flowstats *s = &t->stats;
+    unsigned long long frames = stat_read(&s->frames);
+
+    fprintf(fp, "flows: %llu frames, %llu flows, %llu exported idle %llu "
+            "active %llu evicted %llu at exit, %llu of %u in the table, "
+            "%.2f probes per frame\n", frames, stat_read(&s->created),
+            stat_read(&s->exported[FLOW_END_IDLE]),
+            stat_read(&s->exported[FLOW_END_ACTIVE]),
+            stat_read(&s->exported[FLOW_END_EVICTED]),
+            stat_read(&s->exported[FLOW_END_FLUSH]),
+            stat_read(&s->active), t->nflows,
+            frames == 0 ? 0 : (double)stat_read(&s->probes) / frames);
+}
+
+/* mix the key 8 bytes at a time, see the finalizer of MurmurHash3 */
+static uint32_t hash_key(const struct flowkey *key)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 0, w;
+    size_t i;
+
+    for (i = 0; i + 8 <= sizeof(*key); i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * the index of the flow of key, or 0 with *slot set to where it would go
+ */
+static uint32_t lookup(struct flowtab *t, const struct flowkey *key,
+        uint32_t hash, uint32_t *slot)
+{
+    uint32_t mask = t->nslots - 1, s, i;
+    struct flow *f;
+
+    for (s = hash & mask; (i = t->slots[s]) != 0; s = (s + 1) & mask) {
+        stat_add(&t->stats.probes, 1);
+        f = &t->flows[i];
+        if (f->hash == hash && !memcmp(&f->key, key, sizeof(*key)))
+            return i;
+    }
+    *slot = s;
+    return 0;
+}
+
+/* export the flow and delete it from the hash table and the lists */
+static void remove_flow(struct flowtab *t, uint32_t i, int reason)
+{
+    uint32_t mask = t->nslots - 1, hole, s, home;
+    struct flow *f = &t->flows[i];
+
+    if (t->export != NULL)
+        t->export(f, reason, t->arg);
+    stat_add(&t->stats.exported[reason], 1);
+    __atomic_store_n(&t->stats.active, t->stats.active - 1, __ATOMIC_RELAXED);
+
+    /*
+     * move back the entries after the hole that would not be found past
+     * it, i.e., those whose home slot is not between the hole and them
+     */
+    hole = f->slot;
+    t->slots[hole] = 0;
+    for (s = (hole + 1) & mask; t->slots[s] != 0; s = (s + 1) & mask) {
+        home = t->flows[t->slots[s]].hash & mask;
+        if (((s - home) & mask) >= ((s - hole) & mask)) {
+            t->slots[hole] = t->slots[s];
+            t->flows[t->slots[hole]].slot = hole;
+            t->slots[s] = 0;
+            hole = s;
+        }
+    }
+
+    lru_unlink(t, i);
+    age_unlink(t, i);
+    f->lru_next = t->freelist;
+    t->freelist = i;
+}
+
+static void lru_unlink(struct flowtab *t, uint32_t i)
+{
+    struct flow *f = &t->flows[i];
+
+    if (f->lru_prev != 0)
+        t->flows[f->lru_prev].lru_next = f->lru_next;
+    else
+        t->lru_head = f->lru_next;
+    if (f->lru_next != 0)
+        t->flows[f->lru_next].lru_prev = f->lru_prev;
+    else
+        t->lru_tail = f->lru_prev;
+    f->lru_prev = f->lru_next = 0;
+}
+
+static void lru_append(struct flowtab *t, uint32_t i)
+{
+    struct flow *f = &t->flows[i];
+
+    f->lru_prev = t->lru_tail;
+    f->lru_next = 0;
+    if (t->lru_tail != 0)
+        t->flows[t->lru_tail].lru_next = i;
+    else
+        t->lru_head = i;
+    t->lru_tail = i;
+}
+
+static void age_unlink(struct flowtab *t, uint32_t i)
+{
+    struct flow *f = &t->flows[i];
+
+    if (f->age_prev != 0)
+        t->flows[f->age_prev].age_next = f->age_next;
+    else
+        t->age_head = f->age_next;
+    if (f->age_next != 0)
+        t->flows[f->age_next].age_prev = f->age_prev;
+    else
+        t->age_tail = f->age_prev;
+    f->age_prev = f->age_next = 0;
+}
+
+static void age_append(struct flowtab *t, uint32_t i)
+{
+    struct flow *f = &t->flows[i];
+
+    f->age_prev = t->age_tail;
+    f->age_next = 0;
+    if (t->age_tail != 0)
+        t->flows[t->age_tail].age_next = i;
+    else
+        t->age_head = i;
+    t->age_tail = i;
+}
+
+/* a is after b */
+static int later(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec > b->tv_sec
+        || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+static void print_mac(const uint8_t *mac, FILE *fp)
+{
+    fprintf(fp, "%02x:%02x:%02x:%02x:%02x:%02x",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
@@ -0,0 +1,109 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FLOW_HD
+#define FLOW_HD
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "capframe.h"
+
+#define FLOW_TABLE_SIZE     65536   /* flows kept at a time            */
+#define FLOW_IDLE_TIMEOUT   15      /* s without a frame ends a flow   */
+#define FLOW_ACTIVE_TIMEOUT 60      /* s a record covers at most       */
+
+#define FLOW_END_IDLE       0       /* why a flow record is exported   */
+#define FLOW_END_ACTIVE     1
+#define FLOW_END_EVICTED    2       /* the table was full              */
+#define FLOW_END_FLUSH      3       /* at exit                         */
+
+/*
+ * what frames of a flow have in common. Fields a frame does not have,
+ * e.g., the ports of an ICMP message, are 0. IPv4 addresses take the
+ * first 4 bytes of the address fields.
+ */
+struct flowkey {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint8_t smac[6];
+    uint8_t dmac[6];
+    uint16_t ethertype;         /* after the VLAN tags, host order     */
+    uint16_t sport;             /* type and code for ICMP              */
+    uint16_t dport;
+    uint8_t proto;              /* IP protocol, 0 if not IP            */
+    uint8_t ipver;              /* 4, 6 or 0                           */
+    int32_t ifindex;
+};
+
+struct flow {
+    struct flowkey key;
+    unsigned long long packets;
+    unsigned long long bytes;
+    struct timespec first;
+    struct timespec last;
+    uint32_t hash;
+    uint32_t slot;              /* in the hash table                   */
+    uint32_t lru_prev;          /* by the time of the last frame       */
+    uint32_t lru_next;
+    uint32_t age_prev;          /* by the time the record began        */
+    uint32_t age_next;
+};
+
+typedef void (*flow_export_t)(const struct flow *f, int reason, void *arg);
+
+/* counters, updated by the owner of the table only, read with stat_read() */
+struct flowstats {
+    unsigned long long frames;
+    unsigned long long created;
+    unsigned long long exported[FLOW_END_FLUSH + 1];
+    unsigned long long active;  /* flows in the table                  */
+    unsigned long long probes;  /* hash slots looked at                */
+};
+
+/*
+ * flows in an array, indexed from 1, and an open addressing hash table
+ * of their indices, linearly probed, twice as large
+ */
+struct flowtab {
+    struct flow *flows;
+    uint32_t nflows;
+    uint32_t *slots;            /* flow index, 0 if empty              */
+    uint32_t nslots;            /* a power of 2                        */
+    uint32_t freelist;          /* linked by lru_next                  */
+    uint32_t lru_head, lru_tail;
+    uint32_t age_head, age_tail;
+    unsigned int idle;          /* timeouts in seconds                 */
+    unsigned int active;
+    flow_export_t export;
+    void *arg;
+    struct flowstats stats;
+};
+
+int flow_init(struct flowtab *t, uint32_t nflows, unsigned int idle,
+        unsigned int active, flow_export_t export, void *arg);
+int flow_key(struct flowkey *key, const struct capframe *frame);
+void flow_add(struct flowtab *t, const struct capframe *frame);
+void flow_expire(struct flowtab *t, const struct timespec *now);
+void flow_flush(struct flowtab *t);
+void flow_free(struct flowtab *t);
+void flow_print(const struct flow *f, int reason, const char *ifname,
+        FILE *fp);
+void flow_report(const struct flowtab *t, FILE *fp);
+
+#endif
@@ -0,0 +1,232 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * cut the aggregates of segmentation offload back into the frames that go
+ * on the wire.
+ *
+ * With GRO and TSO, or GSO in software, the kernel handles TCP segments
+ * glued together into frames of up to 64 KiB and a packet socket sees
+ * those rather than what was received or sent. With PACKET_VNET_HDR the
+ * kernel tells, for every frame, the virtio-net header of the aggregate:
+ * the type of offload, the payload of a segment (gso_size) and where the
+ * checksum is to go if it is yet to be computed.
+ *
+ * An aggregate of TCP over IPv4 or IPv6, or of UDP with UDP segmentation,
+ * is cut into segments of gso_size bytes of payload, each with a copy of
+ * the headers: the IP lengths, the IPv4 ID and checksum, the TCP sequence
+ * number and flags (FIN and PSH on the last segment only, CWR on the
+ * first only) or the UDP length, and the transport checksum are fixed up
+ * as the NIC would. Other aggregates, e.g., UFO, which fragments at the
+ * IP layer, and aggregates cut short by the snaplen are left whole.
+ *
+ * Frames sent with checksum offload carry in the checksum field only the
+ * sum of the pseudo-header; the rest of it is added in as well.
+ */
+
+#include <string.h>
+#include <linux/virtio_net.h>
+
+#include "decode.h"
+#include "gso.h"
+
+#ifndef VIRTIO_NET_HDR_GSO_UDP_L4
+#define VIRTIO_NET_HDR_GSO_UDP_L4   5
+#endif
+
+#define TCP_FIN             0x01
+#define TCP_PSH             0x08
+#define TCP_CWR             0x80
+
+static uint32_t sum16(const uint8_t *p, unsigned int n, uint32_t sum);
+static uint16_t fold(uint32_t sum);
+static void put16(uint8_t *p, uint16_t v);
+static void fix_l4_checksum(uint8_t *seg, const struct decoded *d,
+        unsigned int l3off, unsigned int l4off, unsigned int l4bytes);
+
+/*
+ * hand the segments of an aggregate to handler one after another, built
+ * in buf, which must hold the headers and gso_size bytes. Returns the
+ * number of segments, or 0 if the frame is not to be cut: it then is
+ * still to be handled as it is.
+ */
+int gso_segment(const struct capframe *frame, unsigned char *buf,
+        capframe_handler_t handler, void *arg)
+{
+    struct capframe seg;
+    struct decoded d;
+    unsigned int type = frame->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    unsigned int hdr, l3off, l4off, payload, off, n, last;
+    uint16_t id = 0;
+    uint32_t seq = 0;
+    uint8_t flags = 0;
+    int nsegs = 0;
+
+    if (frame->gso_size == 0 || frame->caplen < frame->len)
+        return 0;
+    if (type != VIRTIO_NET_HDR_GSO_TCPV4 && type != VIRTIO_NET_HDR_GSO_TCPV6
+            && type != VIRTIO_NET_HDR_GSO_UDP_L4)
+        return 0;
+    if (decode_frame(&d, frame->data, frame->caplen) != 0
+            || !(d.layers & (DECODE_TCP | DECODE_UDP))
+            || (d.layers & DECODE_FRAGMENT))
+        return 0;
+
+    l3off = d.l3 - frame->data;
+    l4off = d.l4 - frame->data;
+    hdr = l4off + d.l4len;
+    payload = frame->caplen - hdr;
+    if (payload <= frame->gso_size)
+        return 0;
+
+    if (d.layers & DECODE_IPV4)
+        id = decode_be16(d.l3 + 4);
+    if (d.layers & DECODE_TCP) {
+        seq = decode_be32(d.l4 + 4);
+        flags = d.tcpflags;
+    }
+
+    seg = *frame;
+    seg.data = buf;
+    seg.gso_type = 0;
+    seg.gso_size = 0;
+    seg.hdr_len = 0;
+    seg.csum_flags = 0;
+    seg.csum_start = 0;
+    seg.csum_offset = 0;
+    for (off = 0; off < payload; off += n, nsegs ++) {
+        n = payload - off;
+        if (n > frame->gso_size)
+            n = frame->gso_size;
+        last = off + n == payload;
+        memcpy(buf, frame->data, hdr);
+        memcpy(buf + hdr, frame->data + hdr + off, n);
+
+        if (d.layers & DECODE_IPV4) {
+            put16(buf + l3off + 2, hdr - l3off + n);
+            put16(buf + l3off + 4, id + nsegs);
+            put16(buf + l3off + 10, 0);
+            put16(buf + l3off + 10, ~fold(sum16(buf + l3off, d.l3len, 0)));
+        } else {
+            put16(buf + l3off + 4, hdr - l3off - 40 + n);
+        }
+
+        if (d.layers & DECODE_TCP) {
+            seq += nsegs == 0 ? 0 : frame->gso_size;
+            buf[l4off + 4] = seq >> 24;
+            buf[l4off + 5] = seq >> 16;
+            buf[l4off + 6] = seq >> 8;
+            buf[l4off + 7] = seq;
+            buf[l4off + 13] = flags & ~(last ? 0 : TCP_FIN | TCP_PSH)
+                & ~(nsegs == 0 ? 0 : TCP_CWR);
+        } else {
+            put16(buf + l4off + 4, d.l4len + n);
+        }
+        fix_l4_checksum(buf, &d, l3off, l4off, d.l4len + n);
+
+        seg.caplen = seg.len = hdr + n;
+        handler(&seg, arg);
+    }
+    return nsegs;
+}
+
+/*
+ * add what is from csum_start on to the checksum at csum_start +
+ * csum_offset, which has the pseudo-header's only, if the frame needs it
+ * and is whole. Returns 1 if the checksum was filled in.
+ */
+int gso_checksum(struct capframe *frame)
+{
+    unsigned int start = frame->csum_start, ck = start + frame->csum_offset;
+    uint32_t sum;
+
+    if (!(frame->csum_flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+            || frame->caplen < frame->len || ck + 2 > frame->caplen)
+        return 0;
+
+    sum = sum16(frame->data + start, frame->caplen - start, 0);
+    put16(frame->data + ck, ~fold(sum));
+    frame->csum_flags &= ~VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    return 1;
+}
+
+/* the virtio-net header of the frame, if there is anything to tell */
+void gso_print(const struct capframe *frame, FILE *fp)
+{
+    static const char *types[] = {
+        "none", "tcpv4", "?", "ufo", "tcpv6", "udp"
+    };
+    unsigned int type = frame->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+
+    if (frame->gso_type == 0 && frame->csum_flags == 0)
+        return;
+    fprintf(fp, "vnet: gso %s%s size %u hdr_len %u",
+            type < sizeof(types) / sizeof(types[0]) ? types[type] : "?",
+            frame->gso_type & VIRTIO_NET_HDR_GSO_ECN ? " ecn" : "",
+            frame->gso_size, frame->hdr_len);
+    if (frame->csum_flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+        fprintf(fp, ", checksum needed at %u + %u", frame->csum_start,
+                frame->csum_offset);
+    if (frame->csum_flags & VIRTIO_NET_HDR_F_DATA_VALID)
+        fprintf(fp, ", checksum valid");
+    fprintf(fp, "\n");
+}
+
+/* the ones' complement sum of the pseudo-header and the segment */
+static void fix_l4_checksum(uint8_t *seg, const struct decoded *d,
+        unsigned int l3off, unsigned int l4off, unsigned int l4bytes)
+{
+    unsigned int ck = l4off + (d->layers & DECODE_TCP ? 16 : 6);
+    uint8_t *src = seg + (d->src - d->l3) + l3off;
+    uint32_t sum;
+    uint16_t v;
+
+    put16(seg + ck, 0);
+    sum = sum16(src, 2 * d->addrlen, 0);
+    sum += d->proto + l4bytes;
+    sum = sum16(seg + l4off, l4bytes, sum);
+    v = ~fold(sum);
+    /* 0 means no checksum in UDP */
+    if (v == 0 && (d->layers & DECODE_UDP))
+        v = 0xffff;
+    put16(seg + ck, v);
+}
+
+static uint32_t sum16(const uint8_t *p, unsigned int n, uint32_t sum)
+{
+    unsigned int i;
+
+    for (i = 0; i + 1 < n; i += 2)
+        sum += p[i] << 8 | p[i + 1];
+    if (n & 1)
+        sum += p[n - 1] << 8;
+    return sum;
+}
+
+static uint16_t fold(uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
@@ -0,0 +1,32 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GSO_HD
+#define GSO_HD
+
+#include <stdio.h>
+
+#include "capframe.h"
+
+#define GSO_MAX_SIZE        65536   /* largest aggregate, less Ethernet */
+
+int gso_segment(const struct capframe *frame, unsigned char *buf,
+        capframe_handler_t handler, void *arg);
+int gso_checksum(struct capframe *frame);
+void gso_print(const struct capframe *frame, FILE *fp);
+
+#endif
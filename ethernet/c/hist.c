@@ -0,0 +1,169 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * streaming log-linear histograms, e.g., of the gaps between frames and
+ * of the frame sizes.
+ *
+ * Values below 2^HIST_SUB_BITS have a bucket each. Above, every power of
+ * two [2^e, 2^(e+1)) is split into 2^HIST_SUB_BITS buckets of equal width.
+ * Adding a value is a count-leading-zeros and a few shifts, and percentiles
+ * come out within 1/2^HIST_SUB_BITS of the true value.
+ *
+ * A histogram is written by one thread only. Others may read it at any
+ * time, e.g., to report it, and take the difference of two readings to
+ * get the histogram of an interval.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+
+#define SUB_COUNT       (1 << HIST_SUB_BITS)
+
+static int bucket_of(unsigned long long v);
+static unsigned long long bucket_low(int i);
+static unsigned long long bucket_high(int i);
+
+void hist_add(struct hist *h, unsigned long long v)
+{
+    int i = bucket_of(v);
+
+    stat_add(&h->bucket[i], 1);
+    stat_add(&h->sum, v);
+    stat_add(&h->count, 1);
+}
+
+/* add h, which may be being written to, to sum */
+void hist_merge(struct hist *sum, const struct hist *h)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i ++)
+        sum->bucket[i] += stat_read(&h->bucket[i]);
+    sum->sum += stat_read(&h->sum);
+    sum->count += stat_read(&h->count);
+}
+
+/* what has been added between the readings then and now */
+void hist_diff(struct hist *d, const struct hist *now,
+        const struct hist *then)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i ++)
+        d->bucket[i] = now->bucket[i] - then->bucket[i];
+    d->sum = now->sum - then->sum;
+    d->count = now->count - then->count;
+}
+
+/* the upper bound of the bucket where the p-th (0 to 1) percentile is */
+unsigned long long hist_percentile(const struct hist *h, double p)
+{
+    unsigned long long rank, seen = 0;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+
+    rank = (unsigned long long)(p * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (i = 0; i < HIST_BUCKETS; i ++) {
+        seen += h->bucket[i];
+        if (seen > rank)
+            return bucket_high(i);
+    }
+    return bucket_high(HIST_BUCKETS - 1);
+}
+
+/*
+ * the values in [lo, hi), as far as the buckets tell: those of the buckets
+ * that start there
+ */
+unsigned long long hist_range(const struct hist *h, unsigned long long lo,
+        unsigned long long hi)
+{
+    unsigned long long n = 0;
+    int i;
+
+    for (i = bucket_of(lo); i < HIST_BUCKETS && bucket_low(i) < hi; i ++)
+        n += h->bucket[i];
+    return n;
+}
+
+/* one line: count, mean and some percentiles */
+void hist_summary(const struct hist *h, const char *name, FILE *fp)
+{
+    if (h->count == 0) {
+        fprintf(fp, "%s: none\n", name);
+        return;
+    }
+    fprintf(fp, "%s: n %llu mean %llu p50 %llu p90 %llu p99 %llu "
+            "max %llu\n", name, h->count, h->sum / h->count,
+            hist_percentile(h, 0.50), hist_percentile(h, 0.90),
+            hist_percentile(h, 0.99), hist_percentile(h, 1.0));
+}
+
+/* the summary and every bucket that is not empty */
+void hist_print(const struct hist *h, const char *name, FILE *fp)
+{
+    int i;
+
+    hist_summary(h, name, fp);
+    for (i = 0; i < HIST_BUCKETS; i ++) {
+        if (h->bucket[i] == 0)
+            continue;
+        fprintf(fp, "  %12llu - %-12llu %12llu %5.1f%%\n",
+                bucket_low(i), bucket_high(i), h->bucket[i],
+                100.0 * h->bucket[i] / h->count);
+    }
+}
+
+static int bucket_of(unsigned long long v)
+{
+    int e;
+
+    if (v < SUB_COUNT)
+        return v;
+
+    /* v is in [2^e, 2^(e+1)), the sub-bucket is given by the next bits */
+    e = 63 - __builtin_clzll(v);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+        + ((v >> (e - HIST_SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+static unsigned long long bucket_low(int i)
+{
+    int e;
+
+    if (i < SUB_COUNT)
+        return i;
+
+    e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (1ULL << e)
+        + ((unsigned long long)(i & (SUB_COUNT - 1)) << (e - HIST_SUB_BITS));
+}
+
+static unsigned long long bucket_high(int i)
+{
+    if (i == HIST_BUCKETS - 1)
+        return ~0ULL;
+    return bucket_low(i + 1) - 1;
+}
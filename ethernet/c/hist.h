@@ -0,0 +1,62 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HIST_HD
+#define HIST_HD
+
+#include <stdio.h>
+
+#define HIST_SUB_BITS   3                       /* 8 buckets per octave */
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/*
+ * a log-linear histogram of 64-bit values. Its size is fixed no matter
+ * how many values are added, and a bucket is no wider than 1/8 of the
+ * values in it.
+ */
+struct hist {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long bucket[HIST_BUCKETS];
+};
+
+/*
+ * counters written by one thread and read by another while being written.
+ * The relaxed atomics compile to plain loads and stores but keep the
+ * reader from seeing torn values.
+ */
+static inline void stat_add(unsigned long long *c, unsigned long long n)
+{
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long stat_read(const unsigned long long *c)
+{
+    return __atomic_load_n(c, __ATOMIC_RELAXED);
+}
+
+void hist_add(struct hist *h, unsigned long long v);
+void hist_merge(struct hist *sum, const struct hist *h);
+void hist_diff(struct hist *d, const struct hist *now,
+        const struct hist *then);
+unsigned long long hist_percentile(const struct hist *h, double p);
+unsigned long long hist_range(const struct hist *h, unsigned long long lo,
+        unsigned long long hi);
+void hist_summary(const struct hist *h, const char *name, FILE *fp);
+void hist_print(const struct hist *h, const char *name, FILE *fp);
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * list the network interfaces by asking the kernel for a dump of its
+ * links over a rtnetlink socket, see rtnetlink(7) and netlink(7). Unlike
+ * SIOCGIFCONF, this finds the interfaces that have no IP address as well,
+ * and gives the MTU of each without another ioctl(2) per interface.
+ */
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "iflist.h"
+
+#define IFLIST_BUFSIZE  32768
+
+static int parse_link(struct nlmsghdr *nh, struct iflink *link);
+
+/*
+ * fill links with up to max interfaces, whether up or down. Returns the
+ * number of interfaces, or -1 on error.
+ */
+int iflist_get(struct iflink *links, int max)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+    struct sockaddr_nl kernel;
+    static char buf[IFLIST_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *nh;
+    int sockfd, n = 0, len, done = 0;
+
+    sockfd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sockfd < 0) {
+        perror("socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE) failed");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.ifi.ifi_family = AF_UNSPEC;
+
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(sockfd, &req, req.nh.nlmsg_len, 0,
+            (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        perror("sendto(sockfd, RTM_GETLINK, ...)");
+        close(sockfd);
+        return -1;
+    }
+
+    /* the dump comes in as many messages as it takes, ended by NLMSG_DONE */
+    while (!done) {
+        len = recv(sockfd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("recv(sockfd, ...) failed");
+            close(sockfd);
+            return -1;
+        }
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned int)len);
+                nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = 1;
+                break;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                fprintf(stderr, "ERROR: RTM_GETLINK failed\n");
+                close(sockfd);
+                return -1;
+            }
+            if (nh->nlmsg_type != RTM_NEWLINK)
+                continue;
+            if (n == max) {
+                fprintf(stderr, "WARN: more than %d interfaces, "
+                        "ignoring the others\n", max);
+                done = 1;
+                break;
+            }
+            if (parse_link(nh, &links[n]) == 0)
+                n ++;
+        }
+    }
+
+    close(sockfd);
+    return n;
+}
+
+/* the index, name, MTU and flags of a RTM_NEWLINK message */
+static int parse_link(struct nlmsghdr *nh, struct iflink *link)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    int len = IFLA_PAYLOAD(nh);
+
+    memset(link, 0, sizeof(*link));
+    link->ifindex = ifi->ifi_index;
+    link->flags = ifi->ifi_flags;
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+            case IFLA_IFNAME:
+                strncpy(link->name, RTA_DATA(rta), IFNAMSIZ - 1);
+                break;
+            case IFLA_MTU:
+                memcpy(&link->mtu, RTA_DATA(rta), sizeof(link->mtu));
+                break;
+        }
+    }
+    return link->name[0] != '\0' ? 0 : -1;
+}
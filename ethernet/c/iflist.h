@@ -0,0 +1,33 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IFLIST_HD
+#define IFLIST_HD
+
+#include <net/if.h>
+
+/* a network interface as rtnetlink(7) describes it */
+struct iflink {
+    int ifindex;
+    char name[IFNAMSIZ];
+    unsigned int mtu;
+    unsigned int flags;         /* IFF_*                            */
+};
+
+int iflist_get(struct iflink *links, int max);
+
+#endif
@@ -0,0 +1,274 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * a fast LZ77 block codec for capture files, in the manner of LZ4: no
+ * entropy coding, a single hash probe per position and matches copied
+ * byte for byte, so that compressing keeps up with a disk and
+ * decompressing is faster still.
+ *
+ * A block is a series of sequences: a token whose high and low nibble
+ * give the number of literals and the match length less 4 (15 meaning
+ * more bytes of 255 follow, up to one less than 255), the literals, the
+ * offset of the match in 2 bytes, little endian, and the more bytes of
+ * the match length. The last sequence has literals only.
+ *
+ * In a file, each block comes after a struct lzblk_hdr and does not refer
+ * to the blocks before it. A reader can thus go from block to block by
+ * their headers, skipping what it is not interested in, and decompress
+ * any block on its own. Blocks that do not shrink are stored as they are.
+ */
+
+#include <string.h>
+
+#include "lzblk.h"
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5       /* the end of a block is never matched  */
+#define MF_LIMIT        12      /* no match begins this close to the end */
+#define MAX_OFFSET      65535
+#define SKIP_TRIGGER    6       /* probe further apart after 2^6 misses */
+
+static uint32_t read32(const unsigned char *p);
+static uint32_t hash4(const unsigned char *p);
+static unsigned char *put_len(unsigned char *op, size_t len);
+
+/*
+ * compress n bytes of src to dst, using table, LZBLK_HASH_SIZE entries,
+ * as scratch. Returns the compressed length, 0 if it would exceed cap.
+ */
+size_t lzblk_compress(const unsigned char *src, size_t n,
+        unsigned char *dst, size_t cap, uint32_t *table)
+{
+    const unsigned char *ip = src, *anchor = src, *ref;
+    const unsigned char *mflimit, *matchlimit;
+    unsigned char *op = dst, *oend = dst + cap, *token;
+    size_t lit, mlen;
+    unsigned int step, misses;
+    uint32_t h;
+
+    memset(table, 0, LZBLK_HASH_SIZE * sizeof(*table));
+    if (n < MF_LIMIT + 1)
+        goto last;
+    mflimit = src + n - MF_LIMIT;
+    matchlimit = src + n - LAST_LITERALS;
+
+    ip ++;
+    while (1) {
+        /* the next position that repeats one of the last 64 KiB */
+        misses = 1 << SKIP_TRIGGER;
+        step = 1;
+        while (1) {
+            h = hash4(ip);
+            ref = src + table[h];
+            table[h] = ip - src;
+            if (ip - ref <= MAX_OFFSET && ref < ip
+                    && read32(ref) == read32(ip))
+                break;
+            ip += step;
+            step = misses ++ >> SKIP_TRIGGER;
+            if (ip > mflimit)
+                goto last;
+        }
+
+        /* as far back and forth as it goes */
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip --;
+            ref --;
+        }
+        mlen = MIN_MATCH;
+        while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+            mlen ++;
+
+        lit = ip - anchor;
+        if (op + 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1 > oend)
+            return 0;
+        token = op ++;
+        *token = (lit >= 15 ? 15 : lit) << 4;
+        if (lit >= 15)
+            op = put_len(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op ++ = (ip - ref) & 0xff;
+        *op ++ = (ip - ref) >> 8;
+        mlen -= MIN_MATCH;
+        *token |= mlen >= 15 ? 15 : mlen;
+        if (mlen >= 15)
+            op = put_len(op, mlen - 15);
+
+        ip += mlen + MIN_MATCH;
+        anchor = ip;
+        if (ip > mflimit)
+            break;
+        /* the positions skipped over by the match would help too */
+        table[hash4(ip - 2)] = ip - 2 - src;
+    }
+
+last:
+    lit = src + n - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > oend)
+        return 0;
+    *op ++ = (lit >= 15 ? 15 : lit) << 4;
+    if (lit >= 15)
+        op = put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+/*
+ * decompress n bytes of src to dst, checking every length and offset
+ * against the buffers. Returns the decompressed length, -1 if src is
+ * broken or does not fit cap bytes.
+ */
+long lzblk_decompress(const unsigned char *src, size_t n,
+        unsigned char *dst, size_t cap)
+{
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + cap, *ref;
+    size_t lit, mlen, off;
+    unsigned char b, token;
+
+    while (ip < iend) {
+        token = *ip ++;
+        lit = token >> 4;
+        if (lit == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip ++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend)
+            break;      /* the last sequence */
+
+        if (iend - ip < 2)
+            return -1;
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst))
+            return -1;
+        mlen = token & 15;
+        if (mlen == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip ++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += MIN_MATCH;
+        if (mlen > (size_t)(oend - op))
+            return -1;
+
+        /* a match may overlap what it produces, e.g., a run of a byte */
+        ref = op - off;
+        if (off >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen -- > 0)
+                *op ++ = *ref ++;
+        }
+    }
+    return op - dst;
+}
+
+/*
+ * a block of a file: the header and n bytes of src, compressed or stored.
+ * dst must have room for the header and LZBLK_BOUND(n) bytes. Returns the
+ * bytes of dst used.
+ */
+size_t lzblk_frame(const unsigned char *src, size_t n,
+        unsigned char *dst, uint32_t *table)
+{
+    struct lzblk_hdr h;
+    size_t len;
+
+    h.magic = LZBLK_MAGIC;
+    h.flags = 0;
+    h.rawlen = n;
+    len = lzblk_compress(src, n, dst + sizeof(h), n, table);
+    if (len == 0) {
+        h.flags = LZBLK_STORED;
+        len = n;
+        memcpy(dst + sizeof(h), src, n);
+    }
+    h.len = len;
+    memcpy(dst, &h, sizeof(h));
+    return sizeof(h) + len;
+}
+
+/*
+ * the block of a file at src, n bytes at most, to dst. Sets *used to the
+ * bytes of src it takes. Returns the bytes of dst written, -1 if the
+ * block is broken or does not fit.
+ */
+long lzblk_unframe(const unsigned char *src, size_t n,
+        unsigned char *dst, size_t cap, size_t *used)
+{
+    struct lzblk_hdr h;
+
+    if (n < sizeof(h))
+        return -1;
+    memcpy(&h, src, sizeof(h));
+    if (h.magic != LZBLK_MAGIC || h.len > n - sizeof(h) || h.rawlen > cap)
+        return -1;
+    *used = sizeof(h) + h.len;
+
+    if (h.flags & LZBLK_STORED) {
+        if (h.len != h.rawlen)
+            return -1;
+        memcpy(dst, src + sizeof(h), h.len);
+        return h.len;
+    }
+    if (lzblk_decompress(src + sizeof(h), h.len, dst, h.rawlen)
+            != (long)h.rawlen)
+        return -1;
+    return h.rawlen;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(const unsigned char *p)
+{
+    return (read32(p) * 2654435761u) >> (32 - LZBLK_HASH_BITS);
+}
+
+/* the rest of a length of 15 or more: bytes of 255, then what is left */
+static unsigned char *put_len(unsigned char *op, size_t len)
+{
+    while (len >= 255) {
+        *op ++ = 255;
+        len -= 255;
+    }
+    *op ++ = len;
+    return op;
+}
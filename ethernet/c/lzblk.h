@@ -0,0 +1,49 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LZBLK_HD
+#define LZBLK_HD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZBLK_MAGIC         0x315a4c45  /* "ELZ1" in the file            */
+#define LZBLK_STORED        0x1         /* the block is not compressed   */
+#define LZBLK_HASH_BITS     14
+#define LZBLK_HASH_SIZE     (1 << LZBLK_HASH_BITS)
+
+/* in front of every block of a compressed file */
+struct lzblk_hdr {
+    uint32_t magic;
+    uint32_t flags;             /* LZBLK_*                              */
+    uint32_t rawlen;            /* bytes once decompressed              */
+    uint32_t len;               /* bytes that follow the header         */
+};
+
+/* what compressing a block may take at most */
+#define LZBLK_BOUND(n)      ((n) + (n) / 255 + 16)
+
+size_t lzblk_compress(const unsigned char *src, size_t n,
+        unsigned char *dst, size_t cap, uint32_t *table);
+long lzblk_decompress(const unsigned char *src, size_t n,
+        unsigned char *dst, size_t cap);
+size_t lzblk_frame(const unsigned char *src, size_t n,
+        unsigned char *dst, uint32_t *table);
+long lzblk_unframe(const unsigned char *src, size_t n,
+        unsigned char *dst, size_t cap, size_t *used);
+
+#endif
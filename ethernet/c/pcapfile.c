@@ -0,0 +1,753 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * write captured frames to a file in the pcap or the pcapng format, both
+ * with nanosecond timestamps, so that they can be read by tcpdump, Wireshark
+ * and the like. See
+ *
+ *     https://www.tcpdump.org/manpages/pcap-savefile.5.html
+ *     https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-01.html
+ *
+ * Records are collected in large page-aligned buffers. A full buffer is
+ * queued to a writer thread of the file and the caller goes on with the
+ * next free one, so that a slow or stalled disk never holds up whoever
+ * writes the frames. When no buffer is free, frames are dropped and
+ * counted, unless told to wait. How long the buffers wait to be written
+ * and how many are queued is kept track of.
+ *
+ * With a limit on the size of a file or the time it covers, the frames
+ * go to a series of files path.0, path.1, ... instead of path, each with
+ * a header of its own, and only the last so many may be kept. Files are
+ * switched between records, by the timestamps of the frames, and opened,
+ * closed and removed by the writer thread only.
+ *
+ * Optionally, a thread of its own compresses each buffer to a block of
+ * lzblk.c before it is written. The blocks begin at a record, thus
+ * a reader may start at any block, e.g., by the time of its first frame.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lzblk.h"
+#include "pcapfile.h"
+
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_SHB              0x0a0d0d0a  /* section header block    */
+#define PCAPNG_IDB              0x00000001  /* interface description   */
+#define PCAPNG_EPB              0x00000006  /* enhanced packet block   */
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define LINKTYPE_ETHERNET       1
+
+#define PAD4(n)                 (((n) + 3) & ~3u)
+
+/* see pcap-savefile(5) */
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_rec_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+struct pcapng_shb {
+    uint32_t type;
+    uint32_t len;
+    uint32_t byte_order_magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int64_t section_len;
+    uint32_t opt_end;
+    uint32_t len_again;
+} __attribute__ ((__packed__));
+
+struct pcapng_epb_hdr {
+    uint32_t type;
+    uint32_t len;
+    uint32_t ifid;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t caplen;
+    uint32_t origlen;
+};
+
+static void *writer_run(void *arg);
+static void *compressor_run(void *arg);
+static void compress_buffer(struct pcapfile *pf, struct pcapbuf *b);
+static void writer_write(struct pcapfile *pf, struct pcapbuf *b);
+static int writer_open(struct pcapfile *pf, unsigned int seq);
+static int write_all(struct pcapfile *pf, const unsigned char *buf,
+        size_t len);
+static int file_name(const struct pcapfile *pf, unsigned int seq,
+        char *name, size_t size);
+static int put(struct pcapfile *pf, const void *hdr, size_t hdrlen,
+        const void *data, size_t datalen, const void *trailer,
+        size_t trailerlen);
+static int get_buffer(struct pcapfile *pf);
+static void queue_buffer(struct pcapfile *pf);
+static int put_header(struct pcapfile *pf);
+static int put_idb(struct pcapfile *pf, const char *ifname);
+static void next_file(struct pcapfile *pf);
+static int if_id(struct pcapfile *pf, int ifindex);
+
+/* map the name of a file format to PCAPFILE_*, -1 if unknown */
+int pcapfile_format(const char *name)
+{
+    if (!strcmp(name, "pcap"))
+        return PCAPFILE_PCAP;
+    if (!strcmp(name, "pcapng"))
+        return PCAPFILE_PCAPNG;
+    return -1;
+}
+
+/*
+ * open path ("-" for stdout), or the first of the series if opts limits
+ * the files, and start the writer thread. The header goes out with the
+ * first frame, after the interfaces have been added.
+ */
+int pcapfile_open(struct pcapfile *pf, const char *path, int format,
+        unsigned int snaplen, const struct pcapfile_opts *opts)
+{
+    int i, rc;
+
+    memset(pf, 0, sizeof(*pf));
+    pf->format = format;
+    pf->snaplen = snaplen;
+    if (opts != NULL)
+        pf->opts = *opts;
+    pf->fd = -1;
+    pf->cur = -1;
+    pf->need_header = 1;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_mutex_init(&pf->qlock, NULL);
+    pthread_cond_init(&pf->ready, NULL);
+    pthread_cond_init(&pf->zready, NULL);
+    pthread_cond_init(&pf->freed, NULL);
+
+    /* room for the .seq of a series */
+    if (strlen(path) + sizeof(".4294967295") > sizeof(pf->path)) {
+        fprintf(stderr, "ERROR: path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(pf->path, path);
+    pf->tostdout = !strcmp(path, "-");
+    if (pf->tostdout && (pf->opts.max_bytes > 0 || pf->opts.max_secs > 0)) {
+        fprintf(stderr, "ERROR: cannot switch files when writing to "
+                "stdout\n");
+        return -1;
+    }
+
+    for (i = 0; i < PCAPFILE_NBUFS; i ++) {
+        if (posix_memalign((void **)&pf->bufs[i].data, PCAPFILE_ALIGN,
+                    PCAPFILE_BUFSIZE) != 0) {
+            fprintf(stderr, "insufficient memory\n");
+            pcapfile_close(pf);
+            return -1;
+        }
+        if (pf->opts.compress && (pf->bufs[i].zdata = malloc(sizeof(struct
+                        lzblk_hdr) + LZBLK_BOUND(PCAPFILE_BUFSIZE))) == NULL) {
+            fprintf(stderr, "insufficient memory\n");
+            pcapfile_close(pf);
+            return -1;
+        }
+        pf->freelist[pf->nfree ++] = i;
+    }
+    if (pf->opts.compress && (pf->ztable = malloc(LZBLK_HASH_SIZE
+                    * sizeof(*pf->ztable))) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        pcapfile_close(pf);
+        return -1;
+    }
+
+    /* find out now, not with the first frame, that we can't write */
+    if (writer_open(pf, 0) != 0) {
+        pcapfile_close(pf);
+        return -1;
+    }
+
+    if ((rc = pthread_create(&pf->tid, NULL, writer_run, pf)) != 0) {
+        fprintf(stderr, "ERROR: pthread_create(...): %s\n", strerror(rc));
+        pcapfile_close(pf);
+        return -1;
+    }
+    pf->running = 1;
+
+    if (pf->opts.compress) {
+        if ((rc = pthread_create(&pf->ztid, NULL,
+                        compressor_run, pf)) != 0) {
+            fprintf(stderr, "ERROR: pthread_create(...): %s\n",
+                    strerror(rc));
+            pcapfile_close(pf);
+            return -1;
+        }
+        pf->zrunning = 1;
+    }
+    return 0;
+}
+
+/*
+ * describe an interface frames are captured at. pcapng files get an
+ * interface description block with the name of the interface and a
+ * timestamp resolution of nanoseconds, in every file of a series.
+ */
+int pcapfile_add_if(struct pcapfile *pf, int ifindex, const char *ifname)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&pf->lock);
+    if (pf->nifs == PCAPFILE_MAX_IFS) {
+        pthread_mutex_unlock(&pf->lock);
+        return -1;
+    }
+    pf->ifindex[pf->nifs] = ifindex;
+    strncpy(pf->ifname[pf->nifs], ifname, IFNAMSIZ - 1);
+    pf->nifs ++;
+
+    /* otherwise it goes out with the header */
+    if (!pf->need_header)
+        rc = put_idb(pf, ifname);
+    pthread_mutex_unlock(&pf->lock);
+
+    return rc;
+}
+
+int pcapfile_write(struct pcapfile *pf, const struct capframe *frame)
+{
+    static const unsigned char zeros[4] = {0, 0, 0, 0};
+    struct pcap_rec_hdr rh;
+    struct pcapng_epb_hdr eh;
+    unsigned char trailer[8];
+    unsigned long long ts;
+    unsigned int caplen;
+    uint32_t blklen;
+    size_t pad, len;
+    int rc;
+
+    caplen = frame->caplen < pf->snaplen ? frame->caplen : pf->snaplen;
+    if (pf->format == PCAPFILE_PCAP)
+        len = sizeof(rh) + caplen;
+    else
+        len = sizeof(eh) + PAD4(caplen) + 4;
+
+    pthread_mutex_lock(&pf->lock);
+
+    /* on to the next file if this one is full or old enough */
+    if (pf->filestart == 0)
+        pf->filestart = frame->ts.tv_sec;
+    if ((pf->opts.max_bytes > 0 && pf->filebytes + len > pf->opts.max_bytes
+                && pf->fileframes > 0)
+            || (pf->opts.max_secs > 0 && frame->ts.tv_sec
+                >= pf->filestart + (time_t)pf->opts.max_secs)) {
+        next_file(pf);
+        pf->filestart = frame->ts.tv_sec;
+    }
+
+    if (pf->format == PCAPFILE_PCAP) {
+        rh.ts_sec = frame->ts.tv_sec;
+        rh.ts_nsec = frame->ts.tv_nsec;
+        rh.incl_len = caplen;
+        rh.orig_len = frame->len;
+        rc = put(pf, &rh, sizeof(rh), frame->data, caplen, NULL, 0);
+    } else {
+        ts = (unsigned long long)frame->ts.tv_sec * 1000000000ULL
+            + frame->ts.tv_nsec;
+        pad = PAD4(caplen) - caplen;
+        blklen = len;
+
+        eh.type = PCAPNG_EPB;
+        eh.len = blklen;
+        eh.ifid = if_id(pf, frame->ifindex);
+        eh.ts_high = ts >> 32;
+        eh.ts_low = ts & 0xffffffff;
+        eh.caplen = caplen;
+        eh.origlen = frame->len;
+
+        memcpy(trailer, zeros, pad);
+        memcpy(trailer + pad, &blklen, 4);
+        rc = put(pf, &eh, sizeof(eh), frame->data, caplen, trailer, pad + 4);
+    }
+    if (rc == 0) {
+        pf->frames ++;
+        pf->fileframes ++;
+    } else
+        stat_add(&pf->dropped, 1);
+    pthread_mutex_unlock(&pf->lock);
+
+    return rc;
+}
+
+/* queue the records buffered so far to the writer, without waiting */
+int pcapfile_flush(struct pcapfile *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    if (pf->cur >= 0 && pf->bufs[pf->cur].len > 0)
+        queue_buffer(pf);
+    pthread_mutex_unlock(&pf->lock);
+
+    return pcapfile_error(pf) != 0 ? -1 : 0;
+}
+
+/* write out everything and stop the writer */
+int pcapfile_close(struct pcapfile *pf)
+{
+    int i, rc = 0;
+
+    pcapfile_flush(pf);
+    /* the compressor first, it queues to the writer until it is done */
+    if (pf->zrunning) {
+        pthread_mutex_lock(&pf->qlock);
+        pf->zclosing = 1;
+        pthread_cond_signal(&pf->zready);
+        pthread_mutex_unlock(&pf->qlock);
+        pthread_join(pf->ztid, NULL);
+        pf->zrunning = 0;
+    }
+    if (pf->running) {
+        pthread_mutex_lock(&pf->qlock);
+        pf->closing = 1;
+        pthread_cond_signal(&pf->ready);
+        pthread_mutex_unlock(&pf->qlock);
+        pthread_join(pf->tid, NULL);
+        pf->running = 0;
+    }
+
+    if (pf->fd >= 0 && !pf->tostdout && close(pf->fd) != 0
+            && pf->error == 0)
+        pf->error = errno;
+    pf->fd = -1;
+    for (i = 0; i < PCAPFILE_NBUFS; i ++) {
+        free(pf->bufs[i].data);
+        free(pf->bufs[i].zdata);
+        pf->bufs[i].data = NULL;
+        pf->bufs[i].zdata = NULL;
+    }
+    free(pf->ztable);
+    pf->ztable = NULL;
+    if (pf->error != 0)
+        rc = -1;
+
+    return rc;
+}
+
+/* errno of the first failed write, 0 if none */
+int pcapfile_error(const struct pcapfile *pf)
+{
+    return __atomic_load_n(&pf->error, __ATOMIC_RELAXED);
+}
+
+/* what the writer has done and how far behind it is */
+void pcapfile_report(const struct pcapfile *pf, FILE *fp)
+{
+    fprintf(fp, "  writer: %llu files %llu bytes, %llu of %d buffers "
+            "queued (high water %llu), %llu frames dropped\n",
+            stat_read(&pf->files), stat_read(&pf->bytes),
+            stat_read(&pf->backlog), PCAPFILE_NBUFS,
+            stat_read(&pf->backlog_max), stat_read(&pf->dropped));
+    hist_summary(&pf->latency, "  write latency ns", fp);
+    if (pf->opts.compress && stat_read(&pf->zbytes) > 0) {
+        fprintf(fp, "  compressed %llu to %llu bytes, ratio %.2f, "
+                "%.1f MB/s\n", stat_read(&pf->rawbytes),
+                stat_read(&pf->zbytes), (double)stat_read(&pf->rawbytes)
+                / stat_read(&pf->zbytes), stat_read(&pf->zns) == 0 ? 0 :
+                stat_read(&pf->rawbytes) * 1e3 / stat_read(&pf->zns));
+    }
+}
+
+/* write the queued buffers, oldest first, until closed */
+static void *writer_run(void *arg)
+{
+    struct pcapfile *pf = arg;
+    struct pcapbuf *b;
+    int i;
+
+    pthread_mutex_lock(&pf->qlock);
+    while (1) {
+        while (pf->nqueued == 0 && !pf->closing)
+            pthread_cond_wait(&pf->ready, &pf->qlock);
+        if (pf->nqueued == 0)
+            break;
+        i = pf->queue[pf->qhead];
+        pthread_mutex_unlock(&pf->qlock);
+
+        b = &pf->bufs[i];
+        writer_write(pf, b);
+
+        pthread_mutex_lock(&pf->qlock);
+        pf->qhead = (pf->qhead + 1) % PCAPFILE_NBUFS;
+        pf->nqueued --;
+        __atomic_store_n(&pf->backlog, pf->nqueued + pf->nzqueued,
+                __ATOMIC_RELAXED);
+        pf->freelist[pf->nfree ++] = i;
+        pthread_cond_signal(&pf->freed);
+    }
+    pthread_mutex_unlock(&pf->qlock);
+
+    return NULL;
+}
+
+/* compress the queued buffers, oldest first, and queue them to write */
+static void *compressor_run(void *arg)
+{
+    struct pcapfile *pf = arg;
+    int i;
+
+    pthread_mutex_lock(&pf->qlock);
+    while (1) {
+        while (pf->nzqueued == 0 && !pf->zclosing)
+            pthread_cond_wait(&pf->zready, &pf->qlock);
+        if (pf->nzqueued == 0)
+            break;
+        i = pf->zqueue[pf->zqhead];
+        pthread_mutex_unlock(&pf->qlock);
+
+        compress_buffer(pf, &pf->bufs[i]);
+
+        pthread_mutex_lock(&pf->qlock);
+        pf->zqhead = (pf->zqhead + 1) % PCAPFILE_NBUFS;
+        pf->nzqueued --;
+        pf->queue[(pf->qhead + pf->nqueued) % PCAPFILE_NBUFS] = i;
+        pf->nqueued ++;
+        pthread_cond_signal(&pf->ready);
+    }
+    pthread_mutex_unlock(&pf->qlock);
+
+    return NULL;
+}
+
+static void compress_buffer(struct pcapfile *pf, struct pcapbuf *b)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    b->zlen = lzblk_frame(b->data, b->len, b->zdata, pf->ztable);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    stat_add(&pf->rawbytes, b->len);
+    stat_add(&pf->zbytes, b->zlen);
+    stat_add(&pf->zns, (end.tv_sec - start.tv_sec) * 1000000000ULL
+            + end.tv_nsec - start.tv_nsec);
+}
+
+static void writer_write(struct pcapfile *pf, struct pcapbuf *b)
+{
+    struct timespec now;
+    long long ns;
+
+    if (b->seq != pf->fdseq && writer_open(pf, b->seq) != 0)
+        return;
+    if (pf->fd >= 0 && pcapfile_error(pf) == 0) {
+        if (pf->opts.compress)
+            write_all(pf, b->zdata, b->zlen);
+        else
+            write_all(pf, b->data, b->len);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - b->queued.tv_sec) * 1000000000LL
+        + (now.tv_nsec - b->queued.tv_nsec);
+    hist_add(&pf->latency, ns > 0 ? ns : 0);
+}
+
+/*
+ * close the current file and open file seq of the series, removing the
+ * oldest file if we keep only so many
+ */
+static int writer_open(struct pcapfile *pf, unsigned int seq)
+{
+    char name[PCAPFILE_PATHLEN];
+    int err;
+
+    if (pf->tostdout) {
+        pf->fd = STDOUT_FILENO;
+        stat_add(&pf->files, 1);
+        return 0;
+    }
+
+    if (pf->fd >= 0 && close(pf->fd) != 0 && pf->error == 0)
+        __atomic_store_n(&pf->error, errno, __ATOMIC_RELAXED);
+    pf->fd = -1;
+    pf->fdseq = seq;
+
+    if (file_name(pf, seq, name, sizeof(name)) != 0) {
+        fprintf(stderr, "ERROR: the name of file %u of %s is too long\n",
+                seq, pf->path);
+        if (pf->error == 0)
+            __atomic_store_n(&pf->error, ENAMETOOLONG, __ATOMIC_RELAXED);
+        return -1;
+    }
+    if ((pf->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        err = errno;
+        fprintf(stderr, "ERROR: open(%s, ...): %s\n", name, strerror(err));
+        if (pf->error == 0)
+            __atomic_store_n(&pf->error, err, __ATOMIC_RELAXED);
+        return -1;
+    }
+    stat_add(&pf->files, 1);
+
+    if (pf->opts.max_files > 0 && seq >= pf->opts.max_files) {
+        if (file_name(pf, seq - pf->opts.max_files, name,
+                    sizeof(name)) == 0
+                && unlink(name) != 0 && errno != ENOENT)
+            fprintf(stderr, "WARN: unlink(%s): %s\n", name, strerror(errno));
+    }
+    return 0;
+}
+
+/*
+ * path itself, or path.seq if the files are switched. -1 if it does not
+ * fit size, rather than a truncated name that may be another file
+ */
+static int file_name(const struct pcapfile *pf, unsigned int seq,
+        char *name, size_t size)
+{
+    int n;
+
+    if (pf->opts.max_bytes == 0 && pf->opts.max_secs == 0)
+        n = snprintf(name, size, "%s", pf->path);
+    else
+        n = snprintf(name, size, "%s.%u", pf->path, seq);
+    return n >= 0 && (size_t)n < size ? 0 : -1;
+}
+
+/* write(2) until everything is written, remembering the first error */
+static int write_all(struct pcapfile *pf, const unsigned char *buf,
+        size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(pf->fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            __atomic_store_n(&pf->error, errno, __ATOMIC_RELAXED);
+            return -1;
+        }
+        stat_add(&pf->bytes, n);
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * append a record to the current buffer, queueing the buffer to the
+ * writer and taking a free one first if it does not fit. A file begins
+ * with its header.
+ */
+static int put(struct pcapfile *pf, const void *hdr, size_t hdrlen,
+        const void *data, size_t datalen, const void *trailer,
+        size_t trailerlen)
+{
+    struct pcapbuf *b;
+    size_t len = hdrlen + datalen + trailerlen;
+
+    if (pcapfile_error(pf) != 0)
+        return -1;
+
+    if (pf->cur >= 0 && pf->bufs[pf->cur].len + len > PCAPFILE_BUFSIZE)
+        queue_buffer(pf);
+    if (pf->cur < 0 && get_buffer(pf) != 0)
+        return -1;
+    if (pf->need_header) {
+        pf->need_header = 0;
+        if (put_header(pf) != 0)
+            return -1;
+        /* the header may have taken the room the record was to have */
+        return put(pf, hdr, hdrlen, data, datalen, trailer, trailerlen);
+    }
+
+    b = &pf->bufs[pf->cur];
+    memcpy(b->data + b->len, hdr, hdrlen);
+    if (datalen > 0)
+        memcpy(b->data + b->len + hdrlen, data, datalen);
+    if (trailerlen > 0)
+        memcpy(b->data + b->len + hdrlen + datalen, trailer, trailerlen);
+    b->len += len;
+    pf->filebytes += len;
+    return 0;
+}
+
+/* a free buffer to fill, waiting for one only if told to */
+static int get_buffer(struct pcapfile *pf)
+{
+    pthread_mutex_lock(&pf->qlock);
+    while (pf->nfree == 0 && pf->opts.wait)
+        pthread_cond_wait(&pf->freed, &pf->qlock);
+    if (pf->nfree == 0) {
+        pthread_mutex_unlock(&pf->qlock);
+        return -1;
+    }
+    pf->cur = pf->freelist[-- pf->nfree];
+    pthread_mutex_unlock(&pf->qlock);
+
+    pf->bufs[pf->cur].len = 0;
+    pf->bufs[pf->cur].seq = pf->seq;
+    return 0;
+}
+
+/* hand the current buffer to the writer */
+static void queue_buffer(struct pcapfile *pf)
+{
+    struct pcapbuf *b = &pf->bufs[pf->cur];
+    unsigned long long n;
+
+    clock_gettime(CLOCK_MONOTONIC, &b->queued);
+    pthread_mutex_lock(&pf->qlock);
+    if (pf->opts.compress) {
+        pf->zqueue[(pf->zqhead + pf->nzqueued) % PCAPFILE_NBUFS] = pf->cur;
+        pf->nzqueued ++;
+        pthread_cond_signal(&pf->zready);
+    } else {
+        pf->queue[(pf->qhead + pf->nqueued) % PCAPFILE_NBUFS] = pf->cur;
+        pf->nqueued ++;
+        pthread_cond_signal(&pf->ready);
+    }
+    n = pf->nqueued + pf->nzqueued;
+    __atomic_store_n(&pf->backlog, n, __ATOMIC_RELAXED);
+    if (n > pf->backlog_max)
+        __atomic_store_n(&pf->backlog_max, n, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pf->qlock);
+    pf->cur = -1;
+}
+
+/* the records of the next frame go to the next file of the series */
+static void next_file(struct pcapfile *pf)
+{
+    if (pf->cur >= 0 && pf->bufs[pf->cur].len > 0)
+        queue_buffer(pf);
+    pf->seq ++;
+    pf->filebytes = 0;
+    pf->fileframes = 0;
+    pf->need_header = 1;
+}
+
+/* the file header, and the interfaces added so far for pcapng */
+static int put_header(struct pcapfile *pf)
+{
+    struct pcap_file_hdr fh;
+    struct pcapng_shb shb;
+    int i;
+
+    if (pf->format == PCAPFILE_PCAP) {
+        fh.magic = PCAP_MAGIC_NSEC;
+        fh.version_major = 2;
+        fh.version_minor = 4;
+        fh.thiszone = 0;
+        fh.sigfigs = 0;
+        fh.snaplen = pf->snaplen;
+        fh.linktype = LINKTYPE_ETHERNET;
+        return put(pf, &fh, sizeof(fh), NULL, 0, NULL, 0);
+    }
+
+    shb.type = PCAPNG_SHB;
+    shb.len = sizeof(shb);
+    shb.byte_order_magic = PCAPNG_BYTE_ORDER_MAGIC;
+    shb.version_major = 1;
+    shb.version_minor = 0;
+    shb.section_len = -1;      /* not known */
+    shb.opt_end = PCAPNG_OPT_ENDOFOPT;
+    shb.len_again = sizeof(shb);
+    if (put(pf, &shb, sizeof(shb), NULL, 0, NULL, 0) != 0)
+        return -1;
+    for (i = 0; i < pf->nifs; i ++) {
+        if (put_idb(pf, pf->ifname[i]) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* an interface description block, pcapng only */
+static int put_idb(struct pcapfile *pf, const char *ifname)
+{
+    unsigned char idb[16 + 4 + 256 + 8 + 4 + 4];
+    size_t namelen = strlen(ifname), len = 0;
+    uint32_t u32;
+    uint16_t u16;
+
+    if (pf->format != PCAPFILE_PCAPNG)
+        return 0;
+    if (namelen > 255)
+        namelen = 255;
+
+    memset(idb, 0, sizeof(idb));
+    u32 = PCAPNG_IDB;
+    memcpy(idb, &u32, 4);
+    u16 = LINKTYPE_ETHERNET;
+    memcpy(idb + 8, &u16, 2);
+    memcpy(idb + 12, &pf->snaplen, 4);
+    len = 16;
+
+    /* if_name */
+    u16 = PCAPNG_OPT_IF_NAME;
+    memcpy(idb + len, &u16, 2);
+    u16 = namelen;
+    memcpy(idb + len + 2, &u16, 2);
+    memcpy(idb + len + 4, ifname, namelen);
+    len += 4 + PAD4(namelen);
+
+    /* if_tsresol, 10^-9 */
+    u16 = PCAPNG_OPT_IF_TSRESOL;
+    memcpy(idb + len, &u16, 2);
+    u16 = 1;
+    memcpy(idb + len + 2, &u16, 2);
+    idb[len + 4] = 9;
+    len += 8;
+
+    /* opt_endofopt, and the block length at both ends */
+    len += 4 + 4;
+    u32 = len;
+    memcpy(idb + 4, &u32, 4);
+    memcpy(idb + len - 4, &u32, 4);
+
+    return put(pf, idb, len, NULL, 0, NULL, 0);
+}
+
+/* the pcapng interface id of ifindex, the first interface if unknown */
+static int if_id(struct pcapfile *pf, int ifindex)
+{
+    int i;
+
+    for (i = 0; i < pf->nifs; i ++) {
+        if (pf->ifindex[i] == ifindex)
+            return i;
+    }
+    return 0;
+}
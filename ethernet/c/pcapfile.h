@@ -0,0 +1,131 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCAPFILE_HD
+#define PCAPFILE_HD
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <net/if.h>
+
+#include "capframe.h"
+#include "hist.h"
+
+#define PCAPFILE_BUFSIZE        (1 << 20)  /* bytes per write           */
+#define PCAPFILE_NBUFS          16         /* buffers, filled or queued */
+#define PCAPFILE_ALIGN          4096       /* of the buffers, a page    */
+#define PCAPFILE_MAX_IFS        64
+#define PCAPFILE_PATHLEN        4096
+
+#define PCAPFILE_PCAP           0   /* pcap, nanosecond timestamps     */
+#define PCAPFILE_PCAPNG         1   /* pcapng, nanosecond timestamps   */
+
+/* when to move on to the next file, and how to treat a full backlog */
+struct pcapfile_opts {
+    unsigned long long max_bytes;   /* per file, 0 for no limit        */
+    unsigned int max_secs;          /* per file, 0 for no limit        */
+    unsigned int max_files;         /* keep the last so many, 0 for all */
+    int wait;                   /* wait for the writer, don't drop     */
+    int compress;               /* in blocks of lzblk.c                */
+};
+
+/* a buffer of records, filled by the caller and written by the writer */
+struct pcapbuf {
+    unsigned char *data;        /* PCAPFILE_ALIGN aligned              */
+    size_t len;
+    unsigned int seq;           /* of the file the records belong to   */
+    struct timespec queued;     /* when handed to the writer           */
+    unsigned char *zdata;       /* the block compressed, if compressing */
+    size_t zlen;
+};
+
+/* a capture file, or a series of them, being written */
+struct pcapfile {
+    char path[PCAPFILE_PATHLEN];
+    int format;
+    unsigned int snaplen;
+    struct pcapfile_opts opts;
+    int nifs;                   /* interfaces described in the file    */
+    int ifindex[PCAPFILE_MAX_IFS];
+    char ifname[PCAPFILE_MAX_IFS][IFNAMSIZ];
+
+    /* the caller's side, under lock */
+    pthread_mutex_t lock;
+    int cur;                    /* buffer being filled, or -1          */
+    unsigned int seq;           /* file being filled                   */
+    unsigned long long filebytes;   /* of that file, queued or not     */
+    time_t filestart;           /* time of its first frame, or 0       */
+    int need_header;            /* the file has no header yet          */
+    unsigned long long fileframes;
+    unsigned long long frames;
+
+    /* the buffers, handed back and forth under qlock */
+    struct pcapbuf bufs[PCAPFILE_NBUFS];
+    pthread_mutex_t qlock;
+    pthread_cond_t ready;       /* a buffer was queued, or closing     */
+    pthread_cond_t zready;      /* a buffer was queued to compress     */
+    pthread_cond_t freed;       /* a buffer was written                */
+    int freelist[PCAPFILE_NBUFS];
+    int nfree;
+    int queue[PCAPFILE_NBUFS];  /* to write, oldest first              */
+    int qhead;
+    int nqueued;
+    int zqueue[PCAPFILE_NBUFS]; /* to compress, oldest first           */
+    int zqhead;
+    int nzqueued;
+    int closing;
+    int zclosing;
+
+    /* the compressor thread's side */
+    pthread_t ztid;
+    int zrunning;
+    uint32_t *ztable;
+
+    /* the writer thread's side */
+    pthread_t tid;
+    int running;
+    int fd;
+    int tostdout;
+    unsigned int fdseq;         /* file fd is open on                  */
+    int error;                  /* errno of the first failed write     */
+
+    /* read by others with stat_read() */
+    unsigned long long bytes;   /* bytes written to the files          */
+    unsigned long long files;   /* files opened                        */
+    unsigned long long dropped; /* frames dropped, no buffer was free  */
+    unsigned long long backlog; /* buffers queued to the writer        */
+    unsigned long long backlog_max;
+    struct hist latency;        /* ns from queued to written           */
+    unsigned long long rawbytes;    /* compressed so far, before       */
+    unsigned long long zbytes;      /* and after                       */
+    unsigned long long zns;         /* time it took                    */
+};
+
+int pcapfile_format(const char *name);
+int pcapfile_open(struct pcapfile *pf, const char *path, int format,
+        unsigned int snaplen, const struct pcapfile_opts *opts);
+int pcapfile_add_if(struct pcapfile *pf, int ifindex, const char *ifname);
+int pcapfile_write(struct pcapfile *pf, const struct capframe *frame);
+int pcapfile_flush(struct pcapfile *pf);
+int pcapfile_close(struct pcapfile *pf);
+int pcapfile_error(const struct pcapfile *pf);
+void pcapfile_report(const struct pcapfile *pf, FILE *fp);
+
+#endif
@@ -0,0 +1,410 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * read frames from a pcap or pcapng file, see pcapfile.c for the formats.
+ * The file is mapped into memory and the frames are handed out in place,
+ * without a copy or a system call per frame, so that reading a file costs
+ * next to nothing next to what is done with the frames.
+ *
+ * Both byte orders are understood, and pcap files with microsecond or
+ * nanosecond timestamps. Of pcapng, the section header, interface
+ * description, enhanced and simple packet blocks are read and the other
+ * blocks are skipped. The frames of interface i of a pcapng file get
+ * ifindex i + 1, those of a pcap file ifindex 1.
+ *
+ * A file compressed by pcapfile.c is decompressed into memory as a whole
+ * when it is opened.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lzblk.h"
+#include "pcapread.h"
+
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_SHB              0x0a0d0d0a
+#define PCAPNG_IDB              0x00000001
+#define PCAPNG_SPB              0x00000003
+#define PCAPNG_EPB              0x00000006
+#define PCAPNG_OPT_ENDOFOPT     0
+#define PCAPNG_OPT_IF_NAME      2
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+#define PCAP_FILE_HDR_LEN       24
+#define PCAP_REC_HDR_LEN        16
+
+#define PAD4(n)                 (((n) + 3) & ~3u)
+
+static uint32_t get32(const struct pcapread *rd, const unsigned char *p);
+static uint16_t get16(const struct pcapread *rd, const unsigned char *p);
+static int read_shb(struct pcapread *rd, const unsigned char *p, size_t len);
+static int read_idb(struct pcapread *rd, const unsigned char *p, size_t len);
+static int read_headers(struct pcapread *rd);
+static int decompress(struct pcapread *rd, const char *path);
+static void set_time(const struct pcapread_if *ifp, unsigned long long t,
+        struct timespec *ts);
+
+int pcapread_open(struct pcapread *rd, const char *path)
+{
+    struct stat st;
+    uint32_t magic;
+    int fd;
+
+    memset(rd, 0, sizeof(*rd));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < PCAP_FILE_HDR_LEN) {
+        fprintf(stderr, "ERROR: %s is not a capture file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    rd->maplen = st.st_size;
+    rd->map = mmap(NULL, rd->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rd->map == MAP_FAILED) {
+        rd->map = NULL;
+        perror("mmap(capture file) failed");
+        return -1;
+    }
+    /* read ahead aggressively and drop the pages behind us */
+    madvise(rd->map, rd->maplen, MADV_SEQUENTIAL);
+
+    memcpy(&magic, rd->map, 4);
+    if (magic == LZBLK_MAGIC) {
+        if (decompress(rd, path) != 0)
+            return -1;
+        if (rd->maplen < PCAP_FILE_HDR_LEN) {
+            fprintf(stderr, "ERROR: %s is not a capture file\n", path);
+            pcapread_close(rd);
+            return -1;
+        }
+        memcpy(&magic, rd->map, 4);
+    }
+    if (magic == PCAPNG_SHB) {
+        rd->pcapng = 1;
+        return read_headers(rd);
+    }
+
+    if (magic == __builtin_bswap32(PCAP_MAGIC_USEC)
+            || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        rd->swapped = 1;
+        magic = __builtin_bswap32(magic);
+    }
+    if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+        fprintf(stderr, "ERROR: %s is neither pcap nor pcapng\n", path);
+        pcapread_close(rd);
+        return -1;
+    }
+
+    rd->nifs = 1;
+    strcpy(rd->ifs[0].name, "file");
+    rd->ifs[0].snaplen = get32(rd, rd->map + 16);
+    rd->ifs[0].linktype = get32(rd, rd->map + 20);
+    rd->ifs[0].units = magic == PCAP_MAGIC_NSEC ? 1000000000 : 1000000;
+    rd->off = PCAP_FILE_HDR_LEN;
+    return 0;
+}
+
+/*
+ * the next frame, its data pointing into the file. Returns 1, or 0 at the
+ * end of the file, -1 if the file is broken.
+ */
+int pcapread_next(struct pcapread *rd, struct capframe *frame)
+{
+    const unsigned char *p;
+    size_t left;
+    uint32_t type, len, ifid;
+
+    memset(frame, 0, sizeof(*frame));
+    while (rd->off < rd->maplen) {
+        p = rd->map + rd->off;
+        left = rd->maplen - rd->off;
+
+        if (!rd->pcapng) {
+            if (left < PCAP_REC_HDR_LEN)
+                break;
+            frame->caplen = get32(rd, p + 8);
+            frame->len = get32(rd, p + 12);
+            if (frame->caplen > left - PCAP_REC_HDR_LEN)
+                break;
+            set_time(&rd->ifs[0], (unsigned long long)get32(rd, p)
+                    * rd->ifs[0].units + get32(rd, p + 4), &frame->ts);
+            frame->data = (unsigned char *)p + PCAP_REC_HDR_LEN;
+            frame->ifindex = 1;
+            rd->off += PCAP_REC_HDR_LEN + frame->caplen;
+            return 1;
+        }
+
+        /* a block: type, total length, body, total length */
+        if (left < 12)
+            break;
+        type = get32(rd, p);
+        if (type == PCAPNG_SHB) {
+            if (read_shb(rd, p, left) != 0)
+                return -1;
+        }
+        len = get32(rd, p + 4);
+        if (len < 12 || len % 4 != 0 || len > left)
+            break;
+        rd->off += len;
+
+        switch (type) {
+            case PCAPNG_IDB:
+                if (read_idb(rd, p, len) != 0)
+                    return -1;
+                break;
+            case PCAPNG_EPB:
+                if (len < 32)
+                    return -1;
+                ifid = get32(rd, p + 8);
+                frame->caplen = get32(rd, p + 20);
+                frame->len = get32(rd, p + 24);
+                if (ifid >= (uint32_t)rd->nifs || frame->caplen > len - 32) {
+                    fprintf(stderr, "ERROR: broken packet block\n");
+                    return -1;
+                }
+                set_time(&rd->ifs[ifid], (unsigned long long)get32(rd, p + 12)
+                        << 32 | get32(rd, p + 16), &frame->ts);
+                frame->data = (unsigned char *)p + 28;
+                frame->ifindex = ifid + 1;
+                return 1;
+            case PCAPNG_SPB:
+                /* no timestamp, and the captured length is implied */
+                if (rd->nifs == 0 || len < 16)
+                    return -1;
+                frame->len = get32(rd, p + 8);
+                frame->caplen = frame->len;
+                if (rd->ifs[0].snaplen > 0
+                        && frame->caplen > rd->ifs[0].snaplen)
+                    frame->caplen = rd->ifs[0].snaplen;
+                if (frame->caplen > len - 16)
+                    frame->caplen = len - 16;
+                frame->data = (unsigned char *)p + 12;
+                frame->ifindex = 1;
+                return 1;
+        }
+    }
+
+    if (rd->off < rd->maplen)
+        fprintf(stderr, "WARN: capture file is truncated\n");
+    rd->off = rd->maplen;
+    return 0;
+}
+
+void pcapread_close(struct pcapread *rd)
+{
+    if (rd->map != NULL && rd->decompressed)
+        free(rd->map);
+    else if (rd->map != NULL)
+        munmap(rd->map, rd->maplen);
+    rd->map = NULL;
+}
+
+static uint32_t get32(const struct pcapread *rd, const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return rd->swapped ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t get16(const struct pcapread *rd, const unsigned char *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, 2);
+    return rd->swapped ? __builtin_bswap16(v) : v;
+}
+
+/* replace the mapped blocks of a compressed file by what they hold */
+static int decompress(struct pcapread *rd, const char *path)
+{
+    struct lzblk_hdr h;
+    unsigned char *buf;
+    size_t off, len = 0, total, used;
+    long n;
+
+    for (off = 0; off + sizeof(h) <= rd->maplen; off += sizeof(h) + h.len) {
+        memcpy(&h, rd->map + off, sizeof(h));
+        if (h.magic != LZBLK_MAGIC)
+            break;
+        len += h.rawlen;
+    }
+
+    total = len;
+    if ((buf = malloc(total > 0 ? total : 1)) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        pcapread_close(rd);
+        return -1;
+    }
+    for (off = 0, len = 0; off < rd->maplen; off += used, len += n) {
+        n = lzblk_unframe(rd->map + off, rd->maplen - off, buf + len,
+                total - len, &used);
+        if (n < 0) {
+            fprintf(stderr, "WARN: %s: broken block at %zu, the rest is "
+                    "skipped\n", path, off);
+            break;
+        }
+    }
+
+    pcapread_close(rd);
+    rd->map = buf;
+    rd->maplen = len;
+    rd->decompressed = 1;
+    return 0;
+}
+
+/*
+ * the blocks up to the first frame, so that the interfaces are known
+ * before the frames are read. Interfaces described further on are added
+ * as they come along.
+ */
+static int read_headers(struct pcapread *rd)
+{
+    const unsigned char *p;
+    size_t left;
+    uint32_t type, len;
+
+    while (rd->off + 12 <= rd->maplen) {
+        p = rd->map + rd->off;
+        left = rd->maplen - rd->off;
+        /* the type of a section header reads the same in either order */
+        type = get32(rd, p);
+        if (type == PCAPNG_EPB || type == PCAPNG_SPB)
+            break;
+        if (type == PCAPNG_SHB && read_shb(rd, p, left) != 0)
+            break;
+        len = get32(rd, p + 4);
+        if (len < 12 || len % 4 != 0 || len > left)
+            break;
+        if (type == PCAPNG_IDB && read_idb(rd, p, len) != 0)
+            break;
+        rd->off += len;
+    }
+
+    if (rd->nifs == 0) {
+        fprintf(stderr, "ERROR: no interface is described in the file\n");
+        pcapread_close(rd);
+        return -1;
+    }
+    return 0;
+}
+
+/* a new section, possibly of the other byte order, with no interfaces */
+static int read_shb(struct pcapread *rd, const unsigned char *p, size_t len)
+{
+    uint32_t magic;
+
+    if (len < 28) {
+        fprintf(stderr, "ERROR: broken section header block\n");
+        return -1;
+    }
+    memcpy(&magic, p + 8, 4);
+    if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+        rd->swapped = 0;
+    else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC))
+        rd->swapped = 1;
+    else {
+        fprintf(stderr, "ERROR: broken section header block\n");
+        return -1;
+    }
+    rd->nifs = 0;
+    return 0;
+}
+
+/* an interface: its link type, snaplen, name and timestamp resolution */
+static int read_idb(struct pcapread *rd, const unsigned char *p, size_t len)
+{
+    struct pcapread_if *ifp;
+    size_t off = 16, olen;
+    uint16_t code;
+    unsigned int res, i;
+
+    if (len < 20 || rd->nifs == PCAPREAD_MAX_IFS) {
+        fprintf(stderr, "ERROR: broken or too many interface blocks\n");
+        return -1;
+    }
+    ifp = &rd->ifs[rd->nifs];
+    memset(ifp, 0, sizeof(*ifp));
+    ifp->linktype = get16(rd, p + 8);
+    ifp->snaplen = get32(rd, p + 12);
+    ifp->units = 1000000;       /* microseconds unless told otherwise */
+    snprintf(ifp->name, sizeof(ifp->name), "if%d", rd->nifs);
+
+    /* options up to the trailing length */
+    while (off + 4 <= len - 4) {
+        code = get16(rd, p + off);
+        olen = get16(rd, p + off + 2);
+        if (code == PCAPNG_OPT_ENDOFOPT || off + 4 + olen > len - 4)
+            break;
+        if (code == PCAPNG_OPT_IF_NAME && olen > 0) {
+            i = olen < IFNAMSIZ - 1 ? olen : IFNAMSIZ - 1;
+            memcpy(ifp->name, p + off + 4, i);
+            ifp->name[i] = '\0';
+        } else if (code == PCAPNG_OPT_IF_TSRESOL && olen >= 1) {
+            /* 10^-n, or 2^-n if the top bit is set */
+            res = p[off + 4];
+            if (res & 0x80) {
+                ifp->shift = res & 0x7f;
+            } else {
+                ifp->units = 1;
+                for (i = 0; i < (res & 0x7f) && i < 19; i ++)
+                    ifp->units *= 10;
+            }
+        }
+        off += 4 + PAD4(olen);
+    }
+
+    rd->nifs ++;
+    return 0;
+}
+
+/* a timestamp in the units of the interface to a timespec */
+static void set_time(const struct pcapread_if *ifp, unsigned long long t,
+        struct timespec *ts)
+{
+    unsigned long long units, frac;
+
+    if (ifp->shift > 0 && ifp->shift < 64) {
+        ts->tv_sec = t >> ifp->shift;
+        frac = t & ((1ULL << ifp->shift) - 1);
+        ts->tv_nsec = ((unsigned __int128)frac * 1000000000) >> ifp->shift;
+        return;
+    }
+    units = ifp->units;
+    ts->tv_sec = t / units;
+    frac = t % units;
+    if (units <= 1000000000)
+        ts->tv_nsec = frac * (1000000000 / units);
+    else
+        ts->tv_nsec = frac / (units / 1000000000);
+}
@@ -0,0 +1,54 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCAPREAD_HD
+#define PCAPREAD_HD
+
+#include <stddef.h>
+#include <net/if.h>
+
+#include "capframe.h"
+
+#define PCAPREAD_MAX_IFS        64
+#define PCAPREAD_LINKTYPE_ETHERNET 1
+
+/* an interface described in a pcapng file, the only one of a pcap file */
+struct pcapread_if {
+    char name[IFNAMSIZ];
+    unsigned int linktype;
+    unsigned int snaplen;
+    unsigned long long units;   /* timestamp units per second         */
+    int shift;                  /* or 2^shift units, if not 0          */
+};
+
+/* a capture file mapped into memory for reading */
+struct pcapread {
+    unsigned char *map;
+    size_t maplen;
+    int decompressed;           /* map is malloc'ed, not mmap'ed       */
+    size_t off;                 /* of the next record                 */
+    int pcapng;
+    int swapped;                /* written on a host of other byte order */
+    int nifs;
+    struct pcapread_if ifs[PCAPREAD_MAX_IFS];
+};
+
+int pcapread_open(struct pcapread *rd, const char *path);
+int pcapread_next(struct pcapread *rd, struct capframe *frame);
+void pcapread_close(struct pcapread *rd);
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * receive frames from a TPACKET_V3 memory-mapped ring. See
+ * Documentation/networking/packet_mmap.rst in the Linux source tree.
+ *
+ * The ring is a number of blocks. The kernel fills a block with as many
+ * frames as fit and hands the whole block to us when it is full or when
+ * the block timeout expires, whichever comes first. We walk the frames in
+ * place, i.e., without copying them out of the ring, and give the block
+ * back to the kernel once all of its frames have been handled. One poll(2)
+ * thus accounts for up to a whole ring of frames instead of one recvfrom(2)
+ * and one copy per frame.
+ *
+ * The kernel reserves CAPFRAME_HEADROOM bytes in front of every frame
+ * (PACKET_RESERVE) so that the VLAN tag it took off, which the frame
+ * header tells, can be put back in place. With PACKET_VNET_HDR, the
+ * virtio-net header lies right in front of the frame, and is read before
+ * the frame is handed on.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "pktring.h"
+
+static struct tpacket_block_desc *block_at(struct pktring *ring,
+        unsigned int i);
+static void walk_block(struct pktring *ring, struct tpacket_block_desc *bd,
+        capframe_handler_t handler, void *arg);
+
+/*
+ * with vnet, the socket has PACKET_VNET_HDR on and the kernel puts the
+ * virtio-net header right in front of every frame
+ */
+int pktring_setup(struct pktring *ring, int sockfd, unsigned int block_size,
+        unsigned int block_nr, unsigned int timeout, int vnet)
+{
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    unsigned int reserve = CAPFRAME_HEADROOM;
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->sockfd = sockfd;
+    ring->vnet = vnet;
+
+    /* a block must be a power-of-two multiple of the page size */
+    if (block_size < (unsigned int)pagesize
+            || (block_size & (block_size - 1)) != 0 || block_nr == 0) {
+        fprintf(stderr,
+                "ERROR: block size %u is not a power of two no less than %ld "
+                "or number of blocks is 0\n", block_size, pagesize);
+        return -1;
+    }
+
+    if (setsockopt(sockfd, SOL_PACKET,
+            PACKET_VERSION, &version, sizeof(version)) != 0) {
+        perror("setsockopt(sockfd, SOL_PACKET, PACKET_VERSION, ...)");
+        return -1;
+    }
+    if (setsockopt(sockfd, SOL_PACKET,
+            PACKET_RESERVE, &reserve, sizeof(reserve)) != 0) {
+        perror("setsockopt(sockfd, SOL_PACKET, PACKET_RESERVE, ...)");
+        return -1;
+    }
+
+    /*
+     * the frame size matters little for TPACKET_V3 since frames are packed
+     * into a block back-to-back, but the kernel wants it to divide the block
+     * size evenly.
+     */
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_nr;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = (block_size / req.tp_frame_size) * block_nr;
+    req.tp_retire_blk_tov = timeout;
+    req.tp_feature_req_word = 0;
+    if (setsockopt(sockfd, SOL_PACKET,
+            PACKET_RX_RING, &req, sizeof(req)) != 0) {
+        perror("setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, ...)");
+        return -1;
+    }
+
+    ring->maplen = (size_t)block_size * block_nr;
+    ring->map = mmap(NULL, ring->maplen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_LOCKED, sockfd, 0);
+    if (ring->map == MAP_FAILED) {
+        /* MAP_LOCKED may exceed RLIMIT_MEMLOCK, try again without it */
+        ring->map = mmap(NULL, ring->maplen, PROT_READ | PROT_WRITE,
+                MAP_SHARED, sockfd, 0);
+    }
+    if (ring->map == MAP_FAILED) {
+        perror("mmap(NULL, maplen, ..., sockfd, 0)");
+        ring->map = NULL;
+        return -1;
+    }
+
+    ring->block_size = block_size;
+    ring->block_nr = block_nr;
+    ring->cur = 0;
+    return 0;
+}
+
+/*
+ * wait up to timeout milliseconds (-1 forever) for the kernel to hand us a
+ * block, then walk every block that is ready and give each one back once
+ * its frames are handled. Returns the number of frames handled, or -1 if
+ * poll(2) fails.
+ */
+int pktring_poll(struct pktring *ring, int timeout,
+        capframe_handler_t handler, void *arg)
+{
+    struct tpacket_block_desc *bd;
+    struct pollfd pfd;
+    unsigned int walked = 0;
+    int nframes = 0;
+
+    bd = block_at(ring, ring->cur);
+    if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+        pfd.fd = ring->sockfd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+    }
+
+    while (walked < ring->block_nr
+            && (__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+                & TP_STATUS_USER) != 0) {
+        nframes += bd->hdr.bh1.num_pkts;
+        walk_block(ring, bd, handler, arg);
+
+        /* done with the frames in the block, give it back to the kernel */
+        __atomic_store_n(&bd->hdr.bh1.block_status,
+                TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+        ring->cur = (ring->cur + 1) % ring->block_nr;
+        bd = block_at(ring, ring->cur);
+        walked ++;
+    }
+
+    return nframes;
+}
+
+void pktring_teardown(struct pktring *ring)
+{
+    if (ring->map != NULL) {
+        munmap(ring->map, ring->maplen);
+        ring->map = NULL;
+    }
+}
+
+static struct tpacket_block_desc *block_at(struct pktring *ring,
+        unsigned int i)
+{
+    return (struct tpacket_block_desc *)
+        (ring->map + (size_t)i * ring->block_size);
+}
+
+static void walk_block(struct pktring *ring, struct tpacket_block_desc *bd,
+        capframe_handler_t handler, void *arg)
+{
+    struct tpacket3_hdr *hdr;
+    struct sockaddr_ll *sll;
+    struct capframe frame;
+    unsigned int i;
+
+    hdr = (struct tpacket3_hdr *)
+        ((unsigned char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < bd->hdr.bh1.num_pkts; i ++) {
+        /* the link-layer address follows the aligned frame header */
+        sll = (struct sockaddr_ll *)
+            ((unsigned char *)hdr + TPACKET_ALIGN(sizeof(*hdr)));
+
+        memset(&frame, 0, sizeof(frame));
+        frame.data = (unsigned char *)hdr + hdr->tp_mac;
+        frame.caplen = hdr->tp_snaplen;
+        frame.len = hdr->tp_len;
+        frame.ts.tv_sec = hdr->tp_sec;
+        frame.ts.tv_nsec = hdr->tp_nsec;
+        frame.ifindex = sll->sll_ifindex;
+        frame.pkttype = sll->sll_pkttype;
+        frame.halen = sll->sll_halen;
+        memcpy(frame.addr, sll->sll_addr, sizeof(frame.addr));
+        frame.vlan = (hdr->tp_status & TP_STATUS_VLAN_VALID) != 0;
+        frame.vlan_tci = hdr->hv1.tp_vlan_tci;
+        frame.vlan_tpid = hdr->tp_status & TP_STATUS_VLAN_TPID_VALID
+            ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+        if (ring->vnet)
+            capframe_vnet(&frame, frame.data - sizeof(struct virtio_net_hdr));
+
+        handler(&frame, arg);
+
+        hdr = (struct tpacket3_hdr *)
+            ((unsigned char *)hdr + hdr->tp_next_offset);
+    }
+}
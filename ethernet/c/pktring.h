@@ -0,0 +1,46 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PKTRING_HD
+#define PKTRING_HD
+
+#include <stddef.h>
+
+#include "capframe.h"
+
+#define PKTRING_BLOCK_SIZE      (1 << 20)  /* default size of a block     */
+#define PKTRING_BLOCK_NR        64         /* default number of blocks    */
+#define PKTRING_BLOCK_TIMEOUT   64         /* default block timeout in ms */
+
+/* a TPACKET_V3 receive ring (PACKET_RX_RING) mapped into our memory */
+struct pktring {
+    int sockfd;
+    unsigned char *map;        /* the ring shared with the kernel         */
+    size_t maplen;
+    unsigned int block_size;
+    unsigned int block_nr;
+    unsigned int cur;          /* next block to be handed to us           */
+    int vnet;                  /* virtio-net header in front of frames    */
+};
+
+int pktring_setup(struct pktring *ring, int sockfd, unsigned int block_size,
+        unsigned int block_nr, unsigned int timeout, int vnet);
+int pktring_poll(struct pktring *ring, int timeout,
+        capframe_handler_t handler, void *arg);
+void pktring_teardown(struct pktring *ring);
+
+#endif
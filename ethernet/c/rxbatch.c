@@ -0,0 +1,251 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * receive frames in batches with recvmmsg(2): one system call returns as
+ * many frames as are queued, up to the number of slots. Where the mmap'ed
+ * ring of pktring.c can't be used, this still saves a system call per
+ * frame.
+ *
+ * The buffers and the message headers are allocated once and reused for
+ * every batch. If the socket has SO_TIMESTAMPNS or SO_TIMESTAMPING turned
+ * on, each frame gets the time the kernel took from the control messages,
+ * otherwise the time the batch was received. With PACKET_AUXDATA, frames
+ * that the filter truncated get their original length and frames that
+ * the kernel took the VLAN tag off get the tag, to be put back by the
+ * handler in the CAPFRAME_HEADROOM bytes every slot has in front.
+ *
+ * How many frames each batch brings in is counted so that the number of
+ * slots can be sized for the traffic: mostly full batches ask for more
+ * slots, batches of one or two frames for fewer.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rxbatch.h"
+
+static int log2_bucket(unsigned int n);
+static void frame_cmsgs(struct msghdr *msg, struct capframe *frame);
+
+/*
+ * nslots buffers of slotsize bytes, and room for the virtio-net header
+ * if vnet, i.e., the socket has PACKET_VNET_HDR on
+ */
+int rxbatch_init(struct rxbatch *b, unsigned int nslots,
+        unsigned int slotsize, int vnet)
+{
+    unsigned int i, size;
+
+    memset(b, 0, sizeof(*b));
+    if (nslots == 0 || nslots > RXBATCH_MAX) {
+        fprintf(stderr, "ERROR: batch size must be 1 to %d\n", RXBATCH_MAX);
+        return -1;
+    }
+
+    b->nslots = nslots;
+    b->slotsize = slotsize;
+    b->vnet = vnet ? sizeof(struct virtio_net_hdr) : 0;
+    size = CAPFRAME_HEADROOM + b->vnet + slotsize;
+    b->bufs = malloc((size_t)nslots * size);
+    b->msgs = calloc(nslots, sizeof(*b->msgs));
+    b->iovs = calloc(nslots, sizeof(*b->iovs));
+    b->addrs = calloc(nslots, sizeof(*b->addrs));
+    b->ctrl = malloc((size_t)nslots * RXBATCH_CTRLLEN);
+    if (b->bufs == NULL || b->msgs == NULL || b->iovs == NULL
+            || b->addrs == NULL || b->ctrl == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        rxbatch_free(b);
+        return -1;
+    }
+
+    for (i = 0; i < nslots; i ++) {
+        b->iovs[i].iov_base = b->bufs + (size_t)i * size + CAPFRAME_HEADROOM;
+        b->iovs[i].iov_len = b->vnet + slotsize;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+        b->msgs[i].msg_hdr.msg_control =
+            b->ctrl + (size_t)i * RXBATCH_CTRLLEN;
+    }
+
+    return 0;
+}
+
+/*
+ * receive a batch, blocking until at least one frame arrives (or the
+ * socket's SO_RCVTIMEO expires), and hand each frame to handler. Returns
+ * the number of frames received, 0 on timeout or interruption, -1 on error.
+ */
+int rxbatch_recv(struct rxbatch *b, int sockfd,
+        capframe_handler_t handler, void *arg)
+{
+    struct capframe frame;
+    struct timespec now;
+    int i, n;
+
+    for (i = 0; i < (int)b->nslots; i ++) {
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addrs[i]);
+        b->msgs[i].msg_hdr.msg_controllen = RXBATCH_CTRLLEN;
+        b->msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    /* MSG_TRUNC: the length of a frame even if it did not fit the slot */
+    n = recvmmsg(sockfd, b->msgs, b->nslots, MSG_WAITFORONE | MSG_TRUNC,
+            NULL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        return -1;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    b->stats.batches ++;
+    b->stats.frames += n;
+    b->stats.fill[log2_bucket(n)] ++;
+    if (n == (int)b->nslots)
+        b->stats.full ++;
+
+    for (i = 0; i < n; i ++) {
+        memset(&frame, 0, sizeof(frame));
+        frame.data = (unsigned char *)b->iovs[i].iov_base + b->vnet;
+        frame.len = b->msgs[i].msg_len - b->vnet;
+        frame.caplen = frame.len < b->slotsize ? frame.len : b->slotsize;
+        if (b->vnet)
+            capframe_vnet(&frame, b->iovs[i].iov_base);
+        frame.ts = now;
+        frame_cmsgs(&b->msgs[i].msg_hdr, &frame);
+        frame.ifindex = b->addrs[i].sll_ifindex;
+        frame.pkttype = b->addrs[i].sll_pkttype;
+        frame.halen = b->addrs[i].sll_halen;
+        memcpy(frame.addr, b->addrs[i].sll_addr, sizeof(frame.addr));
+
+        handler(&frame, arg);
+    }
+
+    return n;
+}
+
+void rxbatch_free(struct rxbatch *b)
+{
+    free(b->bufs);
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->ctrl);
+    b->bufs = NULL;
+    b->msgs = NULL;
+    b->iovs = NULL;
+    b->addrs = NULL;
+    b->ctrl = NULL;
+}
+
+void rxbatch_stats_add(struct rxbatch_stats *sum,
+        const struct rxbatch_stats *s)
+{
+    int i;
+
+    sum->batches += s->batches;
+    sum->frames += s->frames;
+    sum->full += s->full;
+    for (i = 0; i < RXBATCH_FILL_BUCKETS; i ++)
+        sum->fill[i] += s->fill[i];
+}
+
+void rxbatch_stats_print(const struct rxbatch_stats *s,
+        unsigned int nslots, FILE *fp)
+{
+    unsigned int hi;
+    int i;
+
+    if (s->batches == 0)
+        return;
+
+    fprintf(fp, "batches of %u slots: %llu, %.1f frames per batch, "
+            "%.1f%% full\n", nslots, s->batches,
+            (double)s->frames / s->batches, 100.0 * s->full / s->batches);
+    fprintf(fp, "frames per batch:");
+    for (i = 0; i < RXBATCH_FILL_BUCKETS && (1u << i) <= nslots; i ++) {
+        hi = (2u << i) - 1 < nslots ? (2u << i) - 1 : nslots;
+        if (hi == 1u << i)
+            fprintf(fp, " %u: %llu", hi, s->fill[i]);
+        else
+            fprintf(fp, " %u-%u: %llu", 1u << i, hi, s->fill[i]);
+    }
+    fprintf(fp, "\n");
+}
+
+/*
+ * the kernel's receive timestamp, hardware if there is one, the length of
+ * the frame before truncation and the VLAN tag taken off. See cmsg(3)
+ */
+static void frame_cmsgs(struct msghdr *msg, struct capframe *frame)
+{
+    struct cmsghdr *cmsg;
+    struct timespec stamps[3];
+    struct tpacket_auxdata aux;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_PACKET
+                && cmsg->cmsg_type == PACKET_AUXDATA) {
+            memcpy(&aux, CMSG_DATA(cmsg), sizeof(aux));
+            if (aux.tp_len > frame->len)
+                frame->len = aux.tp_len;
+            if (aux.tp_status & TP_STATUS_VLAN_VALID) {
+                frame->vlan = 1;
+                frame->vlan_tci = aux.tp_vlan_tci;
+                frame->vlan_tpid = aux.tp_status & TP_STATUS_VLAN_TPID_VALID
+                    ? aux.tp_vlan_tpid : ETH_P_8021Q;
+            }
+            continue;
+        }
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&frame->ts, CMSG_DATA(cmsg), sizeof(frame->ts));
+        } else if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            /* software, (deprecated), raw hardware */
+            memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            if (stamps[2].tv_sec != 0 || stamps[2].tv_nsec != 0)
+                frame->ts = stamps[2];
+            else if (stamps[0].tv_sec != 0 || stamps[0].tv_nsec != 0)
+                frame->ts = stamps[0];
+        }
+    }
+}
+
+/* 0 for 1, 1 for 2-3, 2 for 4-7, ... */
+static int log2_bucket(unsigned int n)
+{
+    int i = 0;
+
+    while (n > 1 && i < RXBATCH_FILL_BUCKETS - 1) {
+        n >>= 1;
+        i ++;
+    }
+    return i;
+}
@@ -0,0 +1,62 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RXBATCH_HD
+#define RXBATCH_HD
+
+#include <stdio.h>
+
+#include "capframe.h"
+
+#define RXBATCH_DEFAULT         32    /* frames per recvmmsg(2)        */
+#define RXBATCH_MAX             1024
+#define RXBATCH_FILL_BUCKETS    11    /* 1, 2-3, 4-7, ..., 1024        */
+#define RXBATCH_CTRLLEN         256   /* control messages per frame    */
+
+/* how well the batches are filled */
+struct rxbatch_stats {
+    unsigned long long batches;
+    unsigned long long frames;
+    unsigned long long full;    /* batches that used every slot        */
+    unsigned long long fill[RXBATCH_FILL_BUCKETS]; /* by log2(frames)  */
+};
+
+/* preallocated buffers and message headers for recvmmsg(2) */
+struct rxbatch {
+    unsigned int nslots;
+    unsigned int slotsize;
+    unsigned int vnet;          /* virtio-net header before each frame */
+    unsigned char *bufs;        /* nslots buffers of vnet + slotsize   */
+                                /* bytes, after CAPFRAME_HEADROOM      */
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_ll *addrs;
+    unsigned char *ctrl;        /* nslots of RXBATCH_CTRLLEN bytes     */
+    struct rxbatch_stats stats;
+};
+
+int rxbatch_init(struct rxbatch *b, unsigned int nslots,
+        unsigned int slotsize, int vnet);
+int rxbatch_recv(struct rxbatch *b, int sockfd,
+        capframe_handler_t handler, void *arg);
+void rxbatch_free(struct rxbatch *b);
+void rxbatch_stats_add(struct rxbatch_stats *sum,
+        const struct rxbatch_stats *s);
+void rxbatch_stats_print(const struct rxbatch_stats *s,
+        unsigned int nslots, FILE *fp);
+
+#endif
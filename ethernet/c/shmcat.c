@@ -0,0 +1,159 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/* 
+ * read the frames that ethercap publishes with -O from the ring in shared
+ * memory, and write them as a capture file to stdout, e.g., for tcpdump
+ * or Wireshark, or into a file. Any number of readers can attach to a
+ * ring, each at its own pace.
+ *
+ * usage: 
+ *
+ *      shmcat [-a] [-c count] [-o fmt] [-w file] name
+ *
+ * -a begins with the oldest frame in the ring rather than with the next
+ * one published, -c stops after count frames, -o writes pcap (default)
+ * or pcapng and -w writes into file instead of stdout.
+ *
+ * A reader that falls behind by more than the ring holds misses frames;
+ * how many is reported at the end, which is on CTRL-C, when ethercap
+ * exits, or after count frames. The frames are handed to the writer of
+ * the file whenever the ring has no more for now, so that a pipe sees
+ * them as they come.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcapfile.h"
+#include "shmring.h"
+#include "sighandler.h"
+
+#define ALIVE_CHECK     10000   /* idle sleeps between publisher checks */
+
+static void usage(char *prog);
+static void stop(int s);
+
+static volatile sig_atomic_t stopping = 0;
+
+int main(int argc, char *argv[])
+{
+    struct timespec idle = {0, SHMRING_IDLE_NS};
+    struct pcapfile_opts opts;
+    struct pcapfile pf;
+    struct shmreader r;
+    struct capframe frame;
+    const char *wfile = "-";
+    unsigned long long count = 0;
+    unsigned int i, idles = 0;
+    int c, oldest = 0, format = PCAPFILE_PCAP, pending = 0, rc = 0;
+
+    while ((c = getopt(argc, argv, "ac:o:w:")) != -1) {
+        switch (c) {
+            case 'a':
+                oldest = 1;
+                break;
+            case 'c':
+                count = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                if ((format = pcapfile_format(optarg)) < 0) {
+                    fprintf(stderr, "unknown file format %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                wfile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    setupsignal(SIGINT, stop);
+    setupsignal(SIGTERM, stop);
+
+    if (shmring_attach(&r, argv[optind], oldest) != 0)
+        exit(1);
+    /* the reader is not the capture, it can wait for the disk */
+    memset(&opts, 0, sizeof(opts));
+    opts.wait = 1;
+    if (pcapfile_open(&pf, wfile, format, r.hdr->snaplen, &opts) != 0) {
+        shmring_detach(&r);
+        exit(1);
+    }
+    for (i = 0; i < r.hdr->nifs && i < SHMRING_MAX_IFS; i ++)
+        pcapfile_add_if(&pf, r.hdr->ifs[i].ifindex, r.hdr->ifs[i].name);
+
+    while (!stopping && (count == 0 || r.stats.frames < count)) {
+        c = shmring_read(&r, &frame);
+        if (c > 0) {
+            pcapfile_write(&pf, &frame);
+            pending = 1;
+            idles = 0;
+            continue;
+        }
+        if (c < 0)
+            break;
+        if (pending) {
+            pcapfile_flush(&pf);
+            pending = 0;
+        }
+        if (++ idles % ALIVE_CHECK == 0 && !shmring_alive(&r)) {
+            fprintf(stderr, "ERROR: the publisher of %s is gone\n",
+                    argv[optind]);
+            rc = 1;
+            break;
+        }
+        nanosleep(&idle, NULL);
+    }
+
+    if (pcapfile_close(&pf) != 0) {
+        fprintf(stderr, "ERROR: writing capture file: %s\n",
+                strerror(pcapfile_error(&pf)));
+        rc = 1;
+    }
+    shmring_reader_report(&r, stderr);
+    shmring_detach(&r);
+    return rc;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "\nWrong usage. \n\n"
+            "%s [-a] [-c count] [-o fmt] [-w file] name\n\n"
+            "  -a         begin with the oldest frame in the ring\n"
+            "  -c count   stop after count frames\n"
+            "  -o fmt     pcap (default) or pcapng\n"
+            "  -w file    write into file instead of stdout\n\n", prog);
+}
+
+static void stop(int s __attribute__((unused)))
+{
+    stopping = 1;
+}
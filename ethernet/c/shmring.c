@@ -0,0 +1,428 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * publish the captured frames to other processes on the host through a
+ * ring in POSIX shared memory (see shm_overview(7)). Every process that
+ * opens a raw socket of its own has the kernel copy every frame to it
+ * once more; the processes attached to the ring share one capture.
+ *
+ * There is one publisher and any number of readers, which the publisher
+ * neither knows of nor waits for. The ring is a header page followed by
+ * the records of the frames, each a header and the bytes of a frame, as
+ * the arena of flightrec.c. A reader maps it read-only and keeps its own
+ * cursor, and reads every frame, or, if it falls behind by more than the
+ * ring holds, finds that the frames it was about to read have been
+ * written over: an overrun. It then goes on from the oldest frame left,
+ * and the numbers of the frames tell it how many it missed.
+ *
+ * The publisher moves the tail, the oldest byte it won't write over, past
+ * the records it is about to write over before writing, and the head,
+ * the end of the records that can be read, after. A reader copies a
+ * record out and then looks at the tail again: if the tail has been
+ * moved past the record meanwhile, the copy may be torn and is thrown
+ * away, as with a seqlock. A reader that attaches takes its cursor and the
+ * number of the frame there under a generation count that the publisher
+ * keeps odd while it moves them on. A reader sleeps SHMRING_IDLE_NS when
+ * there is nothing to read, as the output thread of ethercap does.
+ *
+ * If a publisher died without unlinking the ring, the next one with the
+ * same name takes it over; a ring of a running publisher is left alone.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shmring.h"
+
+/* bytes a record of caplen bytes takes in the ring */
+#define RECSIZE(caplen) \
+    ((sizeof(struct shmring_rec) + (size_t)(caplen) + 7) & ~(size_t)7)
+
+static int shm_path(char *path, const char *name);
+static int stale(const char *path);
+static int is_pad(const struct shmring *ring, uint64_t pos);
+static uint64_t next_record(const struct shmring *ring, uint64_t pos);
+
+/*
+ * a ring of size bytes of frames of at most snaplen bytes, by the name
+ * of name, with or without the leading slash
+ */
+int shmring_create(struct shmring *ring, const char *name, size_t size,
+        unsigned int snaplen)
+{
+    void *map;
+    int fd, rc;
+
+    memset(ring, 0, sizeof(*ring));
+    size &= ~(size_t)7;
+    if (size < 2 * RECSIZE(snaplen)) {
+        fprintf(stderr, "ERROR: ring of %zu bytes is too small\n", size);
+        return -1;
+    }
+    if (shm_path(ring->name, name) != 0)
+        return -1;
+
+    fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST && stale(ring->name)) {
+        shm_unlink(ring->name);
+        fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: shm_open(%s, ...): %s\n", ring->name,
+                strerror(errno));
+        return -1;
+    }
+
+    /* all of it now, rather than SIGBUS later if /dev/shm runs out */
+    ring->maplen = SHMRING_HDRLEN + size;
+    if ((rc = posix_fallocate(fd, 0, ring->maplen)) != 0) {
+        fprintf(stderr, "ERROR: allocating %zu bytes of %s: %s\n",
+                ring->maplen, ring->name, strerror(rc));
+        close(fd);
+        shm_unlink(ring->name);
+        return -1;
+    }
+    map = mmap(NULL, ring->maplen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap(NULL, maplen, ..., fd, 0)");
+        shm_unlink(ring->name);
+        return -1;
+    }
+
+    ring->hdr = map;
+    ring->data = (unsigned char *)map + SHMRING_HDRLEN;
+    ring->hdr->version = SHMRING_VERSION;
+    ring->hdr->size = size;
+    ring->hdr->snaplen = snaplen;
+    ring->hdr->pid = getpid();
+    /* last, a reader takes the header for a ring once it has the magic */
+    __atomic_store_n(&ring->hdr->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* an interface the frames come from, for the readers to name them */
+int shmring_add_if(struct shmring *ring, int ifindex, const char *ifname)
+{
+    struct shmring_hdr *hdr = ring->hdr;
+
+    if (hdr->nifs >= SHMRING_MAX_IFS) {
+        fprintf(stderr, "ERROR: ring can name at most %d interfaces\n",
+                SHMRING_MAX_IFS);
+        return -1;
+    }
+    hdr->ifs[hdr->nifs].ifindex = ifindex;
+    snprintf(hdr->ifs[hdr->nifs].name, IFNAMSIZ, "%s", ifname);
+    hdr->nifs ++;
+    return 0;
+}
+
+/* by the one publisher: the frame, writing over the oldest if need be */
+void shmring_publish(struct shmring *ring, const struct capframe *frame)
+{
+    struct shmring_hdr *hdr = ring->hdr;
+    struct shmring_rec *r;
+    uint64_t head = hdr->head, tail = hdr->tail, size = hdr->size;
+    unsigned int caplen = frame->caplen < hdr->snaplen ? frame->caplen
+        : hdr->snaplen;
+    size_t need = RECSIZE(caplen), off, pad;
+
+    /* a record does not wrap, the bytes to the end are skipped instead */
+    off = head % size;
+    pad = need > size - off ? size - off : 0;
+    while (tail != head && head + pad + need - tail > size)
+        tail = next_record(ring, tail);
+    /* a frame, not the bytes skipped before one, is the oldest */
+    if (tail != head && is_pad(ring, tail))
+        tail = next_record(ring, tail);
+
+    __atomic_store_n(&hdr->gen, hdr->gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (tail != hdr->tail) {
+        __atomic_store_n(&hdr->tailseq, tail != head ? ((struct shmring_rec *)
+                    (ring->data + tail % size))->seq : hdr->frames,
+                __ATOMIC_RELAXED);
+        __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELAXED);
+        /* the readers see the records let go before they change */
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    if (pad > 0) {
+        if (pad >= sizeof(*r))
+            ((struct shmring_rec *)(ring->data + off))->caplen = SHMRING_PAD;
+        head += pad;
+    }
+    r = (struct shmring_rec *)(ring->data + head % size);
+    r->seq = hdr->frames;
+    r->sec = frame->ts.tv_sec;
+    r->nsec = frame->ts.tv_nsec;
+    r->caplen = caplen;
+    r->len = frame->len;
+    r->ifindex = frame->ifindex;
+    memcpy(r + 1, frame->data, caplen);
+    ring->bytes += caplen;
+
+    __atomic_store_n(&hdr->frames, hdr->frames + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->gen, hdr->gen + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * no more frames: the readers attached read those left and are told so,
+ * no reader can attach anymore
+ */
+void shmring_close(struct shmring *ring)
+{
+    if (ring->hdr == NULL)
+        return;
+    __atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring->hdr, ring->maplen);
+    shm_unlink(ring->name);
+    ring->hdr = NULL;
+}
+
+void shmring_report(const struct shmring *ring, FILE *fp)
+{
+    if (ring->hdr == NULL)
+        return;
+    fprintf(fp, "\nshared memory %s: %llu frames, %llu bytes published, "
+            "ring of %llu MB gone round %llu times\n", ring->name,
+            (unsigned long long)ring->hdr->frames, ring->bytes,
+            (unsigned long long)ring->hdr->size >> 20,
+            (unsigned long long)(ring->hdr->head / ring->hdr->size));
+}
+
+/*
+ * attach to the ring of name, to read the frames published from now on
+ * or, if oldest, from the oldest one in the ring
+ */
+int shmring_attach(struct shmreader *r, const char *name, int oldest)
+{
+    char path[SHMRING_NAMELEN];
+    const struct shmring_hdr *hdr;
+    struct stat st;
+    uint64_t gen;
+    void *map;
+    int fd;
+
+    memset(r, 0, sizeof(*r));
+    if (shm_path(path, name) != 0)
+        return -1;
+    if ((fd = shm_open(path, O_RDONLY, 0)) < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (st.st_size < SHMRING_HDRLEN) {
+        fprintf(stderr, "ERROR: %s is not a ring of frames\n", path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap(NULL, size, PROT_READ, ..., fd, 0)");
+        return -1;
+    }
+    r->hdr = hdr = map;
+    r->data = (const unsigned char *)map + SHMRING_HDRLEN;
+    r->maplen = st.st_size;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC
+            || hdr->version != SHMRING_VERSION
+            || SHMRING_HDRLEN + hdr->size != (uint64_t)st.st_size) {
+        fprintf(stderr, "ERROR: %s is not a ring of frames\n", path);
+        shmring_detach(r);
+        return -1;
+    }
+    if ((r->buf = malloc(hdr->snaplen)) == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        shmring_detach(r);
+        return -1;
+    }
+
+    /* where to begin and the frame there, as one */
+    do {
+        gen = __atomic_load_n(&hdr->gen, __ATOMIC_ACQUIRE);
+        r->pos = __atomic_load_n(oldest ? &hdr->tail : &hdr->head,
+                __ATOMIC_RELAXED);
+        r->seq = __atomic_load_n(oldest ? &hdr->tailseq : &hdr->frames,
+                __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((gen & 1) || gen != __atomic_load_n(&hdr->gen,
+                __ATOMIC_RELAXED));
+    return 0;
+}
+
+/*
+ * the next frame into frame, its bytes in the reader's buffer until the
+ * next call. Returns 1 if there is one, 0 if not yet, -1 if the publisher
+ * is done and every frame has been read, or on a broken ring.
+ */
+int shmring_read(struct shmreader *r, struct capframe *frame)
+{
+    const struct shmring_hdr *hdr = r->hdr;
+    struct shmring_rec rec;
+    uint64_t head, tail, size = hdr->size;
+    size_t off, rem;
+    int closed, valid;
+
+    /* closed first: no frame is published after it */
+    closed = __atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    while (r->pos != head) {
+        tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+        if (r->pos < tail) {
+            r->pos = tail;
+            r->stats.overruns ++;
+            continue;
+        }
+
+        off = r->pos % size;
+        rem = size - off;
+        if (rem < sizeof(rec)) {
+            r->pos += rem;
+            continue;
+        }
+        memcpy(&rec, r->data + off, sizeof(rec));
+        valid = rec.caplen == SHMRING_PAD || (rec.caplen <= hdr->snaplen
+                && RECSIZE(rec.caplen) <= rem);
+        if (valid && rec.caplen != SHMRING_PAD)
+            memcpy(r->buf, r->data + off + sizeof(rec), rec.caplen);
+
+        /* written over while being copied, the copy is no good */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (r->pos < __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED))
+            continue;
+        if (!valid) {
+            fprintf(stderr, "ERROR: broken record at %llu of the ring\n",
+                    (unsigned long long)r->pos);
+            return -1;
+        }
+        if (rec.caplen == SHMRING_PAD) {
+            r->pos += rem;
+            continue;
+        }
+
+        r->stats.lost += rec.seq - r->seq;
+        r->seq = rec.seq + 1;
+        r->pos += RECSIZE(rec.caplen);
+        r->stats.frames ++;
+        r->stats.bytes += rec.caplen;
+
+        memset(frame, 0, sizeof(*frame));
+        frame->data = r->buf;
+        frame->caplen = rec.caplen;
+        frame->len = rec.len;
+        frame->ts.tv_sec = rec.sec;
+        frame->ts.tv_nsec = rec.nsec;
+        frame->ifindex = rec.ifindex;
+        return 1;
+    }
+    return closed ? -1 : 0;
+}
+
+/* whether the publisher is still there, e.g., it did not die */
+int shmring_alive(const struct shmreader *r)
+{
+    if (__atomic_load_n(&r->hdr->closed, __ATOMIC_ACQUIRE))
+        return 0;
+    return kill(r->hdr->pid, 0) == 0 || errno == EPERM;
+}
+
+void shmring_detach(struct shmreader *r)
+{
+    if (r->hdr != NULL)
+        munmap((void *)r->hdr, r->maplen);
+    free(r->buf);
+    r->hdr = NULL;
+    r->buf = NULL;
+}
+
+void shmring_reader_report(const struct shmreader *r, FILE *fp)
+{
+    fprintf(fp, "read %llu frames, %llu bytes, lost %llu frames in %llu "
+            "overruns\n", r->stats.frames, r->stats.bytes, r->stats.lost,
+            r->stats.overruns);
+}
+
+/* "/name" of name, with or without the slash */
+static int shm_path(char *path, const char *name)
+{
+    if (*name == '/')
+        name ++;
+    if (*name == '\0' || strchr(name, '/') != NULL
+            || strlen(name) + 2 > SHMRING_NAMELEN) {
+        fprintf(stderr, "ERROR: %s is not a name of shared memory\n", name);
+        return -1;
+    }
+    sprintf(path, "/%s", name);
+    return 0;
+}
+
+/* whether the ring at path is one of ours whose publisher is gone */
+static int stale(const char *path)
+{
+    struct shmring_hdr hdr;
+    int fd, n, rc = 0;
+
+    if ((fd = shm_open(path, O_RDONLY, 0)) < 0)
+        return 0;
+    n = read(fd, &hdr, sizeof(hdr));
+    close(fd);
+    if (n != (int)sizeof(hdr) || hdr.magic != SHMRING_MAGIC) {
+        fprintf(stderr, "ERROR: %s is not a ring of frames\n", path);
+    } else if (!hdr.closed && (kill(hdr.pid, 0) == 0 || errno == EPERM)) {
+        fprintf(stderr, "ERROR: %s is published by process %d\n", path,
+                hdr.pid);
+    } else {
+        rc = 1;
+    }
+    return rc;
+}
+
+/* whether the bytes at pos are skipped to the start, by the publisher */
+static int is_pad(const struct shmring *ring, uint64_t pos)
+{
+    size_t off = pos % ring->hdr->size;
+
+    return ring->hdr->size - off < sizeof(struct shmring_rec)
+        || ((const struct shmring_rec *)(ring->data + off))->caplen
+        == SHMRING_PAD;
+}
+
+/* the record after the one, or the bytes skipped, at pos */
+static uint64_t next_record(const struct shmring *ring, uint64_t pos)
+{
+    size_t off = pos % ring->hdr->size;
+
+    if (is_pad(ring, pos))
+        return pos + ring->hdr->size - off;
+    return pos + RECSIZE(((const struct shmring_rec *)
+                (ring->data + off))->caplen);
+}
@@ -0,0 +1,119 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHMRING_HD
+#define SHMRING_HD
+
+#include <sys/types.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capframe.h"
+
+#define SHMRING_MEMORY      64          /* MB of frames by default     */
+#define SHMRING_MAGIC       0x45524e47  /* "ERNG"                      */
+#define SHMRING_VERSION     1
+#define SHMRING_HDRLEN      4096        /* the data begin a page after */
+#define SHMRING_MAX_IFS     64
+#define SHMRING_NAMELEN     256
+#define SHMRING_IDLE_NS     100000      /* a reader's sleep when empty */
+#define SHMRING_PAD         0xffffffffu
+
+/*
+ * the first page of the shared memory, written by the publisher only.
+ * head and tail count the bytes published and let go since the start,
+ * thus the records are at tail % size to head % size of the data.
+ */
+struct shmring_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;              /* bytes of data after the page        */
+    uint32_t snaplen;           /* the most bytes of a frame           */
+    int32_t pid;                /* of the publisher                    */
+    uint64_t head;              /* up to which records can be read     */
+    uint64_t tail;              /* from which records are not written  */
+                                /* over, moved on before they are      */
+    uint64_t frames;            /* published                           */
+    uint64_t tailseq;           /* of the frame at the tail            */
+    uint64_t gen;               /* odd while the above are moved on    */
+    uint32_t closed;            /* the publisher is done               */
+    uint32_t nifs;
+    struct {
+        int32_t ifindex;
+        char name[IFNAMSIZ];
+    } ifs[SHMRING_MAX_IFS];
+};
+
+/*
+ * a frame, followed by its bytes and padded to a multiple of 8 bytes. A
+ * record never wraps: one of caplen SHMRING_PAD, or the end being too
+ * close for a header, means the next record is at the start of the data.
+ * seq numbers the frames, so that a reader knows how many it missed.
+ */
+struct shmring_rec {
+    uint64_t seq;
+    int64_t sec;
+    uint32_t nsec;
+    uint32_t caplen;
+    uint32_t len;
+    int32_t ifindex;
+};
+
+/* the publisher's side */
+struct shmring {
+    char name[SHMRING_NAMELEN];
+    struct shmring_hdr *hdr;    /* the mapping, data after the page    */
+    unsigned char *data;
+    size_t maplen;
+    unsigned long long bytes;   /* published                           */
+};
+
+/* counters of a reader */
+struct shmreader_stats {
+    unsigned long long frames;
+    unsigned long long bytes;
+    unsigned long long overruns; /* times the publisher got ahead      */
+    unsigned long long lost;    /* frames written over before read     */
+};
+
+/* a reader's side, its cursor its own */
+struct shmreader {
+    const struct shmring_hdr *hdr;
+    const unsigned char *data;
+    size_t maplen;
+    uint64_t pos;               /* of the next record                  */
+    uint64_t seq;               /* of the next frame                   */
+    unsigned char *buf;         /* the frame read, snaplen bytes       */
+    struct shmreader_stats stats;
+};
+
+int shmring_create(struct shmring *ring, const char *name, size_t size,
+        unsigned int snaplen);
+int shmring_add_if(struct shmring *ring, int ifindex, const char *ifname);
+void shmring_publish(struct shmring *ring, const struct capframe *frame);
+void shmring_close(struct shmring *ring);
+void shmring_report(const struct shmring *ring, FILE *fp);
+
+int shmring_attach(struct shmreader *r, const char *name, int oldest);
+int shmring_read(struct shmreader *r, struct capframe *frame);
+int shmring_alive(const struct shmreader *r);
+void shmring_detach(struct shmreader *r);
+void shmring_reader_report(const struct shmreader *r, FILE *fp);
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * a lock-free single-producer single-consumer ring of preallocated frame
+ * slots. A capture worker pushes a copy of every frame and the output
+ * thread takes them from the other end, so that a slow terminal or disk
+ * never stalls the capture loop: when the ring is full, the frame is
+ * dropped and counted instead.
+ *
+ * head and tail count the frames pushed and popped, they are never
+ * wrapped and a slot is found by masking. Each side publishes its index
+ * with a release store and reads the other's with an acquire load, and
+ * does so only when its cached copy says the ring is full (or empty).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+#include "spsc.h"
+
+/* nslots is rounded up to a power of 2 */
+int spsc_init(struct spsc *q, unsigned int nslots, unsigned int slotsize)
+{
+    unsigned int n = 1;
+
+    memset(q, 0, sizeof(*q));
+    while (n < nslots)
+        n <<= 1;
+
+    q->nslots = n;
+    q->slotsize = slotsize;
+    q->bufs = malloc((size_t)n * slotsize);
+    q->frames = calloc(n, sizeof(*q->frames));
+    if (q->bufs == NULL || q->frames == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        spsc_free(q);
+        return -1;
+    }
+    return 0;
+}
+
+/* copy frame into the ring, -1 if it is full */
+int spsc_push(struct spsc *q, const struct capframe *frame)
+{
+    unsigned long long head = q->head;
+    struct capframe *slot;
+    unsigned int i;
+
+    if (head - q->tail_cache >= q->nslots) {
+        q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head - q->tail_cache >= q->nslots) {
+            stat_add(&q->overflows, 1);
+            return -1;
+        }
+    }
+
+    i = head & (q->nslots - 1);
+    slot = &q->frames[i];
+    *slot = *frame;
+    slot->data = q->bufs + (size_t)i * q->slotsize;
+    if (slot->caplen > q->slotsize)
+        slot->caplen = q->slotsize;
+    memcpy(slot->data, frame->data, slot->caplen);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * whether a frame can be pushed without being dropped, for a producer that
+ * would rather wait than drop, e.g., replaying a file
+ */
+int spsc_room(struct spsc *q)
+{
+    if (q->head - q->tail_cache < q->nslots)
+        return 1;
+    q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    return q->head - q->tail_cache < q->nslots;
+}
+
+/*
+ * the oldest frame, NULL if the ring is empty. see spsc_pop(). The frames
+ * queued are counted each time the head is loaded, which is when those
+ * seen before have been taken, so the producer's path has no extra load.
+ */
+struct capframe *spsc_front(struct spsc *q)
+{
+    if (q->tail == q->head_cache) {
+        q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (q->tail == q->head_cache)
+            return NULL;
+        if (q->head_cache - q->tail > q->highwater)
+            __atomic_store_n(&q->highwater, q->head_cache - q->tail,
+                    __ATOMIC_RELAXED);
+    }
+    return &q->frames[q->tail & (q->nslots - 1)];
+}
+
+/* give the slot of the front frame back to the producer */
+void spsc_pop(struct spsc *q)
+{
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+void spsc_free(struct spsc *q)
+{
+    free(q->bufs);
+    free(q->frames);
+    q->bufs = NULL;
+    q->frames = NULL;
+}
@@ -0,0 +1,57 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPSC_HD
+#define SPSC_HD
+
+#include "capframe.h"
+
+#define SPSC_SLOTS          4096        /* default number of slots      */
+#define SPSC_MAX_BYTES      (64 << 20)  /* fewer slots for big frames   */
+#define SPSC_MIN_SLOTS      16
+#define SPSC_CACHELINE      64
+
+/*
+ * a single-producer single-consumer queue of captured frames. The fields
+ * of each side are on cache lines of their own so that the producer and
+ * the consumer do not take the line back and forth on every frame.
+ */
+struct spsc {
+    unsigned int nslots;        /* a power of 2                       */
+    unsigned int slotsize;
+    unsigned char *bufs;        /* nslots buffers of slotsize bytes   */
+    struct capframe *frames;
+
+    /* written by the producer */
+    unsigned long long head __attribute__((aligned(SPSC_CACHELINE)));
+    unsigned long long tail_cache;  /* tail as last seen              */
+    unsigned long long overflows;   /* frames dropped as it was full  */
+
+    /* written by the consumer */
+    unsigned long long tail __attribute__((aligned(SPSC_CACHELINE)));
+    unsigned long long head_cache;  /* head as last seen              */
+    unsigned long long highwater;   /* most frames seen queued        */
+};
+
+int spsc_init(struct spsc *q, unsigned int nslots, unsigned int slotsize);
+int spsc_push(struct spsc *q, const struct capframe *frame);
+int spsc_room(struct spsc *q);
+struct capframe *spsc_front(struct spsc *q);
+void spsc_pop(struct spsc *q);
+void spsc_free(struct spsc *q);
+
+#endif
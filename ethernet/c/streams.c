@@ -0,0 +1,216 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * write the streams put back together by tcpreasm.c into files, one per
+ * direction of a connection, in a directory, named by the number of the
+ * connection and its ends, e.g., 12-10.0.0.1.51000-10.0.0.2.80 for what
+ * 10.0.0.1 port 51000 sent to 10.0.0.2 port 80 in the 12th connection.
+ *
+ * Bytes that were never seen are left as a hole in the file, so that
+ * every byte is at its offset in the stream. At most STREAMS_OPEN files
+ * are open at a time: the file written least recently is closed to open
+ * another, and opened again, at the offset it was at, when there is more
+ * to write into it.
+ */
+
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "streams.h"
+
+static struct streamfile *file_of(struct streams *st, struct tcpconn *c,
+        int dir);
+static int open_file(struct streams *st, struct streamfile *f,
+        const char *mode);
+static void close_file(struct streams *st, struct streamfile *f);
+static void fail(struct streams *st, int err);
+
+/* the files go into dir, which is made if need be */
+int streams_init(struct streams *st, const char *dir)
+{
+    memset(st, 0, sizeof(*st));
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "ERROR: cannot make %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    st->dir = dir;
+    return 0;
+}
+
+/* len bytes of the stream, or a hole of len bytes if data is NULL */
+void streams_write(struct streams *st, struct tcpconn *c, int dir,
+        const uint8_t *data, unsigned int len)
+{
+    struct streamfile *f;
+
+    if ((f = file_of(st, c, dir)) == NULL)
+        return;
+
+    if (data == NULL) {
+        if (fseeko(f->fp, len, SEEK_CUR) != 0)
+            fail(st, errno);
+    } else if (fwrite(data, 1, len, f->fp) != len) {
+        fail(st, errno);
+    } else {
+        st->bytes += len;
+    }
+    f->off += len;
+    f->hole = data == NULL;
+
+    /* the file is the most recently written */
+    if (f != st->tail) {
+        if (f->prev != NULL)
+            f->prev->next = f->next;
+        else
+            st->head = f->next;
+        f->next->prev = f->prev;
+        f->prev = st->tail;
+        f->next = NULL;
+        st->tail->next = f;
+        st->tail = f;
+    }
+}
+
+/* done with the files of the connection */
+void streams_close(struct streams *st, struct tcpconn *c)
+{
+    struct streamfile *f;
+    int dir;
+
+    for (dir = 0; dir < 2; dir ++) {
+        if ((f = c->stream[dir].user) == NULL)
+            continue;
+        /* a hole at the end is not written, make it part of the file */
+        if (f->hole && (f->fp != NULL || open_file(st, f, "r+") == 0)
+                && (fflush(f->fp) != 0
+                    || ftruncate(fileno(f->fp), f->off) != 0))
+            fail(st, errno);
+        if (f->fp != NULL)
+            close_file(st, f);
+        free(f);
+        c->stream[dir].user = NULL;
+    }
+}
+
+void streams_free(struct streams *st)
+{
+    while (st->head != NULL)
+        close_file(st, st->head);
+}
+
+void streams_report(const struct streams *st, FILE *fp)
+{
+    fprintf(fp, "streams: %llu files %llu bytes in %s", st->files,
+            st->bytes, st->dir);
+    if (st->errors > 0)
+        fprintf(fp, ", %llu writes failed: %s", st->errors,
+                strerror(st->error));
+    fprintf(fp, "\n");
+}
+
+/* the open file of the stream, or NULL if it can't be */
+static struct streamfile *file_of(struct streams *st, struct tcpconn *c,
+        int dir)
+{
+    struct streamfile *f = c->stream[dir].user;
+    const struct tcpkey *k = &c->key;
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    int af = k->ipver == 6 ? AF_INET6 : AF_INET, n;
+
+    if (f != NULL)
+        return f->fp != NULL || open_file(st, f, "r+") == 0 ? f : NULL;
+
+    inet_ntop(af, k->addr[dir], src, sizeof(src));
+    inet_ntop(af, k->addr[!dir], dst, sizeof(dst));
+    n = snprintf(NULL, 0, "%s/%llu-%s.%u-%s.%u", st->dir, c->id, src,
+            k->port[dir], dst, k->port[!dir]);
+    if ((f = calloc(1, sizeof(*f) + n + 1)) == NULL) {
+        fail(st, ENOMEM);
+        return NULL;
+    }
+    snprintf(f->path, n + 1, "%s/%llu-%s.%u-%s.%u", st->dir, c->id, src,
+            k->port[dir], dst, k->port[!dir]);
+    if (open_file(st, f, "w") != 0) {
+        free(f);
+        return NULL;
+    }
+    c->stream[dir].user = f;
+    st->files ++;
+    return f;
+}
+
+/*
+ * open the file at its offset, closing the least recently written if as
+ * many as can be are open. The file is the most recently written.
+ */
+static int open_file(struct streams *st, struct streamfile *f,
+        const char *mode)
+{
+    if (st->nopen >= STREAMS_OPEN)
+        close_file(st, st->head);
+    if ((f->fp = fopen(f->path, mode)) == NULL) {
+        fail(st, errno);
+        return -1;
+    }
+    if (f->off > 0 && fseeko(f->fp, f->off, SEEK_SET) != 0) {
+        fail(st, errno);
+        fclose(f->fp);
+        f->fp = NULL;
+        return -1;
+    }
+
+    f->prev = st->tail;
+    f->next = NULL;
+    if (st->tail != NULL)
+        st->tail->next = f;
+    else
+        st->head = f;
+    st->tail = f;
+    st->nopen ++;
+    return 0;
+}
+
+/* close the file, it stays with its stream */
+static void close_file(struct streams *st, struct streamfile *f)
+{
+    if (fclose(f->fp) != 0)
+        fail(st, errno);
+    f->fp = NULL;
+    if (f->prev != NULL)
+        f->prev->next = f->next;
+    else
+        st->head = f->next;
+    if (f->next != NULL)
+        f->next->prev = f->prev;
+    else
+        st->tail = f->prev;
+    f->prev = f->next = NULL;
+    st->nopen --;
+}
+
+static void fail(struct streams *st, int err)
+{
+    if (st->errors ++ == 0)
+        st->error = err;
+}
@@ -0,0 +1,56 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAMS_HD
+#define STREAMS_HD
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tcpreasm.h"
+
+#define STREAMS_OPEN        256     /* files open at a time            */
+
+/* the file of a stream, in its tcpstream's user */
+struct streamfile {
+    struct streamfile *prev;    /* open files, least recently written  */
+    struct streamfile *next;    /* first                               */
+    FILE *fp;                   /* NULL if closed to make room         */
+    unsigned long long off;     /* where the next bytes go             */
+    int hole;                   /* the file ends in a hole             */
+    char path[];
+};
+
+/* the reassembled TCP streams, written into a file each */
+struct streams {
+    const char *dir;
+    struct streamfile *head, *tail;
+    unsigned int nopen;
+    unsigned long long files;
+    unsigned long long bytes;
+    unsigned long long errors;  /* writes that failed                  */
+    int error;                  /* errno of the first                  */
+};
+
+int streams_init(struct streams *st, const char *dir);
+void streams_write(struct streams *st, struct tcpconn *c, int dir,
+        const uint8_t *data, unsigned int len);
+void streams_close(struct streams *st, struct tcpconn *c);
+void streams_free(struct streams *st);
+void streams_report(const struct streams *st, FILE *fp);
+
+#endif
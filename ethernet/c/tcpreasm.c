@@ -0,0 +1,621 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * put the TCP segments of a connection back together into the two byte
+ * streams the ends sent, for what is carried over many frames.
+ *
+ * Segments that come in order, by far the most, are handed to a callback
+ * right out of the frame, nothing copied. A segment that comes before the
+ * bytes in front of it is copied and held until they come. The bytes held
+ * are bounded for each stream and in all: a stream holding too much is
+ * pushed on past the bytes it is missing, and while too much is held in
+ * all, the streams that have been holding bytes the longest are, which
+ * frees what they held. Bytes that are never seen, lost to the capture,
+ * are handed on as a gap of their length, so that offsets in the stream
+ * stay right, and bytes that are seen again, e.g., retransmitted, are
+ * handed on once only.
+ *
+ * A stream begins after the SYN, or at the first segment seen if the SYN
+ * was not. A connection ends when the bytes up to the FIN of each end
+ * that sent any have been handed on, at a RST, when no segment of it has
+ * been seen for the idle timeout, or, when the table is full, to make
+ * room for a new one. Whatever it held is handed on first. No state is
+ * made for a segment with neither a SYN nor data, e.g., the last ACK of a
+ * connection that was closed. Time is that of the frames.
+ *
+ * The connections are kept as the flows of flow.c are: in a fixed array,
+ * found by a linearly probed hash table, with a list by the time of their
+ * last segment. The key has the lower end first, so both directions find
+ * the same connection.
+ *
+ * A table belongs to one thread.
+ */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "decode.h"
+#include "hist.h"
+#include "tcpreasm.h"
+
+#define TCP_FIN             0x01
+#define TCP_SYN             0x02
+#define TCP_RST             0x04
+#define TCP_ACK             0x10
+
+static int make_key(struct tcpkey *key, const struct decoded *d,
+        int32_t ifindex);
+static uint32_t segment_len(const struct decoded *d);
+static uint32_t hash_key(const struct tcpkey *key);
+static uint32_t lookup(struct tcpreasm *r, const struct tcpkey *key,
+        uint32_t hash, uint32_t *slot);
+static void add_segment(struct tcpreasm *r, uint32_t i, int dir,
+        uint32_t seq, const uint8_t *data, uint32_t have, uint32_t len);
+static void hold(struct tcpreasm *r, uint32_t i, int dir, uint32_t seq,
+        const uint8_t *data, uint32_t have, uint32_t len);
+static void drain(struct tcpreasm *r, uint32_t i, int dir);
+static void skip_gap(struct tcpreasm *r, uint32_t i, int dir);
+static void deliver(struct tcpreasm *r, struct tcpconn *c, int dir,
+        const uint8_t *data, uint32_t have, uint32_t len);
+static int finished(struct tcpconn *c);
+static void remove_conn(struct tcpreasm *r, uint32_t i, int reason);
+static void lru_unlink(struct tcpreasm *r, uint32_t i);
+static void lru_append(struct tcpreasm *r, uint32_t i);
+static int is_held(const struct tcpreasm *r, uint32_t i);
+static void held_unlink(struct tcpreasm *r, uint32_t i);
+static void held_append(struct tcpreasm *r, uint32_t i);
+static int later(const struct timespec *a, const struct timespec *b);
+
+static const char *reasons[] = {"fin", "rst", "idle", "evicted", "end"};
+
+/*
+ * a table of nconns connections at most, holding at most memory bytes
+ * out of order, handing the streams to data and the ends to close
+ */
+int tcpreasm_init(struct tcpreasm *r, uint32_t nconns, unsigned int idle,
+        unsigned long long memory, tcpreasm_data_t data,
+        tcpreasm_close_t close, void *arg)
+{
+    uint32_t i;
+
+    memset(r, 0, sizeof(*r));
+    if (nconns == 0 || nconns > (1u << 30)) {
+        fprintf(stderr, "ERROR: connection table size must be 1 to %u\n",
+                1u << 30);
+        return -1;
+    }
+
+    r->nconns = nconns;
+    for (r->nslots = 2; r->nslots < 2 * nconns; r->nslots <<= 1)
+        ;
+    r->conns = calloc((size_t)nconns + 1, sizeof(*r->conns));
+    r->slots = calloc(r->nslots, sizeof(*r->slots));
+    if (r->conns == NULL || r->slots == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        tcpreasm_free(r);
+        return -1;
+    }
+
+    for (i = 1; i < nconns; i ++)
+        r->conns[i].lru_next = i + 1;
+    r->freelist = 1;
+    r->idle = idle;
+    r->memory = memory;
+    r->data = data;
+    r->close = close;
+    r->arg = arg;
+    return 0;
+}
+
+/* take in the segment of a frame, if it is one */
+void tcpreasm_add(struct tcpreasm *r, const struct capframe *frame)
+{
+    struct decoded d;
+    struct tcpkey key;
+    struct tcpconn *c;
+    struct tcpstream *s;
+    uint32_t hash, i, slot, seq, len, have;
+    int dir;
+
+    if (decode_frame(&d, frame->data, frame->caplen) != 0
+            || !(d.layers & DECODE_TCP) || (d.layers & DECODE_FRAGMENT))
+        return;
+    stat_add(&r->stats.segments, 1);
+    tcpreasm_expire(r, &frame->ts);
+
+    len = segment_len(&d);
+    have = d.paylen < len ? d.paylen : len;
+    dir = make_key(&key, &d, frame->ifindex);
+    hash = hash_key(&key);
+    if ((i = lookup(r, &key, hash, &slot)) == 0) {
+        if ((d.tcpflags & TCP_RST)
+                || (len == 0 && !(d.tcpflags & TCP_SYN)))
+            return;
+        if (r->freelist == 0) {
+            /* make room, the slot may move */
+            remove_conn(r, r->lru_head, TCPREASM_END_EVICTED);
+            lookup(r, &key, hash, &slot);
+        }
+        i = r->freelist;
+        c = &r->conns[i];
+        r->freelist = c->lru_next;
+        memset(c, 0, sizeof(*c));
+        c->key = key;
+        c->hash = hash;
+        c->slot = slot;
+        /* a SYN-ACK is from the server */
+        c->client = (d.tcpflags & (TCP_SYN | TCP_ACK))
+            == (TCP_SYN | TCP_ACK) ? !dir : dir;
+        c->id = ++ r->ids;
+        c->first = frame->ts;
+        r->slots[slot] = i;
+        stat_add(&r->stats.created, 1);
+        stat_add(&r->stats.active, 1);
+    } else {
+        lru_unlink(r, i);
+    }
+
+    c = &r->conns[i];
+    if (later(&frame->ts, &c->last))
+        c->last = frame->ts;
+    lru_append(r, i);
+
+    if (d.tcpflags & TCP_RST) {
+        remove_conn(r, i, TCPREASM_END_RST);
+        return;
+    }
+
+    s = &c->stream[dir];
+    seq = decode_be32(d.l4 + 4);
+    if (d.tcpflags & TCP_SYN) {
+        if (!(s->flags & TCPSTREAM_STARTED)) {
+            s->next = seq + 1;
+            s->flags |= TCPSTREAM_STARTED | TCPSTREAM_SYN;
+        }
+        seq ++;
+    }
+    if (!(s->flags & TCPSTREAM_STARTED)) {
+        s->next = seq;
+        s->flags |= TCPSTREAM_STARTED;
+    }
+    if (len > 0)
+        add_segment(r, i, dir, seq, d.payload, have, len);
+    if ((d.tcpflags & TCP_FIN) && !(s->flags & TCPSTREAM_FIN)) {
+        s->fin = seq + len;
+        s->flags |= TCPSTREAM_FIN;
+    }
+    if (finished(c))
+        remove_conn(r, i, TCPREASM_END_FIN);
+}
+
+/* close the connections that have seen no segment for the idle timeout */
+void tcpreasm_expire(struct tcpreasm *r, const struct timespec *now)
+{
+    struct timespec limit;
+
+    limit = *now;
+    limit.tv_sec -= r->idle;
+    while (r->lru_head != 0
+            && !later(&r->conns[r->lru_head].last, &limit))
+        remove_conn(r, r->lru_head, TCPREASM_END_IDLE);
+}
+
+/* close every connection, e.g., at exit */
+void tcpreasm_flush(struct tcpreasm *r)
+{
+    while (r->lru_head != 0)
+        remove_conn(r, r->lru_head, TCPREASM_END_FLUSH);
+}
+
+void tcpreasm_free(struct tcpreasm *r)
+{
+    struct tcpseg *seg;
+    uint32_t i;
+    int dir;
+
+    for (i = r->lru_head; r->conns != NULL && i != 0;
+            i = r->conns[i].lru_next) {
+        for (dir = 0; dir < 2; dir ++) {
+            while ((seg = r->conns[i].stream[dir].segs) != NULL) {
+                r->conns[i].stream[dir].segs = seg->next;
+                free(seg);
+            }
+        }
+    }
+    free(r->conns);
+    free(r->slots);
+    r->conns = NULL;
+    r->slots = NULL;
+    r->lru_head = 0;
+}
+
+/* a connection as a line of text, the client first */
+void tcpreasm_print(const struct tcpconn *c, int reason, const char *ifname,
+        FILE *fp)
+{
+    const struct tcpkey *k = &c->key;
+    const struct tcpstream *cs = &c->stream[c->client];
+    const struct tcpstream *ss = &c->stream[!c->client];
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    int af = k->ipver == 6 ? AF_INET6 : AF_INET;
+
+    inet_ntop(af, k->addr[c->client], src, sizeof(src));
+    inet_ntop(af, k->addr[!c->client], dst, sizeof(dst));
+    fprintf(fp, "%lld.%09ld %lld.%09ld %s tcp %s.%u > %s.%u #%llu "
+            "%llu bytes (%llu missing) < %llu bytes (%llu missing) %s\n",
+            (long long)c->first.tv_sec, c->first.tv_nsec,
+            (long long)c->last.tv_sec, c->last.tv_nsec,
+            ifname != NULL ? ifname : "?", src, k->port[c->client], dst,
+            k->port[!c->client], c->id, cs->offset, cs->missing,
+            ss->offset, ss->missing, reasons[reason]);
+}
+
+void tcpreasm_report(const struct tcpreasm *r, FILE *fp)
+{
+    const struct tcpreasm_stats *s = &r->stats;
+
+    fprintf(fp, "tcp: %llu segments, %llu connections, %llu closed fin "
+            "%llu rst %llu idle %llu evicted %llu at exit, %llu of %u in "
+            "the table\n", stat_read(&s->segments), stat_read(&s->created),
+            stat_read(&s->closed[TCPREASM_END_FIN]),
+            stat_read(&s->closed[TCPREASM_END_RST]),
+            stat_read(&s->closed[TCPREASM_END_IDLE]),
+            stat_read(&s->closed[TCPREASM_END_EVICTED]),
+            stat_read(&s->closed[TCPREASM_END_FLUSH]),
+            stat_read(&s->active), r->nconns);
+    fprintf(fp, "tcp: %llu bytes handed on, %llu missing, %llu seen "
+            "again; %llu segments held out of order, at most %llu of %llu "
+            "bytes, %llu streams pushed on to free memory\n",
+            stat_read(&s->bytes), stat_read(&s->missing),
+            stat_read(&s->retrans), stat_read(&s->held),
+            stat_read(&s->memory_max), r->memory, stat_read(&s->skipped));
+}
+
+/* the end that sent the segment, 0 or 1 */
+static int make_key(struct tcpkey *key, const struct decoded *d,
+        int32_t ifindex)
+{
+    int cmp, dir;
+
+    memset(key, 0, sizeof(*key));
+    key->ipver = d->layers & DECODE_IPV4 ? 4 : 6;
+    key->ifindex = ifindex;
+    cmp = memcmp(d->src, d->dst, d->addrlen);
+    if (cmp == 0)
+        cmp = (int)d->sport - (int)d->dport;
+    dir = cmp > 0;
+    memcpy(key->addr[dir], d->src, d->addrlen);
+    memcpy(key->addr[!dir], d->dst, d->addrlen);
+    key->port[dir] = d->sport;
+    key->port[!dir] = d->dport;
+    return dir;
+}
+
+/* the payload by the IP length, even where the capture cut it short */
+static uint32_t segment_len(const struct decoded *d)
+{
+    unsigned int ip, hdrs = d->l3len + d->l4len;
+
+    if (d->layers & DECODE_IPV4)
+        ip = decode_be16(d->l3 + 2);
+    else if ((ip = decode_be16(d->l3 + 4)) != 0)
+        ip += 40;
+    return ip > hdrs ? ip - hdrs : d->paylen;
+}
+
+/* mix the key 8 bytes at a time, see the finalizer of MurmurHash3 */
+static uint32_t hash_key(const struct tcpkey *key)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 0, w;
+    size_t i;
+
+    for (i = 0; i + 8 <= sizeof(*key); i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * the index of the connection of key, or 0 with *slot set to where it
+ * would go
+ */
+static uint32_t lookup(struct tcpreasm *r, const struct tcpkey *key,
+        uint32_t hash, uint32_t *slot)
+{
+    uint32_t mask = r->nslots - 1, s, i;
+    struct tcpconn *c;
+
+    for (s = hash & mask; (i = r->slots[s]) != 0; s = (s + 1) & mask) {
+        c = &r->conns[i];
+        if (c->hash == hash && !memcmp(&c->key, key, sizeof(*key)))
+            return i;
+    }
+    *slot = s;
+    return 0;
+}
+
+/*
+ * hand on what of the segment is next in the stream and what it lets
+ * follow, or hold it if bytes before it are still to come
+ */
+static void add_segment(struct tcpreasm *r, uint32_t i, int dir,
+        uint32_t seq, const uint8_t *data, uint32_t have, uint32_t len)
+{
+    struct tcpstream *s = &r->conns[i].stream[dir];
+    int32_t off = (int32_t)(seq - s->next);
+    uint32_t skip, j;
+    int k;
+
+    if (off <= 0) {
+        skip = -off;
+        if (skip >= len) {
+            stat_add(&r->stats.retrans, len);
+            return;
+        }
+        stat_add(&r->stats.retrans, skip);
+        deliver(r, &r->conns[i], dir, data + (skip < have ? skip : have),
+                have > skip ? have - skip : 0, len - skip);
+        drain(r, i, dir);
+        return;
+    }
+
+    hold(r, i, dir, seq, data, have, len);
+    /* past as many gaps as it takes to hold no more than the bound */
+    while (s->held > TCPREASM_STREAM_BYTES && s->segs != NULL)
+        skip_gap(r, i, dir);
+    while (stat_read(&r->stats.memory) > r->memory && r->held_head != 0) {
+        j = r->held_head;
+        stat_add(&r->stats.skipped, 1);
+        for (k = 0; k < 2; k ++)
+            while (r->conns[j].stream[k].segs != NULL)
+                skip_gap(r, j, k);
+    }
+}
+
+/* copy the segment into the list of those held, by sequence number */
+static void hold(struct tcpreasm *r, uint32_t i, int dir, uint32_t seq,
+        const uint8_t *data, uint32_t have, uint32_t len)
+{
+    struct tcpstream *s = &r->conns[i].stream[dir];
+    struct tcpseg **p, *seg;
+    size_t size = sizeof(*seg) + have;
+
+    for (p = &s->segs; *p != NULL && (int32_t)((*p)->seq - seq) < 0;
+            p = &(*p)->next)
+        ;
+    if (*p != NULL && (*p)->seq == seq && (*p)->len >= len
+            && (*p)->have >= have) {
+        stat_add(&r->stats.retrans, len);
+        return;
+    }
+
+    /* without memory, the bytes are missed as if not captured */
+    if ((seg = malloc(size)) == NULL)
+        return;
+    seg->seq = seq;
+    seg->len = len;
+    seg->have = have;
+    memcpy(seg->data, data, have);
+    seg->next = *p;
+    *p = seg;
+
+    s->held += size;
+    stat_add(&r->stats.held, 1);
+    stat_add(&r->stats.memory, size);
+    if (r->stats.memory > r->stats.memory_max)
+        __atomic_store_n(&r->stats.memory_max, r->stats.memory,
+                __ATOMIC_RELAXED);
+    if (!is_held(r, i))
+        held_append(r, i);
+}
+
+/* hand on the segments held that are now next in the stream */
+static void drain(struct tcpreasm *r, uint32_t i, int dir)
+{
+    struct tcpconn *c = &r->conns[i];
+    struct tcpstream *s = &c->stream[dir];
+    struct tcpseg *seg;
+    uint32_t skip;
+
+    while ((seg = s->segs) != NULL && (int32_t)(seg->seq - s->next) <= 0) {
+        s->segs = seg->next;
+        skip = s->next - seg->seq;
+        if (skip < seg->len) {
+            stat_add(&r->stats.retrans, skip);
+            deliver(r, c, dir, seg->data + (skip < seg->have ? skip
+                        : seg->have), seg->have > skip ? seg->have - skip
+                    : 0, seg->len - skip);
+        } else {
+            stat_add(&r->stats.retrans, seg->len);
+        }
+        s->held -= sizeof(*seg) + seg->have;
+        __atomic_store_n(&r->stats.memory, r->stats.memory
+                - (sizeof(*seg) + seg->have), __ATOMIC_RELAXED);
+        free(seg);
+    }
+    if (c->stream[0].segs == NULL && c->stream[1].segs == NULL
+            && is_held(r, i))
+        held_unlink(r, i);
+}
+
+/* give up on the bytes before the first segment held */
+static void skip_gap(struct tcpreasm *r, uint32_t i, int dir)
+{
+    struct tcpconn *c = &r->conns[i];
+    struct tcpstream *s = &c->stream[dir];
+
+    deliver(r, c, dir, NULL, 0, s->segs->seq - s->next);
+    drain(r, i, dir);
+}
+
+/*
+ * hand on the have bytes at data and, as missing, the rest of len, and
+ * move the stream on
+ */
+static void deliver(struct tcpreasm *r, struct tcpconn *c, int dir,
+        const uint8_t *data, uint32_t have, uint32_t len)
+{
+    struct tcpstream *s = &c->stream[dir];
+
+    if (have > 0) {
+        if (r->data != NULL)
+            r->data(c, dir, data, have, r->arg);
+        s->offset += have;
+        s->next += have;
+        stat_add(&r->stats.bytes, have);
+    }
+    if (len > have) {
+        if (r->data != NULL)
+            r->data(c, dir, NULL, len - have, r->arg);
+        s->offset += len - have;
+        s->next += len - have;
+        s->missing += len - have;
+        stat_add(&r->stats.missing, len - have);
+    }
+}
+
+/* every end that sent anything has sent all up to its FIN */
+static int finished(struct tcpconn *c)
+{
+    struct tcpstream *s;
+    int dir, closed = 0;
+
+    for (dir = 0; dir < 2; dir ++) {
+        s = &c->stream[dir];
+        if ((s->flags & TCPSTREAM_FIN) && (int32_t)(s->next - s->fin) >= 0)
+            s->flags |= TCPSTREAM_CLOSED;
+        if ((s->flags & TCPSTREAM_STARTED)
+                && !(s->flags & TCPSTREAM_CLOSED))
+            return 0;
+        closed |= s->flags & TCPSTREAM_CLOSED;
+    }
+    return closed != 0;
+}
+
+/*
+ * hand on what the connection held, tell it is closed and delete it
+ * from the hash table and the list
+ */
+static void remove_conn(struct tcpreasm *r, uint32_t i, int reason)
+{
+    uint32_t mask = r->nslots - 1, hole, s, home;
+    struct tcpconn *c = &r->conns[i];
+    int dir;
+
+    for (dir = 0; dir < 2; dir ++)
+        while (c->stream[dir].segs != NULL)
+            skip_gap(r, i, dir);
+    if (r->close != NULL)
+        r->close(c, reason, r->arg);
+    stat_add(&r->stats.closed[reason], 1);
+    __atomic_store_n(&r->stats.active, r->stats.active - 1, __ATOMIC_RELAXED);
+
+    /* as in flow.c, move back the entries that would not be found */
+    hole = c->slot;
+    r->slots[hole] = 0;
+    for (s = (hole + 1) & mask; r->slots[s] != 0; s = (s + 1) & mask) {
+        home = r->conns[r->slots[s]].hash & mask;
+        if (((s - home) & mask) >= ((s - hole) & mask)) {
+            r->slots[hole] = r->slots[s];
+            r->conns[r->slots[hole]].slot = hole;
+            r->slots[s] = 0;
+            hole = s;
+        }
+    }
+
+    lru_unlink(r, i);
+    c->lru_next = r->freelist;
+    r->freelist = i;
+}
+
+static void lru_unlink(struct tcpreasm *r, uint32_t i)
+{
+    struct tcpconn *c = &r->conns[i];
+
+    if (c->lru_prev != 0)
+        r->conns[c->lru_prev].lru_next = c->lru_next;
+    else
+        r->lru_head = c->lru_next;
+    if (c->lru_next != 0)
+        r->conns[c->lru_next].lru_prev = c->lru_prev;
+    else
+        r->lru_tail = c->lru_prev;
+    c->lru_prev = c->lru_next = 0;
+}
+
+static void lru_append(struct tcpreasm *r, uint32_t i)
+{
+    struct tcpconn *c = &r->conns[i];
+
+    c->lru_prev = r->lru_tail;
+    c->lru_next = 0;
+    if (r->lru_tail != 0)
+        r->conns[r->lru_tail].lru_next = i;
+    else
+        r->lru_head = i;
+    r->lru_tail = i;
+}
+
+static int is_held(const struct tcpreasm *r, uint32_t i)
+{
+    return r->conns[i].held_prev != 0 || r->held_head == i;
+}
+
+static void held_unlink(struct tcpreasm *r, uint32_t i)
+{
+    struct tcpconn *c = &r->conns[i];
+
+    if (c->held_prev != 0)
+        r->conns[c->held_prev].held_next = c->held_next;
+    else
+        r->held_head = c->held_next;
+    if (c->held_next != 0)
+        r->conns[c->held_next].held_prev = c->held_prev;
+    else
+        r->held_tail = c->held_prev;
+    c->held_prev = c->held_next = 0;
+}
+
+static void held_append(struct tcpreasm *r, uint32_t i)
+{
+    struct tcpconn *c = &r->conns[i];
+
+    c->held_prev = r->held_tail;
+    c->held_next = 0;
+    if (r->held_tail != 0)
+        r->conns[r->held_tail].held_next = i;
+    else
+        r->held_head = i;
+    r->held_tail = i;
+}
+
+/* a is after b */
+static int later(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec > b->tv_sec
+        || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
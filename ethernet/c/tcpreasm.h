@@ -0,0 +1,149 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TCPREASM_HD
+#define TCPREASM_HD
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "capframe.h"
+
+#define TCPREASM_CONNS          65536       /* connections at a time   */
+#define TCPREASM_IDLE           60          /* s without a segment     */
+#define TCPREASM_STREAM_BYTES   (1 << 20)   /* held out of order, each */
+#define TCPREASM_MEMORY         64          /* MB held out of order    */
+
+#define TCPREASM_END_FIN        0   /* why a connection is closed      */
+#define TCPREASM_END_RST        1
+#define TCPREASM_END_IDLE       2
+#define TCPREASM_END_EVICTED    3   /* the table was full              */
+#define TCPREASM_END_FLUSH      4   /* at exit                         */
+
+#define TCPSTREAM_STARTED       0x01    /* next is known               */
+#define TCPSTREAM_SYN           0x02    /* from the first byte on      */
+#define TCPSTREAM_FIN           0x04    /* fin is known                */
+#define TCPSTREAM_CLOSED        0x08    /* delivered up to the FIN     */
+
+/*
+ * the two ends of a connection, the lower address and port first so
+ * that both directions have the same key
+ */
+struct tcpkey {
+    uint8_t addr[2][16];
+    uint16_t port[2];
+    uint8_t ipver;
+    uint8_t pad[7];
+    int32_t ifindex;
+};
+
+/* a segment held until the bytes before it come in */
+struct tcpseg {
+    struct tcpseg *next;
+    uint32_t seq;
+    uint32_t len;               /* of the segment                      */
+    uint32_t have;              /* of it captured, in data             */
+    uint8_t data[];
+};
+
+/* the bytes one end sends */
+struct tcpstream {
+    uint32_t next;              /* sequence number of the next byte    */
+    uint32_t fin;               /* sequence number of the FIN          */
+    unsigned int flags;         /* TCPSTREAM_*                         */
+    unsigned long long offset;  /* of the next byte in the stream      */
+    unsigned long long missing; /* bytes of it never seen              */
+    struct tcpseg *segs;        /* held, by sequence number            */
+    unsigned int held;          /* bytes in segs                       */
+    void *user;                 /* for the consumer of the stream      */
+};
+
+struct tcpconn {
+    struct tcpkey key;
+    struct tcpstream stream[2]; /* sent by key.addr[i], key.port[i]    */
+    int client;                 /* the end that sent the SYN, or the   */
+                                /* first segment seen                  */
+    unsigned long long id;      /* in the order the connections began  */
+    struct timespec first;
+    struct timespec last;
+    uint32_t hash;
+    uint32_t slot;              /* in the hash table                   */
+    uint32_t lru_prev;          /* by the time of the last segment     */
+    uint32_t lru_next;
+    uint32_t held_prev;         /* holding segments, by when it began  */
+    uint32_t held_next;
+};
+
+/*
+ * len bytes of the stream sent by end dir of c, at c->stream[dir].offset,
+ * or, if data is NULL, len bytes that were never seen
+ */
+typedef void (*tcpreasm_data_t)(struct tcpconn *c, int dir,
+        const uint8_t *data, unsigned int len, void *arg);
+/* the connection is closed, all its data has been handed on */
+typedef void (*tcpreasm_close_t)(struct tcpconn *c, int reason, void *arg);
+
+/* counters, updated by the owner of the table only, read with stat_read() */
+struct tcpreasm_stats {
+    unsigned long long segments;
+    unsigned long long created;
+    unsigned long long closed[TCPREASM_END_FLUSH + 1];
+    unsigned long long active;  /* connections in the table            */
+    unsigned long long bytes;   /* handed on                           */
+    unsigned long long missing; /* skipped, never seen                 */
+    unsigned long long retrans; /* seen before, dropped                */
+    unsigned long long held;    /* segments held out of order          */
+    unsigned long long memory;  /* bytes held now                      */
+    unsigned long long memory_max;
+    unsigned long long skipped; /* streams pushed past a gap to free   */
+                                /* memory                              */
+};
+
+/*
+ * connections in an array, indexed from 1, found by an open addressing
+ * hash table of their indices, as the flows of flow.c
+ */
+struct tcpreasm {
+    struct tcpconn *conns;
+    uint32_t nconns;
+    uint32_t *slots;            /* connection index, 0 if empty        */
+    uint32_t nslots;            /* a power of 2                        */
+    uint32_t freelist;          /* linked by lru_next                  */
+    uint32_t lru_head, lru_tail;
+    uint32_t held_head, held_tail;
+    unsigned int idle;          /* timeout in seconds                  */
+    unsigned long long memory;  /* most bytes held in all              */
+    unsigned long long ids;
+    tcpreasm_data_t data;
+    tcpreasm_close_t close;
+    void *arg;
+    struct tcpreasm_stats stats;
+};
+
+int tcpreasm_init(struct tcpreasm *r, uint32_t nconns, unsigned int idle,
+        unsigned long long memory, tcpreasm_data_t data,
+        tcpreasm_close_t close, void *arg);
+void tcpreasm_add(struct tcpreasm *r, const struct capframe *frame);
+void tcpreasm_expire(struct tcpreasm *r, const struct timespec *now);
+void tcpreasm_flush(struct tcpreasm *r);
+void tcpreasm_free(struct tcpreasm *r);
+void tcpreasm_print(const struct tcpconn *c, int reason, const char *ifname,
+        FILE *fp);
+void tcpreasm_report(const struct tcpreasm *r, FILE *fp);
+
+#endif
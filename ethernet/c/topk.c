@@ -0,0 +1,391 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Description */
+/*
+ * find the heaviest talkers of a stream, by source and destination MAC
+ * and IP address, in a fixed amount of memory, after
+ *
+ *     A. Metwally, D. Agrawal and A. El Abbadi, "Efficient Computation of
+ *     Frequent and Top-k Elements in Data Streams", ICDT 2005.
+ *
+ * A space-saving sketch has a fixed number of counters. An address with
+ * a counter has it incremented. A new address, once all the counters are
+ * taken, takes over the counter of the lowest count, keeps counting from
+ * there and remembers that count as its error. An address that is seen
+ * more often than 1 in as many frames as there are counters is sure to
+ * have a counter, and no count is over by more than its error.
+ *
+ * The counters of equal count share a bucket and the buckets are kept in
+ * a list in order of their count (the "stream summary"), thus both the
+ * lowest count and the increment are found in constant time. Addresses
+ * are found by a linearly probed hash table of twice as many slots. Every
+ * frame costs a few hash probes and pointer updates per sketch, however
+ * many addresses there are.
+ *
+ * A sketch belongs to one thread.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "decode.h"
+#include "topk.h"
+
+static uint32_t hash_key(const struct topk_key *key);
+static uint32_t lookup(struct topk *t, const struct topk_key *key,
+        uint32_t hash, uint32_t *slot);
+static void unhash(struct topk *t, uint32_t i);
+static void increment(struct topk *t, uint32_t i);
+static void bucket_detach(struct topk *t, uint32_t i);
+static void bucket_attach(struct topk *t, uint32_t b, uint32_t i);
+static uint32_t bucket_new(struct topk *t, unsigned long long count,
+        uint32_t prev);
+static void bucket_free(struct topk *t, uint32_t b);
+static void print_key(const struct topk_key *key, FILE *fp);
+
+static const char *sketch_names[TALKERS_NSKETCHES] = {
+    "source MAC", "destination MAC", "source IP", "destination IP"
+};
+
+int topk_init(struct topk *t, const char *name, uint32_t ncounters)
+{
+    memset(t, 0, sizeof(*t));
+    if (ncounters == 0 || ncounters > (1u << 24)) {
+        fprintf(stderr, "ERROR: number of counters must be 1 to %u\n",
+                1u << 24);
+        return -1;
+    }
+
+    t->name = name;
+    t->ncounters = ncounters;
+    for (t->nslots = 2; t->nslots < 2 * ncounters; t->nslots <<= 1)
+        ;
+    t->counters = calloc((size_t)ncounters + 1, sizeof(*t->counters));
+    t->slots = calloc(t->nslots, sizeof(*t->slots));
+    t->buckets = calloc((size_t)ncounters + 1, sizeof(*t->buckets));
+    if (t->counters == NULL || t->slots == NULL || t->buckets == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        topk_free(t);
+        return -1;
+    }
+    topk_reset(t);
+    return 0;
+}
+
+/* count a frame of bytes bytes towards key */
+void topk_add(struct topk *t, const struct topk_key *key,
+        unsigned long long bytes)
+{
+    struct topk_counter *c;
+    uint32_t hash, i, slot;
+
+    t->frames ++;
+    t->bytes += bytes;
+    hash = hash_key(key);
+    if ((i = lookup(t, key, hash, &slot)) != 0) {
+        increment(t, i);
+        t->counters[i].bytes += bytes;
+        return;
+    }
+
+    if (t->used < t->ncounters) {
+        /* a counter of its own, starting from 0 */
+        i = ++ t->used;
+        c = &t->counters[i];
+        c->count = 0;
+        c->error = 0;
+        if (t->bmin == 0 || t->buckets[t->bmin].count != 0)
+            bucket_new(t, 0, 0);
+        bucket_attach(t, t->bmin, i);
+    } else {
+        /* take over a counter of the lowest count */
+        i = t->buckets[t->bmin].head;
+        c = &t->counters[i];
+        unhash(t, i);
+        lookup(t, key, hash, &slot);
+        c->error = c->count;
+    }
+
+    c->key = *key;
+    c->hash = hash;
+    c->slot = slot;
+    c->bytes = bytes;
+    t->slots[slot] = i;
+    increment(t, i);
+}
+
+/* forget every address, e.g., at the start of a report interval */
+void topk_reset(struct topk *t)
+{
+    uint32_t i;
+
+    memset(t->slots, 0, t->nslots * sizeof(*t->slots));
+    for (i = 1; i < t->ncounters; i ++)
+        t->buckets[i].next = i + 1;
+    t->buckets[t->ncounters].next = 0;
+    t->bfree = 1;
+    t->bmin = t->bmax = 0;
+    t->used = 0;
+    t->frames = t->bytes = 0;
+}
+
+/* the n addresses of the highest count, highest first */
+void topk_print(const struct topk *t, unsigned int n, FILE *fp)
+{
+    const struct topk_counter *c;
+    uint32_t b, i;
+
+    fprintf(fp, "top %s of %llu frames %llu bytes:\n", t->name, t->frames,
+            t->bytes);
+    for (b = t->bmax; b != 0 && n > 0; b = t->buckets[b].prev) {
+        for (i = t->buckets[b].head; i != 0 && n > 0; i = c->next, n --) {
+            c = &t->counters[i];
+            fprintf(fp, "  ");
+            print_key(&c->key, fp);
+            fprintf(fp, " %llu frames (%.1f%%) +-%llu, %llu bytes\n",
+                    c->count, t->frames == 0 ? 0 :
+                    100.0 * c->count / t->frames, c->error, c->bytes);
+        }
+    }
+}
+
+void topk_free(struct topk *t)
+{
+    free(t->counters);
+    free(t->slots);
+    free(t->buckets);
+    t->counters = NULL;
+    t->slots = NULL;
+    t->buckets = NULL;
+}
+
+int talkers_init(struct talkers *tk, uint32_t ncounters)
+{
+    int i;
+
+    memset(tk, 0, sizeof(*tk));
+    for (i = 0; i < TALKERS_NSKETCHES; i ++) {
+        if (topk_init(&tk->sketches[i], sketch_names[i], ncounters) != 0) {
+            talkers_free(tk);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* count the frame towards its addresses, those of IP if it is IP */
+void talkers_add(struct talkers *tk, const struct capframe *frame)
+{
+    struct decoded d;
+    struct topk_key key;
+
+    if (decode_frame(&d, frame->data, frame->caplen) != 0)
+        return;
+
+    memset(&key, 0, sizeof(key));
+    key.len = 6;
+    memcpy(key.addr, d.smac, 6);
+    topk_add(&tk->sketches[TALKERS_SMAC], &key, frame->len);
+    memcpy(key.addr, d.dmac, 6);
+    topk_add(&tk->sketches[TALKERS_DMAC], &key, frame->len);
+
+    if (!(d.layers & (DECODE_IPV4 | DECODE_IPV6)))
+        return;
+    key.len = d.addrlen;
+    memcpy(key.addr, d.src, d.addrlen);
+    topk_add(&tk->sketches[TALKERS_SIP], &key, frame->len);
+    memcpy(key.addr, d.dst, d.addrlen);
+    topk_add(&tk->sketches[TALKERS_DIP], &key, frame->len);
+}
+
+void talkers_print(const struct talkers *tk, unsigned int n, FILE *fp)
+{
+    int i;
+
+    for (i = 0; i < TALKERS_NSKETCHES; i ++)
+        topk_print(&tk->sketches[i], n, fp);
+}
+
+void talkers_reset(struct talkers *tk)
+{
+    int i;
+
+    for (i = 0; i < TALKERS_NSKETCHES; i ++)
+        topk_reset(&tk->sketches[i]);
+}
+
+void talkers_free(struct talkers *tk)
+{
+    int i;
+
+    for (i = 0; i < TALKERS_NSKETCHES; i ++)
+        topk_free(&tk->sketches[i]);
+}
+
+/* FNV-1a, the keys are short */
+static uint32_t hash_key(const struct topk_key *key)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < key->len; i ++)
+        h = (h ^ key->addr[i]) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+/* the counter of key, or 0 with *slot set to where it would go */
+static uint32_t lookup(struct topk *t, const struct topk_key *key,
+        uint32_t hash, uint32_t *slot)
+{
+    uint32_t mask = t->nslots - 1, s, i;
+    const struct topk_counter *c;
+
+    for (s = hash & mask; (i = t->slots[s]) != 0; s = (s + 1) & mask) {
+        c = &t->counters[i];
+        if (c->hash == hash && c->key.len == key->len
+                && !memcmp(c->key.addr, key->addr, key->len))
+            return i;
+    }
+    *slot = s;
+    return 0;
+}
+
+/* take counter i out of the hash table, shifting back what follows */
+static void unhash(struct topk *t, uint32_t i)
+{
+    uint32_t mask = t->nslots - 1, hole, s, home;
+
+    hole = t->counters[i].slot;
+    t->slots[hole] = 0;
+    for (s = (hole + 1) & mask; t->slots[s] != 0; s = (s + 1) & mask) {
+        home = t->counters[t->slots[s]].hash & mask;
+        if (((s - home) & mask) >= ((s - hole) & mask)) {
+            t->slots[hole] = t->slots[s];
+            t->counters[t->slots[hole]].slot = hole;
+            t->slots[s] = 0;
+            hole = s;
+        }
+    }
+}
+
+/* move counter i to the bucket of the next higher count */
+static void increment(struct topk *t, uint32_t i)
+{
+    struct topk_counter *c = &t->counters[i];
+    uint32_t b = c->bucket, next = t->buckets[b].next;
+    unsigned long long count = c->count + 1;
+
+    c->count = count;
+    if (next != 0 && t->buckets[next].count == count) {
+        bucket_detach(t, i);
+        bucket_attach(t, next, i);
+        return;
+    }
+    /* alone in its bucket, the bucket can take the new count */
+    if (t->buckets[b].head == i && c->next == 0) {
+        t->buckets[b].count = count;
+        return;
+    }
+    bucket_detach(t, i);
+    bucket_attach(t, bucket_new(t, count, b), i);
+}
+
+/* take counter i out of its bucket, freeing the bucket if it empties */
+static void bucket_detach(struct topk *t, uint32_t i)
+{
+    struct topk_counter *c = &t->counters[i];
+    uint32_t b = c->bucket;
+
+    if (c->prev != 0)
+        t->counters[c->prev].next = c->next;
+    else
+        t->buckets[b].head = c->next;
+    if (c->next != 0)
+        t->counters[c->next].prev = c->prev;
+    c->prev = c->next = 0;
+    if (t->buckets[b].head == 0)
+        bucket_free(t, b);
+}
+
+static void bucket_attach(struct topk *t, uint32_t b, uint32_t i)
+{
+    struct topk_counter *c = &t->counters[i];
+
+    c->bucket = b;
+    c->prev = 0;
+    c->next = t->buckets[b].head;
+    if (c->next != 0)
+        t->counters[c->next].prev = i;
+    t->buckets[b].head = i;
+}
+
+/* an empty bucket of count, after prev in the list, first if prev is 0 */
+static uint32_t bucket_new(struct topk *t, unsigned long long count,
+        uint32_t prev)
+{
+    uint32_t b = t->bfree;
+    struct topk_bucket *bk = &t->buckets[b];
+
+    t->bfree = bk->next;
+    bk->count = count;
+    bk->head = 0;
+    bk->prev = prev;
+    bk->next = prev != 0 ? t->buckets[prev].next : t->bmin;
+    if (bk->next != 0)
+        t->buckets[bk->next].prev = b;
+    else
+        t->bmax = b;
+    if (prev != 0)
+        t->buckets[prev].next = b;
+    else
+        t->bmin = b;
+    return b;
+}
+
+static void bucket_free(struct topk *t, uint32_t b)
+{
+    struct topk_bucket *bk = &t->buckets[b];
+
+    if (bk->prev != 0)
+        t->buckets[bk->prev].next = bk->next;
+    else
+        t->bmin = bk->next;
+    if (bk->next != 0)
+        t->buckets[bk->next].prev = bk->prev;
+    else
+        t->bmax = bk->prev;
+    bk->next = t->bfree;
+    t->bfree = b;
+}
+
+static void print_key(const struct topk_key *key, FILE *fp)
+{
+    char buf[INET6_ADDRSTRLEN];
+
+    if (key->len == 6) {
+        fprintf(fp, "%02x:%02x:%02x:%02x:%02x:%02x", key->addr[0],
+                key->addr[1], key->addr[2], key->addr[3], key->addr[4],
+                key->addr[5]);
+        return;
+    }
+    inet_ntop(key->len == 4 ? AF_INET : AF_INET6, key->addr, buf,
+            sizeof(buf));
+    fprintf(fp, "%-15s", buf);
+}
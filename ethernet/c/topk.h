@@ -0,0 +1,100 @@
+/**
+ Copyright (C) 2015 Hui Chen <huichen AT ieee DOT org>
+ 
+ This program is free software; you can redistribute it and/or modify it
+ under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TOPK_HD
+#define TOPK_HD
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capframe.h"
+
+#define TOPK_COUNTERS       1024    /* addresses tracked per sketch    */
+#define TOPK_REPORT         10      /* talkers reported per sketch     */
+#define TOPK_KEYLEN         16
+
+/* an address of up to 16 bytes */
+struct topk_key {
+    uint8_t addr[TOPK_KEYLEN];
+    uint8_t len;                /* 6 for MAC, 4 for IPv4, 16 for IPv6  */
+};
+
+struct topk_counter {
+    struct topk_key key;
+    unsigned long long count;   /* frames, over by error at most       */
+    unsigned long long error;
+    unsigned long long bytes;   /* since the address was taken on      */
+    uint32_t hash;
+    uint32_t slot;              /* in the hash table                   */
+    uint32_t bucket;
+    uint32_t prev;              /* in the bucket                       */
+    uint32_t next;
+};
+
+/* the counters of equal count */
+struct topk_bucket {
+    unsigned long long count;
+    uint32_t head;
+    uint32_t prev;              /* bucket of the next lower count      */
+    uint32_t next;
+};
+
+/*
+ * a space-saving sketch: a fixed number of counters, the addresses
+ * counted found by a linearly probed hash table, and the counters
+ * grouped in buckets of equal count, kept in order of the count
+ */
+struct topk {
+    const char *name;
+    struct topk_counter *counters;  /* indexed from 1                  */
+    uint32_t ncounters;
+    uint32_t used;
+    uint32_t *slots;            /* counter index, 0 if empty           */
+    uint32_t nslots;            /* a power of 2                        */
+    struct topk_bucket *buckets;    /* indexed from 1                  */
+    uint32_t bfree;             /* free buckets, linked by next        */
+    uint32_t bmin;              /* buckets of the lowest and highest   */
+    uint32_t bmax;              /* count                               */
+    unsigned long long frames;
+    unsigned long long bytes;
+};
+
+#define TALKERS_SMAC        0
+#define TALKERS_DMAC        1
+#define TALKERS_SIP         2
+#define TALKERS_DIP         3
+#define TALKERS_NSKETCHES   4
+
+/* the top talkers by source and destination MAC and IP address */
+struct talkers {
+    struct topk sketches[TALKERS_NSKETCHES];
+};
+
+int topk_init(struct topk *t, const char *name, uint32_t ncounters);
+void topk_add(struct topk *t, const struct topk_key *key,
+        unsigned long long bytes);
+void topk_reset(struct topk *t);
+void topk_print(const struct topk *t, unsigned int n, FILE *fp);
+void topk_free(struct topk *t);
+
+int talkers_init(struct talkers *tk, uint32_t ncounters);
+void talkers_add(struct talkers *tk, const struct capframe *frame);
+void talkers_print(const struct talkers *tk, unsigned int n, FILE *fp);
+void talkers_reset(struct talkers *tk);
+void talkers_free(struct talkers *tk);
+
+#endif